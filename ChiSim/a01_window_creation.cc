@@ -1,16 +1,47 @@
 #include "chi_sim.h"
 
+/** Windowed contexts using GLFW. It is initialized by the first and
+ * terminated by the last, so one context shutting down leaves the
+ * others' windows alone.*/
+static std::mutex glfwUsersMutex;
+static size_t     glfwUsers = 0;
+
 //###################################################################
-/** Creates the main GLFW window. */
+/** Creates the main GLFW window, initializing GLFW for the first
+ * windowed context. */
 void ChiSim::CreateMainWindow()
 {
-  glfwInit();
+  {
+    std::lock_guard<std::mutex> lock(glfwUsersMutex);
+    if (glfwUsers == 0 && glfwInit() != GLFW_TRUE)
+      throw std::runtime_error("failed to initialize GLFW!");
+    ++glfwUsers;
+  }
+  m_glfw_user = true;
 
   glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
 
   m_main_window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
+  if (m_main_window == nullptr)
+    throw std::runtime_error("failed to create window!");
   glfwSetWindowUserPointer(m_main_window, this);
   glfwSetFramebufferSizeCallback(m_main_window, FramebufferResizeCallback);
+  glfwSetKeyCallback(m_main_window, KeyCallback);
+}
+
+//###################################################################
+/** Destroys the main window. GLFW is terminated with the last
+ * windowed context. */
+void ChiSim::DestroyMainWindow()
+{
+  if (m_main_window != nullptr) glfwDestroyWindow(m_main_window);
+  m_main_window = nullptr;
+
+  if (!m_glfw_user) return;
+  m_glfw_user = false;
+
+  std::lock_guard<std::mutex> lock(glfwUsersMutex);
+  if (--glfwUsers == 0) glfwTerminate();
 }
 
 //###################################################################
@@ -19,8 +50,9 @@ void ChiSim::FramebufferResizeCallback(GLFWwindow* window,
                                        int width,
                                        int height)
 {
-  auto& app = ChiSim::GetSystemScope();
+  auto& app = *static_cast<ChiSim*>(glfwGetWindowUserPointer(window));
   app.m_framebuffer_resized = true;
+  app.m_last_resize_event = std::chrono::high_resolution_clock::now();
 }
 
 //###################################################################
@@ -32,4 +64,71 @@ void ChiSim::CreateMainWindowSurface()
                               nullptr,
                               &m_main_surface) != VK_SUCCESS)
     throw std::runtime_error("failed to create m_main_window m_main_surface!");
+}
+
+//###################################################################
+/** Callback function for key presses. Keys 1, 2 and 3 select the
+ * low latency, balanced and max throughput presentation modes. T, C, P
+ * and L toggle texturing and cycle the colormap, clip plane count and
+ * lighting mode of the shader variant; U toggles between specialized
+ * pipelines and the uber-shader. G toggles the draw benchmark and D
+ * cycles per-draw parameters between push constants, dynamic uniforms
+ * and batched indirect draws. V toggles the vertex pulling benchmark
+ * and I switches it between interleaved and pulled vertices. R
+ * toggles frame capture through the readback ring and E cycles the
+ * frame encoder between PNG, QOI and raw. */
+void ChiSim::KeyCallback(GLFWwindow* window,
+                         int key,
+                         int scancode,
+                         int action,
+                         int mods)
+{
+  if (action != GLFW_PRESS) return;
+
+  auto& app = *static_cast<ChiSim*>(glfwGetWindowUserPointer(window));
+  switch (key)
+  {
+    case GLFW_KEY_1: app.SetPresentationMode(PresentationMode::LowLatency);    break;
+    case GLFW_KEY_2: app.SetPresentationMode(PresentationMode::Balanced);      break;
+    case GLFW_KEY_3: app.SetPresentationMode(PresentationMode::MaxThroughput); break;
+    case GLFW_KEY_G: app.EnableDrawBenchmark(!app.m_draw_benchmark); return;
+    case GLFW_KEY_R: app.EnableFrameCapture(!app.m_capture_enabled); return;
+    case GLFW_KEY_E:
+      app.SetFrameEncoder(static_cast<ChiFrameEncoder::Format>(
+        (static_cast<int>(app.m_encoder_format) + 1) % 3),
+        app.m_encoder_threads);
+      return;
+    case GLFW_KEY_V:
+      app.EnableVertexPullingBenchmark(!app.m_pulling_benchmark); return;
+    case GLFW_KEY_I:
+      app.SetVertexPullingBenchmarkInput(
+        app.GetVertexPullingBenchmarkInput() == VertexInput::Pulled ?
+        VertexInput::Interleaved : VertexInput::Pulled);
+      return;
+    case GLFW_KEY_D:
+      app.SetDrawParameterPath(static_cast<DrawParameterPath>(
+        (static_cast<int>(app.GetDrawParameterPath()) + 1) % 3));
+      return;
+    default: break;
+  }
+
+  ShaderVariant variant = app.GetShaderVariant();
+  switch (key)
+  {
+    case GLFW_KEY_T: variant.use_texture = !variant.use_texture; break;
+    case GLFW_KEY_C:
+      variant.colormap_id =
+        (variant.colormap_id + 1) % ShaderVariant::NUM_COLORMAPS; break;
+    case GLFW_KEY_P:
+      variant.num_clip_planes =
+        (variant.num_clip_planes + 1) % (ShaderVariant::MAX_CLIP_PLANES + 1);
+      break;
+    case GLFW_KEY_L:
+      variant.lighting_mode =
+        (variant.lighting_mode + 1) % ShaderVariant::NUM_LIGHTING_MODES; break;
+    case GLFW_KEY_U:
+      app.SetUseSpecializedVariants(!app.m_use_specialized_variants); return;
+    default: return;
+  }
+  app.SetShaderVariant(variant);
 }
\ No newline at end of file
@@ -13,7 +13,7 @@ void ChiSim::CreateVulkanInstance()
   appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
   appInfo.pEngineName = "No Engine";
   appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-  appInfo.apiVersion = VK_API_VERSION_1_0;
+  appInfo.apiVersion = VK_API_VERSION_1_2;
 
   VkInstanceCreateInfo createInfo = {};
   createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -67,15 +67,20 @@ bool ChiSim::CheckValidationLayerSupport()
 }
 
 //###################################################################
-/** Gets the window system's required extensions. */
+/** Gets the window system's required extensions. Headless mode has
+ * no window system and GLFW is never initialized.*/
 std::vector<const char*> ChiSim::GetRequiredExtensions()
 {
-  uint32_t glfwExtensionCount = 0;
-  const char** glfwExtensions;
-  glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+  std::vector<const char*> extensions;
 
-  std::vector<const char*> extensions(glfwExtensions, glfwExtensions +
-                                                      glfwExtensionCount);
+  if (!m_headless)
+  {
+    uint32_t glfwExtensionCount = 0;
+    const char** glfwExtensions;
+    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+    extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+  }
 
   if (k_enable_validation_layers)
     extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -20,18 +20,27 @@ void ChiSim::PickPhysicalDevice()
   if (m_physical_device == VK_NULL_HANDLE)
     throw std::runtime_error("failed to find a suitable GPU!");
 
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(m_physical_device, &properties);
+  m_timestamp_period_ns = properties.limits.timestampPeriod;
+
+  if (m_headless)
+    std::cout << "Rendering headless on " << properties.deviceName
+              << std::endl;
 }
 
 //###################################################################
-/** Determines if a device is suitable. */
+/** Determines if a device is suitable. Headless mode renders without
+ * a surface, so devices without present support (e.g. compute nodes or
+ * software ICDs) qualify. */
 bool ChiSim::IsDeviceSuitable(VkPhysicalDevice device)
 {
   QueueFamilyIndices qf_indices = FindDeviceQueueFamilies(device);
 
   bool extensionsSupported = CheckDeviceExtensionSupport(device);
 
-  bool swapChainAdequate = false;
-  if (extensionsSupported)
+  bool swapChainAdequate = m_headless;
+  if (extensionsSupported && !m_headless)
   {
     SwapChainSupportDetails swapChainSupport = QuerySwapChainSupport(device);
     swapChainAdequate = !swapChainSupport.formats.empty() &&
@@ -41,10 +50,30 @@ bool ChiSim::IsDeviceSuitable(VkPhysicalDevice device)
   VkPhysicalDeviceFeatures supportedFeatures;
   vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
 
+  //======================================== Vulkan 1.2 features
+  // Frame pacing is built on timeline semaphores.
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(device, &properties);
+
+  bool timelineSupported = false;
+  if (properties.apiVersion >= VK_API_VERSION_1_2)
+  {
+    VkPhysicalDeviceVulkan12Features features12 = {};
+    features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+    VkPhysicalDeviceFeatures2 features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features2.pNext = &features12;
+    vkGetPhysicalDeviceFeatures2(device, &features2);
+
+    timelineSupported = features12.timelineSemaphore;
+  }
+
   return qf_indices.isComplete() &&
          extensionsSupported &&
          swapChainAdequate &&
-         supportedFeatures.samplerAnisotropy;
+         supportedFeatures.samplerAnisotropy &&
+         timelineSupported;
 }
 
 //###################################################################
@@ -63,8 +92,9 @@ bool ChiSim::CheckDeviceExtensionSupport(VkPhysicalDevice device)
                                        &extensionCount,
                                        availableExtensions.data());
 
-  std::set<std::string> requiredExtensions(k_device_extensions.begin(),
-                                           k_device_extensions.end());
+  const auto deviceExtensions = GetRequiredDeviceExtensions();
+  std::set<std::string> requiredExtensions(deviceExtensions.begin(),
+                                           deviceExtensions.end());
 
   for (const auto& extension : availableExtensions)
     requiredExtensions.erase(extension.extensionName);
@@ -72,6 +102,40 @@ bool ChiSim::CheckDeviceExtensionSupport(VkPhysicalDevice device)
   return requiredExtensions.empty();
 }
 
+//###################################################################
+/** Device extensions that must be present. Headless mode has no swap
+ * chain.*/
+std::vector<const char*> ChiSim::GetRequiredDeviceExtensions()
+{
+  if (m_headless) return {};
+
+  return k_device_extensions;
+}
+
+//###################################################################
+/** Checks whether a single, optional, device extension is available.*/
+bool ChiSim::IsDeviceExtensionAvailable(VkPhysicalDevice device,
+                                        const char* extension_name)
+{
+  uint32_t extensionCount;
+  vkEnumerateDeviceExtensionProperties(device,
+                                       nullptr,
+                                       &extensionCount,
+                                       nullptr);
+
+  std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+  vkEnumerateDeviceExtensionProperties(device,
+                                       nullptr,
+                                       &extensionCount,
+                                       availableExtensions.data());
+
+  for (const auto& extension : availableExtensions)
+    if (strcmp(extension.extensionName, extension_name) == 0)
+      return true;
+
+  return false;
+}
+
 //###################################################################
 /** Creates a logical device. */
 void ChiSim::CreateLogicalDevice()
@@ -94,19 +158,128 @@ void ChiSim::CreateLogicalDevice()
     queueCreateInfos.push_back(queueCreateInfo);
   }
 
+  VkPhysicalDeviceFeatures supportedFeatures;
+  vkGetPhysicalDeviceFeatures(m_physical_device, &supportedFeatures);
+
   VkPhysicalDeviceFeatures deviceFeatures = {};
   deviceFeatures.samplerAnisotropy = VK_TRUE;
 
+  VkPhysicalDeviceVulkan12Features features12 = {};
+  features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  features12.timelineSemaphore = VK_TRUE;
+
+  //======================================== Optional features
+  // Batched indirect draws address their per-draw parameters through
+  // firstInstance. multiDrawIndirect lets one call issue all of them.
+  if (supportedFeatures.drawIndirectFirstInstance)
+  {
+    deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+    m_indirect_draws_supported = true;
+
+    if (supportedFeatures.multiDrawIndirect)
+    {
+      VkPhysicalDeviceProperties properties;
+      vkGetPhysicalDeviceProperties(m_physical_device, &properties);
+
+      deviceFeatures.multiDrawIndirect = VK_TRUE;
+      m_multi_draw_indirect_supported = true;
+      m_max_draw_indirect_count = properties.limits.maxDrawIndirectCount;
+    }
+  }
+
+  // Bindless textures need descriptor indexing (core in Vulkan 1.2):
+  // a partially bound, runtime-sized sampler array that can be
+  // updated while command buffers using other slots are pending.
+  {
+    VkPhysicalDeviceVulkan12Features supported12 = {};
+    supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+    VkPhysicalDeviceFeatures2 features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features2.pNext = &supported12;
+    vkGetPhysicalDeviceFeatures2(m_physical_device, &features2);
+
+    if (supported12.descriptorIndexing &&
+        supported12.runtimeDescriptorArray &&
+        supported12.descriptorBindingPartiallyBound &&
+        supported12.descriptorBindingSampledImageUpdateAfterBind &&
+        supported12.descriptorBindingUpdateUnusedWhilePending &&
+        supported12.shaderSampledImageArrayNonUniformIndexing)
+    {
+      features12.descriptorIndexing = VK_TRUE;
+      features12.runtimeDescriptorArray = VK_TRUE;
+      features12.descriptorBindingPartiallyBound = VK_TRUE;
+      features12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+      features12.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+      features12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+      m_bindless_supported = true;
+    }
+  }
+
+  std::vector<const char*> enabledExtensions = GetRequiredDeviceExtensions();
+
+  //======================================== Optional extensions
+  // Graphics pipeline libraries let the pipeline manager link
+  // pre-built stages instead of compiling whole pipelines.
+#ifdef VK_EXT_graphics_pipeline_library
+  VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT gplFeatures = {};
+  gplFeatures.sType =
+    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT;
+
+  if (IsDeviceExtensionAvailable(m_physical_device,
+        VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+      IsDeviceExtensionAvailable(m_physical_device,
+        VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME))
+  {
+    VkPhysicalDeviceFeatures2 features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features2.pNext = &gplFeatures;
+    vkGetPhysicalDeviceFeatures2(m_physical_device, &features2);
+
+    if (gplFeatures.graphicsPipelineLibrary)
+    {
+      enabledExtensions.push_back(VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME);
+      enabledExtensions.push_back(
+        VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+      gplFeatures.pNext = features12.pNext;
+      features12.pNext = &gplFeatures;
+      m_graphics_pipeline_library_supported = true;
+    }
+  }
+#endif
+
+  // Host memory import lets in-situ solver fields be read by the
+  // device in place instead of through a staging copy.
+#ifdef VK_EXT_external_memory_host
+  if (IsDeviceExtensionAvailable(m_physical_device,
+        VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME))
+  {
+    VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProperties = {};
+    hostProperties.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT;
+
+    VkPhysicalDeviceProperties2 properties2 = {};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties2.pNext = &hostProperties;
+    vkGetPhysicalDeviceProperties2(m_physical_device, &properties2);
+
+    enabledExtensions.push_back(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+    m_host_import_alignment = hostProperties.minImportedHostPointerAlignment;
+    m_external_memory_host_supported = true;
+  }
+#endif
+
   VkDeviceCreateInfo createInfo = {};
   createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  createInfo.pNext = &features12;
 
   createInfo.queueCreateInfoCount = queueCreateInfos.size();
   createInfo.pQueueCreateInfos = queueCreateInfos.data();
 
   createInfo.pEnabledFeatures = &deviceFeatures;
 
-  createInfo.enabledExtensionCount = k_device_extensions.size();
-  createInfo.ppEnabledExtensionNames = k_device_extensions.data();
+  createInfo.enabledExtensionCount = enabledExtensions.size();
+  createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
   if (k_enable_validation_layers)
   {
@@ -150,11 +323,16 @@ ChiSim::QueueFamilyIndices ChiSim::FindDeviceQueueFamilies(VkPhysicalDevice devi
     if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
       qf_indices.graphicsFamily = i;
 
+    // Without a surface nothing is presented; the graphics queue
+    // stands in for the present queue.
     VkBool32 presentSupport = false;
-    vkGetPhysicalDeviceSurfaceSupportKHR(device,
-                                         i,
-                                         m_main_surface,
-                                         &presentSupport);
+    if (m_headless)
+      presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+    else
+      vkGetPhysicalDeviceSurfaceSupportKHR(device,
+                                           i,
+                                           m_main_surface,
+                                           &presentSupport);
 
     if (presentSupport) qf_indices.presentFamily = i;
     if (qf_indices.isComplete()) break;
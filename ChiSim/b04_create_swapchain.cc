@@ -1,9 +1,12 @@
 #include "chi_sim.h"
 
 //###################################################################
-/** Creates a swap chain. */
+/** Creates a swap chain, or the offscreen images standing in for it in
+ * headless mode. */
 void ChiSim::CreateSwapChain()
 {
+  if (m_headless) { CreateOffscreenTargets(); return; }
+
   SwapChainSupportDetails swapChainSupport =
     QuerySwapChainSupport(m_physical_device);
 
@@ -16,9 +19,18 @@ void ChiSim::CreateSwapChain()
   VkExtent2D extent = GetSurface2DExtent(swapChainSupport.capabilities);
 
   //======================================== Find number of swap chain images
-  // This is normally at least 2 but can be 3
-  // for triple buffering.
-  uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+  // Low latency keeps the queue as short as the surface allows,
+  // balanced adds one image and max throughput two.
+  uint32_t imageCount = swapChainSupport.capabilities.minImageCount;
+  switch (m_presentation_mode)
+  {
+    case PresentationMode::LowLatency:
+      imageCount = std::max<uint32_t>(imageCount, 2); break;
+    case PresentationMode::Balanced:
+      imageCount += 1; break;
+    case PresentationMode::MaxThroughput:
+      imageCount += 2; break;
+  }
   auto max_image_count = swapChainSupport.capabilities.maxImageCount;
 
   if (max_image_count > 0 && imageCount > max_image_count)
@@ -36,6 +48,19 @@ void ChiSim::CreateSwapChain()
   createInfo.imageArrayLayers = 1;
   createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 
+  // Frames can only be read back when the images can be copied from
+  // and hold 4 bytes per pixel.
+  const bool readbackFormat =
+    surfaceFormat.format == VK_FORMAT_B8G8R8A8_SRGB  ||
+    surfaceFormat.format == VK_FORMAT_B8G8R8A8_UNORM ||
+    surfaceFormat.format == VK_FORMAT_R8G8B8A8_SRGB  ||
+    surfaceFormat.format == VK_FORMAT_R8G8B8A8_UNORM;
+  m_readback_supported = readbackFormat &&
+    (swapChainSupport.capabilities.supportedUsageFlags &
+     VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+  if (m_readback_supported)
+    createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+
   QueueFamilyIndices qf_indices = FindDeviceQueueFamilies(m_physical_device);
   uint32_t queueFamilyIndices[] =
     {qf_indices.graphicsFamily.value(), qf_indices.presentFamily.value()};
@@ -54,6 +79,7 @@ void ChiSim::CreateSwapChain()
   createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
   createInfo.presentMode = presentMode;
   createInfo.clipped = VK_TRUE;
+  createInfo.oldSwapchain = m_swap_chain;
 
   if (vkCreateSwapchainKHR(m_device,
                            &createInfo,
@@ -74,6 +100,11 @@ void ChiSim::CreateSwapChain()
   m_swap_chain_image_format = surfaceFormat.format;
   m_swap_chain_extent = extent;
 
+  // Counter value of the last submission that used each image index.
+  // Per-image uniform buffers survive a resize when the image count is
+  // unchanged, so existing values are kept.
+  m_image_timeline_values.resize(m_swap_chain_images.size(), 0);
+
   //======================================== Create image views for each image
   m_swap_chain_image_views.resize(m_swap_chain_images.size());
 
@@ -144,13 +175,28 @@ VkSurfaceFormatKHR ChiSim::ChooseSwapSurfaceFormat(
 }
 
 //###################################################################
-/** Chooses a swap surface format. */
+/** Chooses a present mode according to the presentation mode. FIFO is
+ * always available and is the fallback. */
 VkPresentModeKHR ChiSim::ChooseSwapPresentMode(
   const std::vector<VkPresentModeKHR>& availablePresentModes)
 {
-  for (const auto& availablePresentMode : availablePresentModes)
-    if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
-      return availablePresentMode;
+  std::vector<VkPresentModeKHR> preferred;
+  switch (m_presentation_mode)
+  {
+    case PresentationMode::LowLatency:
+      break;
+    case PresentationMode::Balanced:
+      preferred = {VK_PRESENT_MODE_MAILBOX_KHR};
+      break;
+    case PresentationMode::MaxThroughput:
+      preferred = {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR};
+      break;
+  }
+
+  for (auto mode : preferred)
+    for (const auto& availablePresentMode : availablePresentModes)
+      if (availablePresentMode == mode)
+        return availablePresentMode;
 
   return VK_PRESENT_MODE_FIFO_KHR;
 }
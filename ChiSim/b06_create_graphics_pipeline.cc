@@ -1,7 +1,11 @@
 #include "chi_sim.h"
 
 //###################################################################
-/** Create uniform descriptor set.*/
+/** Create uniform descriptor set layouts. Set 0 holds the per-frame
+ * uniforms, texture, model matrices, draw parameters of the indirect
+ * path, the pulled geometry arrays and the texture atlas; set 1 the
+ * dynamic uniform buffer of the bind-heavy draw parameter path; set 2
+ * the bindless textures, if supported.*/
 void ChiSim::CreateDescriptorSetLayout()
 {
   VkDescriptorSetLayoutBinding uboLayoutBinding = {};
@@ -9,7 +13,8 @@ void ChiSim::CreateDescriptorSetLayout()
   uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
   uboLayoutBinding.descriptorCount = 1;
   uboLayoutBinding.pImmutableSamplers = nullptr; // Optional
-  uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT |
+                                VK_SHADER_STAGE_FRAGMENT_BIT;
 
   VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
   samplerLayoutBinding.binding = 1;
@@ -18,8 +23,46 @@ void ChiSim::CreateDescriptorSetLayout()
   samplerLayoutBinding.pImmutableSamplers = nullptr;
   samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-  std::array<VkDescriptorSetLayoutBinding, 2> bindings =
-    {uboLayoutBinding, samplerLayoutBinding};
+  VkDescriptorSetLayoutBinding modelMatrixLayoutBinding = {};
+  modelMatrixLayoutBinding.binding = 2;
+  modelMatrixLayoutBinding.descriptorCount = 1;
+  modelMatrixLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  modelMatrixLayoutBinding.pImmutableSamplers = nullptr;
+  modelMatrixLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+  VkDescriptorSetLayoutBinding drawParameterLayoutBinding = {};
+  drawParameterLayoutBinding.binding = 3;
+  drawParameterLayoutBinding.descriptorCount = 1;
+  drawParameterLayoutBinding.descriptorType =
+    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  drawParameterLayoutBinding.pImmutableSamplers = nullptr;
+  drawParameterLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT |
+                                          VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  // Coordinates, connectivity and field values of pulled meshes.
+  std::array<VkDescriptorSetLayoutBinding, 3> pulledLayoutBindings = {};
+  for (uint32_t b = 0; b < pulledLayoutBindings.size(); ++b)
+  {
+    pulledLayoutBindings[b].binding = 4 + b;
+    pulledLayoutBindings[b].descriptorCount = 1;
+    pulledLayoutBindings[b].descriptorType =
+      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    pulledLayoutBindings[b].pImmutableSamplers = nullptr;
+    pulledLayoutBindings[b].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  }
+
+  // Layers of the texture atlas.
+  VkDescriptorSetLayoutBinding atlasLayoutBinding = {};
+  atlasLayoutBinding.binding = 7;
+  atlasLayoutBinding.descriptorCount = 1;
+  atlasLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  atlasLayoutBinding.pImmutableSamplers = nullptr;
+  atlasLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  std::array<VkDescriptorSetLayoutBinding, 8> bindings =
+    {uboLayoutBinding, samplerLayoutBinding, modelMatrixLayoutBinding,
+     drawParameterLayoutBinding, pulledLayoutBindings[0],
+     pulledLayoutBindings[1], pulledLayoutBindings[2], atlasLayoutBinding};
   VkDescriptorSetLayoutCreateInfo layoutInfo = {};
   layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
   layoutInfo.bindingCount = bindings.size();
@@ -30,150 +73,207 @@ void ChiSim::CreateDescriptorSetLayout()
                                   nullptr,
                                   &m_descriptor_set_layout) != VK_SUCCESS)
     throw std::runtime_error("failed to create descriptor set layout!");
-}
-
-//###################################################################
-/** Create graphics pipeline. */
-void ChiSim::CreateGraphicsPipeline() {
-  auto vertShaderCode = ReadFileToBuffer("../shaders/vert.spv");
-  auto fragShaderCode = ReadFileToBuffer("../shaders/frag.spv");
 
-  VkShaderModule vertShaderModule = CreateShaderModule(vertShaderCode);
-  VkShaderModule fragShaderModule = CreateShaderModule(fragShaderCode);
+  //============================ Draw parameters (dynamic uniforms)
+  VkDescriptorSetLayoutBinding drawLayoutBinding = {};
+  drawLayoutBinding.binding = 0;
+  drawLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  drawLayoutBinding.descriptorCount = 1;
+  drawLayoutBinding.pImmutableSamplers = nullptr;
+  drawLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT |
+                                 VK_SHADER_STAGE_FRAGMENT_BIT;
 
-  VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
-  vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-  vertShaderStageInfo.module = vertShaderModule;
-  vertShaderStageInfo.pName = "main";
+  VkDescriptorSetLayoutCreateInfo drawLayoutInfo = {};
+  drawLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  drawLayoutInfo.bindingCount = 1;
+  drawLayoutInfo.pBindings = &drawLayoutBinding;
 
-  VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
-  fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-  fragShaderStageInfo.module = fragShaderModule;
-  fragShaderStageInfo.pName = "main";
+  if (vkCreateDescriptorSetLayout(m_device,
+                                  &drawLayoutInfo,
+                                  nullptr,
+                                  &m_draw_descriptor_set_layout) != VK_SUCCESS)
+    throw std::runtime_error("failed to create descriptor set layout!");
 
-  VkPipelineShaderStageCreateInfo shaderStages[] =
-    {vertShaderStageInfo, fragShaderStageInfo};
+  CreateBindlessDescriptorSetLayout();
+  CreateDescriptorUpdateTemplates();
+}
 
-  VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
-  vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+//###################################################################
+/** Creates the descriptor update templates of sets 0 and 1. A template
+ * maps the members of MainDescriptorData or DrawDescriptorData onto
+ * the set's bindings, so a whole set is written with one call.*/
+void ChiSim::CreateDescriptorUpdateTemplates()
+{
+  std::array<VkDescriptorUpdateTemplateEntry, 8> entries = {};
+  entries[0].dstBinding = 0;
+  entries[0].descriptorCount = 1;
+  entries[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  entries[0].offset = offsetof(MainDescriptorData, uniforms);
+
+  entries[1].dstBinding = 1;
+  entries[1].descriptorCount = 1;
+  entries[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  entries[1].offset = offsetof(MainDescriptorData, texture);
+
+  entries[2].dstBinding = 2;
+  entries[2].descriptorCount = 1;
+  entries[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  entries[2].offset = offsetof(MainDescriptorData, model_matrices);
+
+  entries[3].dstBinding = 3;
+  entries[3].descriptorCount = 1;
+  entries[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  entries[3].offset = offsetof(MainDescriptorData, draw_parameters);
+
+  const size_t pulledOffsets[3] =
+    {offsetof(MainDescriptorData, pulled_coordinates),
+     offsetof(MainDescriptorData, pulled_connectivity),
+     offsetof(MainDescriptorData, pulled_field_values)};
+  for (uint32_t b = 0; b < 3; ++b)
+  {
+    entries[4 + b].dstBinding = 4 + b;
+    entries[4 + b].descriptorCount = 1;
+    entries[4 + b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    entries[4 + b].offset = pulledOffsets[b];
+  }
+
+  entries[7].dstBinding = 7;
+  entries[7].descriptorCount = 1;
+  entries[7].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  entries[7].offset = offsetof(MainDescriptorData, atlas);
+
+  VkDescriptorUpdateTemplateCreateInfo templateInfo = {};
+  templateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+  templateInfo.descriptorUpdateEntryCount = entries.size();
+  templateInfo.pDescriptorUpdateEntries = entries.data();
+  templateInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+  templateInfo.descriptorSetLayout = m_descriptor_set_layout;
+
+  if (vkCreateDescriptorUpdateTemplate(m_device,
+                                       &templateInfo,
+                                       nullptr,
+                                       &m_main_descriptor_template) !=
+      VK_SUCCESS)
+    throw std::runtime_error("failed to create descriptor update template!");
+
+  //============================ Draw parameters (dynamic uniforms)
+  VkDescriptorUpdateTemplateEntry drawEntry = {};
+  drawEntry.dstBinding = 0;
+  drawEntry.descriptorCount = 1;
+  drawEntry.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  drawEntry.offset = offsetof(DrawDescriptorData, draw_uniforms);
+
+  templateInfo.descriptorUpdateEntryCount = 1;
+  templateInfo.pDescriptorUpdateEntries = &drawEntry;
+  templateInfo.descriptorSetLayout = m_draw_descriptor_set_layout;
+
+  if (vkCreateDescriptorUpdateTemplate(m_device,
+                                       &templateInfo,
+                                       nullptr,
+                                       &m_draw_descriptor_template) !=
+      VK_SUCCESS)
+    throw std::runtime_error("failed to create descriptor update template!");
+}
 
-  auto bindingDescription    = Vertex::GetBindingDescription();
-  auto attributeDescriptions = Vertex::GetAttributeDescriptions();
+//###################################################################
+/** Creates the pipeline layout. It only depends on the descriptor set
+ * layouts, so it survives swap chain recreation. Per-draw parameters
+ * are push constants visible to both stages; at 48 bytes they are well
+ * within the 128 bytes every device supports.*/
+void ChiSim::CreatePipelineLayout()
+{
+  std::vector<VkDescriptorSetLayout> setLayouts =
+    {m_descriptor_set_layout, m_draw_descriptor_set_layout};
+  if (m_bindless_supported)
+    setLayouts.push_back(m_bindless_descriptor_set_layout);
 
-  vertexInputInfo.vertexBindingDescriptionCount = 1;
-  vertexInputInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
-  vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-  vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
-
-  VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
-  inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-  inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-  inputAssembly.primitiveRestartEnable = VK_FALSE;
-
-  VkViewport viewport = {};
-  viewport.x = 0.0f;
-  viewport.y = 0.0f;
-  viewport.width = (float) m_swap_chain_extent.width;
-  viewport.height = (float) m_swap_chain_extent.height;
-  viewport.minDepth = 0.0f;
-  viewport.maxDepth = 1.0f;
-
-  VkRect2D scissor = {};
-  scissor.offset = {0, 0};
-  scissor.extent = m_swap_chain_extent;
-
-  VkPipelineViewportStateCreateInfo viewportState = {};
-  viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-  viewportState.viewportCount = 1;
-  viewportState.pViewports = &viewport;
-  viewportState.scissorCount = 1;
-  viewportState.pScissors = &scissor;
-
-  VkPipelineRasterizationStateCreateInfo rasterizer = {};
-  rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-  rasterizer.depthClampEnable = VK_FALSE;
-  rasterizer.rasterizerDiscardEnable = VK_FALSE;
-  rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-  rasterizer.lineWidth = 1.0f;
-  rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-  rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-  rasterizer.depthBiasEnable = VK_FALSE;
-
-  VkPipelineMultisampleStateCreateInfo multisampling = {};
-  multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-  multisampling.sampleShadingEnable = VK_FALSE;
-  multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-
-  VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-  colorBlendAttachment.colorWriteMask =
-    VK_COLOR_COMPONENT_R_BIT |
-    VK_COLOR_COMPONENT_G_BIT |
-    VK_COLOR_COMPONENT_B_BIT |
-    VK_COLOR_COMPONENT_A_BIT;
-  colorBlendAttachment.blendEnable = VK_FALSE;
-
-  VkPipelineColorBlendStateCreateInfo colorBlending = {};
-  colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-  colorBlending.logicOpEnable = VK_FALSE;
-  colorBlending.logicOp = VK_LOGIC_OP_COPY;
-  colorBlending.attachmentCount = 1;
-  colorBlending.pAttachments = &colorBlendAttachment;
-  colorBlending.blendConstants[0] = 0.0f;
-  colorBlending.blendConstants[1] = 0.0f;
-  colorBlending.blendConstants[2] = 0.0f;
-  colorBlending.blendConstants[3] = 0.0f;
+  VkPushConstantRange pushConstantRange = {};
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT |
+                                 VK_SHADER_STAGE_FRAGMENT_BIT;
+  pushConstantRange.offset = 0;
+  pushConstantRange.size = sizeof(DrawParameters);
 
   VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
   pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-  pipelineLayoutInfo.setLayoutCount = 1;
-  pipelineLayoutInfo.pSetLayouts = &m_descriptor_set_layout;
+  pipelineLayoutInfo.setLayoutCount = setLayouts.size();
+  pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+  pipelineLayoutInfo.pushConstantRangeCount = 1;
+  pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
   if (vkCreatePipelineLayout(m_device,
                              &pipelineLayoutInfo,
                              nullptr,
                              &m_pipeline_layout) != VK_SUCCESS)
     throw std::runtime_error("failed to create pipeline layout!");
+}
+
+//###################################################################
+/** Starts the pipeline manager's compile threads. Pipeline libraries
+ * are used when the device supports VK_EXT_graphics_pipeline_library.*/
+void ChiSim::CreatePipelineManager()
+{
+  size_t numThreads = std::thread::hardware_concurrency();
+  numThreads = std::clamp<size_t>(numThreads / 2, 1, 4);
+
+  m_pipeline_manager.Initialize(m_device,
+                                m_pipeline_cache,
+                                m_graphics_pipeline_library_supported,
+                                numThreads);
+}
+
+//###################################################################
+/** Describes the main graphics pipeline with the current shaders,
+ * render pass and formats. This is the uber-shader, which reads the
+ * shader variant from the uniform buffer; see GetVariantPipeline.*/
+ChiPipelineManager::GraphicsPipelineDesc ChiSim::GetMainPipelineDesc()
+{
+  ChiPipelineManager::GraphicsPipelineDesc desc;
+  desc.name = "main";
+  desc.vertex_spirv   = m_main_vertex_spirv;
+  desc.fragment_spirv = m_main_fragment_spirv;
+  desc.specialization_constants = ShaderVariant().GetSpecializationConstants(true);
 
-  VkPipelineDepthStencilStateCreateInfo depthStencil = {};
-  depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-  depthStencil.depthTestEnable = VK_TRUE;
-  depthStencil.depthWriteEnable = VK_TRUE;
-  depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
-  depthStencil.depthBoundsTestEnable = VK_FALSE;
-  depthStencil.minDepthBounds = 0.0f; // Optional
-  depthStencil.maxDepthBounds = 1.0f; // Optional
-  depthStencil.stencilTestEnable = VK_FALSE;
-  depthStencil.front = {}; // Optional
-  depthStencil.back = {}; // Optional
-
-  VkGraphicsPipelineCreateInfo pipelineInfo = {};
-  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-  pipelineInfo.stageCount = 2;
-  pipelineInfo.pStages = shaderStages;
-  pipelineInfo.pVertexInputState = &vertexInputInfo;
-  pipelineInfo.pInputAssemblyState = &inputAssembly;
-  pipelineInfo.pViewportState = &viewportState;
-  pipelineInfo.pRasterizationState = &rasterizer;
-  pipelineInfo.pMultisampleState = &multisampling;
-  pipelineInfo.pColorBlendState = &colorBlending;
-  pipelineInfo.layout = m_pipeline_layout;
-  pipelineInfo.renderPass = m_render_pass;
-  pipelineInfo.subpass = 0;
-  pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
-  pipelineInfo.pDepthStencilState = &depthStencil;
-
-  if (vkCreateGraphicsPipelines(m_device,
-                                VK_NULL_HANDLE,
-                                1,
-                                &pipelineInfo,
-                                nullptr,
-                                &m_graphics_pipeline) != VK_SUCCESS)
-    throw std::runtime_error("failed to create graphics pipeline!");
-
-  vkDestroyShaderModule(m_device, fragShaderModule, nullptr);
-  vkDestroyShaderModule(m_device, vertShaderModule, nullptr);
+  auto attributeDescriptions = Vertex::GetAttributeDescriptions();
+  desc.vertex_bindings   = {Vertex::GetBindingDescription()};
+  desc.vertex_attributes.assign(attributeDescriptions.begin(),
+                                attributeDescriptions.end());
+
+  desc.topology      = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  desc.polygon_mode  = VK_POLYGON_MODE_FILL;
+  desc.cull_mode     = VK_CULL_MODE_BACK_BIT;
+  desc.front_face    = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+  desc.depth_test    = true;
+  desc.depth_write   = true;
+  desc.depth_compare = VK_COMPARE_OP_LESS;
+
+  desc.layout       = m_pipeline_layout;
+  desc.render_pass  = m_render_pass;
+  desc.subpass      = 0;
+  desc.color_format = m_swap_chain_image_format;
+  desc.depth_format = FindDepthFormat();
+
+  return desc;
+}
+
+//###################################################################
+/** Create graphics pipeline. The pipeline is compiled by the pipeline
+ * manager; this only waits until a usable version exists, which with
+ * pipeline libraries is the fast-linked one. The optimized pipeline
+ * replaces it once ready (see DrawFrame).*/
+void ChiSim::CreateGraphicsPipeline() {
+  m_main_pipeline =
+    m_pipeline_manager.RequestGraphicsPipeline(GetMainPipelineDesc());
+  m_pipeline_manager.WaitUntilUsable(m_main_pipeline);
+
+  std::cout << "Graphics pipeline usable after "
+            << m_pipeline_manager.GetUsableTime(m_main_pipeline)
+            << " ms (" << (m_pipeline_cache_warm ? "warm" : "cold")
+            << " pipeline cache"
+            << (m_pipeline_manager.UsesPipelineLibraries() ?
+                ", pipeline libraries)" : ")") << std::endl;
+
+  // Whatever was just compiled is now in the cache.
+  m_pipeline_cache_warm = true;
 }
 
 //###################################################################
@@ -205,6 +305,7 @@ void ChiSim::CreateCommandPool()
   VkCommandPoolCreateInfo poolInfo = {};
   poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
   poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
   if (vkCreateCommandPool(m_device,
                           &poolInfo,
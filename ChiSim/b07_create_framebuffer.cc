@@ -22,11 +22,7 @@ void ChiSim::CreateTextureSampler()
   samplerInfo.minLod = 0.0f;
   samplerInfo.maxLod = 0.0f;
 
-  if (vkCreateSampler(m_device,
-                      &samplerInfo,
-                      nullptr,
-                      &m_texture_sampler) != VK_SUCCESS)
-    throw std::runtime_error("failed to create texture sampler!");
+  m_texture_sampler = AcquireSampler(samplerInfo);
 }
 
 //###################################################################
@@ -39,7 +35,8 @@ void ChiSim::CreateDepthResources()
               m_swap_chain_extent.height,
               depthFormat,
               VK_IMAGE_TILING_OPTIMAL,
-              VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+              VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
+              (m_readback_depth ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0),
               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
               m_depth_image, m_depth_image_memory);
   m_depth_image_view = CreateImageView(m_depth_image,
@@ -115,13 +112,31 @@ void ChiSim::CreateFramebuffers()
 }
 
 //###################################################################
-/** Creates uniform buffers between CPU and GPU in a coherent sence.*/
+/** Creates uniform buffers between CPU and GPU in a coherent sence.
+ * Next to the per-frame uniforms each image gets a model matrix
+ * buffer, draw parameter buffers for the dynamic uniform and indirect
+ * paths and an indirect command buffer, all sized for k_max_draws.*/
 void ChiSim::CreateUniformBuffers()
 {
   VkDeviceSize bufferSize = sizeof(UniformBufferObject);
 
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(m_physical_device, &properties);
+  const VkDeviceSize alignment =
+    properties.limits.minUniformBufferOffsetAlignment;
+  m_draw_uniform_stride =
+    (sizeof(DrawParameters) + alignment - 1) / alignment * alignment;
+
   m_uniform_buffers.resize(m_swap_chain_images.size());
   m_uniform_buffers_memory.resize(m_swap_chain_images.size());
+  m_model_matrix_buffers.resize(m_swap_chain_images.size());
+  m_model_matrix_buffers_memory.resize(m_swap_chain_images.size());
+  m_draw_uniform_buffers.resize(m_swap_chain_images.size());
+  m_draw_uniform_buffers_memory.resize(m_swap_chain_images.size());
+  m_draw_parameter_buffers.resize(m_swap_chain_images.size());
+  m_draw_parameter_buffers_memory.resize(m_swap_chain_images.size());
+  m_indirect_buffers.resize(m_swap_chain_images.size());
+  m_indirect_buffers_memory.resize(m_swap_chain_images.size());
 
   for (size_t i = 0; i < m_swap_chain_images.size(); i++)
   {
@@ -131,82 +146,117 @@ void ChiSim::CreateUniformBuffers()
                  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
                  m_uniform_buffers[i],
                  m_uniform_buffers_memory[i]);
+
+    CreateBuffer(k_max_draws * sizeof(glm::mat4),
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 m_model_matrix_buffers[i],
+                 m_model_matrix_buffers_memory[i]);
+
+    CreateBuffer(k_max_draws * m_draw_uniform_stride,
+                 VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 m_draw_uniform_buffers[i],
+                 m_draw_uniform_buffers_memory[i]);
+
+    CreateBuffer(k_max_draws * sizeof(DrawParameters),
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 m_draw_parameter_buffers[i],
+                 m_draw_parameter_buffers_memory[i]);
+
+    CreateBuffer(k_max_draws * sizeof(VkDrawIndexedIndirectCommand),
+                 VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 m_indirect_buffers[i],
+                 m_indirect_buffers_memory[i]);
   }
 }
 
 //###################################################################
-/** Create descriptor pool. */
-void ChiSim::CreateDescriptorPool()
+/** Creates the descriptor allocators: one with freeable pools for the
+ * long-lived sets and one per frame slot for transient sets. Pools are
+ * sized for a set 0 plus a set 1 per image and grow by chaining, so
+ * more images, materials or textures never exhaust them. The bindless
+ * set has its own update-after-bind pool.*/
+void ChiSim::CreateDescriptorAllocators()
 {
-  std::array<VkDescriptorPoolSize, 2> poolSizes = {};
-  poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-  poolSizes[0].descriptorCount = m_swap_chain_images.size();
-  poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-  poolSizes[1].descriptorCount = m_swap_chain_images.size();
-
-  VkDescriptorPoolCreateInfo poolInfo = {};
-  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-  poolInfo.poolSizeCount = poolSizes.size();
-  poolInfo.pPoolSizes = poolSizes.data();
-  poolInfo.maxSets = m_swap_chain_images.size();
-
-  if (vkCreateDescriptorPool(m_device,
-                             &poolInfo,
-                             nullptr,
-                             &m_descriptor_pool) != VK_SUCCESS) {
-    throw std::runtime_error("failed to create descriptor pool!");
-  }
+  const std::vector<ChiDescriptorAllocator::PoolSizeRatio> ratios =
+    {{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         0.5f},
+     {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1.0f},
+     {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,         2.5f},
+     {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 0.5f}};
+
+  m_descriptor_allocator.Initialize(m_device, k_descriptor_pool_sets,
+                                    ratios, /*freeable=*/true);
+
+  m_frame_descriptor_allocators.resize(MAX_FRAMES_IN_FLIGHT);
+  for (auto& allocator : m_frame_descriptor_allocators)
+    allocator.Initialize(m_device, k_frame_descriptor_pool_sets,
+                         ratios, /*freeable=*/false);
 }
 
 //###################################################################
-/** Create descriptor sets. */
+/** Creates the descriptor sets of each swap chain image through the
+ * update templates. Sets are looked up by contents first, so an image
+ * whose buffers did not change gets its existing sets back. */
 void ChiSim::CreateDescriptorSets()
 {
   size_t num_swap_images = m_swap_chain_images.size();
-  std::vector<VkDescriptorSetLayout>
-    layouts(num_swap_images, m_descriptor_set_layout);
-  VkDescriptorSetAllocateInfo allocInfo = {};
-  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-  allocInfo.descriptorPool = m_descriptor_pool;
-  allocInfo.descriptorSetCount = num_swap_images;
-  allocInfo.pSetLayouts = layouts.data();
-
   m_descriptor_sets.resize(num_swap_images);
-  if (vkAllocateDescriptorSets(m_device,
-                               &allocInfo,
-                               m_descriptor_sets.data()) != VK_SUCCESS)
-    throw std::runtime_error("failed to allocate descriptor sets!");
+  m_draw_descriptor_sets.resize(num_swap_images);
 
   for (size_t i = 0; i < num_swap_images; i++) {
-    VkDescriptorBufferInfo bufferInfo = {};
-    bufferInfo.buffer = m_uniform_buffers[i];
-    bufferInfo.offset = 0;
-    bufferInfo.range = sizeof(UniformBufferObject);
-
-    VkDescriptorImageInfo imageInfo = {};
-    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    imageInfo.imageView = m_texture_image_view;
-    imageInfo.sampler = m_texture_sampler;
-
-    std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
-    descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrites[0].dstSet = m_descriptor_sets[i];
-    descriptorWrites[0].dstBinding = 0;
-    descriptorWrites[0].dstArrayElement = 0;
-    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    descriptorWrites[0].descriptorCount = 1;
-    descriptorWrites[0].pBufferInfo = &bufferInfo;
-
-    descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrites[1].dstSet = m_descriptor_sets[i];
-    descriptorWrites[1].dstBinding = 1;
-    descriptorWrites[1].dstArrayElement = 0;
-    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    descriptorWrites[1].descriptorCount = 1;
-    descriptorWrites[1].pImageInfo = &imageInfo;
-
-    vkUpdateDescriptorSets(m_device,
-                           descriptorWrites.size(),
-                           descriptorWrites.data(), 0, nullptr);
+    MainDescriptorData data = {};
+    data.uniforms.buffer = m_uniform_buffers[i];
+    data.uniforms.offset = 0;
+    data.uniforms.range = sizeof(UniformBufferObject);
+
+    data.texture.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    data.texture.imageView = m_texture.view;
+    data.texture.sampler = m_texture_sampler;
+
+    data.model_matrices.buffer = m_model_matrix_buffers[i];
+    data.model_matrices.offset = 0;
+    data.model_matrices.range = VK_WHOLE_SIZE;
+
+    data.draw_parameters.buffer = m_draw_parameter_buffers[i];
+    data.draw_parameters.offset = 0;
+    data.draw_parameters.range = VK_WHOLE_SIZE;
+
+    data.pulled_coordinates.buffer = m_pulled_coordinate_buffer;
+    data.pulled_coordinates.offset = 0;
+    data.pulled_coordinates.range = VK_WHOLE_SIZE;
+
+    data.pulled_connectivity.buffer = m_pulled_connectivity_buffer;
+    data.pulled_connectivity.offset = 0;
+    data.pulled_connectivity.range = VK_WHOLE_SIZE;
+
+    data.pulled_field_values.buffer = m_pulled_field_buffer;
+    data.pulled_field_values.offset = 0;
+    data.pulled_field_values.range = VK_WHOLE_SIZE;
+
+    data.atlas.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    data.atlas.imageView = m_atlas_image_view;
+    data.atlas.sampler = m_texture_sampler;
+
+    m_descriptor_sets[i] =
+      m_descriptor_allocator.GetOrCreateSet(m_descriptor_set_layout,
+                                            m_main_descriptor_template,
+                                            &data, sizeof(data));
+
+    DrawDescriptorData drawData = {};
+    drawData.draw_uniforms.buffer = m_draw_uniform_buffers[i];
+    drawData.draw_uniforms.offset = 0;
+    drawData.draw_uniforms.range = sizeof(DrawParameters);
+
+    m_draw_descriptor_sets[i] =
+      m_descriptor_allocator.GetOrCreateSet(m_draw_descriptor_set_layout,
+                                            m_draw_descriptor_template,
+                                            &drawData, sizeof(drawData));
   }
-}
\ No newline at end of file
+}
@@ -17,93 +17,114 @@ void ChiSim::CreateCommandBuffers()
                                m_command_buffers.data()) != VK_SUCCESS)
     throw std::runtime_error("failed to allocate command buffers!");
 
+  BuildRenderGraph();
+
+  //============================ Timestamp queries, two per image
+  VkQueryPoolCreateInfo queryPoolInfo = {};
+  queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  queryPoolInfo.queryCount = 2 * (uint32_t) m_command_buffers.size();
+
+  if (vkCreateQueryPool(m_device,
+                        &queryPoolInfo,
+                        nullptr,
+                        &m_timestamp_query_pool) != VK_SUCCESS)
+    throw std::runtime_error("failed to create timestamp query pool!");
+
+  m_image_timestamps_written.assign(m_command_buffers.size(), false);
+  m_command_buffer_generations.assign(m_command_buffers.size(), 0);
+  m_command_buffer_variant_keys.assign(m_command_buffers.size(), 0);
+  m_command_buffer_draw_paths.assign(m_command_buffers.size(), std::nullopt);
+  m_command_buffer_vertex_inputs.assign(m_command_buffers.size(),
+                                        std::nullopt);
+  m_command_buffer_captures.assign(m_command_buffers.size(), false);
+
   for (size_t i = 0; i < m_command_buffers.size(); i++)
+    RecordCommandBuffer(i);
+}
+
+//###################################################################
+/** Records the frame of a swap chain image. This is done once when the
+ * command buffers are created and again whenever the scene's geometry
+ * changed since the last recording.*/
+void ChiSim::RecordCommandBuffer(size_t image_index)
+{
+  const size_t i = image_index;
+
+  if (m_draw_parameter_path == DrawParameterPath::Indirect &&
+      !m_indirect_draws_supported)
+  {
+    std::cout << "Indirect draws need drawIndirectFirstInstance, "
+                 "using push constants." << std::endl;
+    m_draw_parameter_path = DrawParameterPath::PushConstants;
+  }
+
+  auto recordStart = std::chrono::high_resolution_clock::now();
+
+  VkCommandBufferBeginInfo beginInfo = {};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+  if (vkBeginCommandBuffer(m_command_buffers[i], &beginInfo) != VK_SUCCESS)
+    throw std::runtime_error("failed to begin recording command buffer!");
+
+  const uint32_t firstQuery = 2 * (uint32_t) i;
+  vkCmdResetQueryPool(m_command_buffers[i],
+                      m_timestamp_query_pool, firstQuery, 2);
+  vkCmdWriteTimestamp(m_command_buffers[i],
+                      VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                      m_timestamp_query_pool, firstQuery);
+
+  //============================ Record frame graph for this image
+  m_rg_recording_image = i;
+  m_command_buffer_captures[i] = false;
+  m_render_graph.SetImportedImage(m_rg_swap_chain_image,
+                                  m_swap_chain_images[i]);
+  m_render_graph.Execute(m_command_buffers[i]);
+
+  vkCmdWriteTimestamp(m_command_buffers[i],
+                      VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      m_timestamp_query_pool, firstQuery + 1);
+
+  if (vkEndCommandBuffer(m_command_buffers[i]) != VK_SUCCESS)
+    throw std::runtime_error("failed to record command buffer!");
+
+  m_command_buffer_generations[i] = m_scene_generation;
+
+  //============================ Draw benchmark recording cost
+  m_command_buffer_draw_paths[i] = std::nullopt;
+  if (m_draw_benchmark)
   {
-    VkCommandBufferBeginInfo beginInfo = {};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-
-    if (vkBeginCommandBuffer(m_command_buffers[i], &beginInfo) != VK_SUCCESS)
-      throw std::runtime_error("failed to begin recording command buffer!");
-
-    VkRenderPassBeginInfo renderPassInfo = {};
-    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderPassInfo.renderPass = m_render_pass;
-    renderPassInfo.framebuffer = m_swap_chain_framebuffers[i];
-    renderPassInfo.renderArea.offset = {0, 0};
-    renderPassInfo.renderArea.extent = m_swap_chain_extent;
-
-    //============================ Clear background and depth-buffer
-    std::array<VkClearValue, 2> clearValues = {};
-    clearValues[0].color = {0.0f, 0.0f, 0.0f, 1.0f};
-    clearValues[1].depthStencil = {1.0f,0};
-    renderPassInfo.clearValueCount = clearValues.size();
-    renderPassInfo.pClearValues = clearValues.data();
-
-    //============================ Start rendering
-    vkCmdBeginRenderPass(m_command_buffers[i],
-                         &renderPassInfo,
-                         VK_SUBPASS_CONTENTS_INLINE);
-
-    //============================ Bind a Graphical Material
-    vkCmdBindPipeline(m_command_buffers[i],
-                      VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      m_graphics_pipeline);
-
-    vkCmdBindDescriptorSets(m_command_buffers[i],
-                            VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            m_pipeline_layout,
-                            0,
-                            1,
-                            &m_descriptor_sets[i],
-                            0,
-                            nullptr);
-
-    //============================ Bind geometry information
-    VkBuffer vertexBuffers[] = {m_vertex_buffer};
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(m_command_buffers[i],
-                           0,
-                           1,
-                           vertexBuffers,
-                           offsets);
-
-    vkCmdBindIndexBuffer(m_command_buffers[i],
-                         m_index_buffer,
-                         0,
-                         VK_INDEX_TYPE_UINT16);
-
-    //============================ Execute draw
-    vkCmdDrawIndexed(m_command_buffers[i],
-                     indices.size(),
-                     1,
-                     0,
-                     0,
-                     0);
-
-    //============================ End rendering pass
-    vkCmdEndRenderPass(m_command_buffers[i]);
-
-    if (vkEndCommandBuffer(m_command_buffers[i]) != VK_SUCCESS)
-      throw std::runtime_error("failed to record command buffer!");
+    double recordMs = std::chrono::duration<double, std::milli>(
+      std::chrono::high_resolution_clock::now() - recordStart).count();
+
+    auto& timings =
+      m_draw_path_timings[static_cast<size_t>(m_draw_parameter_path)];
+    ++timings.recordings;
+    timings.record_ms +=
+      (recordMs - timings.record_ms) / double(timings.recordings);
+
+    m_command_buffer_draw_paths[i] = m_draw_parameter_path;
   }
+
+  m_command_buffer_vertex_inputs[i] = std::nullopt;
+  if (m_pulling_benchmark && !m_draw_benchmark)
+    m_command_buffer_vertex_inputs[i] = m_pulling_benchmark_input;
 }
 
 //###################################################################
-/** Create synchronization buffers. */
+/** Create synchronization objects. Binary semaphores are still
+ * required by the swap chain for acquire and present; everything else
+ * is ordered by the graphics queue's timeline semaphore
+ * (see CreateQueueTimelines).*/
 void ChiSim::CreateSyncObjects()
 {
   m_image_available_semaphores.resize(MAX_FRAMES_IN_FLIGHT);
   m_render_finished_semaphores.resize(MAX_FRAMES_IN_FLIGHT);
-  m_in_flight_fences.resize(MAX_FRAMES_IN_FLIGHT);
-  m_images_in_flight.resize(m_swap_chain_images.size(), VK_NULL_HANDLE);
+  m_frame_timeline_values.assign(MAX_FRAMES_IN_FLIGHT, 0);
 
   VkSemaphoreCreateInfo semaphoreInfo = {};
   semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-  VkFenceCreateInfo fenceInfo = {};
-  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-  fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
   for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
   {
     if (vkCreateSemaphore(m_device,
@@ -113,13 +134,10 @@ void ChiSim::CreateSyncObjects()
         vkCreateSemaphore(m_device,
                           &semaphoreInfo,
                           nullptr,
-                          &m_render_finished_semaphores[i]) != VK_SUCCESS ||
-        vkCreateFence(m_device,
-                      &fenceInfo, nullptr,
-                      &m_in_flight_fences[i]) != VK_SUCCESS)
+                          &m_render_finished_semaphores[i]) != VK_SUCCESS)
     {
       throw std::runtime_error("failed to create synchronization "
                                "objects for a frame!");
     }
   }//for
-}
\ No newline at end of file
+}
@@ -1,90 +1,164 @@
 #include "chi_sim.h"
 
 //###################################################################
-/** Draws the actual frame. */
+/** Draws the actual frame. Frame slots and swap chain images are
+ * retired by comparing the graphics timeline's counter against the
+ * value signalled by their last submission. */
 void ChiSim::DrawFrame()
 {
-  vkWaitForFences(m_device,
-                  1,
-                  &m_in_flight_fences[m_current_frame],
-                  VK_TRUE,
-                  UINT64_MAX);
+  if (m_requested_presentation_mode != m_presentation_mode)
+    ApplyPresentationMode();
+
+  ApplyShaderReloads();
+
+  auto frameStart = std::chrono::high_resolution_clock::now();
+
+  //============================ Wait for this frame slot to retire
+  double cpuWaitMs =
+    WaitForTimelineValue(m_graphics_timeline,
+                         m_frame_timeline_values[m_current_frame]);
+  UpdateLatencySamples();
+
+  //============================ Field updates into this slot's range
+  SubmitFieldCopies();
+  ResolveFieldRanges();
 
   uint32_t imageIndex;
-  VkResult result = vkAcquireNextImageKHR(
-    m_device,
-    m_swap_chain,
-    UINT64_MAX,
-    m_image_available_semaphores[m_current_frame],
-    VK_NULL_HANDLE,
-    &imageIndex);
+  VkResult result = m_headless ?
+    AcquireOffscreenImage(imageIndex) :
+    vkAcquireNextImageKHR(
+      m_device,
+      m_swap_chain,
+      UINT64_MAX,
+      m_image_available_semaphores[m_current_frame],
+      VK_NULL_HANDLE,
+      &imageIndex);
 
   if (result == VK_ERROR_OUT_OF_DATE_KHR)
-  { recreateSwapChain(); return; }
+  {
+    m_framebuffer_resized = false;
+    recreateSwapChain();
+    return;
+  }
   else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
     throw std::runtime_error("failed to acquire swap chain image!");
 
-  if (m_images_in_flight[imageIndex] != VK_NULL_HANDLE)
-    vkWaitForFences(m_device,
-                    1,
-                    &m_images_in_flight[imageIndex],
-                    VK_TRUE,
-                    UINT64_MAX);
-
-  m_images_in_flight[imageIndex] = m_in_flight_fences[m_current_frame];
-
-  UpdateUniformBuffer(imageIndex);
+  //============================ Wait for the image's last use
+  cpuWaitMs += WaitForTimelineValue(m_graphics_timeline,
+                                    m_image_timeline_values[imageIndex]);
 
-  VkSubmitInfo submitInfo = {};
-  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  ReadGPUFrameTime(imageIndex);
+  ConsumeCompletedReadbacks();
+  CollectRetiredResources();
 
-  VkSemaphore waitSemaphores[] =
-    {m_image_available_semaphores[m_current_frame]};
-  VkPipelineStageFlags waitStages[] =
-    {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-  submitInfo.waitSemaphoreCount = 1;
-  submitInfo.pWaitSemaphores = waitSemaphores;
-  submitInfo.pWaitDstStageMask = waitStages;
+  //============================ Re-record if the scene changed
+  // Pipelines finishing on the compile threads (e.g. optimized links)
+  // are picked up by re-recording.
+  uint64_t pipelinesReady = m_pipeline_manager.GetReadyGeneration();
+  if (pipelinesReady != m_pipelines_ready_generation)
+  {
+    m_pipelines_ready_generation = pipelinesReady;
+    ++m_scene_generation;
+  }
 
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &m_command_buffers[imageIndex];
+  if (m_command_buffer_generations[imageIndex] != m_scene_generation)
+    RecordCommandBuffer(imageIndex);
 
-  VkSemaphore signalSemaphores[] =
-    {m_render_finished_semaphores[m_current_frame]};
-  submitInfo.signalSemaphoreCount = 1;
-  submitInfo.pSignalSemaphores = signalSemaphores;
+  //============================ Late camera update
+  // In low latency mode input is polled again right before the UBO is
+  // written, so the frame reflects the most recent events.
+  if (m_presentation_mode == PresentationMode::LowLatency && !m_headless)
+    glfwPollEvents();
 
-  vkResetFences(m_device, 1, &m_in_flight_fences[m_current_frame]);
+  auto sampleTime = std::chrono::high_resolution_clock::now();
+  UpdateUniformBuffer(imageIndex);
 
-  if (vkQueueSubmit(m_graphics_queue,
-                    1,
-                    &submitInfo,
-                    m_in_flight_fences[m_current_frame]) != VK_SUCCESS)
-    throw std::runtime_error("failed to submit draw command buffer!");
+  //============================ Submit
+  // Offscreen images are neither acquired nor presented, so headless
+  // frames only signal the timeline.
+  std::vector<SemaphoreWait> acquireWaits;
+  std::vector<VkSemaphore>   presentSignals;
+  if (!m_headless)
+  {
+    acquireWaits = {{m_image_available_semaphores[m_current_frame], 0,
+                     VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT}};
+    presentSignals = {m_render_finished_semaphores[m_current_frame]};
+  }
 
-  VkPresentInfoKHR presentInfo = {};
-  presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+  uint64_t signalValue = SubmitToTimeline(
+    m_graphics_queue,
+    m_graphics_timeline,
+    m_command_buffers[imageIndex],
+    acquireWaits,
+    presentSignals);
+
+  m_frame_timeline_values[m_current_frame] = signalValue;
+  m_image_timeline_values[imageIndex]      = signalValue;
+  m_image_timestamps_written[imageIndex]   = true;
+  QueueLatencySample(signalValue, sampleTime);
+
+  const bool captured = m_command_buffer_captures[imageIndex];
+  if (captured) SubmitReadback(imageIndex, signalValue);
+
+  //============================ Present
+  // Headless frames leave through the readback ring.
+  if (m_headless)
+    result = VK_SUCCESS;
+  else
+  {
+    VkPresentInfoKHR presentInfo = {};
+    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
-  presentInfo.waitSemaphoreCount = 1;
-  presentInfo.pWaitSemaphores = signalSemaphores;
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores =
+      &m_render_finished_semaphores[m_current_frame];
 
-  VkSwapchainKHR swapChains[] = {m_swap_chain};
-  presentInfo.swapchainCount = 1;
-  presentInfo.pSwapchains = swapChains;
+    VkSwapchainKHR swapChains[] = {m_swap_chain};
+    presentInfo.swapchainCount = 1;
+    presentInfo.pSwapchains = swapChains;
 
-  presentInfo.pImageIndices = &imageIndex;
+    presentInfo.pImageIndices = &imageIndex;
 
-  result = vkQueuePresentKHR(m_present_queue, &presentInfo);
+    result = vkQueuePresentKHR(m_present_queue, &presentInfo);
+  }
 
-  if (result == VK_ERROR_OUT_OF_DATE_KHR ||
-      result == VK_SUBOPTIMAL_KHR ||
-      m_framebuffer_resized)
+  //============================ Recreate swap chain if needed
+  // A suboptimal swap chain can still be presented to, so while the
+  // window is being dragged recreation is deferred until resize events
+  // have been quiet for k_resize_debounce_ms.
+  if (result == VK_ERROR_OUT_OF_DATE_KHR)
   {
     m_framebuffer_resized = false;
     recreateSwapChain();
   }
+  else if (result == VK_SUBOPTIMAL_KHR || m_framebuffer_resized)
+  {
+    double msSinceResize = std::chrono::duration<double, std::milli>(
+      std::chrono::high_resolution_clock::now() - m_last_resize_event).count();
+
+    if (msSinceResize >= k_resize_debounce_ms)
+    {
+      m_framebuffer_resized = false;
+      recreateSwapChain();
+    }
+  }
   else if (result != VK_SUCCESS)
     throw std::runtime_error("failed to present swap chain image!");
 
-  m_current_frame = (m_current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
-}
\ No newline at end of file
+  StepRecreateBenchmark();
+
+  m_current_frame = (m_current_frame + 1) % m_frames_in_flight;
+
+  //============================ Timings
+  auto frameEnd = std::chrono::high_resolution_clock::now();
+  double frameMs =
+    std::chrono::duration<double, std::milli>(frameEnd - frameStart).count();
+
+  const double alpha = 0.05;
+  auto& timings = CurrentTimings();
+  timings.cpu_wait_ms += alpha * (cpuWaitMs - timings.cpu_wait_ms);
+  timings.frame_ms    += alpha * (frameMs - timings.frame_ms);
+  ++timings.num_frames;
+
+  UpdateReadbackFrameTime(captured, frameMs);
+}
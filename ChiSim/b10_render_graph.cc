@@ -0,0 +1,285 @@
+#include "chi_sim.h"
+
+//###################################################################
+/** Builds and compiles the frame graph. The swap chain image is
+ * imported once and rebound for each image when recording. In headless
+ * mode it is an offscreen image, left ready to be read back instead of
+ * presented. When the image can be read back, a readback pass copies it
+ * into the readback ring after the scene is drawn, together with the
+ * depth image when depth is read back too. */
+void ChiSim::BuildRenderGraph()
+{
+  if (m_render_graph.IsCompiled()) return;
+
+  m_render_graph.Reset();
+
+  //======================================== Import swap chain image
+  // The image is acquired with a semaphore waited on at the color
+  // attachment output stage, so the first transition chains onto it.
+  ChiRenderGraph::ImageDesc colorDesc;
+  colorDesc.format = m_swap_chain_image_format;
+  colorDesc.extent = m_swap_chain_extent;
+  colorDesc.aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+
+  ChiRenderGraph::AccessState acquiredState;
+  acquiredState.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  acquiredState.stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  acquiredState.access = 0;
+
+  m_rg_swap_chain_image =
+    m_render_graph.ImportImage("swap_chain_image",
+                               m_swap_chain_images[0],
+                               colorDesc,
+                               acquiredState);
+  m_render_graph.SetFinalUsage(m_rg_swap_chain_image,
+                               m_headless ?
+                               ChiRenderGraph::Usage::TransferSrc :
+                               ChiRenderGraph::Usage::Present);
+
+  //======================================== Import depth image
+  // Its contents are cleared every frame but the previous frame's
+  // depth writes, and its readback, must still complete before it is
+  // reused.
+  VkFormat depthFormat = FindDepthFormat();
+
+  ChiRenderGraph::ImageDesc depthDesc;
+  depthDesc.format = depthFormat;
+  depthDesc.extent = m_swap_chain_extent;
+  depthDesc.aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+  if (HasStencilComponent(depthFormat))
+    depthDesc.aspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+
+  ChiRenderGraph::AccessState previousDepthState;
+  previousDepthState.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  previousDepthState.stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                              VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  previousDepthState.access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  if (m_readback_depth)
+    previousDepthState.stages |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+  m_rg_depth_image = m_render_graph.ImportImage("depth_image",
+                                                m_depth_image,
+                                                depthDesc,
+                                                previousDepthState);
+
+  //======================================== Main scene pass
+  m_render_graph.AddPass(
+    "main_scene",
+    ChiRenderGraph::QueueType::Graphics,
+    {{m_rg_swap_chain_image, ChiRenderGraph::Usage::ColorAttachment},
+     {m_rg_depth_image,      ChiRenderGraph::Usage::DepthAttachment}},
+    [this](VkCommandBuffer cmd_buffer) { RecordMainPass(cmd_buffer); });
+
+  //======================================== Readback pass
+  // Writes only host memory, so it is kept even though nothing in the
+  // graph consumes it.
+  if (m_readback_supported)
+  {
+    std::vector<std::pair<ChiRenderGraph::ResourceID,
+                          ChiRenderGraph::Usage>> accesses =
+      {{m_rg_swap_chain_image, ChiRenderGraph::Usage::TransferSrc}};
+    if (m_readback_depth)
+      accesses.push_back({m_rg_depth_image,
+                          ChiRenderGraph::Usage::TransferSrc});
+
+    m_render_graph.AddPass(
+      "readback",
+      ChiRenderGraph::QueueType::Graphics,
+      accesses,
+      [this](VkCommandBuffer cmd_buffer) { RecordReadbackCopy(cmd_buffer); },
+      true);
+  }
+
+  m_render_graph.Compile(m_device, m_physical_device);
+}
+
+//###################################################################
+/** Records the main scene render pass into the framebuffer of the
+ * swap chain image currently being recorded. */
+void ChiSim::RecordMainPass(VkCommandBuffer cmd_buffer)
+{
+  const size_t i = m_rg_recording_image;
+
+  VkRenderPassBeginInfo renderPassInfo = {};
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+  renderPassInfo.renderPass = m_render_pass;
+  renderPassInfo.framebuffer = m_swap_chain_framebuffers[i];
+  renderPassInfo.renderArea.offset = {0, 0};
+  renderPassInfo.renderArea.extent = m_swap_chain_extent;
+
+  //============================ Clear background and depth-buffer
+  std::array<VkClearValue, 2> clearValues = {};
+  clearValues[0].color = {0.0f, 0.0f, 0.0f, 1.0f};
+  clearValues[1].depthStencil = {1.0f,0};
+  renderPassInfo.clearValueCount = clearValues.size();
+  renderPassInfo.pClearValues = clearValues.data();
+
+  //============================ Start rendering
+  vkCmdBeginRenderPass(cmd_buffer,
+                       &renderPassInfo,
+                       VK_SUBPASS_CONTENTS_INLINE);
+
+  //============================ Bind a Graphical Material
+  vkCmdBindPipeline(cmd_buffer,
+                    VK_PIPELINE_BIND_POINT_GRAPHICS,
+                    SelectMainPassPipeline(m_command_buffer_variant_keys[i]));
+
+  VkViewport viewport = {};
+  viewport.x = 0.0f;
+  viewport.y = 0.0f;
+  viewport.width = (float) m_swap_chain_extent.width;
+  viewport.height = (float) m_swap_chain_extent.height;
+  viewport.minDepth = 0.0f;
+  viewport.maxDepth = 1.0f;
+  vkCmdSetViewport(cmd_buffer, 0, 1, &viewport);
+
+  VkRect2D scissor = {};
+  scissor.offset = {0, 0};
+  scissor.extent = m_swap_chain_extent;
+  vkCmdSetScissor(cmd_buffer, 0, 1, &scissor);
+
+  vkCmdBindDescriptorSets(cmd_buffer,
+                          VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          m_pipeline_layout,
+                          0,
+                          1,
+                          &m_descriptor_sets[i],
+                          0,
+                          nullptr);
+
+  //============================ Bind geometry information
+  // All meshes live in the shared geometry buffers, so they are bound
+  // once and each mesh is drawn from its own index/vertex range.
+  VkBuffer vertexBuffers[] = {m_vertex_buffer};
+  VkDeviceSize offsets[] = {0};
+  vkCmdBindVertexBuffers(cmd_buffer,
+                         0,
+                         1,
+                         vertexBuffers,
+                         offsets);
+
+  vkCmdBindIndexBuffer(cmd_buffer,
+                       m_index_buffer,
+                       0,
+                       VK_INDEX_TYPE_UINT32);
+
+  //============================ Bindless textures
+  if (m_bindless_supported)
+    vkCmdBindDescriptorSets(cmd_buffer,
+                            VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            m_pipeline_layout,
+                            2,
+                            1,
+                            &m_bindless_descriptor_set,
+                            0,
+                            nullptr);
+
+  //============================ Execute draws
+  // Per-draw parameters are pushed into the command stream. The
+  // dynamic uniform path instead rebinds set 1 at each draw's offset;
+  // with the other paths it is bound once since the layout requires it.
+  uint32_t dynamicOffset = 0;
+  vkCmdBindDescriptorSets(cmd_buffer,
+                          VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          m_pipeline_layout,
+                          1,
+                          1,
+                          &m_draw_descriptor_sets[i],
+                          1,
+                          &dynamicOffset);
+
+  const auto& draws = GetActiveDraws();
+
+  uint32_t numIndexed = 0, numPulled = 0;
+  for (const auto& draw : draws)
+  {
+    const auto& mesh = m_meshes[draw.mesh];
+    if (mesh.active) ++(mesh.pulled ? numPulled : numIndexed);
+  }
+
+  // Interleaved meshes are drawn first with the bound pipeline, pulled
+  // meshes after it with the vertex pulling pipeline. Descriptor sets
+  // and dynamic state stay bound across the switch.
+  for (bool pulled : {false, true})
+  {
+    if (pulled)
+    {
+      if (numPulled == 0) break;
+      vkCmdBindPipeline(cmd_buffer,
+                        VK_PIPELINE_BIND_POINT_GRAPHICS,
+                        SelectPulledPipeline(m_command_buffer_variant_keys[i]));
+    }
+
+    if (m_draw_parameter_path == DrawParameterPath::Indirect)
+    {
+      // The commands are written per frame by WriteDrawParameters, one
+      // per active draw, so a single call covers each kind of mesh.
+      if (!pulled)
+        for (uint32_t first = 0; first < numIndexed;
+             first += m_max_draw_indirect_count)
+          vkCmdDrawIndexedIndirect(
+            cmd_buffer,
+            m_indirect_buffers[i],
+            first * sizeof(VkDrawIndexedIndirectCommand),
+            std::min(m_max_draw_indirect_count, numIndexed - first),
+            sizeof(VkDrawIndexedIndirectCommand));
+      else
+        for (uint32_t first = 0; first < numPulled;
+             first += m_max_draw_indirect_count)
+          vkCmdDrawIndirect(
+            cmd_buffer,
+            m_indirect_buffers[i],
+            numIndexed * sizeof(VkDrawIndexedIndirectCommand) +
+            first * sizeof(VkDrawIndirectCommand),
+            std::min(m_max_draw_indirect_count, numPulled - first),
+            sizeof(VkDrawIndirectCommand));
+      continue;
+    }
+
+    const bool pushConstants =
+      m_draw_parameter_path == DrawParameterPath::PushConstants;
+
+    for (size_t d = 0; d < draws.size(); ++d)
+    {
+      const auto& draw = draws[d];
+      const auto& mesh = m_meshes[draw.mesh];
+      if (!mesh.active || mesh.pulled != pulled) continue;
+
+      if (pushConstants)
+        vkCmdPushConstants(cmd_buffer,
+                           m_pipeline_layout,
+                           VK_SHADER_STAGE_VERTEX_BIT |
+                           VK_SHADER_STAGE_FRAGMENT_BIT,
+                           0,
+                           sizeof(DrawParameters),
+                           &draw.parameters);
+      else if (uint32_t(d * m_draw_uniform_stride) != dynamicOffset)
+      {
+        dynamicOffset = uint32_t(d * m_draw_uniform_stride);
+        vkCmdBindDescriptorSets(cmd_buffer,
+                                VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                m_pipeline_layout,
+                                1,
+                                1,
+                                &m_draw_descriptor_sets[i],
+                                1,
+                                &dynamicOffset);
+      }
+
+      // Pulled meshes are not indexed by the hardware; firstVertex
+      // starts gl_VertexIndex at the mesh's first connectivity entry.
+      if (pulled)
+        vkCmdDraw(cmd_buffer, mesh.index_count, 1, mesh.first_index, 0);
+      else
+        vkCmdDrawIndexed(cmd_buffer,
+                         mesh.index_count,
+                         1,
+                         mesh.first_index,
+                         mesh.vertex_offset,
+                         0);
+    }
+  }
+
+  //============================ End rendering pass
+  vkCmdEndRenderPass(cmd_buffer);
+}
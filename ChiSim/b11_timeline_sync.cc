@@ -0,0 +1,170 @@
+#include "chi_sim.h"
+
+//###################################################################
+/** Creates one timeline semaphore per submitting queue. Presentation
+ * does not submit command buffers, so only the graphics queue needs
+ * one at present. */
+void ChiSim::CreateQueueTimelines()
+{
+  VkSemaphoreTypeCreateInfo timelineInfo = {};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+  timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  timelineInfo.initialValue = 0;
+
+  VkSemaphoreCreateInfo semaphoreInfo = {};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  semaphoreInfo.pNext = &timelineInfo;
+
+  if (vkCreateSemaphore(m_device,
+                        &semaphoreInfo,
+                        nullptr,
+                        &m_graphics_timeline.semaphore) != VK_SUCCESS)
+    throw std::runtime_error("failed to create graphics timeline semaphore!");
+
+  m_graphics_timeline.last_submitted = 0;
+}
+
+//###################################################################
+/** Submits a command buffer that signals the next value of the
+ * queue's timeline, plus any binary semaphores (e.g. for present).
+ * Waits may mix binary semaphores and timeline values of other queues,
+ * which lets upload, compute and graphics work form one dependency
+ * chain without fences. Returns the signalled timeline value.*/
+uint64_t ChiSim::SubmitToTimeline(VkQueue queue,
+                                  QueueTimeline& timeline,
+                                  VkCommandBuffer cmd_buffer,
+                                  const std::vector<SemaphoreWait>& waits,
+                                  const std::vector<VkSemaphore>& signal_binary)
+{
+  const uint64_t signal_value = timeline.last_submitted + 1;
+
+  std::vector<VkSemaphore>          waitSemaphores;
+  std::vector<uint64_t>             waitValues;
+  std::vector<VkPipelineStageFlags> waitStages;
+  for (const auto& wait : waits)
+  {
+    waitSemaphores.push_back(wait.semaphore);
+    waitValues.push_back(wait.value);
+    waitStages.push_back(wait.stages);
+  }
+
+  std::vector<VkSemaphore> signalSemaphores(signal_binary);
+  std::vector<uint64_t>    signalValues(signal_binary.size(), 0);
+  signalSemaphores.push_back(timeline.semaphore);
+  signalValues.push_back(signal_value);
+
+  VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timelineInfo.waitSemaphoreValueCount = waitValues.size();
+  timelineInfo.pWaitSemaphoreValues = waitValues.data();
+  timelineInfo.signalSemaphoreValueCount = signalValues.size();
+  timelineInfo.pSignalSemaphoreValues = signalValues.data();
+
+  VkSubmitInfo submitInfo = {};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.pNext = &timelineInfo;
+  submitInfo.waitSemaphoreCount = waitSemaphores.size();
+  submitInfo.pWaitSemaphores = waitSemaphores.data();
+  submitInfo.pWaitDstStageMask = waitStages.data();
+  submitInfo.commandBufferCount = (cmd_buffer != VK_NULL_HANDLE)? 1 : 0;
+  submitInfo.pCommandBuffers = &cmd_buffer;
+  submitInfo.signalSemaphoreCount = signalSemaphores.size();
+  submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+  if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+    throw std::runtime_error("failed to submit to queue timeline!");
+
+  timeline.last_submitted = signal_value;
+
+  return signal_value;
+}
+
+//###################################################################
+/** Blocks the host until the timeline reaches the given value. Returns
+ * the time spent waiting in milliseconds. */
+double ChiSim::WaitForTimelineValue(const QueueTimeline& timeline,
+                                    uint64_t value)
+{
+  if (value == 0 || GetCompletedTimelineValue(timeline) >= value)
+    return 0.0;
+
+  auto t0 = std::chrono::high_resolution_clock::now();
+
+  VkSemaphoreWaitInfo waitInfo = {};
+  waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &timeline.semaphore;
+  waitInfo.pValues = &value;
+
+  if (vkWaitSemaphores(m_device, &waitInfo, UINT64_MAX) != VK_SUCCESS)
+    throw std::runtime_error("failed to wait on queue timeline!");
+
+  auto t1 = std::chrono::high_resolution_clock::now();
+
+  return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+//###################################################################
+/** Returns the last value the GPU has signalled on the timeline. */
+uint64_t ChiSim::GetCompletedTimelineValue(const QueueTimeline& timeline)
+{
+  uint64_t value = 0;
+  vkGetSemaphoreCounterValue(m_device, timeline.semaphore, &value);
+  return value;
+}
+
+//###################################################################
+/** Defers destruction of a resource until the graphics timeline has
+ * passed the given value, i.e. until no submitted frame can still
+ * reference it. */
+void ChiSim::RetireAfter(uint64_t timeline_value,
+                         std::function<void()> deleter)
+{
+  m_retired_resources.emplace_back(timeline_value, std::move(deleter));
+}
+
+//###################################################################
+/** Destroys every retired resource whose timeline value has been
+ * reached. Values are queued in submission order, so the scan stops at
+ * the first value not yet reached. */
+void ChiSim::CollectRetiredResources()
+{
+  if (m_retired_resources.empty()) return;
+
+  const uint64_t completed = GetCompletedTimelineValue(m_graphics_timeline);
+
+  while (!m_retired_resources.empty() &&
+         m_retired_resources.front().first <= completed)
+  {
+    m_retired_resources.front().second();
+    m_retired_resources.pop_front();
+  }
+}
+
+//###################################################################
+/** Reads the timestamps recorded by the last submission of an image's
+ * command buffer. Must only be called once that submission completed.*/
+void ChiSim::ReadGPUFrameTime(uint32_t image_index)
+{
+  if (!m_image_timestamps_written[image_index]) return;
+
+  uint64_t timestamps[2] = {0, 0};
+  VkResult result = vkGetQueryPoolResults(m_device,
+                                          m_timestamp_query_pool,
+                                          2 * image_index, 2,
+                                          sizeof(timestamps), timestamps,
+                                          sizeof(uint64_t),
+                                          VK_QUERY_RESULT_64_BIT);
+  if (result != VK_SUCCESS) return;
+
+  double gpu_ms = double(timestamps[1] - timestamps[0]) *
+                  m_timestamp_period_ns * 1.0e-6;
+
+  const double alpha = 0.05;
+  auto& timings = CurrentTimings();
+  timings.gpu_ms += alpha * (gpu_ms - timings.gpu_ms);
+
+  UpdateVariantTimings(image_index, gpu_ms);
+  UpdateDrawPathTimings(image_index, gpu_ms);
+  UpdateVertexInputTimings(image_index, gpu_ms);
+}
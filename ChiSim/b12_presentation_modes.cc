@@ -0,0 +1,200 @@
+#include "chi_sim.h"
+
+//###################################################################
+/** Number of frames the CPU may record ahead of the GPU. */
+size_t ChiSim::GetFramesInFlight(PresentationMode mode)
+{
+  switch (mode)
+  {
+    case PresentationMode::LowLatency:    return 1;
+    case PresentationMode::Balanced:      return 2;
+    case PresentationMode::MaxThroughput: return 3;
+  }
+  return 2;
+}
+
+//###################################################################
+/** Human readable name of a presentation mode. */
+const char* ChiSim::GetPresentationModeName(PresentationMode mode)
+{
+  switch (mode)
+  {
+    case PresentationMode::LowLatency:    return "low latency";
+    case PresentationMode::Balanced:      return "balanced";
+    case PresentationMode::MaxThroughput: return "max throughput";
+  }
+  return "unknown";
+}
+
+//###################################################################
+/** Switches to the requested presentation mode. The present mode and
+ * swap chain depth require a new swap chain; the frames in flight only
+ * require that all outstanding frames have retired. */
+void ChiSim::ApplyPresentationMode()
+{
+  // Field copies recorded for the current slot go out before slots
+  // are renumbered.
+  SubmitFieldCopies();
+  WaitForTimelineValue(m_graphics_timeline, m_graphics_timeline.last_submitted);
+  UpdateLatencySamples();
+
+  m_presentation_mode = m_requested_presentation_mode;
+  m_frames_in_flight  = std::min<size_t>(GetFramesInFlight(m_presentation_mode),
+                                         MAX_FRAMES_IN_FLIGHT);
+  m_current_frame     = 0;
+
+  recreateSwapChain();
+
+  std::cout << "Presentation mode: "
+            << GetPresentationModeName(m_presentation_mode)
+            << " (" << m_frames_in_flight << " frame(s) in flight, "
+            << m_swap_chain_images.size() << " swap chain images)"
+            << std::endl;
+}
+
+//###################################################################
+/** Hands a frame's camera/UBO sample time to the latency watcher
+ * thread, starting it with the first sample.*/
+void ChiSim::QueueLatencySample(
+  uint64_t timeline_value,
+  std::chrono::high_resolution_clock::time_point sampled)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_latency_mutex);
+    m_latency_samples.push_back({timeline_value, sampled,
+                                 m_presentation_mode});
+  }
+  m_latency_cv.notify_one();
+
+  if (!m_latency_watcher.joinable())
+  {
+    m_latency_stopping = false;
+    m_latency_watcher = std::thread([this]() { LatencyWatcherLoop(); });
+  }
+}
+
+//###################################################################
+/** Latency watcher thread. Blocks on the graphics timeline until the
+ * oldest sample's value is reached and resolves it right then, so the
+ * latency runs from the camera/UBO sample to the frame's completion on
+ * the GPU, excluding only scan-out, and not to whenever the render
+ * loop next polls the timeline. Waits are bounded so stopping is
+ * noticed; once stopping, samples still pending are dropped.*/
+void ChiSim::LatencyWatcherLoop()
+{
+  const uint64_t k_wait_timeout_ns = 100000000; //100 ms
+
+  while (true)
+  {
+    LatencySample sample;
+    {
+      std::unique_lock<std::mutex> lock(m_latency_mutex);
+      m_latency_cv.wait(lock, [this]()
+        { return m_latency_stopping || !m_latency_samples.empty(); });
+      if (m_latency_samples.empty()) return;
+      sample = m_latency_samples.front();
+    }
+
+    VkSemaphoreWaitInfo waitInfo = {};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &m_graphics_timeline.semaphore;
+    waitInfo.pValues = &sample.timeline_value;
+
+    const VkResult result =
+      vkWaitSemaphores(m_device, &waitInfo, k_wait_timeout_ns);
+    const auto reached = std::chrono::high_resolution_clock::now();
+
+    std::lock_guard<std::mutex> lock(m_latency_mutex);
+    if (result == VK_SUCCESS)
+    {
+      m_resolved_latencies.emplace_back(sample.mode,
+        std::chrono::duration<double, std::milli>(
+          reached - sample.sampled).count());
+      m_latency_samples.pop_front();
+    }
+    else if (m_latency_stopping || result != VK_TIMEOUT)
+    {
+      m_latency_samples.clear();
+      return;
+    }
+  }
+}
+
+//###################################################################
+/** Stops the latency watcher thread. Called once the device is idle,
+ * so every sample has been resolved.*/
+void ChiSim::StopLatencyWatcher()
+{
+  if (!m_latency_watcher.joinable()) return;
+
+  {
+    std::lock_guard<std::mutex> lock(m_latency_mutex);
+    m_latency_stopping = true;
+  }
+  m_latency_cv.notify_one();
+  m_latency_watcher.join();
+}
+
+//###################################################################
+/** Folds the latencies resolved by the watcher thread into the
+ * smoothed timings of the mode each frame was drawn in. */
+void ChiSim::UpdateLatencySamples()
+{
+  std::vector<std::pair<PresentationMode, double>> resolved;
+  {
+    std::lock_guard<std::mutex> lock(m_latency_mutex);
+    resolved.swap(m_resolved_latencies);
+  }
+
+  const double alpha = 0.05;
+  for (const auto& latency : resolved)
+  {
+    auto& timings = m_mode_timings[static_cast<size_t>(latency.first)];
+    timings.latency_ms += alpha * (latency.second - timings.latency_ms);
+  }
+}
+
+//###################################################################
+/** Prints the smoothed timings of every mode that was used. */
+void ChiSim::PrintFrameTimings()
+{
+  for (size_t m = 0; m < m_mode_timings.size(); ++m)
+  {
+    const auto& timings = m_mode_timings[m];
+    if (timings.num_frames == 0) continue;
+
+    std::cout << "Frame timings ("
+              << GetPresentationModeName(static_cast<PresentationMode>(m))
+              << ", " << timings.num_frames << " frames): frame "
+              << timings.frame_ms << " ms, latency "
+              << timings.latency_ms << " ms, CPU wait "
+              << timings.cpu_wait_ms << " ms, GPU "
+              << timings.gpu_ms << " ms" << std::endl;
+  }
+
+  const char* recreateMethods[] = {"retired, oldSwapchain",
+                                   "device idle, no oldSwapchain"};
+  for (size_t m = 0; m < m_recreate_timings.size(); ++m)
+  {
+    const auto& timings = m_recreate_timings[m];
+    if (timings.count == 0) continue;
+
+    std::cout << "Swap chain recreations (" << recreateMethods[m] << "): "
+              << timings.count << ", average " << timings.ms_average
+              << " ms (" << timings.idle_ms_average
+              << " ms waiting for idle), max " << timings.ms_max
+              << " ms" << std::endl;
+  }
+
+  PrintVariantTimings();
+  PrintDrawPathTimings();
+  PrintVertexInputTimings();
+  PrintResourceStatistics();
+  PrintAtlasStatistics();
+  PrintReadbackTimings();
+  PrintEncoderTimings();
+  PrintStreamTimings();
+  PrintInSituTimings();
+  PrintSolverRingTimings();
+}
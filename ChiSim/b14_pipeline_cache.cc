@@ -0,0 +1,114 @@
+#include "chi_sim.h"
+
+#include <cstdio>
+#include <filesystem>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+//###################################################################
+/** Checks that previously saved pipeline cache data was produced by
+ * this physical device and driver. Drivers are supposed to reject
+ * foreign data themselves but not all of them do so gracefully.*/
+bool ChiSim::IsPipelineCacheDataValid(const std::vector<char>& data)
+{
+  // VkPipelineCacheHeaderVersionOne: headerSize, headerVersion,
+  // vendorID, deviceID (4 x uint32_t), pipelineCacheUUID.
+  const size_t headerSize = 4 * sizeof(uint32_t) + VK_UUID_SIZE;
+  if (data.size() < headerSize) return false;
+
+  uint32_t header[4];
+  memcpy(header, data.data(), sizeof(header));
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(m_physical_device, &properties);
+
+  if (header[0] < headerSize || header[0] > data.size()) return false;
+  if (header[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) return false;
+  if (header[2] != properties.vendorID) return false;
+  if (header[3] != properties.deviceID) return false;
+
+  return memcmp(data.data() + sizeof(header),
+                properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+//###################################################################
+/** Creates the pipeline cache, seeded from k_pipeline_cache_filename
+ * when a valid file from a previous run exists.*/
+void ChiSim::CreatePipelineCache()
+{
+  std::vector<char> initialData;
+  try
+  {
+    initialData = ReadFileToBuffer(k_pipeline_cache_filename);
+  }
+  catch (const std::runtime_error&) {}
+
+  if (!initialData.empty() && !IsPipelineCacheDataValid(initialData))
+  {
+    std::cout << "Ignoring pipeline cache \"" << k_pipeline_cache_filename
+              << "\", it was created by a different device or driver."
+              << std::endl;
+    initialData.clear();
+  }
+
+  VkPipelineCacheCreateInfo cacheInfo = {};
+  cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  cacheInfo.initialDataSize = initialData.size();
+  cacheInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+
+  if (vkCreatePipelineCache(m_device,
+                            &cacheInfo,
+                            nullptr,
+                            &m_pipeline_cache) != VK_SUCCESS)
+    throw std::runtime_error("failed to create pipeline cache!");
+
+  m_pipeline_cache_warm = !initialData.empty();
+}
+
+//###################################################################
+/** Writes the pipeline cache to k_pipeline_cache_filename. The data is
+ * written to a temporary file which then replaces the old one, so an
+ * interrupted write never leaves a truncated cache behind.*/
+void ChiSim::SavePipelineCache()
+{
+  size_t dataSize = 0;
+  if (vkGetPipelineCacheData(m_device, m_pipeline_cache,
+                             &dataSize, nullptr) != VK_SUCCESS)
+    return;
+
+  std::vector<char> data(dataSize);
+  if (vkGetPipelineCacheData(m_device, m_pipeline_cache,
+                             &dataSize, data.data()) != VK_SUCCESS)
+    return;
+  data.resize(dataSize);
+
+  const std::string tempFilename = k_pipeline_cache_filename + ".tmp";
+
+  FILE* file = std::fopen(tempFilename.c_str(), "wb");
+  if (file == nullptr)
+  {
+    std::cout << "Failed to write pipeline cache \""
+              << tempFilename << "\"." << std::endl;
+    return;
+  }
+
+  bool written = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+  written = written && std::fflush(file) == 0;
+#if defined(__unix__) || defined(__APPLE__)
+  written = written && fsync(fileno(file)) == 0;
+#endif
+  std::fclose(file);
+
+  std::error_code error;
+  if (written)
+    std::filesystem::rename(tempFilename, k_pipeline_cache_filename, error);
+
+  if (!written || error)
+  {
+    std::filesystem::remove(tempFilename, error);
+    std::cout << "Failed to write pipeline cache \""
+              << k_pipeline_cache_filename << "\"." << std::endl;
+  }
+}
@@ -0,0 +1,193 @@
+#include "chi_sim.h"
+
+//###################################################################
+/** Locates the shader directory, configures the compiler cache and
+ * loads the main pipeline's shaders. The directory is taken from the
+ * CHI_SHADER_DIR environment variable, else from the path configured
+ * at build time, else "../shaders" relative to the working directory.
+ * Runs before the descriptor set layouts are created, so bindless
+ * textures can still be turned off when their shader is missing.
+ * When hot reload is enabled the shader files are watched for changes.*/
+void ChiSim::InitializeShaders()
+{
+  if (const char* shaderDir = std::getenv("CHI_SHADER_DIR"))
+    m_shader_directory = shaderDir;
+  else
+  {
+#ifdef CHI_SHADER_DIR
+    m_shader_directory = CHI_SHADER_DIR;
+#else
+    m_shader_directory = "../shaders";
+#endif
+  }
+
+  m_shader_compiler.SetCacheDirectory(k_shader_cache_directory);
+
+  if (m_bindless_supported && !IsShaderAvailable(k_bindless_fragment_shader))
+  {
+    std::cout << "No " << k_bindless_fragment_shader.precompiled
+              << ", textures are bound per draw instead of bindless."
+              << std::endl;
+    m_bindless_supported = false;
+  }
+
+  m_main_vertex_spirv   = LoadShader(k_main_vertex_shader);
+  m_main_fragment_spirv = LoadShader(GetMainFragmentShader());
+
+  // Without it field meshes are uploaded as interleaved vertices.
+  if (IsShaderAvailable(k_pulled_vertex_shader))
+    m_pulled_vertex_spirv = LoadShader(k_pulled_vertex_shader);
+  else
+    std::cout << "No " << k_pulled_vertex_shader.precompiled
+              << ", field meshes are drawn from interleaved vertices."
+              << std::endl;
+
+  if (m_shader_hot_reload)
+    StartShaderHotReload();
+}
+
+//###################################################################
+/** The main fragment shader: the bindless build when the device
+ * supports descriptor indexing.*/
+const ChiSim::ShaderFile& ChiSim::GetMainFragmentShader() const
+{
+  return m_bindless_supported ? k_bindless_fragment_shader :
+                                k_main_fragment_shader;
+}
+
+//###################################################################
+/** Path of the file a shader is loaded from: the GLSL source when it
+ * can be compiled at runtime, otherwise the SPIR-V the build
+ * precompiled from it.*/
+std::string ChiSim::GetShaderPath(const ShaderFile& shader) const
+{
+  const std::string& filename = ChiShaderCompiler::IsAvailable() ?
+                                shader.source : shader.precompiled;
+  return m_shader_directory + "/" + filename;
+}
+
+//###################################################################
+/** Whether a shader can be loaded: always with the runtime compiler,
+ * otherwise if its SPIR-V was built.*/
+bool ChiSim::IsShaderAvailable(const ShaderFile& shader) const
+{
+  return ChiShaderCompiler::IsAvailable() ||
+         std::ifstream(GetShaderPath(shader)).good();
+}
+
+//###################################################################
+/** Returns a shader's SPIR-V. GLSL sources go through the shader
+ * compiler and its on-disk cache.*/
+std::vector<char> ChiSim::LoadShader(const ShaderFile& shader)
+{
+  const std::string path = GetShaderPath(shader);
+
+  if (!ChiShaderCompiler::IsAvailable())
+    return ReadFileToBuffer(path);
+
+  return m_shader_compiler.CompileFile(
+    path,
+    ChiShaderCompiler::GetStageFromFilename(shader.source),
+    shader.defines);
+}
+
+//###################################################################
+/** Watches the main pipeline's shader files. Changed shaders are
+ * recompiled on the watcher thread and handed to the render loop
+ * (see ApplyShaderReloads). Compile errors are reported and the
+ * current pipeline stays in use.*/
+void ChiSim::StartShaderHotReload()
+{
+  m_shader_watcher.Watch(GetShaderPath(k_main_vertex_shader));
+  m_shader_watcher.Watch(GetShaderPath(GetMainFragmentShader()));
+
+  m_shader_watcher.Start([this](const std::string& path)
+  {
+    const bool isVertex = (path == GetShaderPath(k_main_vertex_shader));
+    const ShaderFile& shader = isVertex ? k_main_vertex_shader :
+                                          GetMainFragmentShader();
+
+    std::vector<char> spirv, pulledSpirv;
+    try
+    {
+      spirv = LoadShader(shader);
+      if (isVertex && IsShaderAvailable(k_pulled_vertex_shader))
+        pulledSpirv = LoadShader(k_pulled_vertex_shader);
+    }
+    catch (const std::runtime_error& error)
+    {
+      std::cout << error.what() << std::endl;
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_shader_reload_mutex);
+    if (isVertex)
+    {
+      m_reloaded_vertex_spirv        = std::move(spirv);
+      m_reloaded_pulled_vertex_spirv = std::move(pulledSpirv);
+    }
+    else
+      m_reloaded_fragment_spirv = std::move(spirv);
+  });
+
+  std::cout << "Shader hot reload watching " << m_shader_directory
+            << std::endl;
+}
+
+//###################################################################
+/** Called between frames. Requests a new main pipeline for reloaded
+ * shaders and, once the pipeline manager has it ready, swaps it in.
+ * The old pipeline is retired on the timeline, so no device idle is
+ * needed.*/
+void ChiSim::ApplyShaderReloads()
+{
+  //============================ Request pipeline for new shaders
+  {
+    std::lock_guard<std::mutex> lock(m_shader_reload_mutex);
+    if (!m_reloaded_vertex_spirv.empty() ||
+        !m_reloaded_fragment_spirv.empty())
+    {
+      if (!m_reloaded_vertex_spirv.empty())
+        m_main_vertex_spirv = std::move(m_reloaded_vertex_spirv);
+      if (!m_reloaded_fragment_spirv.empty())
+        m_main_fragment_spirv = std::move(m_reloaded_fragment_spirv);
+      if (!m_reloaded_pulled_vertex_spirv.empty())
+        m_pulled_vertex_spirv = std::move(m_reloaded_pulled_vertex_spirv);
+      m_reloaded_vertex_spirv.clear();
+      m_reloaded_fragment_spirv.clear();
+      m_reloaded_pulled_vertex_spirv.clear();
+
+      if (m_reloading_pipeline != ChiPipelineManager::INVALID_HANDLE)
+        m_pipeline_manager.Release(m_reloading_pipeline);
+
+      m_reloading_pipeline = m_pipeline_manager.RequestGraphicsPipeline(
+        GetMainPipelineDesc(), m_main_pipeline);
+    }
+  }
+
+  if (m_reloading_pipeline == ChiPipelineManager::INVALID_HANDLE) return;
+
+  //============================ Swap once ready
+  if (m_pipeline_manager.HasFailed(m_reloading_pipeline))
+  {
+    std::cout << "Shader reload failed, keeping the current pipeline."
+              << std::endl;
+    m_pipeline_manager.Release(m_reloading_pipeline);
+    m_reloading_pipeline = ChiPipelineManager::INVALID_HANDLE;
+  }
+  else if (m_pipeline_manager.IsUsable(m_reloading_pipeline))
+  {
+    RetireAfter(m_graphics_timeline.last_submitted,
+      [this, pipeline = m_main_pipeline]()
+      { m_pipeline_manager.Release(pipeline); });
+
+    m_main_pipeline = m_reloading_pipeline;
+    m_reloading_pipeline = ChiPipelineManager::INVALID_HANDLE;
+    RetireVariantPipelines();
+    ++m_scene_generation;
+
+    std::cout << "Shaders reloaded, pipeline usable after "
+              << m_pipeline_manager.GetUsableTime(m_main_pipeline)
+              << " ms" << std::endl;
+  }
+}
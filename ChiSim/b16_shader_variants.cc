@@ -0,0 +1,170 @@
+#include "chi_sim.h"
+
+/** Marks a recorded variant key as drawn by the uber-shader.*/
+static const uint32_t UBER_KEY_BIT = 1u << 31;
+/** Position of the draw parameter path in a variant key.*/
+static const uint32_t DRAW_PATH_KEY_SHIFT = 10;
+/** Marks a variant key as the vertex pulling pipeline.*/
+static const uint32_t VERTEX_PULLING_KEY_BIT = 1u << 12;
+
+//###################################################################
+/** Returns the specialized pipeline of a shader variant, requesting it
+ * from the pipeline manager the first time the variant is used.
+ * Variants are deduplicated by key. Until the specialized pipeline is
+ * ready the handle resolves to the uber-shader pipeline, except for
+ * draw parameter paths other than push constants, which the
+ * uber-shader does not read, and for vertex pulling, which has no
+ * uber-shader.*/
+ChiPipelineManager::PipelineHandle ChiSim::
+  GetVariantPipeline(const ShaderVariant& variant,
+                     DrawParameterPath path,
+                     VertexInput input)
+{
+  const bool pulled = input == VertexInput::Pulled;
+  const bool hasFallback = path == DrawParameterPath::PushConstants &&
+                           !pulled;
+  const uint32_t key = variant.GetKey() |
+                       (uint32_t(path) << DRAW_PATH_KEY_SHIFT) |
+                       (pulled ? VERTEX_PULLING_KEY_BIT : 0u);
+
+  auto existing = m_variant_pipelines.find(key);
+  if (existing != m_variant_pipelines.end()) return existing->second;
+
+  ChiPipelineManager::GraphicsPipelineDesc desc = GetMainPipelineDesc();
+  desc.name = "main_variant_" + std::to_string(key);
+  desc.specialization_constants = variant.GetSpecializationConstants(false);
+  desc.specialization_constants.push_back(uint32_t(path));
+
+  // Pulled vertices are fetched from storage buffers; there is no
+  // fixed-function vertex input.
+  if (pulled)
+  {
+    desc.vertex_spirv = m_pulled_vertex_spirv;
+    desc.vertex_bindings.clear();
+    desc.vertex_attributes.clear();
+  }
+
+  auto handle = m_pipeline_manager.RequestGraphicsPipeline(
+    desc,
+    hasFallback ? m_main_pipeline : ChiPipelineManager::INVALID_HANDLE);
+  m_variant_pipelines[key] = handle;
+
+  return handle;
+}
+
+//###################################################################
+/** Hands all variant pipelines to the retire queue, e.g. because the
+ * shaders or the render pass changed. They are requested again on
+ * next use.*/
+void ChiSim::RetireVariantPipelines()
+{
+  for (const auto& variant : m_variant_pipelines)
+    RetireAfter(m_graphics_timeline.last_submitted,
+      [this, pipeline = variant.second]()
+      { m_pipeline_manager.Release(pipeline); });
+
+  m_variant_pipelines.clear();
+}
+
+//###################################################################
+/** Chooses the pipeline of the main pass: the specialized pipeline of
+ * the current variant once it is compiled, otherwise the uber-shader.
+ * `variant_key` receives the variant key, flagged when the uber-shader
+ * is used, for attributing GPU time.*/
+VkPipeline ChiSim::SelectMainPassPipeline(uint32_t& variant_key)
+{
+  variant_key = m_shader_variant.GetKey();
+
+  // The uber-shader reads push constants, so the other draw parameter
+  // paths always need their specialized pipeline and wait for it on
+  // first use.
+  if (m_draw_parameter_path != DrawParameterPath::PushConstants)
+  {
+    auto handle = GetVariantPipeline(m_shader_variant,
+                                     m_draw_parameter_path);
+    m_pipeline_manager.WaitUntilUsable(handle);
+
+    variant_key |= uint32_t(m_draw_parameter_path) << DRAW_PATH_KEY_SHIFT;
+    return m_pipeline_manager.GetPipeline(handle);
+  }
+
+  if (m_use_specialized_variants)
+  {
+    auto handle = GetVariantPipeline(m_shader_variant);
+    if (m_pipeline_manager.IsUsable(handle))
+      return m_pipeline_manager.GetPipeline(handle);
+  }
+
+  variant_key |= UBER_KEY_BIT;
+  return m_pipeline_manager.GetPipeline(m_main_pipeline);
+}
+
+//###################################################################
+/** Chooses the pipeline for the pulled meshes of the main pass: the
+ * specialized vertex pulling pipeline of the current variant and draw
+ * parameter path, waited for on first use. `variant_key` is flagged as
+ * drawing pulled meshes.*/
+VkPipeline ChiSim::SelectPulledPipeline(uint32_t& variant_key)
+{
+  auto handle = GetVariantPipeline(m_shader_variant,
+                                   m_draw_parameter_path,
+                                   VertexInput::Pulled);
+  m_pipeline_manager.WaitUntilUsable(handle);
+
+  variant_key |= VERTEX_PULLING_KEY_BIT;
+  return m_pipeline_manager.GetPipeline(handle);
+}
+
+//###################################################################
+/** Attributes a frame's GPU time to the variant its command buffer was
+ * recorded with.*/
+void ChiSim::UpdateVariantTimings(uint32_t image_index, double gpu_ms)
+{
+  const uint32_t recordedKey = m_command_buffer_variant_keys[image_index];
+  auto& timings = m_variant_timings[recordedKey & ~UBER_KEY_BIT];
+
+  double& average = (recordedKey & UBER_KEY_BIT) ?
+                    timings.uber_gpu_ms : timings.specialized_gpu_ms;
+  size_t& frames  = (recordedKey & UBER_KEY_BIT) ?
+                    timings.uber_frames : timings.specialized_frames;
+
+  ++frames;
+  average += (gpu_ms - average) / double(frames);
+}
+
+//###################################################################
+/** Prints the GPU cost of each variant drawn during the run, with the
+ * uber-shader and specialized. The per-fragment cost is approximated
+ * by the GPU time per framebuffer pixel.*/
+void ChiSim::PrintVariantTimings()
+{
+  const double pixels = double(m_swap_chain_extent.width) *
+                        double(m_swap_chain_extent.height);
+
+  for (const auto& entry : m_variant_timings)
+  {
+    const uint32_t key = entry.first;
+    const VariantTimings& timings = entry.second;
+
+    std::cout << "Variant (texture " << (key & 1u)
+              << ", colormap " << ((key >> 1) & 7u)
+              << ", clip planes " << ((key >> 4) & 15u)
+              << ", lighting " << ((key >> 8) & 3u)
+              << ", draw parameters "
+              << GetDrawParameterPathName(static_cast<DrawParameterPath>(
+                   (key >> DRAW_PATH_KEY_SHIFT) & 3u))
+              << ((key & VERTEX_PULLING_KEY_BIT) ? ", vertex pulling" : "")
+              << "):";
+
+    if (timings.uber_frames > 0)
+      std::cout << " uber " << timings.uber_gpu_ms << " ms ("
+                << timings.uber_gpu_ms * 1.0e6 / pixels << " ns/pixel, "
+                << timings.uber_frames << " frames)";
+    if (timings.specialized_frames > 0)
+      std::cout << " specialized " << timings.specialized_gpu_ms << " ms ("
+                << timings.specialized_gpu_ms * 1.0e6 / pixels
+                << " ns/pixel, " << timings.specialized_frames << " frames)";
+
+    std::cout << std::endl;
+  }
+}
@@ -0,0 +1,294 @@
+#include "chi_sim.h"
+
+#include <cmath>
+
+//###################################################################
+/** Adds a draw of a mesh with default draw parameters.*/
+size_t ChiSim::AddDraw(MeshID mesh_id, const glm::mat4& model)
+{
+  return AddDraw(mesh_id, model, DrawParameters());
+}
+
+//###################################################################
+/** Adds a draw of a mesh with its own model matrix. The returned index
+ * is the draw's position in the draw list. Draws of pulled meshes carry
+ * the mesh's first vertex in their parameters.*/
+size_t ChiSim::AddDraw(MeshID mesh_id,
+                       const glm::mat4& model,
+                       DrawParameters parameters)
+{
+  if (m_draws.size() >= k_max_draws)
+    throw std::runtime_error("failed to add draw, draw list is full!");
+
+  parameters.model_index = (uint32_t) m_model_matrices.size();
+  parameters.vertex_offset = m_meshes[mesh_id].pulled ?
+                             uint32_t(m_meshes[mesh_id].vertex_offset) : 0;
+  m_model_matrices.push_back(model);
+  m_draws.push_back({mesh_id, parameters});
+
+  ++m_scene_generation;
+
+  return m_draws.size() - 1;
+}
+
+//###################################################################
+/** Removes all draws. Meshes stay uploaded.*/
+void ChiSim::ClearDraws()
+{
+  m_draws.clear();
+  m_model_matrices.clear();
+
+  ++m_scene_generation;
+}
+
+//###################################################################
+/** Builds the draw benchmark: a square grid of k_benchmark_draws small
+ * copies of the first drawn mesh, with parameters varying per draw so
+ * every draw really needs its own values. With bindless textures the
+ * draws also cycle through k_benchmark_textures textures.*/
+void ChiSim::BuildBenchmarkDraws()
+{
+  if (m_draws.empty())
+    throw std::runtime_error("failed to build draw benchmark, no meshes!");
+
+  if (m_bindless_supported && m_benchmark_textures.empty())
+    CreateBenchmarkTextures();
+
+  const MeshID mesh = m_draws.front().mesh;
+  const uint32_t gridSize =
+    (uint32_t) std::ceil(std::sqrt(double(k_benchmark_draws)));
+  const float spacing = 2.0f / float(gridSize);
+
+  m_benchmark_draws.clear();
+  m_benchmark_model_matrices.clear();
+  for (uint32_t d = 0; d < k_benchmark_draws; ++d)
+  {
+    glm::vec3 position(-1.0f + spacing * (float(d % gridSize) + 0.5f),
+                       -1.0f + spacing * (float(d / gridSize) + 0.5f),
+                       0.0f);
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), position);
+    model = glm::scale(model, glm::vec3(0.9f * spacing));
+
+    DrawParameters parameters;
+    parameters.model_index = d;
+    parameters.field_id = d % 4;
+    parameters.colormap_range = (parameters.field_id == 0) ?
+                                glm::vec2(0.0f, 1.0f) :
+                                glm::vec2(-0.5f, 0.5f);
+    parameters.clip_flags = d % 16;
+    parameters.texture_index = m_benchmark_textures.empty() ?
+      m_texture.slot :
+      m_benchmark_textures[d % m_benchmark_textures.size()].slot;
+
+    m_benchmark_model_matrices.push_back(model);
+    m_benchmark_draws.push_back({mesh, parameters});
+  }
+}
+
+//###################################################################
+/** The full draw list: the draw benchmark's if enabled,
+ * else the vertex pulling benchmark's, otherwise the scene's.*/
+const std::vector<ChiSim::DrawCommand>& ChiSim::GetSceneDraws()
+{
+  if (m_draw_benchmark)
+  {
+    if (m_benchmark_draws.empty()) BuildBenchmarkDraws();
+    return m_benchmark_draws;
+  }
+
+  if (m_pulling_benchmark)
+  {
+    if (m_pulling_benchmark_model_matrices.empty()) BuildPullingBenchmark();
+    return m_pulling_benchmark_draws[
+      static_cast<size_t>(m_pulling_benchmark_input)];
+  }
+
+  return m_draws;
+}
+
+//###################################################################
+/** The draws this process renders: all of the scene's draws, or when
+ * compositing, the contiguous block of them belonging to this
+ * process's rank. Blocks keep the scene's draw order, so compositing
+ * them in rank order reproduces the draw order of a single process.*/
+const std::vector<ChiSim::DrawCommand>& ChiSim::GetActiveDraws()
+{
+  const auto& draws = GetSceneDraws();
+  if (m_composite_size <= 1) return draws;
+
+  const size_t first = draws.size() * m_composite_rank / m_composite_size;
+  const size_t last = draws.size() * (m_composite_rank + 1) / m_composite_size;
+
+  m_partition_draws.assign(draws.begin() + first, draws.begin() + last);
+  return m_partition_draws;
+}
+
+//###################################################################
+/** The model matrices indexed by GetActiveDraws.*/
+const std::vector<glm::mat4>& ChiSim::GetActiveModelMatrices()
+{
+  if (m_draw_benchmark)
+  {
+    if (m_benchmark_draws.empty()) BuildBenchmarkDraws();
+    return m_benchmark_model_matrices;
+  }
+
+  if (m_pulling_benchmark)
+  {
+    if (m_pulling_benchmark_model_matrices.empty()) BuildPullingBenchmark();
+    return m_pulling_benchmark_model_matrices;
+  }
+
+  return m_model_matrices;
+}
+
+//###################################################################
+/** Writes the model matrices of an image and the draw parameters of
+ * the buffer based paths: for dynamic uniforms every draw's parameters
+ * at its aligned offset, for indirect draws the tightly packed
+ * parameters and the indirect commands, indexed ones first and those
+ * of pulled meshes after them. Push constants need no buffer writes;
+ * they are part of the recorded commands.*/
+void ChiSim::WriteDrawParameters(uint32_t image_index)
+{
+  const auto& modelMatrices = GetActiveModelMatrices();
+  if (!modelMatrices.empty())
+  {
+    void* data;
+    vkMapMemory(m_device,
+                m_model_matrix_buffers_memory[image_index],
+                0, modelMatrices.size() * sizeof(glm::mat4), 0, &data);
+    memcpy(data, modelMatrices.data(),
+           modelMatrices.size() * sizeof(glm::mat4));
+    vkUnmapMemory(m_device, m_model_matrix_buffers_memory[image_index]);
+  }
+
+  const auto& draws = GetActiveDraws();
+  if (draws.empty()) return;
+
+  void* data;
+  if (m_draw_parameter_path == DrawParameterPath::Indirect)
+  {
+    vkMapMemory(m_device,
+                m_draw_parameter_buffers_memory[image_index],
+                0, draws.size() * sizeof(DrawParameters), 0, &data);
+    for (size_t d = 0; d < draws.size(); ++d)
+      memcpy(static_cast<DrawParameters*>(data) + d,
+             &draws[d].parameters, sizeof(DrawParameters));
+    vkUnmapMemory(m_device, m_draw_parameter_buffers_memory[image_index]);
+
+    std::vector<VkDrawIndexedIndirectCommand> commands;
+    std::vector<VkDrawIndirectCommand> pulledCommands;
+    BuildIndirectCommands(commands, pulledCommands);
+    if (commands.empty() && pulledCommands.empty()) return;
+
+    const VkDeviceSize commandsSize =
+      commands.size() * sizeof(VkDrawIndexedIndirectCommand);
+    const VkDeviceSize pulledCommandsSize =
+      pulledCommands.size() * sizeof(VkDrawIndirectCommand);
+    vkMapMemory(m_device,
+                m_indirect_buffers_memory[image_index],
+                0, commandsSize + pulledCommandsSize, 0, &data);
+    memcpy(data, commands.data(), commandsSize);
+    memcpy(static_cast<char*>(data) + commandsSize,
+           pulledCommands.data(), pulledCommandsSize);
+    vkUnmapMemory(m_device, m_indirect_buffers_memory[image_index]);
+    return;
+  }
+
+  if (m_draw_parameter_path != DrawParameterPath::DynamicUniforms) return;
+
+  vkMapMemory(m_device,
+              m_draw_uniform_buffers_memory[image_index],
+              0, draws.size() * m_draw_uniform_stride, 0, &data);
+  for (size_t d = 0; d < draws.size(); ++d)
+    memcpy(static_cast<char*>(data) + d * m_draw_uniform_stride,
+           &draws[d].parameters, sizeof(DrawParameters));
+  vkUnmapMemory(m_device, m_draw_uniform_buffers_memory[image_index]);
+}
+
+//###################################################################
+/** One indirect command per active draw: indexed for interleaved
+ * meshes, non-indexed for pulled meshes, whose firstVertex is the
+ * mesh's first index into the connectivity. firstInstance carries the
+ * draw's index, which the shaders use to find its parameters.*/
+void ChiSim::BuildIndirectCommands(
+  std::vector<VkDrawIndexedIndirectCommand>& commands,
+  std::vector<VkDrawIndirectCommand>& pulled_commands)
+{
+  const auto& draws = GetActiveDraws();
+
+  commands.clear();
+  commands.reserve(draws.size());
+  pulled_commands.clear();
+  for (size_t d = 0; d < draws.size(); ++d)
+  {
+    const auto& mesh = m_meshes[draws[d].mesh];
+    if (!mesh.active) continue;
+
+    if (mesh.pulled)
+    {
+      VkDrawIndirectCommand command = {};
+      command.vertexCount = mesh.index_count;
+      command.instanceCount = 1;
+      command.firstVertex = mesh.first_index;
+      command.firstInstance = (uint32_t) d;
+      pulled_commands.push_back(command);
+      continue;
+    }
+
+    VkDrawIndexedIndirectCommand command = {};
+    command.indexCount = mesh.index_count;
+    command.instanceCount = 1;
+    command.firstIndex = mesh.first_index;
+    command.vertexOffset = mesh.vertex_offset;
+    command.firstInstance = (uint32_t) d;
+    commands.push_back(command);
+  }
+}
+
+//###################################################################
+/** Attributes a frame's GPU time to the draw parameter path its
+ * command buffer was recorded with, if it was a benchmark frame.*/
+void ChiSim::UpdateDrawPathTimings(uint32_t image_index, double gpu_ms)
+{
+  const auto& recordedPath = m_command_buffer_draw_paths[image_index];
+  if (!recordedPath.has_value()) return;
+
+  auto& timings = m_draw_path_timings[static_cast<size_t>(*recordedPath)];
+  ++timings.frames;
+  timings.gpu_ms += (gpu_ms - timings.gpu_ms) / double(timings.frames);
+}
+
+//###################################################################
+/** Prints the recording and GPU cost of each draw parameter path
+ * measured with the draw benchmark.*/
+void ChiSim::PrintDrawPathTimings()
+{
+  for (size_t p = 0; p < m_draw_path_timings.size(); ++p)
+  {
+    const auto& timings = m_draw_path_timings[p];
+    if (timings.recordings == 0 && timings.frames == 0) continue;
+
+    std::cout << "Draw parameters ("
+              << GetDrawParameterPathName(static_cast<DrawParameterPath>(p))
+              << ", "
+              << k_benchmark_draws << " draws): record "
+              << timings.record_ms << " ms (" << timings.recordings
+              << " recordings), GPU " << timings.gpu_ms << " ms ("
+              << timings.frames << " frames)" << std::endl;
+  }
+}
+
+//###################################################################
+/** Name of a draw parameter path for printing.*/
+const char* ChiSim::GetDrawParameterPathName(DrawParameterPath path)
+{
+  switch (path)
+  {
+    case DrawParameterPath::PushConstants:   return "push constants";
+    case DrawParameterPath::DynamicUniforms: return "dynamic uniforms";
+    case DrawParameterPath::Indirect:        return "indirect";
+  }
+  return "unknown";
+}
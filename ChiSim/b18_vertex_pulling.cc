@@ -0,0 +1,154 @@
+#include "chi_sim.h"
+
+#include <cmath>
+
+//###################################################################
+/** Builds the vertex pulling benchmark: a structured solver grid of
+ * k_pulling_benchmark_grid^2 vertices with a smooth scalar field, in
+ * the structure-of-arrays form a solver produces. It is uploaded twice,
+ * once re-interleaved into ChiSim::Vertex and once as-is for vertex
+ * pulling, and the time of each upload is recorded. Both meshes show
+ * the field as color luminance, so they render identically.*/
+void ChiSim::BuildPullingBenchmark()
+{
+  const uint32_t n = k_pulling_benchmark_grid;
+  const float spacing = 1.0f / float(n - 1);
+  const float pi = 3.14159265f;
+
+  //============================ Solver arrays
+  std::vector<float>    coordinates;
+  std::vector<float>    fieldValues;
+  std::vector<uint32_t> connectivity;
+  coordinates.reserve(3 * n * n);
+  fieldValues.reserve(n * n);
+  connectivity.reserve(6 * (n - 1) * (n - 1));
+
+  for (uint32_t j = 0; j < n; ++j)
+    for (uint32_t i = 0; i < n; ++i)
+    {
+      const float x = -0.5f + spacing * float(i);
+      const float y = -0.5f + spacing * float(j);
+      coordinates.push_back(x);
+      coordinates.push_back(y);
+      coordinates.push_back(0.0f);
+      fieldValues.push_back(0.5f + 0.5f * std::sin(6.0f * pi * x) *
+                                          std::cos(6.0f * pi * y));
+    }
+
+  for (uint32_t j = 0; j + 1 < n; ++j)
+    for (uint32_t i = 0; i + 1 < n; ++i)
+    {
+      const uint32_t v = j * n + i;
+      connectivity.insert(connectivity.end(),
+                          {v, v + 1, v + n + 1, v + n + 1, v + n, v});
+    }
+
+  //============================ Interleaved upload
+  auto start = std::chrono::high_resolution_clock::now();
+
+  MeshID interleavedMesh = UploadMesh(
+    InterleaveFieldMesh(coordinates.data(), fieldValues.size(),
+                        fieldValues.data()),
+    connectivity);
+
+  auto end = std::chrono::high_resolution_clock::now();
+  m_vertex_input_timings[0].upload_ms =
+    std::chrono::duration<double, std::milli>(end - start).count();
+
+  DrawParameters parameters;
+  parameters.model_index = 0;
+  parameters.texture_index = m_texture.slot;
+
+  m_pulling_benchmark_model_matrices = {glm::mat4(1.0f)};
+  m_pulling_benchmark_draws[0] = {{interleavedMesh, parameters}};
+
+  if (!IsVertexPullingAvailable())
+  {
+    std::cout << "Vertex pulling unavailable, the benchmark draws "
+                 "interleaved vertices only." << std::endl;
+    m_pulling_benchmark_draws[1] = m_pulling_benchmark_draws[0];
+    return;
+  }
+
+  //============================ Pulled upload
+  start = std::chrono::high_resolution_clock::now();
+
+  MeshID pulledMesh = UploadFieldMesh(coordinates, connectivity, fieldValues);
+
+  end = std::chrono::high_resolution_clock::now();
+  m_vertex_input_timings[1].upload_ms =
+    std::chrono::duration<double, std::milli>(end - start).count();
+
+  parameters.vertex_offset = uint32_t(m_meshes[pulledMesh].vertex_offset);
+  m_pulling_benchmark_draws[1] = {{pulledMesh, parameters}};
+}
+
+//###################################################################
+/** Attributes a frame's GPU time to the vertex input its command buffer
+ * was recorded with, if it was a vertex pulling benchmark frame.*/
+void ChiSim::UpdateVertexInputTimings(uint32_t image_index, double gpu_ms)
+{
+  const auto& recordedInput = m_command_buffer_vertex_inputs[image_index];
+  if (!recordedInput.has_value()) return;
+
+  auto& timings = m_vertex_input_timings[static_cast<size_t>(*recordedInput)];
+  ++timings.frames;
+  timings.gpu_ms += (gpu_ms - timings.gpu_ms) / double(timings.frames);
+}
+
+//###################################################################
+/** Prints the upload and GPU cost of each vertex input measured with
+ * the vertex pulling benchmark.*/
+void ChiSim::PrintVertexInputTimings()
+{
+  if (m_pulling_benchmark_model_matrices.empty()) return;
+
+  const uint32_t numVertices =
+    k_pulling_benchmark_grid * k_pulling_benchmark_grid;
+
+  for (size_t v = 0; v < m_vertex_input_timings.size(); ++v)
+  {
+    if (static_cast<VertexInput>(v) == VertexInput::Pulled &&
+        !IsVertexPullingAvailable()) continue;
+
+    const auto& timings = m_vertex_input_timings[v];
+
+    std::cout << "Vertex input ("
+              << GetVertexInputName(static_cast<VertexInput>(v))
+              << ", " << numVertices << " vertices): upload "
+              << timings.upload_ms << " ms, GPU " << timings.gpu_ms
+              << " ms (" << timings.frames << " frames)" << std::endl;
+  }
+}
+
+//###################################################################
+/** Interleaves a solver's arrays into vertices for the classic vertex
+ * input, the field as the color's luminance like the pulled vertex
+ * shader shows it.*/
+std::vector<ChiSim::Vertex> ChiSim::InterleaveFieldMesh(
+  const float* coordinates, size_t num_vertices, const float* field_values)
+{
+  std::vector<Vertex> interleaved(num_vertices);
+  for (size_t v = 0; v < num_vertices; ++v)
+  {
+    interleaved[v].pos = glm::vec3(coordinates[3 * v + 0],
+                                   coordinates[3 * v + 1],
+                                   coordinates[3 * v + 2]);
+    interleaved[v].color = glm::vec3(field_values[v]);
+    interleaved[v].texCoord = glm::vec2(coordinates[3 * v + 0] + 0.5f,
+                                        coordinates[3 * v + 1] + 0.5f);
+  }
+  return interleaved;
+}
+
+//###################################################################
+/** Name of a vertex input for printing.*/
+const char* ChiSim::GetVertexInputName(VertexInput input)
+{
+  switch (input)
+  {
+    case VertexInput::Interleaved: return "interleaved";
+    case VertexInput::Pulled:      return "pulled";
+  }
+  return "unknown";
+}
@@ -0,0 +1,64 @@
+#include "chi_sim.h"
+
+//###################################################################
+/** Creates the offscreen color images that stand in for the swap chain
+ * images in headless mode. Everything downstream (render pass,
+ * framebuffers, render graph, command buffers) uses them like swap
+ * chain images. Every frame is captured through the readback ring.*/
+void ChiSim::CreateOffscreenTargets()
+{
+  m_swap_chain_image_format = k_offscreen_format;
+  m_swap_chain_extent = {static_cast<uint32_t>(WIDTH),
+                         static_cast<uint32_t>(HEIGHT)};
+
+  m_swap_chain_images.resize(k_offscreen_images);
+  m_offscreen_image_memory.resize(k_offscreen_images);
+  m_swap_chain_image_views.resize(k_offscreen_images);
+
+  for (uint32_t i = 0; i < k_offscreen_images; ++i)
+  {
+    CreateImage(m_swap_chain_extent.width,
+                m_swap_chain_extent.height,
+                m_swap_chain_image_format,
+                VK_IMAGE_TILING_OPTIMAL,
+                VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                m_swap_chain_images[i],
+                m_offscreen_image_memory[i]);
+
+    m_swap_chain_image_views[i] =
+      CreateImageView(m_swap_chain_images[i], m_swap_chain_image_format);
+  }
+
+  m_image_timeline_values.resize(m_swap_chain_images.size(), 0);
+
+  m_readback_supported = true;
+}
+
+//###################################################################
+/** Hands out the offscreen images in turn, in place of
+ * vkAcquireNextImageKHR. The caller still waits for the image's last
+ * submission before reusing it.*/
+VkResult ChiSim::AcquireOffscreenImage(uint32_t& image_index)
+{
+  image_index = m_next_offscreen_image;
+  m_next_offscreen_image =
+    (m_next_offscreen_image + 1) % uint32_t(m_swap_chain_images.size());
+
+  return VK_SUCCESS;
+}
+
+//###################################################################
+/** Destroys the offscreen images. Their views go with the swap chain
+ * image views (see cleanupSwapChain). Only called once the device is
+ * idle.*/
+void ChiSim::DestroyOffscreenTargets()
+{
+  for (size_t i = 0; i < m_offscreen_image_memory.size(); ++i)
+  {
+    vkDestroyImage(m_device, m_swap_chain_images[i], nullptr);
+    vkFreeMemory(m_device, m_offscreen_image_memory[i], nullptr);
+  }
+  m_offscreen_image_memory.clear();
+}
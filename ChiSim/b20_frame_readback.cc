@@ -0,0 +1,309 @@
+#include "chi_sim.h"
+
+//###################################################################
+/** Creates the readback ring: one host visible, persistently mapped
+ * buffer per swap chain image, each large enough for a full frame.
+ *
+ * A frame's copy is recorded into its own command buffer and so lands
+ * in the slot of its swap chain image. The slot is consumed once the
+ * graphics timeline passes the frame's submission, which is at the
+ * latest when the image comes round again, so the render loop never
+ * waits on a readback. Host cached memory is preferred since the CPU
+ * reads every byte; it is invalidated before each read. With depth
+ * readback each slot has a second buffer for the depth aspect, which
+ * copies out at 4 bytes per pixel for every depth format.*/
+void ChiSim::CreateReadbackRing()
+{
+  if (!m_readback_supported) return;
+
+  const VkDeviceSize frameSize =
+    VkDeviceSize(m_swap_chain_extent.width) * m_swap_chain_extent.height * 4;
+
+  VkPhysicalDeviceMemoryProperties memProperties;
+  vkGetPhysicalDeviceMemoryProperties(m_physical_device, &memProperties);
+
+  const VkMemoryPropertyFlags cachedProperties =
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+  VkMemoryPropertyFlags properties =
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
+    if ((memProperties.memoryTypes[i].propertyFlags & cachedProperties) ==
+        cachedProperties)
+    {
+      properties = cachedProperties;
+      break;
+    }
+
+  m_readback_slots.resize(m_swap_chain_images.size());
+  for (auto& slot : m_readback_slots)
+  {
+    CreateBuffer(frameSize,
+                 VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 properties,
+                 slot.buffer,
+                 slot.memory);
+
+    if (vkMapMemory(m_device, slot.memory, 0, VK_WHOLE_SIZE, 0,
+                    &slot.mapped) != VK_SUCCESS)
+      throw std::runtime_error("failed to map readback buffer!");
+
+    if (!m_readback_depth) continue;
+
+    CreateBuffer(frameSize,
+                 VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 properties,
+                 slot.depth_buffer,
+                 slot.depth_memory);
+
+    if (vkMapMemory(m_device, slot.depth_memory, 0, VK_WHOLE_SIZE, 0,
+                    &slot.depth_mapped) != VK_SUCCESS)
+      throw std::runtime_error("failed to map depth readback buffer!");
+  }
+}
+
+//###################################################################
+/** Records the copy of the swap chain image currently being recorded
+ * into its readback slot, followed by the barrier that makes the copy
+ * visible to host reads once the submission's timeline value is
+ * reached, and likewise for the depth image with depth readback.
+ * Nothing is recorded while capture is off. The render graph has
+ * already put the images in transfer source layout.*/
+void ChiSim::RecordReadbackCopy(VkCommandBuffer cmd_buffer)
+{
+  const size_t i = m_rg_recording_image;
+  if (!m_capture_enabled || i >= m_readback_slots.size()) return;
+
+  const ReadbackSlot& slot = m_readback_slots[i];
+
+  VkBufferImageCopy region = {};
+  region.bufferOffset = 0;
+  region.bufferRowLength = 0;
+  region.bufferImageHeight = 0;
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.mipLevel = 0;
+  region.imageSubresource.baseArrayLayer = 0;
+  region.imageSubresource.layerCount = 1;
+  region.imageOffset = {0, 0, 0};
+  region.imageExtent = {m_swap_chain_extent.width,
+                        m_swap_chain_extent.height,
+                        1};
+
+  vkCmdCopyImageToBuffer(cmd_buffer,
+                         m_swap_chain_images[i],
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                         slot.buffer,
+                         1,
+                         &region);
+
+  std::array<VkBufferMemoryBarrier, 2> barriers = {};
+  barriers[0].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barriers[0].dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[0].buffer = slot.buffer;
+  barriers[0].offset = 0;
+  barriers[0].size = VK_WHOLE_SIZE;
+  uint32_t numBarriers = 1;
+
+  if (slot.depth_buffer != VK_NULL_HANDLE)
+  {
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    vkCmdCopyImageToBuffer(cmd_buffer,
+                           m_depth_image,
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           slot.depth_buffer,
+                           1,
+                           &region);
+
+    barriers[1] = barriers[0];
+    barriers[1].buffer = slot.depth_buffer;
+    numBarriers = 2;
+  }
+
+  vkCmdPipelineBarrier(cmd_buffer,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT,
+                       0,
+                       0, nullptr,
+                       numBarriers, barriers.data(),
+                       0, nullptr);
+
+  m_command_buffer_captures[i] = true;
+}
+
+//###################################################################
+/** Queues the readback of a submitted frame whose command buffer
+ * copied into its slot.*/
+void ChiSim::SubmitReadback(uint32_t image_index, uint64_t timeline_value)
+{
+  PendingReadback pending;
+  pending.slot           = m_readback_slots[image_index];
+  pending.extent         = m_swap_chain_extent;
+  pending.format         = m_swap_chain_image_format;
+  pending.depth_format   = m_readback_depth ? FindDepthFormat() :
+                                              VK_FORMAT_UNDEFINED;
+  pending.frame_number   = m_num_readback_frames++;
+  pending.timeline_value = timeline_value;
+  pending.submitted      = std::chrono::high_resolution_clock::now();
+
+  m_pending_readbacks.push_back(pending);
+}
+
+//###################################################################
+/** Hands every readback whose frame has completed on the GPU to the
+ * readback callback, or the frame encoder if none is set, oldest first,
+ * without waiting for the others.*/
+void ChiSim::ConsumeCompletedReadbacks()
+{
+  if (m_pending_readbacks.empty()) return;
+
+  const uint64_t completed = GetCompletedTimelineValue(m_graphics_timeline);
+
+  while (!m_pending_readbacks.empty() &&
+         m_pending_readbacks.front().timeline_value <= completed)
+  {
+    const PendingReadback pending = m_pending_readbacks.front();
+    m_pending_readbacks.pop_front();
+
+    std::array<VkMappedMemoryRange, 2> ranges = {};
+    ranges[0].sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    ranges[0].memory = pending.slot.memory;
+    ranges[0].offset = 0;
+    ranges[0].size = VK_WHOLE_SIZE;
+    ranges[1] = ranges[0];
+    ranges[1].memory = pending.slot.depth_memory;
+    vkInvalidateMappedMemoryRanges(
+      m_device, pending.slot.depth_memory != VK_NULL_HANDLE ? 2 : 1,
+      ranges.data());
+
+    //============================ Latency
+    double latencyMs = std::chrono::duration<double, std::milli>(
+      std::chrono::high_resolution_clock::now() - pending.submitted).count();
+    double latencyFrames =
+      double(m_num_readback_frames - 1 - pending.frame_number);
+
+    auto& timings = m_readback_timings;
+    ++timings.frames;
+    timings.latency_ms +=
+      (latencyMs - timings.latency_ms) / double(timings.frames);
+    timings.latency_frames +=
+      (latencyFrames - timings.latency_frames) / double(timings.frames);
+
+    //============================ Hand over
+    ReadbackFrame frame;
+    frame.frame_number = pending.frame_number;
+    frame.width        = pending.extent.width;
+    frame.height       = pending.extent.height;
+    frame.format       = pending.format;
+    frame.pixels       = pending.slot.mapped;
+    frame.depth_format = pending.depth_format;
+    frame.depth        = pending.slot.depth_mapped;
+
+    if (m_readback_callback) m_readback_callback(frame);
+    else                     EncodeFrame(frame);
+  }
+}
+
+//###################################################################
+/** Accumulates a frame's time under frames drawn with or without
+ * capture, so the sustained cost of readback can be compared.*/
+void ChiSim::UpdateReadbackFrameTime(bool captured, double frame_ms)
+{
+  if (!m_readback_supported) return;
+
+  auto& timings = m_readback_timings;
+  const size_t c = captured ? 1 : 0;
+  ++timings.num_frames[c];
+  timings.frame_ms[c] +=
+    (frame_ms - timings.frame_ms[c]) / double(timings.num_frames[c]);
+}
+
+//###################################################################
+/** Prints the readback latency and the frame time with and without
+ * capture.*/
+void ChiSim::PrintReadbackTimings()
+{
+  const auto& timings = m_readback_timings;
+  if (timings.frames == 0) return;
+
+  std::cout << "Frame readback (" << timings.frames << " frames): latency "
+            << timings.latency_ms << " ms, "
+            << timings.latency_frames << " frames" << std::endl;
+
+  const char* names[] = {"without capture", "with capture"};
+  for (size_t c = 0; c < 2; ++c)
+    if (timings.num_frames[c] > 0)
+      std::cout << "Frame time " << names[c] << " ("
+                << timings.num_frames[c] << " frames): "
+                << timings.frame_ms[c] << " ms, "
+                << 1000.0 / timings.frame_ms[c] << " fps" << std::endl;
+}
+
+//###################################################################
+/** Hands the readback ring to the retire queue. Frames still pending
+ * in it are consumed before it is destroyed.*/
+void ChiSim::RetireReadbackRing()
+{
+  if (m_readback_slots.empty()) return;
+
+  RetireAfter(m_graphics_timeline.last_submitted,
+    [this, slots = m_readback_slots]()
+    {
+      ConsumeCompletedReadbacks();
+
+      for (const auto& slot : slots)
+      {
+        vkDestroyBuffer(m_device, slot.buffer, nullptr);
+        vkFreeMemory(m_device, slot.memory, nullptr);
+        vkDestroyBuffer(m_device, slot.depth_buffer, nullptr);
+        vkFreeMemory(m_device, slot.depth_memory, nullptr);
+      }
+    });
+
+  m_readback_slots.clear();
+}
+
+//###################################################################
+/** Consumes the frames still pending and destroys the readback ring.
+ * Only called once the device is idle.*/
+void ChiSim::DestroyReadbackRing()
+{
+  ConsumeCompletedReadbacks();
+
+  for (const auto& slot : m_readback_slots)
+  {
+    vkDestroyBuffer(m_device, slot.buffer, nullptr);
+    vkFreeMemory(m_device, slot.memory, nullptr);
+    vkDestroyBuffer(m_device, slot.depth_buffer, nullptr);
+    vkFreeMemory(m_device, slot.depth_memory, nullptr);
+  }
+  m_readback_slots.clear();
+}
+
+//###################################################################
+/** Converts the depth of a frame read back with depth readback to
+ * floats in [0, 1], one per pixel. 24 bit depth is stored in the low
+ * bits of each 4 byte texel.*/
+void ChiSim::GetReadbackDepth(const ReadbackFrame& frame, float* depth)
+{
+  const size_t numPixels = size_t(frame.width) * frame.height;
+
+  switch (frame.depth_format)
+  {
+    case VK_FORMAT_D32_SFLOAT:
+    case VK_FORMAT_D32_SFLOAT_S8_UINT:
+      std::memcpy(depth, frame.depth, numPixels * sizeof(float));
+      break;
+    case VK_FORMAT_D24_UNORM_S8_UINT:
+    {
+      const uint32_t* texels = static_cast<const uint32_t*>(frame.depth);
+      for (size_t p = 0; p < numPixels; ++p)
+        depth[p] = float(texels[p] & 0xffffffu) / float(0xffffffu);
+      break;
+    }
+    default:
+      throw std::runtime_error("failed to convert read back depth, "
+                               "unsupported depth format!");
+  }
+}
@@ -0,0 +1,76 @@
+#include "chi_sim.h"
+
+//###################################################################
+/** Queues a captured frame on the frame encoder, starting it with the
+ * current format and thread count if needed. Blocks only while the
+ * encoder's queue is full.*/
+void ChiSim::EncodeFrame(const ReadbackFrame& frame)
+{
+  if (!m_frame_encoder.IsRunning())
+  {
+    size_t numThreads = m_encoder_threads;
+    if (numThreads == 0)
+      numThreads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+    m_frame_encoder.Start(m_encoder_format,
+                          numThreads,
+                          m_headless_output_prefix);
+  }
+
+  const bool bgra = frame.format == VK_FORMAT_B8G8R8A8_SRGB ||
+                    frame.format == VK_FORMAT_B8G8R8A8_UNORM;
+
+  m_frame_encoder.Submit(frame.frame_number,
+                         frame.width,
+                         frame.height,
+                         frame.pixels,
+                         bgra);
+}
+
+//###################################################################
+/** Waits for the frame encoder to write every queued frame and keeps
+ * its sustained rate for PrintEncoderTimings.*/
+void ChiSim::FinishFrameEncoder()
+{
+  if (!m_frame_encoder.IsRunning()) return;
+
+  EncoderResult result;
+  result.format = m_frame_encoder.GetFormat();
+  result.num_threads = m_frame_encoder.GetNumThreads();
+
+  m_frame_encoder.Finish();
+  result.stats = m_frame_encoder.GetStats();
+
+  if (result.stats.frames + result.stats.failed_frames > 0)
+    m_encoder_results.push_back(result);
+}
+
+//###################################################################
+/** Prints the sustained frame rate, throughput and compression of each
+ * encoder configuration used, and how long the renderer was held back
+ * by a full encoder queue.*/
+void ChiSim::PrintEncoderTimings()
+{
+  for (const auto& result : m_encoder_results)
+  {
+    const auto& stats = result.stats;
+    const double mib = 1024.0 * 1024.0;
+
+    std::cout << "Frame encoder ("
+              << ChiFrameEncoder::GetFormatName(result.format) << ", "
+              << result.num_threads << " threads, "
+              << stats.frames << " frames): "
+              << stats.GetFramesPerSecond() << " fps, "
+              << (stats.seconds > 0.0 ?
+                  double(stats.bytes_in) / mib / stats.seconds : 0.0)
+              << " MiB/s in, ratio "
+              << (stats.bytes_out > 0 ?
+                  double(stats.bytes_in) / double(stats.bytes_out) : 0.0)
+              << ", renderer blocked " << stats.blocked_ms << " ms ("
+              << stats.blocked_submits << " frames)" << std::endl;
+
+    if (stats.failed_frames > 0)
+      std::cout << "Frame encoder failed to write " << stats.failed_frames
+                << " frames" << std::endl;
+  }
+}
@@ -0,0 +1,118 @@
+#include "chi_sim.h"
+
+//###################################################################
+/** Enables headless rendering of one frame per poster tile and routes
+ * the captured tiles to the poster file. Throws before anything is
+ * rendered if the poster does not fit in a TIFF file.*/
+void ChiSim::EnablePoster(uint32_t width,
+                          uint32_t height,
+                          const std::string& path)
+{
+  if (width == 0 || height == 0)
+    throw std::runtime_error("failed to enable poster, poster is empty!");
+  if (ChiStripedImageWriter::GetFileSize(width, height, HEIGHT) > UINT32_MAX)
+    throw std::runtime_error("failed to enable poster, " + path +
+                             " would exceed the 4 GiB TIFF limit!");
+
+  m_poster = true;
+  m_poster_width = width;
+  m_poster_height = height;
+  m_poster_path = path;
+
+  const uint32_t numTilesY = (height + HEIGHT - 1) / HEIGHT;
+  EnableHeadless(true,
+                 size_t(GetNumPosterTilesX()) * numTilesY,
+                 m_headless_output_prefix);
+
+  SetReadbackCallback([this](const ReadbackFrame& frame)
+                      { WritePosterTile(frame); });
+}
+
+//###################################################################
+/** Number of tile columns covering the poster.*/
+uint32_t ChiSim::GetNumPosterTilesX() const
+{
+  return (m_poster_width + WIDTH - 1) / WIDTH;
+}
+
+//###################################################################
+/** Projection of the poster's sub-frustum seen by a tile. Tiles are
+ * numbered row by row from the top left.
+ *
+ * The whole poster is projected with its own aspect ratio, then the
+ * clip space range the tile covers is scaled and translated to fill
+ * [-1, 1]. Tiles on the right and bottom edges may extend past the
+ * poster; the excess is not written.*/
+glm::mat4 ChiSim::GetPosterTileProjection(size_t tile) const
+{
+  glm::mat4 proj = glm::perspective(glm::radians(45.0f),
+                                    float(m_poster_width) /
+                                    float(m_poster_height), 0.1f, 10.0f);
+  proj[1][1] *= -1;
+
+  const uint32_t numTilesX = GetNumPosterTilesX();
+  const float x0 = float(uint32_t(tile % numTilesX) * uint32_t(WIDTH));
+  const float y0 = float(uint32_t(tile / numTilesX) * uint32_t(HEIGHT));
+
+  const float scaleX = float(m_poster_width) / float(WIDTH);
+  const float scaleY = float(m_poster_height) / float(HEIGHT);
+  const float centerX =
+    -1.0f + (2.0f * x0 + float(WIDTH)) / float(m_poster_width);
+  const float centerY =
+    -1.0f + (2.0f * y0 + float(HEIGHT)) / float(m_poster_height);
+
+  glm::mat4 crop = glm::scale(glm::mat4(1.0f),
+                              glm::vec3(scaleX, scaleY, 1.0f));
+  crop = glm::translate(crop, glm::vec3(-centerX, -centerY, 0.0f));
+
+  return crop * proj;
+}
+
+//###################################################################
+/** Writes a captured tile to its place in the poster file, opening the
+ * file with the first tile and closing it after the last.*/
+void ChiSim::WritePosterTile(const ReadbackFrame& frame)
+{
+  const size_t tile = frame.frame_number;
+  const uint32_t numTilesX = GetNumPosterTilesX();
+
+  if (tile == 0)
+  {
+    m_poster_writer.Open(m_poster_path,
+                         m_poster_width,
+                         m_poster_height,
+                         frame.height);
+    m_poster_start = std::chrono::high_resolution_clock::now();
+  }
+
+  const bool bgra = frame.format == VK_FORMAT_B8G8R8A8_SRGB ||
+                    frame.format == VK_FORMAT_B8G8R8A8_UNORM;
+
+  m_poster_writer.WriteRegion(uint32_t(tile % numTilesX) * frame.width,
+                              uint32_t(tile / numTilesX) * frame.height,
+                              frame.width,
+                              frame.height,
+                              frame.pixels,
+                              size_t(frame.width) * 4,
+                              bgra);
+
+  if (tile + 1 < m_headless_frames) return;
+
+  //============================ Last tile
+  const size_t bufferBytes = m_poster_writer.GetBufferSize();
+  m_poster_writer.Close();
+
+  const double seconds = std::chrono::duration<double>(
+    std::chrono::high_resolution_clock::now() - m_poster_start).count();
+  const double mib = 1024.0 * 1024.0;
+  const size_t ringBytes =
+    m_readback_slots.size() * size_t(frame.width) * frame.height * 4;
+
+  std::cout << "Poster " << m_poster_width << "x" << m_poster_height
+            << " (" << m_headless_frames << " tiles of " << frame.width
+            << "x" << frame.height << ") written to " << m_poster_path
+            << " in " << seconds << " s, "
+            << double(m_poster_writer.GetBytesWritten()) / mib / seconds
+            << " MiB/s, host buffers "
+            << double(ringBytes + bufferBytes) / mib << " MiB" << std::endl;
+}
@@ -0,0 +1,103 @@
+#include "chi_sim.h"
+
+#include <sstream>
+#include <unistd.h>
+
+//###################################################################
+/** Turns this process into a batch worker. Frames are captured like
+ * headless frames and written by WriteBatchFrame.*/
+void ChiSim::EnableBatchWorker(int read_fd, int write_fd)
+{
+  m_batch_worker = true;
+  m_batch_read_fd = read_fd;
+  m_batch_write_fd = write_fd;
+
+  EnableHeadless(true, 0, m_headless_output_prefix);
+
+  SetReadbackCallback([this](const ReadbackFrame& frame)
+                      { WriteBatchFrame(frame); });
+}
+
+//###################################################################
+/** Asks the coordinator for the next job and makes it the job of the
+ * frame about to be drawn. Returns false when no jobs are left.*/
+bool ChiSim::AcquireBatchJob()
+{
+  m_batch_job.reset();
+  SendBatchMessage("NEXT\n");
+
+  //============================ Read one line
+  std::string line;
+  char c;
+  while (true)
+  {
+    const ssize_t numRead = read(m_batch_read_fd, &c, 1);
+    if (numRead <= 0) return false;
+    if (c == '\n') break;
+    line.push_back(c);
+  }
+
+  std::istringstream fields(line);
+  std::string type;
+  fields >> type;
+  if (type == "END") return false;
+
+  BatchJob job;
+  if (type != "JOB" ||
+      !(fields >> job.index >> job.timestep >> job.camera >> job.dataset))
+    throw std::runtime_error("failed to parse batch job \"" + line + "\"!");
+
+  // Every worker frame is captured, so the frame about to be drawn
+  // gets the next capture number.
+  m_batch_jobs_in_flight[m_num_readback_frames] = job;
+  m_batch_job = job;
+
+  return true;
+}
+
+//###################################################################
+/** Encodes a job's frame with the frame encoder's format and writes it
+ * to `<prefix>_<job>.<ext>.part`; the coordinator renames it once all
+ * earlier jobs are done. Failed writes are reported without a path.*/
+void ChiSim::WriteBatchFrame(const ReadbackFrame& frame)
+{
+  auto inFlight = m_batch_jobs_in_flight.find(frame.frame_number);
+  if (inFlight == m_batch_jobs_in_flight.end()) return;
+
+  const BatchJob job = inFlight->second;
+  m_batch_jobs_in_flight.erase(inFlight);
+
+  const size_t numBytes = size_t(frame.width) * frame.height * 4;
+  std::vector<uint8_t> pixels(static_cast<const uint8_t*>(frame.pixels),
+                              static_cast<const uint8_t*>(frame.pixels) +
+                              numBytes);
+  if (frame.format == VK_FORMAT_B8G8R8A8_SRGB ||
+      frame.format == VK_FORMAT_B8G8R8A8_UNORM)
+    for (size_t p = 0; p < numBytes; p += 4)
+      std::swap(pixels[p + 0], pixels[p + 2]);
+
+  const std::vector<uint8_t> encoded =
+    ChiFrameEncoder::Encode(m_encoder_format,
+                            frame.width, frame.height, pixels.data());
+
+  const std::string path =
+    ChiFrameEncoder::GetFilename(m_headless_output_prefix,
+                                 job.index, m_encoder_format);
+
+  std::ofstream file(path + ".part", std::ios::binary);
+  file.write(reinterpret_cast<const char*>(encoded.data()),
+             std::streamsize(encoded.size()));
+
+  const bool written = !encoded.empty() && file.good();
+  SendBatchMessage("DONE " + std::to_string(job.index) +
+                   (written ? " " + path : std::string()) + "\n");
+}
+
+//###################################################################
+/** Writes a message to the coordinator.*/
+void ChiSim::SendBatchMessage(const std::string& message)
+{
+  if (write(m_batch_write_fd, message.data(), message.size()) !=
+      ssize_t(message.size()))
+    throw std::runtime_error("failed to reach batch coordinator!");
+}
@@ -0,0 +1,50 @@
+#include "chi_sim.h"
+
+//###################################################################
+/** Turns this process into rank `rank` of `size` compositing processes.
+ * Frames are captured with depth like headless frames and merged by
+ * CompositeFrame. Rank 0 hands the composited frames to the frame
+ * encoder if `write_frames` is set.*/
+void ChiSim::EnableCompositing(const std::string& region,
+                               uint32_t rank, uint32_t size,
+                               bool write_frames)
+{
+  m_compositor.Attach(region, rank);
+  if (m_compositor.GetSize() != size)
+    throw std::runtime_error("failed to enable compositing, "
+                             "process count does not match region!");
+
+  m_compositing = true;
+  m_composite_rank = rank;
+  m_composite_size = size;
+  m_composite_write_frames = write_frames;
+  m_readback_depth = true;
+
+  EnableHeadless(true, m_headless_frames, m_headless_output_prefix);
+
+  SetReadbackCallback([this](const ReadbackFrame& frame)
+                      { CompositeFrame(frame); });
+}
+
+//###################################################################
+/** Puts a frame's color and depth into this process's compositor slots
+ * and composites it with the other processes' frames of the same
+ * number. Every process consumes its frames in order, so all of them
+ * composite the same frame together.*/
+void ChiSim::CompositeFrame(const ReadbackFrame& frame)
+{
+  const size_t numPixels = size_t(frame.width) * frame.height;
+
+  std::memcpy(m_compositor.GetColorSlot(), frame.pixels, numPixels * 4);
+  GetReadbackDepth(frame, m_compositor.GetDepthSlot());
+
+  const uint8_t* composited = m_compositor.Composite();
+
+  if (m_composite_rank != 0 || !m_composite_write_frames) return;
+
+  ReadbackFrame output = frame;
+  output.pixels = composited;
+  output.depth_format = VK_FORMAT_UNDEFINED;
+  output.depth = nullptr;
+  EncodeFrame(output);
+}
@@ -0,0 +1,81 @@
+#include "chi_sim.h"
+
+//###################################################################
+/** Starts listening for a viewer and routes captured frames to the
+ * streamer.*/
+void ChiSim::EnableStreaming(const std::string& address,
+                             double viewer_timeout_seconds)
+{
+  m_frame_streamer.Start(address);
+
+  m_streaming = true;
+  m_stream_viewer_timeout = viewer_timeout_seconds;
+  m_capture_enabled = true;
+
+  SetReadbackCallback([this](const ReadbackFrame& frame)
+                      { StreamFrame(frame); });
+}
+
+//###################################################################
+/** Hands a captured frame to the streamer. Returns at once; frames the
+ * viewer cannot keep up with are skipped by the streamer.*/
+void ChiSim::StreamFrame(const ReadbackFrame& frame)
+{
+  const bool bgra = frame.format == VK_FORMAT_B8G8R8A8_SRGB ||
+                    frame.format == VK_FORMAT_B8G8R8A8_UNORM;
+
+  m_frame_streamer.Submit(frame.frame_number,
+                          frame.width,
+                          frame.height,
+                          frame.pixels,
+                          bgra);
+}
+
+//###################################################################
+/** Waits for a viewer before a headless run, whose frames would
+ * otherwise all be skipped before anyone watches.*/
+void ChiSim::WaitForStreamViewer()
+{
+  if (!m_streaming) return;
+
+  std::cout << "Waiting for a stream viewer..." << std::endl;
+  if (!m_frame_streamer.WaitForViewer(m_stream_viewer_timeout))
+    std::cout << "No stream viewer connected, rendering anyway"
+              << std::endl;
+}
+
+//###################################################################
+/** Sends the last frame, stops the streamer and keeps its statistics
+ * for PrintStreamTimings.*/
+void ChiSim::FinishFrameStreamer()
+{
+  if (!m_frame_streamer.IsRunning()) return;
+
+  m_frame_streamer.Finish();
+  m_stream_stats = m_frame_streamer.GetStats();
+}
+
+//###################################################################
+/** Prints the streamed frame rate, bandwidth, the share of tiles and
+ * bytes the delta encoding and compression left to send, and the
+ * latency to the viewer's acknowledgement.*/
+void ChiSim::PrintStreamTimings()
+{
+  const auto& stats = m_stream_stats;
+  if (stats.frames_submitted == 0) return;
+
+  const double mib = 1024.0 * 1024.0;
+
+  std::cout << "Frame streaming (" << stats.frames_sent << " of "
+            << stats.frames_submitted << " frames sent, "
+            << stats.frames_skipped << " skipped): "
+            << stats.GetFramesPerSecond() << " fps, "
+            << stats.GetBytesPerSecond() / mib << " MiB/s, tiles "
+            << (stats.tiles_total > 0 ?
+                100.0 * double(stats.tiles_sent) / double(stats.tiles_total) :
+                0.0)
+            << "% changed, ratio "
+            << (stats.bytes_sent > 0 ?
+                double(stats.bytes_raw) / double(stats.bytes_sent) : 0.0)
+            << ", latency " << stats.latency_ms << " ms" << std::endl;
+}
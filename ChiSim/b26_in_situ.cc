@@ -0,0 +1,915 @@
+#include "chi_sim.h"
+
+//###################################################################
+/** Makes a solver's mesh the scene: `coordinates` holds x, y, z of
+ * `num_nodes` nodes, `connectivity` `num_indices` triangle corner
+ * indices and `field_values` one scalar per node, colored over
+ * [`field_min`, `field_max`]. A reversed range (`field_min` >
+ * `field_max`) colors it over the field's own minimum and maximum,
+ * which follow every update. The arrays are uploaded as they are, with
+ * no Vertex vectors in between. The field array must stay valid: it
+ * is read again at every Render, so the solver can update it in place.
+ * Replaces a previous solver mesh and releases the imported fields of
+ * its arrays. Must be called after Initialize.*/
+ChiSim::MeshID ChiSim::SetSolverMesh(const float* coordinates,
+                                     size_t num_nodes,
+                                     const uint32_t* connectivity,
+                                     size_t num_indices,
+                                     const float* field_values,
+                                     float field_min,
+                                     float field_max)
+{
+  if (!m_initialized)
+    throw std::runtime_error("failed to set solver mesh, "
+                             "context is not initialized!");
+
+  if (m_solver_mesh) FreeMesh(*m_solver_mesh);
+  ReleaseImportedFields();
+
+  // Its field is overwritten in place, so it is never shared with
+  // other uploads of the same arrays.
+  const MeshID mesh = UploadFieldMesh(coordinates, num_nodes,
+                                      connectivity, num_indices,
+                                      field_values, /*shared=*/false);
+
+  DrawParameters parameters;
+  parameters.colormap_range = glm::vec2(field_min, field_max);
+
+  ClearDraws();
+  AddDraw(mesh, glm::mat4(1.0f), parameters);
+
+  m_solver_mesh = mesh;
+  m_solver_field = field_values;
+
+  // Ranges still read back belong to the previous field.
+  m_solver_auto_range = field_min > field_max;
+  if (m_solver_auto_range)
+  {
+    m_field_range = ComputeFieldRange(field_values, num_nodes);
+    m_field_range_value = m_graphics_timeline.last_submitted;
+  }
+
+  // Kept to re-upload the mesh with new fields.
+  m_solver_vertices.clear();
+  m_solver_indices.clear();
+  if (!m_meshes[mesh].pulled)
+  {
+    m_solver_vertices = InterleaveFieldMesh(coordinates, num_nodes,
+                                            field_values);
+    m_solver_indices.assign(connectivity, connectivity + num_indices);
+  }
+
+  return mesh;
+}
+
+//###################################################################
+/** Draws one frame of the solver's current state at timestep `step`,
+ * for a solver calling it every N iterations in place of Execute.
+ * The field is re-read from the solver's array first. Headless frames
+ * are captured and encoded like those of EnableHeadless, windowed ones
+ * presented. Returns false once the window has been closed.*/
+bool ChiSim::Render(size_t step)
+{
+  if (!m_initialized)
+    throw std::runtime_error("failed to render, "
+                             "context is not initialized!");
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  if (!m_headless)
+  {
+    glfwPollEvents();
+    if (glfwWindowShouldClose(m_main_window)) return false;
+  }
+
+  //============================ Field update
+  double updateMs = 0.0;
+  if (m_solver_mesh && m_solver_field)
+  {
+    auto updateStart = std::chrono::high_resolution_clock::now();
+    UpdateSolverField();
+    updateMs = std::chrono::duration<double, std::milli>(
+      std::chrono::high_resolution_clock::now() - updateStart).count();
+  }
+
+  //============================ Frame
+  m_insitu_step = step;
+  DrawFrame();
+  m_insitu_step.reset();
+
+  //============================ Timings
+  const double renderMs = std::chrono::duration<double, std::milli>(
+    std::chrono::high_resolution_clock::now() - start).count();
+
+  auto& timings = m_insitu_timings;
+  ++timings.calls;
+  timings.render_ms += (renderMs - timings.render_ms) / double(timings.calls);
+  timings.update_ms += (updateMs - timings.update_ms) / double(timings.calls);
+  timings.max_render_ms = std::max(timings.max_render_ms, renderMs);
+
+  return true;
+}
+
+//###################################################################
+/** Uploads the solver mesh's field from m_solver_field. Imported
+ * fields are copied by the device straight from the solver's array,
+ * which the solver may overwrite once Render returns and a solver ring
+ * once its read was validated: that copy is submitted and waited for
+ * right away, frames in flight are not. The others go through staging
+ * with the next frame.*/
+void ChiSim::UpdateSolverField()
+{
+  if (!m_meshes[*m_solver_mesh].pulled)
+  {
+    ReplaceInterleavedSolverMesh();
+    return;
+  }
+
+  const MeshRange& mesh = m_meshes[*m_solver_mesh];
+  const VkDeviceSize fieldBytes =
+    sizeof(float) * VkDeviceSize(mesh.vertex_count);
+
+  const ImportedField* imported = m_import_solver_fields ?
+    ImportSolverField(m_solver_field, fieldBytes) : nullptr;
+
+  if (imported)
+  {
+    RecordFieldCopy(*m_solver_mesh, imported->buffer, 0);
+    if (m_solver_auto_range) RecordFieldRange(*m_solver_mesh);
+    WaitForTimelineValue(m_graphics_timeline, SubmitFieldCopies());
+    m_insitu_timings.bytes_imported += size_t(fieldBytes);
+    ++m_insitu_timings.imported_updates;
+  }
+  else
+  {
+    UpdateFieldValues(*m_solver_mesh, m_solver_field);
+    if (m_solver_auto_range) RecordFieldRange(*m_solver_mesh);
+  }
+}
+
+//###################################################################
+/** Without vertex pulling, uploads the solver mesh again as
+ * interleaved vertices colored by m_solver_field and draws that
+ * instead. The previous mesh is freed once the frames drawing it have
+ * retired, so nothing waits for them.*/
+void ChiSim::ReplaceInterleavedSolverMesh()
+{
+  for (size_t v = 0; v < m_solver_vertices.size(); ++v)
+    m_solver_vertices[v].color = glm::vec3(m_solver_field[v]);
+  if (m_solver_auto_range)
+    m_field_range = ComputeFieldRange(m_solver_field,
+                                      m_solver_vertices.size());
+
+  const MeshID previous = *m_solver_mesh;
+  const MeshID mesh = UploadMesh(m_solver_vertices, m_solver_indices,
+                                 /*shared=*/false);
+
+  for (auto& draw : m_draws)
+    if (draw.mesh == previous) draw.mesh = mesh;
+  ++m_scene_generation;
+
+  FreeMesh(previous);
+  m_solver_mesh = mesh;
+
+  m_insitu_timings.bytes_copied += sizeof(Vertex) * m_solver_vertices.size();
+  ++m_insitu_timings.staged_updates;
+}
+
+//###################################################################
+/** Replaces the field values of a pulled mesh with `field_values`, one
+ * per vertex. They are staged in the frame slot's staging buffer and
+ * copied into the current frame slot's field range ahead of the next
+ * frame, so only that slot's previous frame is waited for; frames in
+ * flight keep reading their own ranges, which take the new values over
+ * before their next frames. The mesh must have been uploaded unshared:
+ * a registered mesh may be drawn by other owners and would no longer
+ * match its registered content.*/
+void ChiSim::UpdateFieldValues(MeshID mesh_id, const float* field_values)
+{
+  if (mesh_id >= m_meshes.size() || !m_meshes[mesh_id].active ||
+      !m_meshes[mesh_id].pulled)
+    throw std::runtime_error("failed to update field values, "
+                             "invalid field mesh id!");
+  if (m_meshes[mesh_id].shared)
+    throw std::runtime_error("failed to update field values, "
+                             "mesh is shared!");
+
+  const MeshRange& mesh = m_meshes[mesh_id];
+  const VkDeviceSize fieldBytes = sizeof(float) * VkDeviceSize(mesh.vertex_count);
+
+  // Begins the slot's copies first: its staging buffer is free again
+  // once the slot has retired.
+  BeginFieldCopies();
+  const VkDeviceSize stagingOffset = StageFieldValues(field_values,
+                                                      fieldBytes);
+  RecordFieldCopy(mesh_id, m_field_staging[m_current_frame].buffer,
+                  stagingOffset);
+
+  m_insitu_timings.bytes_copied += size_t(fieldBytes);
+  ++m_insitu_timings.staged_updates;
+}
+
+//###################################################################
+/** Copies `size` bytes of field values into the current frame slot's
+ * staging buffer and returns their offset in it. A buffer too small
+ * is replaced by one twice as large, or as large as needed; copies
+ * already recorded from it keep it alive until they are submitted and
+ * retired. Must be called while the slot's field copies are recorded.*/
+VkDeviceSize ChiSim::StageFieldValues(const float* field_values,
+                                      VkDeviceSize size)
+{
+  FieldStaging& staging = m_field_staging[m_current_frame];
+
+  if (staging.used + size > staging.size)
+  {
+    const VkDeviceSize newSize = std::max(2 * staging.size, size);
+    if (staging.used > 0)
+      m_retiring_field_staging.push_back(staging);
+    else
+      DestroyFieldStaging(staging);
+
+    staging = FieldStaging();
+    CreateBuffer(newSize,
+                 VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 staging.buffer,
+                 staging.memory);
+    vkMapMemory(m_device, staging.memory, 0, VK_WHOLE_SIZE, 0,
+                &staging.mapped);
+    staging.size = newSize;
+  }
+
+  const VkDeviceSize offset = staging.used;
+  memcpy(static_cast<char*>(staging.mapped) + offset, field_values,
+         (size_t) size);
+  // Keeps every update 4 byte aligned for vkCmdCopyBuffer.
+  staging.used += (size + 3) / 4 * 4;
+
+  return offset;
+}
+
+//###################################################################
+/** Byte offset of vertex `vertex_offset` in frame slot `frame`'s range
+ * of the pulled field buffer.*/
+VkDeviceSize ChiSim::GetPulledFieldOffset(size_t frame,
+                                          int32_t vertex_offset) const
+{
+  return sizeof(float) *
+    (VkDeviceSize(frame) * k_geometry_vertex_capacity +
+     VkDeviceSize(vertex_offset));
+}
+
+//###################################################################
+/** Returns the current frame slot's field command buffer, beginning it
+ * if it is not recording. The slot's range may only be written once
+ * its previous frame and field copies have retired, which DrawFrame
+ * would wait for anyway. Then the slot's field range is read back and
+ * its transient descriptor sets are released.*/
+VkCommandBuffer ChiSim::BeginFieldCopies()
+{
+  VkCommandBuffer commandBuffer = m_field_command_buffers[m_current_frame];
+  if (m_field_copies_recording) return commandBuffer;
+
+  WaitForTimelineValue(m_graphics_timeline,
+                       std::max(m_frame_timeline_values[m_current_frame],
+                                m_field_copy_values[m_current_frame]));
+
+  VkCommandBufferBeginInfo beginInfo = {};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+  if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+    throw std::runtime_error("failed to begin recording field copies!");
+
+  m_field_staging[m_current_frame].used = 0;
+  ResolveFieldRanges();
+  GetFrameDescriptorAllocator().Reset();
+
+  m_field_copies_recording = true;
+  return commandBuffer;
+}
+
+//###################################################################
+/** Records a copy of mesh `mesh_id`'s field values from
+ * `source_offset` in `source` into the current frame slot's range.
+ * The other slots' ranges are stale until they copy the values over.*/
+void ChiSim::RecordFieldCopy(MeshID mesh_id,
+                             VkBuffer source,
+                             VkDeviceSize source_offset)
+{
+  VkCommandBuffer commandBuffer = BeginFieldCopies();
+  const MeshRange& mesh = m_meshes[mesh_id];
+
+  // After earlier copies from and into the range, also of this
+  // recording.
+  VkMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  vkCmdPipelineBarrier(commandBuffer,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       0,
+                       1, &barrier,
+                       0, nullptr,
+                       0, nullptr);
+
+  VkBufferCopy region = {};
+  region.srcOffset = source_offset;
+  region.dstOffset = GetPulledFieldOffset(m_current_frame,
+                                          mesh.vertex_offset);
+  region.size = sizeof(float) * VkDeviceSize(mesh.vertex_count);
+  vkCmdCopyBuffer(commandBuffer, source, m_pulled_field_buffer, 1, &region);
+
+  for (size_t frame = 0; frame < m_stale_field_ranges.size(); ++frame)
+    if (frame == m_current_frame)
+      m_stale_field_ranges[frame].erase(mesh_id);
+    else
+      m_stale_field_ranges[frame][mesh_id] = m_current_frame;
+}
+
+//###################################################################
+/** Brings the current frame slot's stale field ranges up to date from
+ * the slots holding the newest values, and submits the slot's field
+ * copies ahead of its frame. Later frames' vertex shaders see the new
+ * values. Outgrown staging buffers are retired with them. Returns
+ * the copies' timeline value, or 0 if there were none.*/
+uint64_t ChiSim::SubmitFieldCopies()
+{
+  auto& staleRanges = m_stale_field_ranges[m_current_frame];
+  if (!m_field_copies_recording && staleRanges.empty()) return 0;
+
+  VkCommandBuffer commandBuffer = BeginFieldCopies();
+
+  VkMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+
+  //============================ Stale ranges
+  if (!staleRanges.empty())
+  {
+    std::vector<VkBufferCopy> regions;
+    regions.reserve(staleRanges.size());
+    for (const auto& staleRange : staleRanges)
+    {
+      const MeshRange& mesh = m_meshes[staleRange.first];
+      VkBufferCopy region = {};
+      region.srcOffset = GetPulledFieldOffset(staleRange.second,
+                                              mesh.vertex_offset);
+      region.dstOffset = GetPulledFieldOffset(m_current_frame,
+                                              mesh.vertex_offset);
+      region.size = sizeof(float) * VkDeviceSize(mesh.vertex_count);
+      regions.push_back(region);
+    }
+    staleRanges.clear();
+
+    // The newest values were copied into the source ranges by earlier
+    // submissions.
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT |
+                            VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         1, &barrier,
+                         0, nullptr,
+                         0, nullptr);
+
+    vkCmdCopyBuffer(commandBuffer, m_pulled_field_buffer,
+                    m_pulled_field_buffer,
+                    uint32_t(regions.size()), regions.data());
+  }
+
+  //============================ Submit
+  // The host reads the reduced field range once the copies retired.
+  if (m_field_range_recorded)
+  {
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT,
+                         0,
+                         1, &barrier,
+                         0, nullptr,
+                         0, nullptr);
+  }
+
+  // Later vertex shaders, and copies from this slot's range into
+  // others, see the new values.
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT |
+                          VK_ACCESS_TRANSFER_READ_BIT;
+  vkCmdPipelineBarrier(commandBuffer,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       0,
+                       1, &barrier,
+                       0, nullptr,
+                       0, nullptr);
+
+  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+    throw std::runtime_error("failed to record field copies!");
+  m_field_copies_recording = false;
+
+  const uint64_t value = SubmitToTimeline(m_graphics_queue,
+                                          m_graphics_timeline,
+                                          commandBuffer,
+                                          {}, {});
+  m_field_copy_values[m_current_frame] = value;
+
+  if (m_field_range_recorded)
+    m_field_range_values[m_current_frame] = value;
+  m_field_range_recorded = false;
+
+  for (const auto& staging : m_retiring_field_staging)
+    RetireAfter(value, [this, staging]() { DestroyFieldStaging(staging); });
+  m_retiring_field_staging.clear();
+
+  return value;
+}
+
+//###################################################################
+/** Creates the compute pipeline reducing a field update to its range
+ * (shaders/field_range.comp) and the host visible buffer each frame
+ * slot reduces into. Without the shader automatic colormap ranges are
+ * computed on the host.*/
+void ChiSim::CreateFieldRangePipeline()
+{
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(m_physical_device, &properties);
+  m_storage_buffer_alignment =
+    properties.limits.minStorageBufferOffsetAlignment;
+
+  m_field_range_values.assign(MAX_FRAMES_IN_FLIGHT, 0);
+
+  if (!IsShaderAvailable(k_field_range_shader))
+  {
+    std::cout << "No " << k_field_range_shader.precompiled
+              << ", automatic colormap ranges are computed on the host."
+              << std::endl;
+    return;
+  }
+
+  //============================ Descriptor set layout
+  std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+  for (uint32_t b = 0; b < 2; ++b)
+  {
+    bindings[b].binding = b;
+    bindings[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[b].descriptorCount = 1;
+    bindings[b].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = bindings.size();
+  layoutInfo.pBindings = bindings.data();
+
+  if (vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr,
+                                  &m_field_range_set_layout) != VK_SUCCESS)
+    throw std::runtime_error("failed to create field range "
+                             "descriptor set layout!");
+
+  //============================ Update template
+  std::array<VkDescriptorUpdateTemplateEntry, 2> entries = {};
+  const size_t offsets[2] =
+    {offsetof(FieldRangeDescriptorData, field_values),
+     offsetof(FieldRangeDescriptorData, range)};
+  for (uint32_t b = 0; b < 2; ++b)
+  {
+    entries[b].dstBinding = b;
+    entries[b].descriptorCount = 1;
+    entries[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    entries[b].offset = offsets[b];
+  }
+
+  VkDescriptorUpdateTemplateCreateInfo templateInfo = {};
+  templateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+  templateInfo.descriptorUpdateEntryCount = entries.size();
+  templateInfo.pDescriptorUpdateEntries = entries.data();
+  templateInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+  templateInfo.descriptorSetLayout = m_field_range_set_layout;
+
+  if (vkCreateDescriptorUpdateTemplate(m_device, &templateInfo, nullptr,
+                                       &m_field_range_template) !=
+      VK_SUCCESS)
+    throw std::runtime_error("failed to create descriptor update template!");
+
+  //============================ Pipeline
+  VkPushConstantRange pushConstantRange = {};
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  pushConstantRange.offset = 0;
+  pushConstantRange.size = sizeof(FieldRangeParameters);
+
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts = &m_field_range_set_layout;
+  pipelineLayoutInfo.pushConstantRangeCount = 1;
+  pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+  if (vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr,
+                             &m_field_range_pipeline_layout) != VK_SUCCESS)
+    throw std::runtime_error("failed to create field range "
+                             "pipeline layout!");
+
+  VkShaderModule shaderModule =
+    CreateShaderModule(LoadShader(k_field_range_shader));
+
+  VkComputePipelineCreateInfo pipelineInfo = {};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType =
+    VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = shaderModule;
+  pipelineInfo.stage.pName = "main";
+  pipelineInfo.layout = m_field_range_pipeline_layout;
+
+  const VkResult result =
+    vkCreateComputePipelines(m_device, m_pipeline_cache, 1, &pipelineInfo,
+                             nullptr, &m_field_range_pipeline);
+  vkDestroyShaderModule(m_device, shaderModule, nullptr);
+  if (result != VK_SUCCESS)
+    throw std::runtime_error("failed to create field range pipeline!");
+
+  //============================ Range buffers
+  m_field_range_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+  m_field_range_buffers_memory.resize(MAX_FRAMES_IN_FLIGHT);
+  m_field_range_mapped.resize(MAX_FRAMES_IN_FLIGHT);
+  for (int f = 0; f < MAX_FRAMES_IN_FLIGHT; ++f)
+  {
+    CreateBuffer(2 * sizeof(uint32_t),
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 m_field_range_buffers[f],
+                 m_field_range_buffers_memory[f]);
+
+    void* mapped;
+    vkMapMemory(m_device, m_field_range_buffers_memory[f], 0,
+                VK_WHOLE_SIZE, 0, &mapped);
+    m_field_range_mapped[f] = static_cast<uint32_t*>(mapped);
+  }
+}
+
+//###################################################################
+/** Records the reduction of mesh `mesh_id`'s field, just copied into
+ * the current frame slot's range, to its minimum and maximum. The
+ * range is read back by ResolveFieldRanges once the slot's copies
+ * have retired. The set binding the range is transient: it comes from
+ * the slot's descriptor allocator and is released with the slot.
+ * Without the field range pipeline the range is computed on the host
+ * from m_solver_field.*/
+void ChiSim::RecordFieldRange(MeshID mesh_id)
+{
+  const MeshRange& mesh = m_meshes[mesh_id];
+  if (m_field_range_pipeline == VK_NULL_HANDLE)
+  {
+    m_field_range = ComputeFieldRange(m_solver_field, mesh.vertex_count);
+    return;
+  }
+
+  VkCommandBuffer commandBuffer = BeginFieldCopies();
+
+  // After the copy into the range.
+  VkMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  vkCmdPipelineBarrier(commandBuffer,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       0,
+                       1, &barrier,
+                       0, nullptr,
+                       0, nullptr);
+
+  // The slot has retired and its last range was read back, so the
+  // host starts the reduction of this recording.
+  uint32_t* range = m_field_range_mapped[m_current_frame];
+  if (!m_field_range_recorded)
+  {
+    range[0] = 0xFFFFFFFFu;
+    range[1] = 0u;
+  }
+
+  //============================ Transient set
+  // Storage buffers bind at aligned offsets, the rest is skipped by
+  // the shader.
+  const VkDeviceSize fieldOffset =
+    GetPulledFieldOffset(m_current_frame, mesh.vertex_offset);
+  const VkDeviceSize fieldBytes =
+    sizeof(float) * VkDeviceSize(mesh.vertex_count);
+  const VkDeviceSize boundOffset =
+    fieldOffset / m_storage_buffer_alignment * m_storage_buffer_alignment;
+
+  FieldRangeDescriptorData data = {};
+  data.field_values.buffer = m_pulled_field_buffer;
+  data.field_values.offset = boundOffset;
+  data.field_values.range = fieldOffset - boundOffset + fieldBytes;
+  data.range.buffer = m_field_range_buffers[m_current_frame];
+  data.range.offset = 0;
+  data.range.range = VK_WHOLE_SIZE;
+
+  VkDescriptorSet set =
+    GetFrameDescriptorAllocator().Allocate(m_field_range_set_layout);
+  vkUpdateDescriptorSetWithTemplate(m_device, set, m_field_range_template,
+                                    &data);
+
+  //============================ Dispatch
+  FieldRangeParameters parameters;
+  parameters.first = uint32_t((fieldOffset - boundOffset) / sizeof(float));
+  parameters.count = mesh.vertex_count;
+
+  const uint32_t groupSize = 256; //local_size_x of the shader
+  const uint32_t numGroups =
+    std::clamp((mesh.vertex_count + groupSize - 1) / groupSize,
+               1u, k_field_range_max_groups);
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    m_field_range_pipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          m_field_range_pipeline_layout, 0, 1, &set,
+                          0, nullptr);
+  vkCmdPushConstants(commandBuffer, m_field_range_pipeline_layout,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                     sizeof(parameters), &parameters);
+  vkCmdDispatch(commandBuffer, numGroups, 1, 1);
+
+  m_field_range_recorded = true;
+}
+
+//###################################################################
+/** Reads back the field ranges of retired frame slots. The newest
+ * becomes m_field_range, older ones are dropped.*/
+void ChiSim::ResolveFieldRanges()
+{
+  // Inverse of OrderedKey in shaders/field_range.comp.
+  auto keyToFloat = [](uint32_t key)
+  {
+    const uint32_t bits = (key & 0x80000000u) ? (key & 0x7FFFFFFFu) : ~key;
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+  };
+
+  uint64_t completed = 0;
+  for (size_t f = 0; f < m_field_range_values.size(); ++f)
+  {
+    const uint64_t value = m_field_range_values[f];
+    if (value == 0) continue;
+
+    if (completed < value)
+      completed = GetCompletedTimelineValue(m_graphics_timeline);
+    if (completed < value) continue;
+
+    m_field_range_values[f] = 0;
+    if (value <= m_field_range_value) continue;
+
+    m_field_range = glm::vec2(keyToFloat(m_field_range_mapped[f][0]),
+                              keyToFloat(m_field_range_mapped[f][1]));
+    m_field_range_value = value;
+  }
+}
+
+//###################################################################
+/** Minimum and maximum of `count` field values, on the host.*/
+glm::vec2 ChiSim::ComputeFieldRange(const float* field_values, size_t count)
+{
+  if (count == 0) return glm::vec2(0.0f, 1.0f);
+
+  auto range = std::minmax_element(field_values, field_values + count);
+  return glm::vec2(*range.first, *range.second);
+}
+
+//###################################################################
+/** Destroys the field range pipeline and its buffers.*/
+void ChiSim::DestroyFieldRangePipeline()
+{
+  for (size_t f = 0; f < m_field_range_buffers.size(); ++f)
+  {
+    vkDestroyBuffer(m_device, m_field_range_buffers[f], nullptr);
+    vkFreeMemory(m_device, m_field_range_buffers_memory[f], nullptr);
+  }
+  m_field_range_buffers.clear();
+  m_field_range_buffers_memory.clear();
+  m_field_range_mapped.clear();
+
+  vkDestroyPipeline(m_device, m_field_range_pipeline, nullptr);
+  vkDestroyPipelineLayout(m_device, m_field_range_pipeline_layout, nullptr);
+  vkDestroyDescriptorUpdateTemplate(m_device, m_field_range_template,
+                                    nullptr);
+  vkDestroyDescriptorSetLayout(m_device, m_field_range_set_layout, nullptr);
+  m_field_range_pipeline = VK_NULL_HANDLE;
+  m_field_range_pipeline_layout = VK_NULL_HANDLE;
+  m_field_range_template = VK_NULL_HANDLE;
+  m_field_range_set_layout = VK_NULL_HANDLE;
+}
+
+//###################################################################
+/** Returns the solver array `field_values`, of `size` bytes, imported
+ * as a transfer source buffer through VK_EXT_external_memory_host, or
+ * nullptr when it cannot be imported: the extension is missing, the
+ * array is not aligned to m_host_import_alignment or the driver has no
+ * host coherent memory type for it. The import covers whole alignment
+ * blocks, so the array must be allocated in whole blocks. Imports are
+ * kept per array, so a solver alternating between two buffers imports
+ * each once.
+ *
+ * The device reads the array in place when copying it, and the memory
+ * is host coherent, so solver writes made before Render are seen
+ * without a flush and no host copy is needed.*/
+const ChiSim::ImportedField*
+ChiSim::ImportSolverField(const float* field_values, VkDeviceSize size)
+{
+  for (auto it = m_imported_fields.begin();
+       it != m_imported_fields.end(); ++it)
+  {
+    if (it->host_pointer != field_values) continue;
+    if (it->size >= size) return &*it;
+
+    // Same array, grown: no copy from it is pending.
+    vkDestroyBuffer(m_device, it->buffer, nullptr);
+    vkFreeMemory(m_device, it->memory, nullptr);
+    m_imported_fields.erase(it);
+    break;
+  }
+
+#ifdef VK_EXT_external_memory_host
+  const VkDeviceSize alignment = m_host_import_alignment;
+  if (!m_external_memory_host_supported || alignment == 0 ||
+      reinterpret_cast<uintptr_t>(field_values) % alignment != 0)
+    return nullptr;
+
+  auto getHostPointerProperties =
+    reinterpret_cast<PFN_vkGetMemoryHostPointerPropertiesEXT>(
+      vkGetDeviceProcAddr(m_device, "vkGetMemoryHostPointerPropertiesEXT"));
+  if (!getHostPointerProperties) return nullptr;
+
+  const VkExternalMemoryHandleTypeFlagBits handleType =
+    VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+
+  VkMemoryHostPointerPropertiesEXT hostProperties = {};
+  hostProperties.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+  if (getHostPointerProperties(m_device, handleType, field_values,
+                               &hostProperties) != VK_SUCCESS)
+    return nullptr;
+
+  //============================ Buffer
+  ImportedField field;
+  field.host_pointer = field_values;
+  field.size = (size + alignment - 1) / alignment * alignment;
+
+  VkExternalMemoryBufferCreateInfo externalInfo = {};
+  externalInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+  externalInfo.handleTypes = handleType;
+
+  VkBufferCreateInfo bufferInfo = {};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.pNext = &externalInfo;
+  bufferInfo.size = field.size;
+  bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  if (vkCreateBuffer(m_device, &bufferInfo, nullptr,
+                     &field.buffer) != VK_SUCCESS)
+    return nullptr;
+
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(m_device, field.buffer, &requirements);
+
+  //============================ Memory type
+  VkPhysicalDeviceMemoryProperties memProperties;
+  vkGetPhysicalDeviceMemoryProperties(m_physical_device, &memProperties);
+
+  const uint32_t typeBits =
+    hostProperties.memoryTypeBits & requirements.memoryTypeBits;
+  uint32_t memoryType = memProperties.memoryTypeCount;
+  for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i)
+    if ((typeBits & (1u << i)) &&
+        (memProperties.memoryTypes[i].propertyFlags &
+         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+    {
+      memoryType = i;
+      break;
+    }
+
+  if (memoryType == memProperties.memoryTypeCount ||
+      requirements.size > field.size)
+  {
+    vkDestroyBuffer(m_device, field.buffer, nullptr);
+    return nullptr;
+  }
+
+  //============================ Import
+  VkImportMemoryHostPointerInfoEXT importInfo = {};
+  importInfo.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+  importInfo.handleType = handleType;
+  importInfo.pHostPointer = const_cast<float*>(field_values);
+
+  VkMemoryAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.pNext = &importInfo;
+  allocInfo.allocationSize = field.size;
+  allocInfo.memoryTypeIndex = memoryType;
+
+  if (vkAllocateMemory(m_device, &allocInfo, nullptr,
+                       &field.memory) != VK_SUCCESS)
+  {
+    vkDestroyBuffer(m_device, field.buffer, nullptr);
+    return nullptr;
+  }
+  vkBindBufferMemory(m_device, field.buffer, field.memory, 0);
+
+  m_imported_fields.push_back(field);
+  return &m_imported_fields.back();
+#else
+  return nullptr;
+#endif
+}
+
+//###################################################################
+/** Releases the imported solver fields, after which their arrays may
+ * be freed. Arrays still in use are imported again at the next Render.
+ * Copies from imports never outlive a Render call, so none is pending.*/
+void ChiSim::ReleaseImportedFields()
+{
+  for (auto& field : m_imported_fields)
+  {
+    vkDestroyBuffer(m_device, field.buffer, nullptr);
+    vkFreeMemory(m_device, field.memory, nullptr);
+  }
+  m_imported_fields.clear();
+}
+
+//###################################################################
+/** Prints the mean and worst wall time of a Render call and the share
+ * of it spent updating the field. For field updates through staging
+ * and through imported solver memory, by Render or from a solver ring,
+ * prints the bytes the host copied per update and, imported, the bytes
+ * the device read in place.*/
+void ChiSim::PrintInSituTimings()
+{
+  const auto& timings = m_insitu_timings;
+
+  if (timings.calls > 0)
+    std::cout << "In-situ render (" << timings.calls << " calls): "
+              << timings.render_ms << " ms per call (max "
+              << timings.max_render_ms << " ms), field update "
+              << timings.update_ms << " ms" << std::endl;
+
+  if (timings.staged_updates > 0)
+  {
+    std::cout << "  staged field:   " << timings.staged_updates
+              << " updates, "
+              << double(timings.bytes_copied) /
+                 double(timings.staged_updates) / 1024.0
+              << " KiB copied by the host per frame";
+    if (m_import_solver_fields)
+      std::cout << (m_external_memory_host_supported ?
+                    " (arrays not aligned to " +
+                    std::to_string(m_host_import_alignment) + " bytes)" :
+                    std::string(" (no VK_EXT_external_memory_host)"));
+    std::cout << std::endl;
+  }
+
+  if (timings.imported_updates > 0)
+    std::cout << "  imported field: " << timings.imported_updates
+              << " updates, 0 KiB copied by the host per frame, "
+              << double(timings.bytes_imported) /
+                 double(timings.imported_updates) / 1024.0
+              << " KiB read in place by the device ("
+              << m_imported_fields.size() << " arrays imported)"
+              << std::endl;
+}
+
+//###################################################################
+/** Destroys the imported fields, the field range pipeline and the
+ * field staging buffers. Only called once no copy from them is
+ * pending.*/
+void ChiSim::DestroyInSituResources()
+{
+  ReleaseImportedFields();
+  DestroyFieldRangePipeline();
+
+  for (const auto& staging : m_field_staging)
+    DestroyFieldStaging(staging);
+  for (const auto& staging : m_retiring_field_staging)
+    DestroyFieldStaging(staging);
+  m_field_staging.clear();
+  m_retiring_field_staging.clear();
+}
+
+//###################################################################
+/** Destroys a field staging buffer. Only called once no copy from it
+ * is pending.*/
+void ChiSim::DestroyFieldStaging(const FieldStaging& staging)
+{
+  if (staging.buffer == VK_NULL_HANDLE) return;
+
+  vkDestroyBuffer(m_device, staging.buffer, nullptr);
+  vkFreeMemory(m_device, staging.memory, nullptr);
+}
@@ -0,0 +1,143 @@
+#include "chi_sim.h"
+
+#include <thread>
+
+//###################################################################
+/** Renders the fields a solver process publishes to the ChiSolverRing
+ * `name`. Execute waits up to `timeout_seconds` for the ring, then
+ * draws each newest field until the solver finishes or exits, or the
+ * window is closed. Must be set before Execute.*/
+void ChiSim::EnableSolverRing(const std::string& name, double timeout_seconds)
+{
+  m_solver_ring_name = name;
+  m_solver_ring_timeout = timeout_seconds;
+}
+
+//###################################################################
+/** Opens the solver ring before the first frame.*/
+void ChiSim::OpenSolverRing()
+{
+  std::cout << "Waiting for solver ring " << m_solver_ring_name << "..."
+            << std::endl;
+  if (!m_solver_ring.Open(m_solver_ring_name, m_solver_ring_timeout))
+    throw std::runtime_error("failed to open solver ring " +
+                             m_solver_ring_name + ", no solver!");
+}
+
+//###################################################################
+/** Uploads the newest complete field of the solver ring, and its mesh
+ * if that changed, for the frame about to be drawn. Both are read
+ * straight from the ring's shared pages. An upload the solver
+ * overwrote meanwhile is discarded and the then newest field taken.
+ * Waits while no newer field is published; windowed, the last field
+ * is drawn again meanwhile. Returns false once the solver finished or
+ * exited and its last field was drawn, or the window was closed.*/
+bool ChiSim::AcquireRingStep()
+{
+  auto& timings = m_ring_timings;
+  auto waitStart = std::chrono::high_resolution_clock::now();
+
+  while (true)
+  {
+    if (!m_headless)
+    {
+      glfwPollEvents();
+      if (glfwWindowShouldClose(m_main_window)) return false;
+    }
+
+    //============================ Newest field
+    ChiSolverRing::Field field;
+    if (!m_solver_ring.AcquireField(field, m_ring_field_sequence))
+    {
+      if (m_solver_ring.IsFinished()) return false;
+      if (!m_solver_ring.IsProducerAlive())
+      {
+        std::cout << "Solver of ring " << m_solver_ring_name
+                  << " exited without finishing" << std::endl;
+        return false;
+      }
+      if (!m_headless && m_solver_mesh) return true;
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+
+    const double waitMs = std::chrono::duration<double, std::milli>(
+      std::chrono::high_resolution_clock::now() - waitStart).count();
+    auto uploadStart = std::chrono::high_resolution_clock::now();
+
+    //============================ Upload
+    if (!m_solver_mesh || field.mesh_version != m_ring_mesh_version)
+    {
+      // A new mesh comes with its first field.
+      ChiSolverRing::Mesh mesh;
+      if (!m_solver_ring.AcquireMesh(mesh))
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        continue;
+      }
+
+      // The solver published another mesh since this field.
+      if (mesh.version != field.mesh_version ||
+          mesh.num_nodes != field.num_values)
+      {
+        m_ring_field_sequence = field.sequence;
+        ++timings.steps_skipped;
+        continue;
+      }
+
+      SetSolverMesh(mesh.coordinates, mesh.num_nodes,
+                    mesh.connectivity, mesh.num_indices,
+                    field.values, mesh.field_min, mesh.field_max);
+
+      if (!m_solver_ring.IsValid(mesh))
+      {
+        ++timings.torn_reads;
+        continue;
+      }
+      m_ring_mesh_version = mesh.version;
+    }
+    else
+    {
+      m_solver_field = field.values;
+      UpdateSolverField();
+    }
+
+    if (!m_solver_ring.IsValid(field))
+    {
+      ++timings.torn_reads;
+      continue;
+    }
+
+    //============================ Timings
+    const double uploadMs = std::chrono::duration<double, std::milli>(
+      std::chrono::high_resolution_clock::now() - uploadStart).count();
+
+    if (m_ring_field_sequence > 0)
+      timings.steps_skipped += field.sequence - m_ring_field_sequence - 1;
+    m_ring_field_sequence = field.sequence;
+    m_insitu_step = field.step;
+
+    ++timings.steps;
+    timings.wait_ms += (waitMs - timings.wait_ms) / double(timings.steps);
+    timings.upload_ms += (uploadMs - timings.upload_ms) / double(timings.steps);
+
+    return true;
+  }
+}
+
+//###################################################################
+/** Prints how many solver steps were drawn and skipped, the torn
+ * uploads retried, and the mean wait for and upload of a step.*/
+void ChiSim::PrintSolverRingTimings()
+{
+  const auto& timings = m_ring_timings;
+  if (timings.steps == 0) return;
+
+  std::cout << "Solver ring " << m_solver_ring_name << ": "
+            << timings.steps << " steps drawn, "
+            << timings.steps_skipped << " skipped, "
+            << timings.torn_reads << " torn reads retried, "
+            << timings.wait_ms << " ms wait and "
+            << timings.upload_ms << " ms upload per step" << std::endl;
+}
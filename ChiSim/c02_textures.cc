@@ -1,22 +1,23 @@
 #include "chi_sim.h"
 
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
-
 //###################################################################
-/** Create texture image. */
+/** Create texture image. The main texture is loaded through the
+ * texture registry like any other.*/
 void ChiSim::CreateTextureImage()
 {
-  int texWidth, texHeight, texChannels;
-  stbi_uc* pixels = stbi_load("../textures/texture.jpg",
-                              &texWidth,
-                              &texHeight,
-                              &texChannels,
-                              STBI_rgb_alpha);
-  VkDeviceSize imageSize = texWidth * texHeight * 4;
+  m_texture = LoadTexture(k_texture_path);
+}
 
-  if (!pixels)
-    throw std::runtime_error("failed to load texture image!");
+//###################################################################
+/** Creates a device local RGBA8 sRGB texture image from pixels and
+ * leaves it ready for sampling.*/
+void ChiSim::CreateTextureFromPixels(uint32_t width,
+                                     uint32_t height,
+                                     const void* pixels,
+                                     VkImage& image,
+                                     VkDeviceMemory& image_memory)
+{
+  VkDeviceSize imageSize = VkDeviceSize(width) * height * 4;
 
   VkBuffer stagingBuffer;
   VkDeviceMemory stagingBufferMemory;
@@ -33,26 +34,21 @@ void ChiSim::CreateTextureImage()
   memcpy(data, pixels, static_cast<size_t>(imageSize));
   vkUnmapMemory(m_device, stagingBufferMemory);
 
-  stbi_image_free(pixels);
-
-  CreateImage(texWidth, texHeight,
+  CreateImage(width, height,
               VK_FORMAT_R8G8B8A8_SRGB,
               VK_IMAGE_TILING_OPTIMAL,
               VK_IMAGE_USAGE_TRANSFER_DST_BIT |
               VK_IMAGE_USAGE_SAMPLED_BIT,
               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-              m_texture_image,
-              m_texture_image_memory);
+              image,
+              image_memory);
 
-  TransitionImageLayout(m_texture_image,
+  TransitionImageLayout(image,
                         VK_FORMAT_R8G8B8A8_SRGB,
                         VK_IMAGE_LAYOUT_UNDEFINED,
                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-  CopyBufferToImage(stagingBuffer,
-                    m_texture_image,
-                    static_cast<uint32_t>(texWidth),
-                    static_cast<uint32_t>(texHeight));
-  TransitionImageLayout(m_texture_image,
+  CopyBufferToImage(stagingBuffer, image, width, height);
+  TransitionImageLayout(image,
                         VK_FORMAT_R8G8B8A8_SRGB,
                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                         VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
@@ -61,22 +57,18 @@ void ChiSim::CreateTextureImage()
   vkFreeMemory(m_device, stagingBufferMemory, nullptr);
 }
 
-
 //###################################################################
-/** Create texture image view. */
-void ChiSim::CreateTextureImageView()
-{
-  m_texture_image_view =
-    CreateImageView(m_texture_image, VK_FORMAT_R8G8B8A8_SRGB);
-}
-
-//###################################################################
-/** Transition image layout. */
+/** Transition image layout. The stages and access masks on either
+ * side of the barrier are derived from the layouts, using the same
+ * rules the render graph applies.*/
 void ChiSim::TransitionImageLayout(VkImage image,
                                    VkFormat format,
                                    VkImageLayout oldLayout,
                                    VkImageLayout newLayout)
 {
+  auto srcState = ChiRenderGraph::GetLayoutAccessState(oldLayout);
+  auto dstState = ChiRenderGraph::GetLayoutAccessState(newLayout);
+
   VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
 
   VkImageMemoryBarrier barrier = {};
@@ -92,35 +84,20 @@ void ChiSim::TransitionImageLayout(VkImage image,
   barrier.subresourceRange.baseArrayLayer = 0;
   barrier.subresourceRange.layerCount = 1;
 
-  VkPipelineStageFlags sourceStage;
-  VkPipelineStageFlags destinationStage;
-
-  if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED &&
-      newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+  if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL ||
+      newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL)
   {
-    barrier.srcAccessMask = 0;
-    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-    sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-    destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    if (HasStencilComponent(format))
+      barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
   }
-  else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL &&
-           newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-  {
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
-    sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-    destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-  }
-  else
-  {
-    throw std::invalid_argument("unsupported layout transition!");
-  }
+  barrier.srcAccessMask = srcState.access;
+  barrier.dstAccessMask = dstState.access;
 
   vkCmdPipelineBarrier(
     commandBuffer,
-    sourceStage, destinationStage,
+    srcState.stages, dstState.stages,
     0,
     0, nullptr,
     0, nullptr,
@@ -0,0 +1,408 @@
+#include "chi_sim.h"
+
+//###################################################################
+/** Creates the shared vertex and index buffers. Meshes are
+ * sub-allocated from these with UploadMesh so the whole scene binds
+ * geometry once per frame and selects meshes through firstIndex and
+ * vertexOffset. The storage buffers of pulled meshes are shared the
+ * same way (see UploadFieldMesh); their field values once per frame
+ * slot, each with a command buffer copying field updates into it.*/
+void ChiSim::CreateGeometryBuffers()
+{
+  CreateBuffer(sizeof(Vertex) * VkDeviceSize(k_geometry_vertex_capacity),
+               VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+               VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+               m_vertex_buffer,
+               m_vertex_buffer_memory);
+
+  CreateBuffer(sizeof(uint32_t) * VkDeviceSize(k_geometry_index_capacity),
+               VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+               VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+               m_index_buffer,
+               m_index_buffer_memory);
+
+  m_vertex_allocator.Reset(k_geometry_vertex_capacity);
+  m_index_allocator.Reset(k_geometry_index_capacity);
+
+  //============================ Pulled geometry
+  CreateBuffer(3 * sizeof(float) * VkDeviceSize(k_geometry_vertex_capacity),
+               VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+               m_pulled_coordinate_buffer,
+               m_pulled_coordinate_buffer_memory);
+
+  CreateBuffer(sizeof(float) * VkDeviceSize(k_geometry_vertex_capacity) *
+               MAX_FRAMES_IN_FLIGHT,
+               VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+               VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+               m_pulled_field_buffer,
+               m_pulled_field_buffer_memory);
+
+  CreateBuffer(sizeof(uint32_t) * VkDeviceSize(k_geometry_index_capacity),
+               VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+               m_pulled_connectivity_buffer,
+               m_pulled_connectivity_buffer_memory);
+
+  m_pulled_vertex_allocator.Reset(k_geometry_vertex_capacity);
+  m_pulled_index_allocator.Reset(k_geometry_index_capacity);
+
+  //============================ Field copies
+  m_field_command_buffers.resize(MAX_FRAMES_IN_FLIGHT);
+
+  VkCommandBufferAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.commandPool = m_command_pool;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandBufferCount = MAX_FRAMES_IN_FLIGHT;
+
+  if (vkAllocateCommandBuffers(m_device, &allocInfo,
+                               m_field_command_buffers.data()) != VK_SUCCESS)
+    throw std::runtime_error("failed to allocate field command buffers!");
+
+  m_field_copy_values.assign(MAX_FRAMES_IN_FLIGHT, 0);
+  m_field_staging.assign(MAX_FRAMES_IN_FLIGHT, FieldStaging());
+  m_stale_field_ranges.assign(MAX_FRAMES_IN_FLIGHT, {});
+}
+
+//###################################################################
+/** Sub-allocates a mesh in the shared geometry buffers and uploads
+ * its data through a staging buffer. Indices are relative to the
+ * mesh's first vertex. Command buffers are re-recorded before their
+ * next use. Uploading the same vertices and indices again returns the
+ * existing mesh, which is then only freed by its last FreeMesh, unless
+ * `shared` is false: then the mesh is private to the caller and never
+ * registered.*/
+ChiSim::MeshID ChiSim::UploadMesh(const std::vector<Vertex>& mesh_vertices,
+                                  const std::vector<uint32_t>& mesh_indices,
+                                  bool shared)
+{
+  //============================ Share identical meshes
+  // Vertex is taken member by member, its padding is uninitialized.
+  typedef ChiResourceRegistry<MeshID> MeshRegistry;
+  MeshRegistry::Content content;
+  if (shared)
+  {
+    const char tag[] = "interleaved";
+    content.reserve(sizeof(tag) + sizeof(Vertex) * mesh_vertices.size() +
+                    sizeof(uint32_t) * mesh_indices.size());
+    MeshRegistry::Append(content, tag, sizeof(tag));
+    for (const auto& vertex : mesh_vertices)
+    {
+      MeshRegistry::Append(content, &vertex.pos.x, 3 * sizeof(float));
+      MeshRegistry::Append(content, &vertex.color.x, 3 * sizeof(float));
+      MeshRegistry::Append(content, &vertex.texCoord.x, 2 * sizeof(float));
+    }
+    MeshRegistry::Append(content, mesh_indices.data(),
+                         sizeof(uint32_t) * mesh_indices.size());
+
+    MeshID sharedMesh;
+    if (m_mesh_registry.Acquire(content, sharedMesh)) return sharedMesh;
+  }
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  //============================ Allocate ranges
+  uint32_t vertexOffset = m_vertex_allocator.Allocate(mesh_vertices.size());
+  if (vertexOffset == ChiOffsetAllocator::INVALID_OFFSET)
+    throw std::runtime_error("failed to allocate mesh vertices!");
+
+  uint32_t firstIndex = m_index_allocator.Allocate(mesh_indices.size());
+  if (firstIndex == ChiOffsetAllocator::INVALID_OFFSET)
+  {
+    m_vertex_allocator.Free(vertexOffset);
+    throw std::runtime_error("failed to allocate mesh indices!");
+  }
+
+  //============================ Fill staging buffer
+  VkDeviceSize vertexBytes = sizeof(Vertex) * mesh_vertices.size();
+  VkDeviceSize indexBytes  = sizeof(uint32_t) * mesh_indices.size();
+
+  VkBuffer stagingBuffer;
+  VkDeviceMemory stagingBufferMemory;
+  CreateBuffer(vertexBytes + indexBytes,
+               VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+               VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+               stagingBuffer,
+               stagingBufferMemory);
+
+  void* data;
+  vkMapMemory(m_device, stagingBufferMemory,
+              0, vertexBytes + indexBytes, 0, &data);
+  memcpy(data, mesh_vertices.data(), (size_t) vertexBytes);
+  memcpy(static_cast<char*>(data) + vertexBytes,
+         mesh_indices.data(), (size_t) indexBytes);
+  vkUnmapMemory(m_device, stagingBufferMemory);
+
+  //============================ Copy into the shared buffers
+  VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+
+  VkBufferCopy vertexRegion = {};
+  vertexRegion.srcOffset = 0;
+  vertexRegion.dstOffset = sizeof(Vertex) * VkDeviceSize(vertexOffset);
+  vertexRegion.size = vertexBytes;
+  vkCmdCopyBuffer(commandBuffer, stagingBuffer, m_vertex_buffer,
+                  1, &vertexRegion);
+
+  VkBufferCopy indexRegion = {};
+  indexRegion.srcOffset = vertexBytes;
+  indexRegion.dstOffset = sizeof(uint32_t) * VkDeviceSize(firstIndex);
+  indexRegion.size = indexBytes;
+  vkCmdCopyBuffer(commandBuffer, stagingBuffer, m_index_buffer,
+                  1, &indexRegion);
+
+  EndSingleTimeCommands(commandBuffer);
+
+  vkDestroyBuffer(m_device, stagingBuffer, nullptr);
+  vkFreeMemory(m_device, stagingBufferMemory, nullptr);
+
+  //============================ Register mesh
+  MeshRange mesh;
+  mesh.first_index   = firstIndex;
+  mesh.index_count   = mesh_indices.size();
+  mesh.vertex_offset = static_cast<int32_t>(vertexOffset);
+  mesh.vertex_count  = mesh_vertices.size();
+  mesh.active        = true;
+  mesh.shared        = shared;
+
+  MeshID meshID;
+  if (!m_free_mesh_ids.empty())
+  {
+    meshID = m_free_mesh_ids.back();
+    m_free_mesh_ids.pop_back();
+    m_meshes[meshID] = mesh;
+  }
+  else
+  {
+    meshID = m_meshes.size();
+    m_meshes.push_back(mesh);
+  }
+
+  ++m_scene_generation;
+
+  auto end = std::chrono::high_resolution_clock::now();
+  if (shared)
+    m_meshes[meshID].key = m_mesh_registry.Insert(
+      content, meshID, vertexBytes + indexBytes,
+      std::chrono::duration<double, std::milli>(end - start).count());
+
+  return meshID;
+}
+
+//###################################################################
+/** Uploads solver output as-is for vertex pulling: `coordinates` holds
+ * x, y, z per vertex, `connectivity` triangle indices relative to the
+ * mesh's first vertex and `field_values` one scalar per vertex. Each
+ * array is copied straight into its storage buffer, so no interleaving
+ * happens on the CPU. The field is shown as the color's luminance
+ * (DrawParameters::field_id 0). Identical arrays share one mesh, as
+ * with UploadMesh. Without vertex pulling the arrays are interleaved
+ * and uploaded with UploadMesh.*/
+ChiSim::MeshID ChiSim::UploadFieldMesh(const std::vector<float>& coordinates,
+                                       const std::vector<uint32_t>& connectivity,
+                                       const std::vector<float>& field_values)
+{
+  if (coordinates.size() != 3 * field_values.size())
+    throw std::runtime_error("failed to upload field mesh, "
+                             "coordinates and field values differ in size!");
+
+  return UploadFieldMesh(coordinates.data(), field_values.size(),
+                         connectivity.data(), connectivity.size(),
+                         field_values.data());
+}
+
+//###################################################################
+/** Uploads a field mesh straight from a solver's arrays: 3 *
+ * `num_vertices` coordinates, `num_indices` connectivity entries and
+ * `num_vertices` field values. The arrays are only read during the
+ * call. A mesh whose field will be updated must not be `shared`.*/
+ChiSim::MeshID ChiSim::UploadFieldMesh(const float* coordinates,
+                                       size_t num_vertices,
+                                       const uint32_t* connectivity,
+                                       size_t num_indices,
+                                       const float* field_values,
+                                       bool shared)
+{
+  const size_t numVertices = num_vertices;
+
+  if (!IsVertexPullingAvailable())
+    return UploadMesh(InterleaveFieldMesh(coordinates, numVertices,
+                                          field_values),
+                      std::vector<uint32_t>(connectivity,
+                                            connectivity + num_indices),
+                      shared);
+
+  //============================ Share identical meshes
+  typedef ChiResourceRegistry<MeshID> MeshRegistry;
+  MeshRegistry::Content content;
+  if (shared)
+  {
+    const char tag[] = "pulled";
+    content.reserve(sizeof(tag) + 4 * sizeof(float) * numVertices +
+                    sizeof(uint32_t) * num_indices);
+    MeshRegistry::Append(content, tag, sizeof(tag));
+    MeshRegistry::Append(content, coordinates,
+                         3 * sizeof(float) * numVertices);
+    MeshRegistry::Append(content, connectivity,
+                         sizeof(uint32_t) * num_indices);
+    MeshRegistry::Append(content, field_values, sizeof(float) * numVertices);
+
+    MeshID sharedMesh;
+    if (m_mesh_registry.Acquire(content, sharedMesh)) return sharedMesh;
+  }
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  //============================ Allocate ranges
+  uint32_t vertexOffset = m_pulled_vertex_allocator.Allocate(numVertices);
+  if (vertexOffset == ChiOffsetAllocator::INVALID_OFFSET)
+    throw std::runtime_error("failed to allocate mesh vertices!");
+
+  uint32_t firstIndex = m_pulled_index_allocator.Allocate(num_indices);
+  if (firstIndex == ChiOffsetAllocator::INVALID_OFFSET)
+  {
+    m_pulled_vertex_allocator.Free(vertexOffset);
+    throw std::runtime_error("failed to allocate mesh indices!");
+  }
+
+  //============================ Fill staging buffer
+  VkDeviceSize coordinateBytes = 3 * sizeof(float) * numVertices;
+  VkDeviceSize fieldBytes      = sizeof(float) * numVertices;
+  VkDeviceSize indexBytes      = sizeof(uint32_t) * num_indices;
+  VkDeviceSize stagingBytes    = coordinateBytes + fieldBytes + indexBytes;
+
+  VkBuffer stagingBuffer;
+  VkDeviceMemory stagingBufferMemory;
+  CreateBuffer(stagingBytes,
+               VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+               VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+               stagingBuffer,
+               stagingBufferMemory);
+
+  void* data;
+  vkMapMemory(m_device, stagingBufferMemory, 0, stagingBytes, 0, &data);
+  char* bytes = static_cast<char*>(data);
+  memcpy(bytes, coordinates, (size_t) coordinateBytes);
+  memcpy(bytes + coordinateBytes, field_values, (size_t) fieldBytes);
+  memcpy(bytes + coordinateBytes + fieldBytes,
+         connectivity, (size_t) indexBytes);
+  vkUnmapMemory(m_device, stagingBufferMemory);
+
+  //============================ Copy into the shared buffers
+  VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+
+  VkBufferCopy coordinateRegion = {};
+  coordinateRegion.srcOffset = 0;
+  coordinateRegion.dstOffset = 3 * sizeof(float) * VkDeviceSize(vertexOffset);
+  coordinateRegion.size = coordinateBytes;
+  vkCmdCopyBuffer(commandBuffer, stagingBuffer, m_pulled_coordinate_buffer,
+                  1, &coordinateRegion);
+
+  // Into every frame slot's range.
+  std::vector<VkBufferCopy> fieldRegions(MAX_FRAMES_IN_FLIGHT);
+  for (size_t frame = 0; frame < fieldRegions.size(); ++frame)
+  {
+    fieldRegions[frame].srcOffset = coordinateBytes;
+    fieldRegions[frame].dstOffset =
+      GetPulledFieldOffset(frame, static_cast<int32_t>(vertexOffset));
+    fieldRegions[frame].size = fieldBytes;
+  }
+  vkCmdCopyBuffer(commandBuffer, stagingBuffer, m_pulled_field_buffer,
+                  uint32_t(fieldRegions.size()), fieldRegions.data());
+
+  VkBufferCopy indexRegion = {};
+  indexRegion.srcOffset = coordinateBytes + fieldBytes;
+  indexRegion.dstOffset = sizeof(uint32_t) * VkDeviceSize(firstIndex);
+  indexRegion.size = indexBytes;
+  vkCmdCopyBuffer(commandBuffer, stagingBuffer, m_pulled_connectivity_buffer,
+                  1, &indexRegion);
+
+  EndSingleTimeCommands(commandBuffer);
+
+  vkDestroyBuffer(m_device, stagingBuffer, nullptr);
+  vkFreeMemory(m_device, stagingBufferMemory, nullptr);
+
+  //============================ Register mesh
+  MeshRange mesh;
+  mesh.first_index   = firstIndex;
+  mesh.index_count   = num_indices;
+  mesh.vertex_offset = static_cast<int32_t>(vertexOffset);
+  mesh.vertex_count  = numVertices;
+  mesh.active        = true;
+  mesh.pulled        = true;
+  mesh.shared        = shared;
+
+  MeshID meshID;
+  if (!m_free_mesh_ids.empty())
+  {
+    meshID = m_free_mesh_ids.back();
+    m_free_mesh_ids.pop_back();
+    m_meshes[meshID] = mesh;
+  }
+  else
+  {
+    meshID = m_meshes.size();
+    m_meshes.push_back(mesh);
+  }
+
+  ++m_scene_generation;
+
+  auto end = std::chrono::high_resolution_clock::now();
+  if (shared)
+    m_meshes[meshID].key = m_mesh_registry.Insert(
+      content, meshID, stagingBytes,
+      std::chrono::duration<double, std::milli>(end - start).count());
+
+  return meshID;
+}
+
+//###################################################################
+/** Drops a reference to a mesh and removes it from the scene when it
+ * was the last one. Its ranges in the shared geometry buffers are
+ * returned to the allocators once the frames that may still draw it
+ * have retired.*/
+void ChiSim::FreeMesh(MeshID mesh_id)
+{
+  if (mesh_id >= m_meshes.size() || !m_meshes[mesh_id].active)
+    throw std::runtime_error("failed to free mesh, invalid mesh id!");
+
+  MeshRange& mesh = m_meshes[mesh_id];
+
+  MeshID sharedMesh;
+  if (mesh.shared && !m_mesh_registry.Release(mesh.key, sharedMesh)) return;
+
+  mesh.active = false;
+
+  // Field copies recorded into its ranges are submitted before the
+  // ranges retire, and pending ones dropped.
+  if (mesh.pulled)
+  {
+    for (auto& staleRanges : m_stale_field_ranges) staleRanges.erase(mesh_id);
+    if (m_field_copies_recording) SubmitFieldCopies();
+  }
+
+  ChiOffsetAllocator& vertexAllocator =
+    mesh.pulled ? m_pulled_vertex_allocator : m_vertex_allocator;
+  ChiOffsetAllocator& indexAllocator =
+    mesh.pulled ? m_pulled_index_allocator : m_index_allocator;
+
+  RetireAfter(m_graphics_timeline.last_submitted,
+    [this, mesh_id, &vertexAllocator, &indexAllocator,
+     vertexOffset = static_cast<uint32_t>(mesh.vertex_offset),
+     firstIndex = mesh.first_index]()
+    {
+      vertexAllocator.Free(vertexOffset);
+      indexAllocator.Free(firstIndex);
+      m_free_mesh_ids.push_back(mesh_id);
+    });
+
+  ++m_scene_generation;
+}
@@ -0,0 +1,184 @@
+#include "chi_sim.h"
+
+//###################################################################
+/** Creates the descriptor set layout of the bindless texture array
+ * (set 2): one runtime-sized array of combined image samplers. Slots
+ * that were never written are allowed (partially bound) and slots can
+ * be written while command buffers using other slots are recorded or
+ * pending (update after bind, update unused while pending). Does
+ * nothing without descriptor indexing support.*/
+void ChiSim::CreateBindlessDescriptorSetLayout()
+{
+  if (!m_bindless_supported) return;
+
+  //============================ Capacity within device limits
+  VkPhysicalDeviceVulkan12Properties properties12 = {};
+  properties12.sType =
+    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+
+  VkPhysicalDeviceProperties2 properties2 = {};
+  properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  properties2.pNext = &properties12;
+  vkGetPhysicalDeviceProperties2(m_physical_device, &properties2);
+
+  m_bindless_capacity = std::min({
+    k_max_bindless_textures,
+    properties12.maxDescriptorSetUpdateAfterBindSampledImages,
+    properties12.maxDescriptorSetUpdateAfterBindSamplers,
+    properties12.maxPerStageDescriptorUpdateAfterBindSampledImages,
+    properties12.maxPerStageDescriptorUpdateAfterBindSamplers});
+
+  //============================ Layout
+  VkDescriptorSetLayoutBinding textureBinding = {};
+  textureBinding.binding = 0;
+  textureBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  textureBinding.descriptorCount = m_bindless_capacity;
+  textureBinding.pImmutableSamplers = nullptr;
+  textureBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+  VkDescriptorBindingFlags bindingFlags =
+    VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+    VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+    VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+
+  VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo = {};
+  bindingFlagsInfo.sType =
+    VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+  bindingFlagsInfo.bindingCount = 1;
+  bindingFlagsInfo.pBindingFlags = &bindingFlags;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.pNext = &bindingFlagsInfo;
+  layoutInfo.flags =
+    VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+  layoutInfo.bindingCount = 1;
+  layoutInfo.pBindings = &textureBinding;
+
+  if (vkCreateDescriptorSetLayout(m_device,
+                                  &layoutInfo,
+                                  nullptr,
+                                  &m_bindless_descriptor_set_layout) !=
+      VK_SUCCESS)
+    throw std::runtime_error("failed to create descriptor set layout!");
+}
+
+//###################################################################
+/** Allocates the bindless texture set. It is shared by all swap chain
+ * images, so it is created once, before any texture is loaded.*/
+void ChiSim::CreateBindlessDescriptors()
+{
+  if (!m_bindless_supported) return;
+
+  VkDescriptorPoolSize poolSize = {};
+  poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSize.descriptorCount = m_bindless_capacity;
+
+  VkDescriptorPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+  poolInfo.poolSizeCount = 1;
+  poolInfo.pPoolSizes = &poolSize;
+  poolInfo.maxSets = 1;
+
+  if (vkCreateDescriptorPool(m_device,
+                             &poolInfo,
+                             nullptr,
+                             &m_bindless_descriptor_pool) != VK_SUCCESS)
+    throw std::runtime_error("failed to create descriptor pool!");
+
+  VkDescriptorSetAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = m_bindless_descriptor_pool;
+  allocInfo.descriptorSetCount = 1;
+  allocInfo.pSetLayouts = &m_bindless_descriptor_set_layout;
+
+  if (vkAllocateDescriptorSets(m_device,
+                               &allocInfo,
+                               &m_bindless_descriptor_set) != VK_SUCCESS)
+    throw std::runtime_error("failed to allocate descriptor sets!");
+}
+
+//###################################################################
+/** Writes a texture into a free bindless slot and returns the slot,
+ * which draws select through DrawParameters::texture_index. The write
+ * is safe while frames are in flight since no pending frame uses a
+ * free slot. Without bindless support every draw samples the main
+ * texture and 0 is returned.*/
+uint32_t ChiSim::RegisterTexture(VkImageView image_view, VkSampler sampler)
+{
+  if (!m_bindless_supported) return 0;
+
+  uint32_t slot;
+  if (!m_bindless_free_slots.empty())
+  {
+    slot = m_bindless_free_slots.back();
+    m_bindless_free_slots.pop_back();
+  }
+  else if (m_bindless_next_slot < m_bindless_capacity)
+    slot = m_bindless_next_slot++;
+  else
+    throw std::runtime_error("failed to register texture, "
+                             "no free bindless slots!");
+
+  VkDescriptorImageInfo imageInfo = {};
+  imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  imageInfo.imageView = image_view;
+  imageInfo.sampler = sampler;
+
+  VkWriteDescriptorSet descriptorWrite = {};
+  descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  descriptorWrite.dstSet = m_bindless_descriptor_set;
+  descriptorWrite.dstBinding = 0;
+  descriptorWrite.dstArrayElement = slot;
+  descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  descriptorWrite.descriptorCount = 1;
+  descriptorWrite.pImageInfo = &imageInfo;
+
+  vkUpdateDescriptorSets(m_device, 1, &descriptorWrite, 0, nullptr);
+
+  return slot;
+}
+
+//###################################################################
+/** Returns a bindless slot to the free list once every frame submitted
+ * so far has retired, so a frame in flight never samples a texture
+ * re-registered into its slot. Draws using the slot must have been
+ * removed before. The texture itself stays owned by the caller, who
+ * must keep it alive equally long (e.g. with RetireAfter).*/
+void ChiSim::ReleaseTexture(uint32_t slot)
+{
+  if (!m_bindless_supported) return;
+
+  RetireAfter(m_graphics_timeline.last_submitted,
+    [this, slot]() { m_bindless_free_slots.push_back(slot); });
+}
+
+//###################################################################
+/** Creates the textures of the draw benchmark: small checkerboards in
+ * distinct colors, each in its own bindless slot.*/
+void ChiSim::CreateBenchmarkTextures()
+{
+  const uint32_t size = 64;
+  const uint32_t checkerSize = 8;
+
+  for (uint32_t t = 0; t < k_benchmark_textures; ++t)
+  {
+    const uint8_t color[3] = {uint8_t((t & 1) ? 255 : 64),
+                              uint8_t((t & 2) ? 255 : 64),
+                              uint8_t((t & 4) ? 255 : 64)};
+
+    std::vector<uint8_t> pixels(size * size * 4);
+    for (uint32_t y = 0; y < size; ++y)
+      for (uint32_t x = 0; x < size; ++x)
+      {
+        const bool dark = ((x / checkerSize) + (y / checkerSize)) % 2;
+        uint8_t* pixel = &pixels[4 * (y * size + x)];
+        for (int c = 0; c < 3; ++c)
+          pixel[c] = dark ? color[c] / 2 : color[c];
+        pixel[3] = 255;
+      }
+
+    m_benchmark_textures.push_back(LoadTexture(size, size, pixels.data()));
+  }
+}
@@ -0,0 +1,265 @@
+#include "chi_sim.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <cmath>
+
+//###################################################################
+/** Loads a texture from an image file. Files with identical bytes,
+ * whatever their path, share one texture; the file is only decoded
+ * and uploaded the first time.*/
+ChiSim::Texture ChiSim::LoadTexture(const std::string& path)
+{
+  typedef ChiResourceRegistry<Texture> TextureRegistry;
+
+  std::vector<char> fileBytes = ReadFileToBuffer(path);
+  TextureRegistry::Content content(fileBytes.begin(), fileBytes.end());
+
+  Texture texture;
+  if (m_texture_registry.Acquire(content, texture)) return texture;
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  int texWidth, texHeight, texChannels;
+  stbi_uc* pixels =
+    stbi_load_from_memory(reinterpret_cast<stbi_uc*>(fileBytes.data()),
+                          static_cast<int>(fileBytes.size()),
+                          &texWidth,
+                          &texHeight,
+                          &texChannels,
+                          STBI_rgb_alpha);
+
+  if (!pixels)
+    throw std::runtime_error("failed to load texture image!");
+
+  texture = CreateTexture(static_cast<uint32_t>(texWidth),
+                          static_cast<uint32_t>(texHeight),
+                          pixels);
+
+  stbi_image_free(pixels);
+
+  auto end = std::chrono::high_resolution_clock::now();
+  texture.key = m_texture_registry.Insert(content, texture,
+    uint64_t(texWidth) * uint64_t(texHeight) * 4,
+    std::chrono::duration<double, std::milli>(end - start).count());
+
+  return texture;
+}
+
+//###################################################################
+/** Loads a texture from RGBA8 pixels in memory. Identical dimensions
+ * and pixels share one texture.*/
+ChiSim::Texture ChiSim::LoadTexture(uint32_t width,
+                                    uint32_t height,
+                                    const void* pixels)
+{
+  typedef ChiResourceRegistry<Texture> TextureRegistry;
+
+  const uint64_t numBytes = uint64_t(width) * height * 4;
+
+  TextureRegistry::Content content;
+  content.reserve(2 * sizeof(uint32_t) + numBytes);
+  TextureRegistry::Append(content, &width, sizeof(width));
+  TextureRegistry::Append(content, &height, sizeof(height));
+  TextureRegistry::Append(content, pixels, numBytes);
+
+  Texture texture;
+  if (m_texture_registry.Acquire(content, texture)) return texture;
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  texture = CreateTexture(width, height, pixels);
+
+  auto end = std::chrono::high_resolution_clock::now();
+  texture.key = m_texture_registry.Insert(content, texture,
+    numBytes,
+    std::chrono::duration<double, std::milli>(end - start).count());
+
+  return texture;
+}
+
+//###################################################################
+/** Creates a texture's image and view and registers it in a bindless
+ * slot.*/
+ChiSim::Texture ChiSim::CreateTexture(uint32_t width,
+                                      uint32_t height,
+                                      const void* pixels)
+{
+  Texture texture;
+  CreateTextureFromPixels(width, height, pixels,
+                          texture.image, texture.memory);
+  texture.view = CreateImageView(texture.image, VK_FORMAT_R8G8B8A8_SRGB);
+  texture.slot = RegisterTexture(texture.view, m_texture_sampler);
+
+  return texture;
+}
+
+//###################################################################
+/** Drops a reference to a texture. The last one releases its bindless
+ * slot and destroys it once the frames that may still sample it have
+ * retired. Draws using the texture must have been removed before.*/
+void ChiSim::UnloadTexture(const Texture& texture)
+{
+  Texture sharedTexture;
+  if (!m_texture_registry.Release(texture.key, sharedTexture)) return;
+
+  ReleaseTexture(sharedTexture.slot);
+
+  RetireAfter(m_graphics_timeline.last_submitted,
+    [this, sharedTexture]()
+    {
+      vkDestroyImageView(m_device, sharedTexture.view, nullptr);
+      vkDestroyImage(m_device, sharedTexture.image, nullptr);
+      vkFreeMemory(m_device, sharedTexture.memory, nullptr);
+    });
+}
+
+//###################################################################
+/** Returns a sampler for the create-info, shared with every other
+ * request for the same create-info. The create-info is identified by
+ * its members, not its bytes, so its padding does not matter; it must
+ * not chain a pNext.*/
+VkSampler ChiSim::AcquireSampler(const VkSamplerCreateInfo& sampler_info)
+{
+  if (sampler_info.pNext != nullptr)
+    throw std::runtime_error("failed to acquire sampler, "
+                             "chained create-infos are not supported!");
+
+  //============================ Identify by members
+  typedef ChiResourceRegistry<VkSampler> SamplerRegistry;
+  SamplerRegistry::Content content;
+  auto append = [&content](const auto& member)
+    { SamplerRegistry::Append(content, &member, sizeof(member)); };
+
+  append(sampler_info.flags);
+  append(sampler_info.magFilter);
+  append(sampler_info.minFilter);
+  append(sampler_info.mipmapMode);
+  append(sampler_info.addressModeU);
+  append(sampler_info.addressModeV);
+  append(sampler_info.addressModeW);
+  append(sampler_info.mipLodBias);
+  append(sampler_info.anisotropyEnable);
+  append(sampler_info.maxAnisotropy);
+  append(sampler_info.compareEnable);
+  append(sampler_info.compareOp);
+  append(sampler_info.minLod);
+  append(sampler_info.maxLod);
+  append(sampler_info.borderColor);
+  append(sampler_info.unnormalizedCoordinates);
+
+  VkSampler sampler;
+  if (m_sampler_registry.Acquire(content, sampler)) return sampler;
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  if (vkCreateSampler(m_device,
+                      &sampler_info,
+                      nullptr,
+                      &sampler) != VK_SUCCESS)
+    throw std::runtime_error("failed to create texture sampler!");
+
+  auto end = std::chrono::high_resolution_clock::now();
+  m_sampler_keys[sampler] = m_sampler_registry.Insert(content,
+    sampler, 0,
+    std::chrono::duration<double, std::milli>(end - start).count());
+
+  return sampler;
+}
+
+//###################################################################
+/** Drops a reference to a sampler. The last one destroys it once the
+ * frames that may still use it have retired.*/
+void ChiSim::ReleaseSampler(VkSampler sampler)
+{
+  auto samplerKey = m_sampler_keys.find(sampler);
+  if (samplerKey == m_sampler_keys.end())
+    throw std::runtime_error("failed to release sampler, "
+                             "sampler was not acquired!");
+
+  VkSampler sharedSampler;
+  if (!m_sampler_registry.Release(samplerKey->second, sharedSampler)) return;
+
+  m_sampler_keys.erase(samplerKey);
+
+  RetireAfter(m_graphics_timeline.last_submitted,
+    [this, sharedSampler]()
+    { vkDestroySampler(m_device, sharedSampler, nullptr); });
+}
+
+//###################################################################
+/** Builds the repeated asset scene: a grid of k_repeated_assets copies
+ * of the main mesh, each uploaded and textured as if it were its own
+ * asset. All copies resolve to the main mesh and texture, so only one
+ * of each exists on the device.*/
+void ChiSim::LoadRepeatedAssetScene()
+{
+  const uint32_t side =
+    static_cast<uint32_t>(std::ceil(std::sqrt(float(k_repeated_assets))));
+  const float spacing = 2.0f / float(side);
+
+  for (uint32_t a = 0; a < k_repeated_assets; ++a)
+  {
+    const float x = -1.0f + spacing * (float(a % side) + 0.5f);
+    const float y = -1.0f + spacing * (float(a / side) + 0.5f);
+
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(x, y, -0.5f));
+    model = glm::scale(model, glm::vec3(0.5f * spacing));
+
+    DrawParameters parameters;
+    parameters.texture_index = LoadTexture(k_texture_path).slot;
+
+    AddDraw(UploadMesh(vertices, indices), model, parameters);
+  }
+}
+
+//###################################################################
+/** Prints how many requests each resource registry served from an
+ * existing resource and the device memory and creation time that
+ * saved.*/
+void ChiSim::PrintResourceStatistics()
+{
+  auto print = [](const char* name, size_t numResources,
+                  const auto& statistics)
+  {
+    if (statistics.requests == 0) return;
+
+    std::cout << name << " registry: " << numResources << " resources, "
+              << statistics.requests << " requests, "
+              << statistics.hits << " shared, "
+              << double(statistics.bytes_saved) / (1024.0 * 1024.0)
+              << " MiB VRAM saved, " << statistics.ms_saved
+              << " ms load time saved" << std::endl;
+  };
+
+  print("Texture", m_texture_registry.GetNumResources(),
+        m_texture_registry.GetStatistics());
+  print("Mesh", m_mesh_registry.GetNumResources(),
+        m_mesh_registry.GetStatistics());
+  print("Sampler", m_sampler_registry.GetNumResources(),
+        m_sampler_registry.GetStatistics());
+}
+
+//###################################################################
+/** Destroys every texture and sampler still registered, whatever its
+ * reference count. Only called once the device is idle. Meshes live in
+ * the shared geometry buffers and go with them.*/
+void ChiSim::DestroyResourceRegistries()
+{
+  m_texture_registry.ForEach([this](const Texture& texture)
+  {
+    vkDestroyImageView(m_device, texture.view, nullptr);
+    vkDestroyImage(m_device, texture.image, nullptr);
+    vkFreeMemory(m_device, texture.memory, nullptr);
+  });
+  m_texture_registry.Clear();
+  m_benchmark_textures.clear();
+
+  m_sampler_registry.ForEach([this](VkSampler sampler)
+  { vkDestroySampler(m_device, sampler, nullptr); });
+  m_sampler_registry.Clear();
+  m_sampler_keys.clear();
+
+  m_mesh_registry.Clear();
+}
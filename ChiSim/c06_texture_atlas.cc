@@ -0,0 +1,310 @@
+#include "chi_sim.h"
+
+//###################################################################
+/** Creates the texture atlas's placeholder: a single transparent
+ * texel, so the descriptor sets have an atlas view to bind. The atlas
+ * itself is only allocated by the first AddAtlasImage.*/
+void ChiSim::CreateTextureAtlas()
+{
+  CreateAtlasImage(1, 1);
+}
+
+//###################################################################
+/** Allocates the texture atlas, k_atlas_layers layers of
+ * k_atlas_size^2 texels and a skyline packer per layer, in place of
+ * the placeholder. The placeholder is destroyed once the frames
+ * sampling it have retired. The descriptor sets are rewritten for the
+ * new view and the command buffers re-recorded before their next use;
+ * the old sets are freed with the placeholder.*/
+void ChiSim::AllocateTextureAtlas()
+{
+  RetireAfter(m_graphics_timeline.last_submitted,
+    [this,
+     imageView = m_atlas_image_view,
+     image = m_atlas_image,
+     imageMemory = m_atlas_image_memory,
+     descriptorSets = m_descriptor_sets]()
+    {
+      for (auto set : descriptorSets)
+        m_descriptor_allocator.Free(set);
+
+      vkDestroyImageView(m_device, imageView, nullptr);
+      vkDestroyImage(m_device, image, nullptr);
+      vkFreeMemory(m_device, imageMemory, nullptr);
+    });
+
+  CreateAtlasImage(k_atlas_size, k_atlas_layers);
+  m_atlas_packers.assign(k_atlas_layers,
+                         ChiSkylinePacker(k_atlas_size, k_atlas_size));
+
+  // Only the set 0 contents change, the set 1 lookups return the
+  // existing sets.
+  CreateDescriptorSets();
+  ++m_scene_generation;
+}
+
+//###################################################################
+/** Creates the atlas image: an RGBA8 sRGB array image of `layers`
+ * layers of `size`^2 texels, cleared to transparent black and ready
+ * for sampling by the frames submitted after it.*/
+void ChiSim::CreateAtlasImage(uint32_t size, uint32_t layers)
+{
+  //============================ Image
+  VkImageCreateInfo imageInfo = {};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.extent.width = size;
+  imageInfo.extent.height = size;
+  imageInfo.extent.depth = 1;
+  imageInfo.mipLevels = 1;
+  imageInfo.arrayLayers = layers;
+  imageInfo.format = VK_FORMAT_R8G8B8A8_SRGB;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                    VK_IMAGE_USAGE_SAMPLED_BIT;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  if (vkCreateImage(m_device, &imageInfo, nullptr, &m_atlas_image) !=
+      VK_SUCCESS)
+    throw std::runtime_error("failed to create image!");
+
+  VkMemoryRequirements memRequirements;
+  vkGetImageMemoryRequirements(m_device, m_atlas_image, &memRequirements);
+
+  VkMemoryAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = memRequirements.size;
+  allocInfo.memoryTypeIndex =
+    FindMemoryType(memRequirements.memoryTypeBits,
+                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+  if (vkAllocateMemory(m_device,
+                       &allocInfo,
+                       nullptr,
+                       &m_atlas_image_memory) != VK_SUCCESS)
+    throw std::runtime_error("failed to allocate image memory!");
+
+  vkBindImageMemory(m_device, m_atlas_image, m_atlas_image_memory, 0);
+
+  //============================ View
+  VkImageViewCreateInfo viewInfo = {};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = m_atlas_image;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+  viewInfo.format = VK_FORMAT_R8G8B8A8_SRGB;
+  viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  viewInfo.subresourceRange.baseMipLevel = 0;
+  viewInfo.subresourceRange.levelCount = 1;
+  viewInfo.subresourceRange.baseArrayLayer = 0;
+  viewInfo.subresourceRange.layerCount = layers;
+
+  if (vkCreateImageView(m_device,
+                        &viewInfo,
+                        nullptr,
+                        &m_atlas_image_view) != VK_SUCCESS)
+    throw std::runtime_error("failed to create texture image view!");
+
+  //============================ Clear
+  VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = m_atlas_image;
+  barrier.subresourceRange = viewInfo.subresourceRange;
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+  vkCmdPipelineBarrier(commandBuffer,
+                       VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+  VkClearColorValue clearColor = {};
+  vkCmdClearColorImage(commandBuffer, m_atlas_image,
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       &clearColor, 1, &viewInfo.subresourceRange);
+
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+  vkCmdPipelineBarrier(commandBuffer,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+  SubmitSingleTimeCommands(commandBuffer);
+}
+
+//###################################################################
+/** Packs a small RGBA8 image into the texture atlas and uploads it. The
+ * returned region goes into a draw's parameters with UseAtlasRegion;
+ * the shaders then map the draw's texture coordinates into it, so all
+ * atlas images share one descriptor and need no bind of their own.
+ *
+ * Images can be added at any time; the first one allocates the atlas.
+ * The upload joins the graphics timeline without a host wait. Only
+ * the layer receiving the image is written, after a barrier that waits
+ * for every frame submitted so far, so frames in flight keep sampling
+ * the other regions safely. The staging buffer is destroyed once the
+ * upload has retired. Images cannot be removed.*/
+ChiSim::AtlasRegion ChiSim::AddAtlasImage(uint32_t width,
+                                          uint32_t height,
+                                          const void* pixels)
+{
+  const uint32_t padding = k_atlas_padding;
+  const uint32_t paddedWidth = width + 2 * padding;
+  const uint32_t paddedHeight = height + 2 * padding;
+
+  if (width == 0 || height == 0 ||
+      paddedWidth > k_atlas_size || paddedHeight > k_atlas_size)
+    throw std::runtime_error("failed to add atlas image, "
+                             "image size exceeds an atlas layer!");
+
+  if (m_atlas_packers.empty()) AllocateTextureAtlas();
+
+  //============================ Pack
+  AtlasRegion region;
+  uint32_t x = 0, y = 0;
+  bool packed = false;
+  for (uint32_t l = 0; l < m_atlas_packers.size() && !packed; ++l)
+  {
+    packed = m_atlas_packers[l].Insert(paddedWidth, paddedHeight, x, y);
+    region.layer = l;
+  }
+
+  if (!packed)
+    throw std::runtime_error("failed to add atlas image, atlas is full!");
+
+  region.rect = glm::vec4(float(x + padding) / float(k_atlas_size),
+                          float(y + padding) / float(k_atlas_size),
+                          float(width) / float(k_atlas_size),
+                          float(height) / float(k_atlas_size));
+
+  //============================ Fill staging buffer with padding
+  // The padding repeats the image's edge texels.
+  VkDeviceSize paddedBytes = VkDeviceSize(paddedWidth) * paddedHeight * 4;
+
+  VkBuffer stagingBuffer;
+  VkDeviceMemory stagingBufferMemory;
+  CreateBuffer(paddedBytes,
+               VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+               VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+               stagingBuffer,
+               stagingBufferMemory);
+
+  void* data;
+  vkMapMemory(m_device, stagingBufferMemory, 0, paddedBytes, 0, &data);
+  const uint32_t* source = static_cast<const uint32_t*>(pixels);
+  uint32_t* destination = static_cast<uint32_t*>(data);
+  for (uint32_t py = 0; py < paddedHeight; ++py)
+  {
+    const uint32_t sy =
+      std::min(std::max(py, padding) - padding, height - 1);
+    for (uint32_t px = 0; px < paddedWidth; ++px)
+    {
+      const uint32_t sx =
+        std::min(std::max(px, padding) - padding, width - 1);
+      destination[py * paddedWidth + px] = source[sy * width + sx];
+    }
+  }
+  vkUnmapMemory(m_device, stagingBufferMemory);
+
+  //============================ Copy into the layer
+  VkCommandBuffer commandBuffer = BeginSingleTimeCommands();
+
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = m_atlas_image;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseMipLevel = 0;
+  barrier.subresourceRange.levelCount = 1;
+  barrier.subresourceRange.baseArrayLayer = region.layer;
+  barrier.subresourceRange.layerCount = 1;
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+  // Waits for the fragment shaders of every earlier submission.
+  vkCmdPipelineBarrier(commandBuffer,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+  VkBufferImageCopy copyRegion = {};
+  copyRegion.bufferOffset = 0;
+  copyRegion.bufferRowLength = 0;
+  copyRegion.bufferImageHeight = 0;
+  copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  copyRegion.imageSubresource.mipLevel = 0;
+  copyRegion.imageSubresource.baseArrayLayer = region.layer;
+  copyRegion.imageSubresource.layerCount = 1;
+  copyRegion.imageOffset = {int32_t(x), int32_t(y), 0};
+  copyRegion.imageExtent = {paddedWidth, paddedHeight, 1};
+
+  vkCmdCopyBufferToImage(commandBuffer,
+                         stagingBuffer,
+                         m_atlas_image,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         1, &copyRegion);
+
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+  vkCmdPipelineBarrier(commandBuffer,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+  const uint64_t value = SubmitSingleTimeCommands(commandBuffer);
+  RetireAfter(value, [this, stagingBuffer, stagingBufferMemory]()
+    {
+      vkDestroyBuffer(m_device, stagingBuffer, nullptr);
+      vkFreeMemory(m_device, stagingBufferMemory, nullptr);
+    });
+
+  ++m_num_atlas_images;
+
+  return region;
+}
+
+//###################################################################
+/** Prints how many images the texture atlas holds and how full its
+ * layers are, if it was allocated.*/
+void ChiSim::PrintAtlasStatistics()
+{
+  if (m_num_atlas_images == 0) return;
+
+  std::cout << "Texture atlas: " << m_num_atlas_images << " images in "
+            << k_atlas_layers << " layers of " << k_atlas_size << "^2,"
+            << " occupancy";
+  for (const auto& packer : m_atlas_packers)
+    std::cout << " " << int(100.0f * packer.GetOccupancy()) << "%";
+  std::cout << std::endl;
+}
+
+//###################################################################
+/** Destroys the texture atlas, or its placeholder. Only called once the
+ * device is idle.*/
+void ChiSim::DestroyTextureAtlas()
+{
+  vkDestroyImageView(m_device, m_atlas_image_view, nullptr);
+  vkDestroyImage(m_device, m_atlas_image, nullptr);
+  vkFreeMemory(m_device, m_atlas_image_memory, nullptr);
+
+  m_atlas_packers.clear();
+  m_num_atlas_images = 0;
+}
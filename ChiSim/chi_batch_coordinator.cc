@@ -0,0 +1,395 @@
+#include "chi_batch_coordinator.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <csignal>
+#include <cerrno>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+
+//###################################################################
+/** Reads jobs from a text file, one `<dataset> <timestep> <camera>`
+ * per line. Blank lines and lines starting with # are skipped.*/
+std::vector<ChiBatchCoordinator::Job>
+  ChiBatchCoordinator::ReadJobFile(const std::string& path)
+{
+  std::ifstream file(path);
+  if (!file.is_open())
+    throw std::runtime_error("failed to open job file " + path + "!");
+
+  std::vector<Job> jobs;
+  std::string line;
+  size_t lineNumber = 0;
+  while (std::getline(file, line))
+  {
+    ++lineNumber;
+    if (line.empty() || line[0] == '#') continue;
+
+    std::istringstream fields(line);
+    Job job;
+    if (!(fields >> job.dataset >> job.timestep >> job.camera))
+      throw std::runtime_error("failed to parse job file " + path +
+                               ", line " + std::to_string(lineNumber) + "!");
+    jobs.push_back(job);
+  }
+
+  return jobs;
+}
+
+//###################################################################
+/** Jobs for timesteps 0 to `num_timesteps`-1 of the built-in scene,
+ * seen from camera 0.*/
+std::vector<ChiBatchCoordinator::Job>
+  ChiBatchCoordinator::MakeTimestepJobs(uint32_t num_timesteps)
+{
+  std::vector<Job> jobs(num_timesteps);
+  for (uint32_t t = 0; t < num_timesteps; ++t)
+  {
+    jobs[t].dataset = "scene";
+    jobs[t].timestep = t;
+  }
+
+  return jobs;
+}
+
+//###################################################################
+/** Runs every job on `num_workers` worker processes and returns once
+ * all workers have exited.*/
+ChiBatchCoordinator::Stats
+  ChiBatchCoordinator::Run(const std::vector<Job>& jobs,
+                           size_t num_workers,
+                           const std::string& executable,
+                           const std::vector<std::string>& worker_args)
+{
+  num_workers = std::max<size_t>(std::min(num_workers, jobs.size()), 1);
+
+  m_executable = executable;
+  m_worker_args = worker_args;
+  m_jobs = jobs;
+  m_workers.assign(num_workers, Worker());
+  m_finished_paths.assign(jobs.size(), std::string());
+  m_finished.assign(jobs.size(), false);
+  m_job_attempts.assign(jobs.size(), 0);
+  m_next_commit = 0;
+  m_stats = Stats();
+  m_stats.num_workers = num_workers;
+
+  // A worker dying mid-write must not take the coordinator with it.
+  std::signal(SIGPIPE, SIG_IGN);
+
+  //============================ Deal out contiguous blocks
+  for (size_t w = 0; w < num_workers; ++w)
+  {
+    const size_t first = w * jobs.size() / num_workers;
+    const size_t last  = (w + 1) * jobs.size() / num_workers;
+    for (size_t j = first; j < last; ++j)
+      m_workers[w].block.push_back(j);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (size_t w = 0; w < num_workers; ++w)
+    StartWorker(w, executable, worker_args);
+
+  //============================ Serve workers until all have exited
+  while (true)
+  {
+    std::vector<pollfd> fds;
+    std::vector<size_t> fdWorkers;
+    for (size_t w = 0; w < m_workers.size(); ++w)
+      if (m_workers[w].from_fd >= 0)
+      {
+        fds.push_back({m_workers[w].from_fd, POLLIN, 0});
+        fdWorkers.push_back(w);
+      }
+    if (fds.empty()) break;
+
+    if (poll(fds.data(), fds.size(), -1) < 0) continue;
+
+    for (size_t f = 0; f < fds.size(); ++f)
+    {
+      if (fds[f].revents == 0) continue;
+
+      const size_t w = fdWorkers[f];
+      Worker& worker = m_workers[w];
+
+      char buffer[4096];
+      const ssize_t numRead = read(worker.from_fd, buffer, sizeof(buffer));
+      if (numRead > 0)
+      {
+        worker.input.append(buffer, size_t(numRead));
+
+        size_t end;
+        while ((end = worker.input.find('\n')) != std::string::npos)
+        {
+          const std::string message = worker.input.substr(0, end);
+          worker.input.erase(0, end + 1);
+          if (!HandleMessage(w, message))
+            throw std::runtime_error("failed to parse batch worker "
+                                     "message \"" + message + "\"!");
+        }
+        continue;
+      }
+
+      // Interrupted by a signal; only end of file or a real error
+      // means the worker is gone.
+      if (numRead < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+
+      //==================== Worker exited
+      close(worker.from_fd);
+      worker.from_fd = -1;
+      if (worker.to_fd >= 0) close(worker.to_fd);
+      worker.to_fd = -1;
+
+      int status = 0;
+      waitpid(worker.pid, &status, 0);
+
+      if (!worker.assigned.empty())
+        std::fprintf(stderr, "Batch worker %zu exited with %zu jobs "
+                             "unfinished, requeuing them\n",
+                     w, worker.assigned.size());
+      RequeueJobs(w);
+    }
+  }
+
+  //============================ Statistics
+  m_stats.seconds = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+
+  // Frames after a job that never finished are still committed, out of
+  // order.
+  for (size_t j = m_next_commit; j < m_jobs.size(); ++j)
+    if (m_finished[j] && !m_finished_paths[j].empty())
+      std::rename((m_finished_paths[j] + ".part").c_str(),
+                  m_finished_paths[j].c_str());
+
+  for (size_t j = 0; j < m_jobs.size(); ++j)
+    if (m_finished[j] && !m_finished_paths[j].empty()) ++m_stats.jobs;
+  m_stats.failed_jobs = m_jobs.size() - m_stats.jobs;
+
+  for (const auto& worker : m_workers)
+    m_stats.jobs_per_worker.push_back(worker.jobs_done);
+
+  return m_stats;
+}
+
+//###################################################################
+/** Starts a worker process connected through two pipes.*/
+void ChiBatchCoordinator::StartWorker(
+  size_t w,
+  const std::string& executable,
+  const std::vector<std::string>& worker_args)
+{
+  int toWorker[2], fromWorker[2];
+  if (pipe(toWorker) != 0 || pipe(fromWorker) != 0)
+    throw std::runtime_error("failed to create batch worker pipes!");
+
+  // Only the worker's own ends survive exec.
+  fcntl(toWorker[1], F_SETFD, FD_CLOEXEC);
+  fcntl(fromWorker[0], F_SETFD, FD_CLOEXEC);
+
+  const std::string fdArgument = "--batch-worker=" +
+                                 std::to_string(toWorker[0]) + "," +
+                                 std::to_string(fromWorker[1]);
+
+  std::vector<std::string> arguments = {executable};
+  arguments.insert(arguments.end(), worker_args.begin(), worker_args.end());
+  arguments.push_back(fdArgument);
+
+  std::vector<char*> argv;
+  for (auto& argument : arguments)
+    argv.push_back(const_cast<char*>(argument.c_str()));
+  argv.push_back(nullptr);
+
+  const int pid = fork();
+  if (pid < 0)
+    throw std::runtime_error("failed to start batch worker!");
+
+  if (pid == 0)
+  {
+    execv(executable.c_str(), argv.data());
+    _exit(127);
+  }
+
+  close(toWorker[0]);
+  close(fromWorker[1]);
+
+  m_workers[w].pid = pid;
+  m_workers[w].to_fd = toWorker[1];
+  m_workers[w].from_fd = fromWorker[0];
+}
+
+//###################################################################
+/** Handles one message from a worker. Returns false if it is not
+ * understood.*/
+bool ChiBatchCoordinator::HandleMessage(size_t w, const std::string& message)
+{
+  std::istringstream fields(message);
+  std::string type;
+  fields >> type;
+
+  if (type == "NEXT")
+  {
+    SendNextJob(w);
+    return true;
+  }
+
+  if (type == "DONE")
+  {
+    size_t job;
+    if (!(fields >> job) || job >= m_jobs.size()) return false;
+
+    std::string path;
+    std::getline(fields >> std::ws, path);
+    FinishJob(w, job, path);
+    return true;
+  }
+
+  return false;
+}
+
+//###################################################################
+/** Sends a worker the next job of its block, or one stolen from the
+ * back of the largest other block, or END when no jobs are left.*/
+void ChiBatchCoordinator::SendNextJob(size_t w)
+{
+  Worker& worker = m_workers[w];
+  if (worker.to_fd < 0) return;
+
+  std::deque<size_t>* source = &worker.block;
+  if (source->empty())
+  {
+    for (auto& other : m_workers)
+      if (other.block.size() > source->size()) source = &other.block;
+    if (!source->empty()) ++m_stats.steals;
+  }
+
+  std::string message;
+  if (source->empty())
+    message = "END\n";
+  else
+  {
+    size_t job;
+    if (source == &worker.block)
+    {
+      job = source->front();
+      source->pop_front();
+    }
+    else
+    {
+      job = source->back();
+      source->pop_back();
+    }
+    worker.assigned.push_back(job);
+
+    const Job& description = m_jobs[job];
+    message = "JOB " + std::to_string(job) + " " +
+              std::to_string(description.timestep) + " " +
+              std::to_string(description.camera) + " " +
+              description.dataset + "\n";
+  }
+
+  if (write(worker.to_fd, message.data(), message.size()) !=
+      ssize_t(message.size()))
+    std::fprintf(stderr, "Batch worker %zu is not accepting jobs\n", w);
+
+  if (message == "END\n")
+  {
+    close(worker.to_fd);
+    worker.to_fd = -1;
+  }
+}
+
+//###################################################################
+/** Records a finished job. An empty path means the worker failed to
+ * write the frame.*/
+void ChiBatchCoordinator::FinishJob(size_t w,
+                                    size_t job,
+                                    const std::string& path)
+{
+  Worker& worker = m_workers[w];
+  auto assigned = std::find(worker.assigned.begin(),
+                            worker.assigned.end(), job);
+  if (assigned != worker.assigned.end()) worker.assigned.erase(assigned);
+
+  ++worker.jobs_done;
+  worker.failed_starts = 0;
+  m_finished[job] = true;
+  m_finished_paths[job] = path;
+
+  CommitFinishedFrames();
+}
+
+//###################################################################
+/** Renames the finished frames that directly follow the last committed
+ * one to their final names.*/
+void ChiBatchCoordinator::CommitFinishedFrames()
+{
+  while (m_next_commit < m_jobs.size() && m_finished[m_next_commit])
+  {
+    const std::string& path = m_finished_paths[m_next_commit];
+    if (!path.empty() &&
+        std::rename((path + ".part").c_str(), path.c_str()) != 0)
+      std::fprintf(stderr, "Failed to rename %s.part\n", path.c_str());
+
+    ++m_next_commit;
+  }
+}
+
+//###################################################################
+/** Hands the unfinished jobs of an exited worker to the front of a
+ * running worker's block, where its own remaining block is also
+ * stolen from. When every other worker has already received END, the
+ * worker is restarted for them instead. A job is dropped after
+ * MAX_JOB_ATTEMPTS workers died on it, and a worker is not restarted
+ * after exiting that many times without taking a job, so a job or
+ * worker that always crashes cannot keep the batch from ending; its
+ * jobs stay unfinished.*/
+void ChiBatchCoordinator::RequeueJobs(size_t w)
+{
+  Worker& worker = m_workers[w];
+
+  //============================ Count the attempt
+  std::vector<size_t> requeued;
+  for (size_t job : worker.assigned)
+    if (++m_job_attempts[job] < MAX_JOB_ATTEMPTS)
+      requeued.push_back(job);
+    else
+      std::fprintf(stderr, "Batch job %zu failed on %zu workers, "
+                           "giving up\n", job, MAX_JOB_ATTEMPTS);
+
+  if (worker.assigned.empty()) ++worker.failed_starts;
+  worker.assigned.clear();
+
+  //============================ Hand to a running worker
+  for (auto& other : m_workers)
+    if (other.to_fd >= 0)
+    {
+      other.block.insert(other.block.begin(),
+                         requeued.begin(), requeued.end());
+      return;
+    }
+
+  //============================ Or restart this one
+  worker.block.insert(worker.block.begin(), requeued.begin(), requeued.end());
+  if (worker.block.empty()) return;
+
+  if (worker.failed_starts >= MAX_JOB_ATTEMPTS)
+  {
+    std::fprintf(stderr, "Batch worker %zu keeps failing, "
+                         "%zu jobs stay unfinished\n",
+                 w, worker.block.size());
+    return;
+  }
+
+  worker.input.clear();
+  StartWorker(w, m_executable, m_worker_args);
+  ++m_stats.restarts;
+}
@@ -0,0 +1,103 @@
+#ifndef _ChiBatchCoordinator_h
+#define _ChiBatchCoordinator_h
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+//###################################################################
+/** Distributes batch render jobs over worker processes.
+ *
+ * Each worker is a separate process running the renderer with its own
+ * VkInstance and VkDevice, so CPU-side (software) devices use every
+ * core. Workers are started with
+ * `<executable> <worker_args> --batch-worker=<read_fd>,<write_fd>`
+ * and talk to the coordinator over a pair of pipes, one line per
+ * message:
+ *
+ *   worker:      NEXT                   asks for a job
+ *                DONE <job> <path>      job's frame is in <path>.part
+ *   coordinator: JOB <job> <timestep> <camera> <dataset>
+ *                END                    no jobs left
+ *
+ * Jobs are dealt out in contiguous blocks, one per worker, so each
+ * worker walks consecutive timesteps. A worker whose block runs dry
+ * steals from the back of the largest remaining block, which evens out
+ * jobs of uneven cost. Finished frames are renamed from `<path>.part`
+ * to `<path>` strictly in job order, so a consumer watching the output
+ * sees a growing, gapless sequence. Jobs of a worker that dies are
+ * handed to the others, or to a restarted worker once the others have
+ * ended; a job is given up after MAX_JOB_ATTEMPTS workers died on it.
+ * POSIX only.*/
+class ChiBatchCoordinator
+{
+public:
+  static constexpr size_t MAX_JOB_ATTEMPTS = 3;
+
+  struct Job
+  {
+    std::string dataset;
+    uint32_t    timestep = 0;
+    uint32_t    camera = 0;
+  };
+
+  struct Stats
+  {
+    size_t num_workers = 0;
+    size_t jobs = 0;
+    size_t failed_jobs = 0;
+    size_t steals = 0;
+    size_t restarts = 0;
+    double seconds = 0.0;
+    std::vector<size_t> jobs_per_worker;
+
+    double GetJobsPerSecond() const
+      { return seconds > 0.0 ? double(jobs) / seconds : 0.0; }
+  };
+
+private:
+  struct Worker
+  {
+    int                 pid = -1;
+    int                 to_fd = -1;
+    int                 from_fd = -1;
+    std::string         input;
+    std::deque<size_t>  block;
+    std::vector<size_t> assigned;
+    size_t              jobs_done = 0;
+    size_t              failed_starts = 0; //exits without a job taken
+  };
+
+  std::string              m_executable;
+  std::vector<std::string> m_worker_args;
+  std::vector<Job>         m_jobs;
+  std::vector<Worker>      m_workers;
+  std::vector<std::string> m_finished_paths;
+  std::vector<bool>        m_finished;
+  std::vector<size_t>      m_job_attempts;
+  size_t                   m_next_commit = 0;
+  Stats                    m_stats;
+
+public:
+  static std::vector<Job> ReadJobFile(const std::string& path);
+  static std::vector<Job> MakeTimestepJobs(uint32_t num_timesteps);
+
+  Stats Run(const std::vector<Job>& jobs,
+            size_t num_workers,
+            const std::string& executable,
+            const std::vector<std::string>& worker_args);
+
+private:
+  void StartWorker(size_t w,
+                   const std::string& executable,
+                   const std::vector<std::string>& worker_args);
+  bool HandleMessage(size_t w, const std::string& message);
+  void SendNextJob(size_t w);
+  void FinishJob(size_t w, size_t job, const std::string& path);
+  void CommitFinishedFrames();
+  void RequeueJobs(size_t w);
+};
+
+#endif
@@ -0,0 +1,290 @@
+#include "chi_compositor.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <cerrno>
+
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+//###################################################################
+/** Bytes of a region: the header, a color and depth slot per process
+ * and the output image.*/
+size_t ChiCompositor::GetRegionSize(uint32_t size,
+                                    uint32_t width,
+                                    uint32_t height)
+{
+  const size_t numPixels = size_t(width) * height;
+  return sizeof(Header) + size_t(size) * numPixels * 8 + numPixels * 4;
+}
+
+//###################################################################
+/** Creates a region for `num_processes` processes rendering `width` x
+ * `height` frames, runs `executable` with `args` once per process and
+ * returns once all have exited. If a process cannot be started, or one
+ * crashes or exits with an error, the others would wait for it at the
+ * next barrier forever: they are killed and Launch throws.*/
+ChiCompositor::Stats ChiCompositor::Launch(
+  size_t num_processes,
+  uint32_t width,
+  uint32_t height,
+  const std::string& executable,
+  const std::vector<std::string>& args)
+{
+  if (num_processes == 0 || num_processes > MAX_PROCESSES)
+    throw std::runtime_error("failed to launch compositing, "
+                             "unsupported process count!");
+
+  const uint32_t size = uint32_t(num_processes);
+  const std::string region = "/chisim_composite_" + std::to_string(getpid());
+  const size_t regionSize = GetRegionSize(size, width, height);
+
+  //============================ Create the region
+  const int fd = shm_open(region.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0)
+    throw std::runtime_error("failed to create compositing region!");
+
+  if (ftruncate(fd, off_t(regionSize)) != 0)
+  {
+    close(fd);
+    shm_unlink(region.c_str());
+    throw std::runtime_error("failed to size compositing region!");
+  }
+
+  void* mapped = mmap(nullptr, regionSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED)
+  {
+    shm_unlink(region.c_str());
+    throw std::runtime_error("failed to map compositing region!");
+  }
+
+  Header* header = new (mapped) Header();
+  header->size = size;
+  header->width = width;
+  header->height = height;
+
+  pthread_barrierattr_t barrierAttributes;
+  pthread_barrierattr_init(&barrierAttributes);
+  pthread_barrierattr_setpshared(&barrierAttributes, PTHREAD_PROCESS_SHARED);
+  pthread_barrier_init(&header->barrier, &barrierAttributes, size);
+  pthread_barrierattr_destroy(&barrierAttributes);
+
+  // Stops and reaps the started processes and removes the region.
+  std::vector<pid_t> pids;
+  auto fail = [&](const std::string& message)
+  {
+    for (pid_t pid : pids) kill(pid, SIGKILL);
+    for (pid_t pid : pids)
+      while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR) {}
+    pthread_barrier_destroy(&header->barrier);
+    munmap(mapped, regionSize);
+    shm_unlink(region.c_str());
+    throw std::runtime_error(message);
+  };
+
+  //============================ Run the processes
+  auto start = std::chrono::steady_clock::now();
+
+  for (uint32_t rank = 0; rank < size; ++rank)
+  {
+    std::vector<std::string> arguments = {executable};
+    arguments.insert(arguments.end(), args.begin(), args.end());
+    arguments.push_back("--composite-worker=" + region + "," +
+                        std::to_string(rank) + "," + std::to_string(size));
+
+    std::vector<char*> argv;
+    for (auto& argument : arguments)
+      argv.push_back(const_cast<char*>(argument.c_str()));
+    argv.push_back(nullptr);
+
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+      execv(executable.c_str(), argv.data());
+      _exit(127);
+    }
+    if (pid < 0)
+      fail("failed to start compositing process " +
+            std::to_string(rank) + "!");
+    pids.push_back(pid);
+  }
+
+  //============================ Reap them
+  // In whatever order they exit, so the first failure is seen while
+  // the others still wait for it.
+  size_t numRunning = pids.size();
+  while (numRunning > 0)
+  {
+    int status = 0;
+    const pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0)
+    {
+      if (errno == EINTR) continue;
+      fail("failed to wait for the compositing processes!");
+    }
+
+    auto it = std::find(pids.begin(), pids.end(), pid);
+    if (it == pids.end()) continue;
+    pids.erase(it);
+    --numRunning;
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      fail("compositing process " + std::to_string(pid) +
+            (WIFSIGNALED(status) ?
+             " was killed by signal " + std::to_string(WTERMSIG(status)) :
+             " exited with status " + std::to_string(WEXITSTATUS(status))) +
+            "!");
+  }
+
+  //============================ Statistics
+  Stats stats;
+  stats.num_processes = size;
+  stats.frames = header->frames;
+  stats.seconds = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+  stats.checksum = header->checksum;
+  for (uint32_t rank = 0; rank < size; ++rank)
+  {
+    stats.composite_ms = std::max(stats.composite_ms, header->composite_ms[rank]);
+    stats.wait_ms = std::max(stats.wait_ms, header->wait_ms[rank]);
+  }
+  if (stats.frames > 0)
+  {
+    stats.composite_ms /= double(stats.frames);
+    stats.wait_ms /= double(stats.frames);
+  }
+
+  pthread_barrier_destroy(&header->barrier);
+  munmap(mapped, regionSize);
+  shm_unlink(region.c_str());
+
+  return stats;
+}
+
+//###################################################################
+/** Maps a region created by Launch as process `rank`.*/
+void ChiCompositor::Attach(const std::string& region, uint32_t rank)
+{
+  Detach();
+
+  const int fd = shm_open(region.c_str(), O_RDWR, 0600);
+  if (fd < 0)
+    throw std::runtime_error("failed to open compositing region " +
+                             region + "!");
+
+  // The header tells the size of the rest.
+  void* mapped = mmap(nullptr, sizeof(Header), PROT_READ, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED)
+  {
+    close(fd);
+    throw std::runtime_error("failed to map compositing region!");
+  }
+  const Header* header = static_cast<const Header*>(mapped);
+  const size_t regionSize =
+    GetRegionSize(header->size, header->width, header->height);
+  const bool validRank = rank < header->size;
+  munmap(mapped, sizeof(Header));
+
+  if (!validRank)
+  {
+    close(fd);
+    throw std::runtime_error("failed to attach compositing region, "
+                             "rank out of range!");
+  }
+
+  mapped = mmap(nullptr, regionSize, PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED)
+    throw std::runtime_error("failed to map compositing region!");
+
+  m_header = static_cast<Header*>(mapped);
+  m_data = static_cast<uint8_t*>(mapped) + sizeof(Header);
+  m_mapped_size = regionSize;
+  m_rank = rank;
+}
+
+//###################################################################
+/** Unmaps the region.*/
+void ChiCompositor::Detach()
+{
+  if (!m_header) return;
+
+  munmap(m_header, m_mapped_size);
+  m_header = nullptr;
+  m_data = nullptr;
+  m_mapped_size = 0;
+}
+
+//###################################################################
+/** Merges this process's strip of the output once every process has
+ * filled its slots, and returns the output once every strip is done.
+ * The output stays valid until this process fills its slots again.*/
+const uint8_t* ChiCompositor::Composite()
+{
+  const uint32_t size = m_header->size;
+  const size_t numPixels = GetNumPixels();
+
+  //============================ Wait for every slot
+  auto start = std::chrono::steady_clock::now();
+  pthread_barrier_wait(&m_header->barrier);
+  auto merged = std::chrono::steady_clock::now();
+
+  //============================ Merge this process's strip
+  const size_t rowSize = m_header->width;
+  const size_t firstRow = size_t(m_rank) * m_header->height / size;
+  const size_t lastRow = size_t(m_rank + 1) * m_header->height / size;
+
+  std::vector<const float*> depths(size);
+  std::vector<const uint32_t*> colors(size);
+  for (uint32_t r = 0; r < size; ++r)
+  {
+    depths[r] = GetDepth(r);
+    colors[r] = reinterpret_cast<const uint32_t*>(GetColor(r));
+  }
+  uint32_t* output = reinterpret_cast<uint32_t*>(GetOutput());
+
+  for (size_t p = firstRow * rowSize; p < lastRow * rowSize; ++p)
+  {
+    uint32_t nearest = 0;
+    float nearestDepth = depths[0][p];
+    for (uint32_t r = 1; r < size; ++r)
+      if (depths[r][p] < nearestDepth)
+      {
+        nearest = r;
+        nearestDepth = depths[r][p];
+      }
+    output[p] = colors[nearest][p];
+  }
+
+  //============================ Wait for every strip
+  auto composited = std::chrono::steady_clock::now();
+  pthread_barrier_wait(&m_header->barrier);
+  auto end = std::chrono::steady_clock::now();
+
+  m_header->composite_ms[m_rank] +=
+    std::chrono::duration<double, std::milli>(composited - merged).count();
+  m_header->wait_ms[m_rank] +=
+    std::chrono::duration<double, std::milli>((merged - start) +
+                                              (end - composited)).count();
+
+  if (m_rank == 0)
+  {
+    // FNV-1a over the output, chained across frames.
+    uint64_t hash = m_header->checksum ^ 0xcbf29ce484222325ull;
+    const uint8_t* bytes = GetOutput();
+    for (size_t b = 0; b < numPixels * 4; ++b)
+      hash = (hash ^ bytes[b]) * 0x100000001b3ull;
+    m_header->checksum = hash;
+    ++m_header->frames;
+  }
+
+  return GetOutput();
+}
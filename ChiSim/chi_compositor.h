@@ -0,0 +1,104 @@
+#ifndef _ChiCompositor_h
+#define _ChiCompositor_h
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include <pthread.h>
+
+//###################################################################
+/** Sort-last compositing of images rendered by several processes.
+ *
+ * Every process renders its own partition of the scene with the same
+ * camera into color (4 bytes per pixel) and depth (float). Launch
+ * creates a shared memory region holding one color and depth slot per
+ * process plus the output image, and starts the processes with
+ * `--composite-worker=<region>,<rank>,<size>`. Each process Attach-es
+ * to the region, writes its frame into its slots and calls Composite.
+ *
+ * Compositing is direct-send through shared memory: after a barrier
+ * every process merges its own horizontal strip of the output from all
+ * slots, keeping for each pixel the color of the nearest depth, and a
+ * second barrier publishes the finished output. Ties go to the lower
+ * rank. With partitions in draw order and a less-than depth test, that
+ * is the fragment a single process drawing the whole scene keeps, so
+ * the output is identical to a single-process render.
+ *
+ * Processes run in lockstep. Launch watches them: when one cannot be
+ * started, crashes or exits with an error, it kills the others, which
+ * would otherwise wait for it at the next barrier, and throws.
+ * POSIX only.*/
+class ChiCompositor
+{
+public:
+  static constexpr uint32_t MAX_PROCESSES = 64;
+
+  struct Stats
+  {
+    size_t   num_processes = 0;
+    size_t   frames = 0;
+    double   seconds = 0.0;
+    double   composite_ms = 0.0; //slowest process, per frame
+    double   wait_ms = 0.0;      //slowest process, per frame
+    uint64_t checksum = 0;       //of every output frame, in order
+
+    double GetFramesPerSecond() const
+      { return seconds > 0.0 ? double(frames) / seconds : 0.0; }
+  };
+
+private:
+  struct Header
+  {
+    pthread_barrier_t barrier;
+    uint32_t          size = 0;
+    uint32_t          width = 0;
+    uint32_t          height = 0;
+    uint64_t          frames = 0;
+    uint64_t          checksum = 0;
+    double            composite_ms[MAX_PROCESSES] = {};
+    double            wait_ms[MAX_PROCESSES] = {};
+  };
+
+  Header*  m_header = nullptr;
+  uint8_t* m_data = nullptr;
+  size_t   m_mapped_size = 0;
+  uint32_t m_rank = 0;
+
+public:
+  ChiCompositor() = default;
+  ChiCompositor(const ChiCompositor&) = delete;
+  ChiCompositor& operator=(const ChiCompositor&) = delete;
+  ~ChiCompositor() { Detach(); }
+
+  static Stats Launch(size_t num_processes,
+                      uint32_t width,
+                      uint32_t height,
+                      const std::string& executable,
+                      const std::vector<std::string>& args);
+
+  void Attach(const std::string& region, uint32_t rank);
+  void Detach();
+
+  bool      IsAttached() const {return m_header != nullptr;}
+  uint32_t  GetRank() const {return m_rank;}
+  uint32_t  GetSize() const {return m_header ? m_header->size : 0;}
+  uint8_t*  GetColorSlot() {return GetColor(m_rank);}
+  float*    GetDepthSlot() {return GetDepth(m_rank);}
+
+  const uint8_t* Composite();
+
+private:
+  static size_t GetRegionSize(uint32_t size, uint32_t width, uint32_t height);
+  size_t   GetNumPixels() const
+    { return size_t(m_header->width) * m_header->height; }
+  uint8_t* GetColor(uint32_t rank)
+    { return m_data + size_t(rank) * GetNumPixels() * 8; }
+  float*   GetDepth(uint32_t rank)
+    { return reinterpret_cast<float*>(GetColor(rank) + GetNumPixels() * 4); }
+  uint8_t* GetOutput()
+    { return m_data + size_t(m_header->size) * GetNumPixels() * 8; }
+};
+
+#endif
@@ -0,0 +1,224 @@
+#include "chi_descriptor_allocator.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+//###################################################################
+/** Sets up the allocator. The first pool holds `initial_sets` sets and
+ * is created on the first allocation. `freeable` allows Free, at the
+ * cost of pools created with VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_
+ * SET_BIT; transient allocators should only ever Reset.*/
+void ChiDescriptorAllocator::Initialize(VkDevice device,
+                                        uint32_t initial_sets,
+                                        const std::vector<PoolSizeRatio>& ratios,
+                                        bool freeable)
+{
+  m_device = device;
+  m_ratios = ratios;
+  m_freeable = freeable;
+  m_next_pool_sets = std::clamp<uint32_t>(initial_sets, 1, MAX_SETS_PER_POOL);
+}
+
+//###################################################################
+/** Destroys all pools, which frees every set allocated from them. The
+ * sets must no longer be in use by the device.*/
+void ChiDescriptorAllocator::Shutdown()
+{
+  for (auto pool : m_pools)
+    vkDestroyDescriptorPool(m_device, pool, nullptr);
+
+  m_pools.clear();
+  m_current_pool = 0;
+  m_set_pools.clear();
+  m_cache.clear();
+  m_cache_keys.clear();
+}
+
+//###################################################################
+/** Allocates an unwritten set. Full pools are skipped; at the end of
+ * the chain a larger pool is added.*/
+VkDescriptorSet ChiDescriptorAllocator::Allocate(VkDescriptorSetLayout layout)
+{
+  while (true)
+  {
+    bool newPool = false;
+    if (m_current_pool == m_pools.size())
+    {
+      m_pools.push_back(CreatePool());
+      newPool = true;
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = m_pools[m_current_pool];
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &layout;
+
+    VkDescriptorSet set;
+    VkResult result = vkAllocateDescriptorSets(m_device, &allocInfo, &set);
+
+    if (result == VK_SUCCESS)
+    {
+      if (m_freeable) m_set_pools[set] = m_current_pool;
+      return set;
+    }
+
+    if (result != VK_ERROR_OUT_OF_POOL_MEMORY &&
+        result != VK_ERROR_FRAGMENTED_POOL)
+      throw std::runtime_error("failed to allocate descriptor sets!");
+
+    // A layout that does not even fit an empty pool would otherwise
+    // grow the chain forever.
+    if (newPool)
+      throw std::runtime_error("failed to allocate descriptor sets, "
+                               "layout exceeds the pool size ratios!");
+
+    ++m_current_pool;
+  }
+}
+
+//###################################################################
+/** Returns a set holding the given contents, writing a new one only if
+ * no cached set matches. `data` is laid out as `update_template`
+ * expects and is compared bytewise, so it must be zero-initialized
+ * before its members are set (padding included). Requires a freeable
+ * allocator, since cached sets are released with Free.*/
+VkDescriptorSet ChiDescriptorAllocator::GetOrCreateSet(
+  VkDescriptorSetLayout layout,
+  VkDescriptorUpdateTemplate update_template,
+  const void* data, size_t size)
+{
+  if (!m_freeable)
+    throw std::runtime_error("failed to cache descriptor set, "
+                             "allocator is not freeable!");
+
+  const uint64_t key = HashContents(layout, update_template, data, size);
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+
+  auto cached = m_cache.find(key);
+  if (cached != m_cache.end())
+  {
+    const CachedSet& entry = cached->second;
+    if (entry.layout == layout &&
+        entry.update_template == update_template &&
+        entry.contents.size() == size &&
+        std::memcmp(entry.contents.data(), bytes, size) == 0)
+      return entry.set;
+  }
+
+  VkDescriptorSet set = Allocate(layout);
+  vkUpdateDescriptorSetWithTemplate(m_device, set, update_template, data);
+
+  // On a hash collision the new set simply stays uncached.
+  if (cached == m_cache.end())
+  {
+    m_cache[key] = {set, layout, update_template,
+                    std::vector<unsigned char>(bytes, bytes + size)};
+    m_cache_keys[set] = key;
+  }
+
+  return set;
+}
+
+//###################################################################
+/** Frees a set, cached or not. The set must no longer be in use by the
+ * device (see ChiSim::RetireAfter). Its pool becomes the first one
+ * tried by the next allocation.*/
+void ChiDescriptorAllocator::Free(VkDescriptorSet set)
+{
+  if (!m_freeable)
+    throw std::runtime_error("failed to free descriptor set, "
+                             "allocator is not freeable!");
+
+  auto setPool = m_set_pools.find(set);
+  if (setPool == m_set_pools.end()) return;
+
+  const size_t pool = setPool->second;
+  vkFreeDescriptorSets(m_device, m_pools[pool], 1, &set);
+  m_set_pools.erase(setPool);
+  m_current_pool = std::min(m_current_pool, pool);
+
+  auto cacheKey = m_cache_keys.find(set);
+  if (cacheKey != m_cache_keys.end())
+  {
+    m_cache.erase(cacheKey->second);
+    m_cache_keys.erase(cacheKey);
+  }
+}
+
+//###################################################################
+/** Frees every set at once by resetting the pools, which are kept for
+ * the next allocations.*/
+void ChiDescriptorAllocator::Reset()
+{
+  for (auto pool : m_pools)
+    vkResetDescriptorPool(m_device, pool, 0);
+
+  m_current_pool = 0;
+  m_set_pools.clear();
+  m_cache.clear();
+  m_cache_keys.clear();
+}
+
+//###################################################################
+/** Creates the next pool of the chain and doubles the size of the one
+ * after it.*/
+VkDescriptorPool ChiDescriptorAllocator::CreatePool()
+{
+  const uint32_t numSets = m_next_pool_sets;
+
+  std::vector<VkDescriptorPoolSize> poolSizes;
+  poolSizes.reserve(m_ratios.size());
+  for (const auto& ratio : m_ratios)
+  {
+    VkDescriptorPoolSize poolSize = {};
+    poolSize.type = ratio.type;
+    poolSize.descriptorCount =
+      std::max(1u, uint32_t(std::ceil(ratio.per_set * float(numSets))));
+    poolSizes.push_back(poolSize);
+  }
+
+  VkDescriptorPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.flags = m_freeable ?
+                   VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT : 0;
+  poolInfo.poolSizeCount = poolSizes.size();
+  poolInfo.pPoolSizes = poolSizes.data();
+  poolInfo.maxSets = numSets;
+
+  VkDescriptorPool pool;
+  if (vkCreateDescriptorPool(m_device, &poolInfo, nullptr, &pool) !=
+      VK_SUCCESS)
+    throw std::runtime_error("failed to create descriptor pool!");
+
+  m_next_pool_sets = std::min(2 * numSets, MAX_SETS_PER_POOL);
+
+  return pool;
+}
+
+//###################################################################
+/** 64-bit FNV-1a hash of a set's layout, template and contents.*/
+uint64_t ChiDescriptorAllocator::HashContents(
+  VkDescriptorSetLayout layout,
+  VkDescriptorUpdateTemplate update_template,
+  const void* data, size_t size)
+{
+  uint64_t hash = 0xcbf29ce484222325ull;
+  auto mix = [&hash](const void* bytes, size_t count)
+  {
+    const unsigned char* b = static_cast<const unsigned char*>(bytes);
+    for (size_t i = 0; i < count; ++i)
+    {
+      hash ^= b[i];
+      hash *= 0x100000001b3ull;
+    }
+  };
+
+  mix(&layout, sizeof(layout));
+  mix(&update_template, sizeof(update_template));
+  mix(data, size);
+
+  return hash;
+}
@@ -0,0 +1,86 @@
+#ifndef _ChiDescriptorAllocator_h
+#define _ChiDescriptorAllocator_h
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+//###################################################################
+/** Allocates descriptor sets from a growing chain of pools.
+ *
+ * Pools are sized for a number of sets, with the descriptors of each
+ * type reserved in a fixed ratio per set. When the current pool runs
+ * out the allocator moves on to the next one, creating it with twice
+ * the sets of the previous pool (up to MAX_SETS_PER_POOL), so callers
+ * never have to know how many sets will exist.
+ *
+ * Two usage patterns are supported:
+ *  - Long-lived sets, with individually freeable pools. GetOrCreateSet
+ *    writes a set through a descriptor update template and caches it
+ *    by its contents, so requesting the same resources again returns
+ *    the existing set.
+ *  - Transient sets, allocated during a frame and released all at once
+ *    by Reset when the frame has retired. Reset keeps the pools, so a
+ *    steady state allocates no pools at all.*/
+class ChiDescriptorAllocator
+{
+public:
+  static constexpr uint32_t MAX_SETS_PER_POOL = 4096;
+
+  /** Descriptors of a type reserved per set in each pool.*/
+  struct PoolSizeRatio
+  {
+    VkDescriptorType type;
+    float            per_set;
+  };
+
+private:
+  struct CachedSet
+  {
+    VkDescriptorSet            set;
+    VkDescriptorSetLayout      layout;
+    VkDescriptorUpdateTemplate update_template;
+    std::vector<unsigned char> contents;
+  };
+
+  VkDevice                      m_device = VK_NULL_HANDLE;
+  std::vector<PoolSizeRatio>    m_ratios;
+  bool                          m_freeable = false;
+  uint32_t                      m_next_pool_sets = 0;
+
+  std::vector<VkDescriptorPool> m_pools;
+  size_t                        m_current_pool = 0;
+
+  std::unordered_map<VkDescriptorSet, size_t>   m_set_pools; //set->pool
+  std::unordered_map<uint64_t, CachedSet>       m_cache;     //hash->set
+  std::unordered_map<VkDescriptorSet, uint64_t> m_cache_keys;//set->hash
+
+public:
+  void Initialize(VkDevice device,
+                  uint32_t initial_sets,
+                  const std::vector<PoolSizeRatio>& ratios,
+                  bool freeable);
+  void Shutdown();
+
+  VkDescriptorSet Allocate(VkDescriptorSetLayout layout);
+  VkDescriptorSet GetOrCreateSet(VkDescriptorSetLayout layout,
+                                 VkDescriptorUpdateTemplate update_template,
+                                 const void* data, size_t size);
+  void            Free(VkDescriptorSet set);
+  void            Reset();
+
+  size_t GetNumPools() const {return m_pools.size();}
+  size_t GetNumCachedSets() const {return m_cache.size();}
+
+private:
+  VkDescriptorPool CreatePool();
+  static uint64_t  HashContents(VkDescriptorSetLayout layout,
+                                VkDescriptorUpdateTemplate update_template,
+                                const void* data, size_t size);
+};
+
+#endif
@@ -0,0 +1,69 @@
+#include "chi_file_watcher.h"
+
+//###################################################################
+/** Adds a file to the watch list. Must be called before Start.*/
+void ChiFileWatcher::Watch(const std::string& path)
+{
+  std::error_code error;
+  WatchedFile file;
+  file.path = path;
+  file.last_write_time = std::filesystem::last_write_time(path, error);
+
+  m_files.push_back(file);
+}
+
+//###################################################################
+/** Starts polling. `callback` is invoked with the path of each file
+ * whose modification time changed.*/
+void ChiFileWatcher::Start(Callback callback,
+                           std::chrono::milliseconds interval)
+{
+  Stop();
+
+  m_callback = std::move(callback);
+  m_interval = interval;
+  m_stopping = false;
+  m_thread = std::thread(&ChiFileWatcher::PollLoop, this);
+}
+
+//###################################################################
+/** Stops polling and joins the watcher thread.*/
+void ChiFileWatcher::Stop()
+{
+  if (!m_thread.joinable()) return;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_stop_cv.notify_all();
+
+  m_thread.join();
+}
+
+//###################################################################
+void ChiFileWatcher::PollLoop()
+{
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      if (m_stop_cv.wait_for(lock, m_interval,
+                             [this]() { return m_stopping; }))
+        return;
+    }
+
+    for (auto& file : m_files)
+    {
+      std::error_code error;
+      auto writeTime = std::filesystem::last_write_time(file.path, error);
+
+      // Editors often replace files by delete-and-rename; a missing
+      // file is simply checked again on the next poll.
+      if (error || writeTime == file.last_write_time) continue;
+
+      file.last_write_time = writeTime;
+      m_callback(file.path);
+    }
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef _ChiFileWatcher_h
+#define _ChiFileWatcher_h
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <filesystem>
+#include <chrono>
+
+//###################################################################
+/** Watches files for modification on a background thread.
+ *
+ * Modification times are polled, which works the same on every
+ * platform and is cheap for the handful of files involved. The
+ * callback runs on the watcher thread, so it may do slow work such as
+ * compiling, but must synchronize with the rest of the program.*/
+class ChiFileWatcher
+{
+public:
+  typedef std::function<void(const std::string&)> Callback;
+
+private:
+  struct WatchedFile
+  {
+    std::string                     path;
+    std::filesystem::file_time_type last_write_time;
+  };
+
+  std::vector<WatchedFile>  m_files;
+  Callback                  m_callback;
+  std::chrono::milliseconds m_interval{250};
+
+  std::thread               m_thread;
+  std::mutex                m_mutex;
+  std::condition_variable   m_stop_cv;
+  bool                      m_stopping = false;
+
+public:
+  ChiFileWatcher() = default;
+  ChiFileWatcher(const ChiFileWatcher&) = delete;
+  ChiFileWatcher& operator=(const ChiFileWatcher&) = delete;
+  ~ChiFileWatcher() { Stop(); }
+
+  void Watch(const std::string& path);
+  void Start(Callback callback,
+             std::chrono::milliseconds interval =
+               std::chrono::milliseconds(250));
+  void Stop();
+
+  bool IsRunning() const {return m_thread.joinable();}
+
+private:
+  void PollLoop();
+};
+
+#endif
@@ -0,0 +1,448 @@
+#include "chi_frame_encoder.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+//###################################################################
+/** Starts the worker threads. `queue_capacity` bounds the number of
+ * frames waiting to be encoded; 0 picks two per thread. Statistics of
+ * a previous run are cleared.*/
+void ChiFrameEncoder::Start(Format format,
+                            size_t num_threads,
+                            const std::string& prefix,
+                            size_t queue_capacity)
+{
+  Finish();
+
+  num_threads = std::max<size_t>(num_threads, 1);
+
+  m_format = format;
+  m_prefix = prefix;
+  m_queue_capacity = queue_capacity > 0 ? queue_capacity : 2 * num_threads;
+  m_stopping = false;
+
+  m_stats = Stats();
+  m_started_timing = false;
+
+  for (size_t t = 0; t < num_threads; ++t)
+    m_workers.emplace_back(&ChiFrameEncoder::WorkerLoop, this);
+}
+
+//###################################################################
+/** Encodes every frame still queued and stops the workers. Statistics
+ * remain available until the next Start.*/
+void ChiFrameEncoder::Finish()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_job_cv.notify_all();
+
+  for (auto& worker : m_workers)
+    worker.join();
+  m_workers.clear();
+}
+
+//###################################################################
+/** Copies a frame of tightly packed 4 byte pixels into the queue,
+ * blocking while the queue is full. BGRA frames are swizzled by the
+ * workers.*/
+void ChiFrameEncoder::Submit(size_t frame_number,
+                             uint32_t width,
+                             uint32_t height,
+                             const void* pixels,
+                             bool bgra)
+{
+  if (m_workers.empty())
+    throw std::runtime_error("failed to submit frame, "
+                             "encoder is not running!");
+
+  Job job;
+  job.frame_number = frame_number;
+  job.width = width;
+  job.height = height;
+  job.bgra = bgra;
+  const uint8_t* bytes = static_cast<const uint8_t*>(pixels);
+  job.pixels.assign(bytes, bytes + size_t(width) * height * 4);
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (!m_started_timing)
+  {
+    m_started_timing = true;
+    m_first_submit = std::chrono::steady_clock::now();
+    m_last_write = m_first_submit;
+  }
+
+  //============================ Back-pressure
+  if (m_jobs.size() >= m_queue_capacity)
+  {
+    auto blockStart = std::chrono::steady_clock::now();
+    m_space_cv.wait(lock, [this]{ return m_jobs.size() < m_queue_capacity; });
+
+    ++m_stats.blocked_submits;
+    m_stats.blocked_ms += std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - blockStart).count();
+  }
+
+  m_stats.bytes_in += job.pixels.size();
+  m_jobs.push_back(std::move(job));
+  lock.unlock();
+
+  m_job_cv.notify_one();
+}
+
+//###################################################################
+/** Statistics of the current or last run.*/
+ChiFrameEncoder::Stats ChiFrameEncoder::GetStats()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  Stats stats = m_stats;
+  if (m_started_timing)
+    stats.seconds = std::chrono::duration<double>(
+      m_last_write - m_first_submit).count();
+
+  return stats;
+}
+
+//###################################################################
+/** Takes frames off the queue until Finish is called and the queue is
+ * empty.*/
+void ChiFrameEncoder::WorkerLoop()
+{
+  while (true)
+  {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_job_cv.wait(lock, [this]{ return m_stopping || !m_jobs.empty(); });
+      if (m_jobs.empty()) return;
+
+      job = std::move(m_jobs.front());
+      m_jobs.pop_front();
+    }
+    m_space_cv.notify_one();
+
+    size_t bytesOut = 0;
+    const bool written = EncodeJob(job, bytesOut);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (written)
+    {
+      ++m_stats.frames;
+      m_stats.bytes_out += bytesOut;
+    }
+    else
+      ++m_stats.failed_frames;
+    m_last_write = std::chrono::steady_clock::now();
+  }
+}
+
+//###################################################################
+/** Encodes a frame and writes it to its file. Returns false if the
+ * file could not be written.*/
+bool ChiFrameEncoder::EncodeJob(Job& job, size_t& bytes_out) const
+{
+  if (job.bgra)
+    for (size_t p = 0; p < job.pixels.size(); p += 4)
+      std::swap(job.pixels[p + 0], job.pixels[p + 2]);
+
+  const std::vector<uint8_t> encoded =
+    Encode(m_format, job.width, job.height, job.pixels.data());
+  if (encoded.empty()) return false;
+
+  std::ofstream file(GetFilename(m_prefix, job.frame_number, m_format),
+                     std::ios::binary);
+  file.write(reinterpret_cast<const char*>(encoded.data()),
+             std::streamsize(encoded.size()));
+  if (!file) return false;
+
+  bytes_out = encoded.size();
+  return true;
+}
+
+//###################################################################
+/** Name of a format for printing.*/
+const char* ChiFrameEncoder::GetFormatName(Format format)
+{
+  switch (format)
+  {
+    case Format::PNG: return "PNG";
+    case Format::QOI: return "QOI";
+    case Format::Raw: return "raw";
+  }
+  return "unknown";
+}
+
+//###################################################################
+/** File extension of a format.*/
+const char* ChiFrameEncoder::GetExtension(Format format)
+{
+  switch (format)
+  {
+    case Format::PNG: return "png";
+    case Format::QOI: return "qoi";
+    case Format::Raw: return "pam";
+  }
+  return "bin";
+}
+
+//###################################################################
+/** `<prefix>_<frame>.<ext>` with the frame number zero padded.*/
+std::string ChiFrameEncoder::GetFilename(const std::string& prefix,
+                                         size_t frame_number,
+                                         Format format)
+{
+  char frameNumber[16];
+  snprintf(frameNumber, sizeof(frameNumber), "%05zu", frame_number);
+
+  return prefix + "_" + frameNumber + "." + GetExtension(format);
+}
+
+//###################################################################
+/** Encodes RGBA pixels in a format. Empty on failure.*/
+std::vector<uint8_t> ChiFrameEncoder::Encode(Format format,
+                                             uint32_t width,
+                                             uint32_t height,
+                                             const uint8_t* rgba)
+{
+  switch (format)
+  {
+    case Format::PNG: return EncodePNG(width, height, rgba);
+    case Format::QOI: return EncodeQOI(width, height, rgba);
+    case Format::Raw: return EncodeRaw(width, height, rgba);
+  }
+  return {};
+}
+
+//###################################################################
+/** Encodes RGBA pixels as PNG. Empty on failure.*/
+std::vector<uint8_t> ChiFrameEncoder::EncodePNG(uint32_t width,
+                                                uint32_t height,
+                                                const uint8_t* rgba)
+{
+  std::vector<uint8_t> encoded;
+  auto append = [](void* context, void* data, int size)
+  {
+    auto& out = *static_cast<std::vector<uint8_t>*>(context);
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    out.insert(out.end(), bytes, bytes + size);
+  };
+
+  if (!stbi_write_png_to_func(append, &encoded,
+                              int(width), int(height), 4,
+                              rgba, int(width) * 4))
+    encoded.clear();
+
+  return encoded;
+}
+
+//###################################################################
+/** Encodes RGBA pixels as QOI (https://qoiformat.org), sRGB with
+ * alpha. Each pixel becomes a run of the previous pixel, an entry of a
+ * 64 slot hash table of pixels seen before, a small delta from the
+ * previous pixel or, failing those, a literal.*/
+std::vector<uint8_t> ChiFrameEncoder::EncodeQOI(uint32_t width,
+                                                uint32_t height,
+                                                const uint8_t* rgba)
+{
+  const uint8_t QOI_OP_INDEX = 0x00;
+  const uint8_t QOI_OP_DIFF  = 0x40;
+  const uint8_t QOI_OP_LUMA  = 0x80;
+  const uint8_t QOI_OP_RUN   = 0xc0;
+  const uint8_t QOI_OP_RGB   = 0xfe;
+  const uint8_t QOI_OP_RGBA  = 0xff;
+
+  const size_t numPixels = size_t(width) * height;
+
+  std::vector<uint8_t> encoded;
+  encoded.reserve(14 + numPixels * 5 + 8);
+
+  //============================ Header
+  auto write32 = [&encoded](uint32_t value)
+  {
+    encoded.push_back(uint8_t(value >> 24));
+    encoded.push_back(uint8_t(value >> 16));
+    encoded.push_back(uint8_t(value >> 8));
+    encoded.push_back(uint8_t(value));
+  };
+  encoded.insert(encoded.end(), {'q', 'o', 'i', 'f'});
+  write32(width);
+  write32(height);
+  encoded.push_back(4); // channels
+  encoded.push_back(0); // sRGB with linear alpha
+
+  //============================ Pixels
+  uint8_t index[64][4] = {};
+  uint8_t previous[4] = {0, 0, 0, 255};
+  uint32_t run = 0;
+
+  for (size_t p = 0; p < numPixels; ++p)
+  {
+    const uint8_t* pixel = rgba + 4 * p;
+
+    if (std::memcmp(pixel, previous, 4) == 0)
+    {
+      ++run;
+      if (run == 62 || p + 1 == numPixels)
+      {
+        encoded.push_back(uint8_t(QOI_OP_RUN | (run - 1)));
+        run = 0;
+      }
+      continue;
+    }
+
+    if (run > 0)
+    {
+      encoded.push_back(uint8_t(QOI_OP_RUN | (run - 1)));
+      run = 0;
+    }
+
+    const uint32_t hash =
+      (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64;
+
+    if (std::memcmp(index[hash], pixel, 4) == 0)
+      encoded.push_back(uint8_t(QOI_OP_INDEX | hash));
+    else
+    {
+      std::memcpy(index[hash], pixel, 4);
+
+      if (pixel[3] == previous[3])
+      {
+        const int8_t dr = int8_t(pixel[0] - previous[0]);
+        const int8_t dg = int8_t(pixel[1] - previous[1]);
+        const int8_t db = int8_t(pixel[2] - previous[2]);
+        const int8_t drg = int8_t(dr - dg);
+        const int8_t dbg = int8_t(db - dg);
+
+        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 &&
+            db >= -2 && db <= 1)
+          encoded.push_back(uint8_t(QOI_OP_DIFF | (dr + 2) << 4 |
+                                    (dg + 2) << 2 | (db + 2)));
+        else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 &&
+                 dbg >= -8 && dbg <= 7)
+        {
+          encoded.push_back(uint8_t(QOI_OP_LUMA | (dg + 32)));
+          encoded.push_back(uint8_t((drg + 8) << 4 | (dbg + 8)));
+        }
+        else
+          encoded.insert(encoded.end(),
+                         {QOI_OP_RGB, pixel[0], pixel[1], pixel[2]});
+      }
+      else
+        encoded.insert(encoded.end(),
+                       {QOI_OP_RGBA, pixel[0], pixel[1], pixel[2], pixel[3]});
+    }
+
+    std::memcpy(previous, pixel, 4);
+  }
+
+  //============================ End marker
+  encoded.insert(encoded.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+
+  return encoded;
+}
+
+//###################################################################
+/** Decodes a QOI image of `width` x `height` pixels, as written by
+ * EncodeQOI, into RGBA rows `row_pitch` bytes apart. Returns false if
+ * the data is not such an image.*/
+bool ChiFrameEncoder::DecodeQOI(const uint8_t* data,
+                                size_t size,
+                                uint32_t width,
+                                uint32_t height,
+                                uint8_t* rgba,
+                                size_t row_pitch)
+{
+  const size_t headerSize = 14;
+  const size_t endSize = 8;
+  if (size < headerSize + endSize ||
+      std::memcmp(data, "qoif", 4) != 0)
+    return false;
+
+  auto read32 = [data](size_t offset)
+  {
+    return uint32_t(data[offset]) << 24 | uint32_t(data[offset + 1]) << 16 |
+           uint32_t(data[offset + 2]) << 8 | uint32_t(data[offset + 3]);
+  };
+  if (read32(4) != width || read32(8) != height) return false;
+
+  uint8_t index[64][4] = {};
+  uint8_t pixel[4] = {0, 0, 0, 255};
+  uint32_t run = 0;
+  size_t p = headerSize;
+  const size_t end = size - endSize;
+
+  for (uint32_t y = 0; y < height; ++y)
+    for (uint32_t x = 0; x < width; ++x)
+    {
+      if (run > 0)
+        --run;
+      else
+      {
+        if (p >= end) return false;
+        const uint8_t op = data[p++];
+
+        if (op == 0xfe || op == 0xff)
+        {
+          const size_t numBytes = op == 0xfe ? 3 : 4;
+          if (p + numBytes > end) return false;
+          std::memcpy(pixel, data + p, numBytes);
+          p += numBytes;
+        }
+        else if ((op & 0xc0) == 0x00)
+          std::memcpy(pixel, index[op], 4);
+        else if ((op & 0xc0) == 0x40)
+        {
+          pixel[0] = uint8_t(pixel[0] + ((op >> 4) & 0x03) - 2);
+          pixel[1] = uint8_t(pixel[1] + ((op >> 2) & 0x03) - 2);
+          pixel[2] = uint8_t(pixel[2] + (op & 0x03) - 2);
+        }
+        else if ((op & 0xc0) == 0x80)
+        {
+          if (p >= end) return false;
+          const int dg = (op & 0x3f) - 32;
+          const uint8_t drbg = data[p++];
+          pixel[0] = uint8_t(pixel[0] + dg - 8 + ((drbg >> 4) & 0x0f));
+          pixel[1] = uint8_t(pixel[1] + dg);
+          pixel[2] = uint8_t(pixel[2] + dg - 8 + (drbg & 0x0f));
+        }
+        else
+          run = op & 0x3f;
+
+        const uint32_t hash =
+          (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64;
+        std::memcpy(index[hash], pixel, 4);
+      }
+
+      std::memcpy(rgba + y * row_pitch + size_t(x) * 4, pixel, 4);
+    }
+
+  return true;
+}
+
+//###################################################################
+/** Wraps RGBA pixels in a PAM header, which most image tools read.*/
+std::vector<uint8_t> ChiFrameEncoder::EncodeRaw(uint32_t width,
+                                                uint32_t height,
+                                                const uint8_t* rgba)
+{
+  char header[128];
+  const int headerSize =
+    snprintf(header, sizeof(header),
+             "P7\nWIDTH %u\nHEIGHT %u\nDEPTH 4\nMAXVAL 255\n"
+             "TUPLTYPE RGB_ALPHA\nENDHDR\n",
+             width, height);
+
+  std::vector<uint8_t> encoded(header, header + headerSize);
+  encoded.insert(encoded.end(), rgba, rgba + size_t(width) * height * 4);
+
+  return encoded;
+}
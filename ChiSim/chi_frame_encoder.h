@@ -0,0 +1,132 @@
+#ifndef _ChiFrameEncoder_h
+#define _ChiFrameEncoder_h
+
+#include <vector>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+//###################################################################
+/** Compresses a sequence of frames to image files on a pool of worker
+ * threads, e.g. for movie capture.
+ *
+ * Submit copies a frame into a bounded queue and returns; the workers
+ * encode and write queued frames in parallel. Only when the queue is
+ * full does Submit block until a worker takes a frame, so the caller is
+ * back-pressured only when the encoders fall behind. Files are named
+ * `<prefix>_<frame>.<ext>` with the frame number zero padded, so they
+ * sort in frame order whatever order the workers finish in.
+ *
+ * Formats:
+ *  - PNG: deflate compressed, smallest and slowest.
+ *  - QOI: "Quite OK Image" format, lossless run/index/delta coding;
+ *         typically an order of magnitude faster than PNG.
+ *  - Raw: uncompressed PAM (netpbm) with a short text header.
+ *
+ * Statistics cover the time from the first submission to the last
+ * written frame, which is the sustained rate of the whole pipeline.*/
+class ChiFrameEncoder
+{
+public:
+  enum class Format
+  {
+    PNG = 0,
+    QOI = 1,
+    Raw = 2
+  };
+
+  struct Stats
+  {
+    size_t frames         = 0;
+    size_t failed_frames  = 0;
+    size_t bytes_in       = 0;
+    size_t bytes_out      = 0;
+    double seconds        = 0.0;
+    double blocked_ms     = 0.0;
+    size_t blocked_submits = 0;
+
+    double GetFramesPerSecond() const
+      { return seconds > 0.0 ? double(frames) / seconds : 0.0; }
+  };
+
+private:
+  struct Job
+  {
+    size_t               frame_number = 0;
+    uint32_t             width = 0;
+    uint32_t             height = 0;
+    bool                 bgra = false;
+    std::vector<uint8_t> pixels;
+  };
+
+  Format                  m_format = Format::PNG;
+  std::string             m_prefix;
+  size_t                  m_queue_capacity = 0;
+
+  std::mutex              m_mutex;
+  std::condition_variable m_job_cv;
+  std::condition_variable m_space_cv;
+  std::deque<Job>         m_jobs;
+  std::vector<std::thread> m_workers;
+  bool                    m_stopping = false;
+
+  Stats                   m_stats;
+  bool                    m_started_timing = false;
+  std::chrono::steady_clock::time_point m_first_submit;
+  std::chrono::steady_clock::time_point m_last_write;
+
+public:
+  ChiFrameEncoder() = default;
+  ChiFrameEncoder(const ChiFrameEncoder&) = delete;
+  ChiFrameEncoder& operator=(const ChiFrameEncoder&) = delete;
+  ~ChiFrameEncoder() { Finish(); }
+
+  void Start(Format format,
+             size_t num_threads,
+             const std::string& prefix,
+             size_t queue_capacity = 0);
+  void Finish();
+
+  void Submit(size_t frame_number,
+              uint32_t width,
+              uint32_t height,
+              const void* pixels,
+              bool bgra);
+
+  bool   IsRunning() const {return !m_workers.empty();}
+  Format GetFormat() const {return m_format;}
+  size_t GetNumThreads() const {return m_workers.size();}
+  Stats  GetStats();
+
+  static const char* GetFormatName(Format format);
+  static const char* GetExtension(Format format);
+  static std::string GetFilename(const std::string& prefix,
+                                 size_t frame_number,
+                                 Format format);
+
+  static std::vector<uint8_t> Encode(Format format,
+                                     uint32_t width, uint32_t height,
+                                     const uint8_t* rgba);
+
+  static std::vector<uint8_t> EncodePNG(uint32_t width, uint32_t height,
+                                        const uint8_t* rgba);
+  static std::vector<uint8_t> EncodeQOI(uint32_t width, uint32_t height,
+                                        const uint8_t* rgba);
+  static std::vector<uint8_t> EncodeRaw(uint32_t width, uint32_t height,
+                                        const uint8_t* rgba);
+
+  static bool DecodeQOI(const uint8_t* data, size_t size,
+                        uint32_t width, uint32_t height,
+                        uint8_t* rgba, size_t row_pitch);
+
+private:
+  void WorkerLoop();
+  bool EncodeJob(Job& job, size_t& bytes_out) const;
+};
+
+#endif
@@ -0,0 +1,138 @@
+#include "chi_frame_stream_receiver.h"
+#include "chi_frame_encoder.h"
+
+#include <algorithm>
+#include <thread>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+//###################################################################
+/** Connects to a streamer on `address`, retrying until
+ * `timeout_seconds` have passed so the viewer can be started first.*/
+bool ChiFrameStreamReceiver::Connect(const std::string& address,
+                                     double timeout_seconds)
+{
+  Disconnect();
+
+  const auto deadline = std::chrono::steady_clock::now() +
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(timeout_seconds));
+
+  while (true)
+  {
+    m_fd = ChiFrameStreamer::OpenSocket(address, false);
+    if (m_fd >= 0) break;
+    if (std::chrono::steady_clock::now() >= deadline) return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+
+  m_stats = Stats();
+  return true;
+}
+
+//###################################################################
+/** Closes the connection.*/
+void ChiFrameStreamReceiver::Disconnect()
+{
+  if (m_fd < 0) return;
+
+  close(m_fd);
+  m_fd = -1;
+}
+
+//###################################################################
+/** Receives the next frame, applies its tiles and acknowledges it.
+ * Returns false once the streamer is gone or sent something that is
+ * not a frame.*/
+bool ChiFrameStreamReceiver::ReceiveFrame()
+{
+  if (m_fd < 0) return false;
+
+  ChiFrameStreamer::FrameHeader header;
+  if (!ReceiveAll(&header, sizeof(header)) ||
+      header.magic != ChiFrameStreamer::MAGIC ||
+      header.tile_size == 0)
+    return false;
+
+  m_payload.resize(header.payload_size);
+  if (!ReceiveAll(m_payload.data(), m_payload.size())) return false;
+
+  if (header.width != m_width || header.height != m_height)
+  {
+    m_width = header.width;
+    m_height = header.height;
+    m_pixels.assign(size_t(m_width) * m_height * 4, 0);
+  }
+
+  //============================ Apply tiles
+  const uint32_t tileSize = header.tile_size;
+  const uint32_t tilesX = (m_width + tileSize - 1) / tileSize;
+  const uint32_t tilesY = (m_height + tileSize - 1) / tileSize;
+  const size_t rowPitch = size_t(m_width) * 4;
+
+  size_t offset = 0;
+  for (uint32_t t = 0; t < header.num_tiles; ++t)
+  {
+    ChiFrameStreamer::TileHeader tile;
+    if (offset + sizeof(tile) > m_payload.size()) return false;
+    std::memcpy(&tile, m_payload.data() + offset, sizeof(tile));
+    offset += sizeof(tile);
+
+    if (tile.index >= tilesX * tilesY ||
+        offset + tile.size > m_payload.size())
+      return false;
+
+    const uint32_t x = (tile.index % tilesX) * tileSize;
+    const uint32_t y = (tile.index / tilesX) * tileSize;
+    if (!ChiFrameEncoder::DecodeQOI(m_payload.data() + offset, tile.size,
+                                    std::min(tileSize, m_width - x),
+                                    std::min(tileSize, m_height - y),
+                                    m_pixels.data() + y * rowPitch + x * 4,
+                                    rowPitch))
+      return false;
+    offset += tile.size;
+  }
+  m_frame_number = header.frame_number;
+
+  //============================ Acknowledge
+  const uint64_t frameNumber = header.frame_number;
+  if (send(m_fd, &frameNumber, sizeof(frameNumber), MSG_NOSIGNAL) !=
+      ssize_t(sizeof(frameNumber)))
+    return false;
+
+  //============================ Statistics
+  const auto now = std::chrono::steady_clock::now();
+  const double latencyMs = double(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(
+      now.time_since_epoch()).count() - int64_t(header.submitted_ns)) / 1.0e6;
+
+  auto& stats = m_stats;
+  if (stats.frames == 0) m_first_frame = now;
+  ++stats.frames;
+  stats.tiles += header.num_tiles;
+  stats.bytes += sizeof(header) + header.payload_size;
+  stats.latency_ms += (latencyMs - stats.latency_ms) / double(stats.frames);
+  stats.max_latency_ms = std::max(stats.max_latency_ms, latencyMs);
+  stats.seconds = std::chrono::duration<double>(now - m_first_frame).count();
+
+  return true;
+}
+
+//###################################################################
+/** Reads exactly `size` bytes. False once the streamer is gone.*/
+bool ChiFrameStreamReceiver::ReceiveAll(void* data, size_t size)
+{
+  char* bytes = static_cast<char*>(data);
+  while (size > 0)
+  {
+    const ssize_t numRead = recv(m_fd, bytes, size, 0);
+    if (numRead < 0 && errno == EINTR) continue;
+    if (numRead <= 0) return false;
+    bytes += numRead;
+    size -= size_t(numRead);
+  }
+  return true;
+}
@@ -0,0 +1,69 @@
+#ifndef _ChiFrameStreamReceiver_h
+#define _ChiFrameStreamReceiver_h
+
+#include "chi_frame_streamer.h"
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+//###################################################################
+/** Minimal viewer side of a ChiFrameStreamer: connects to it, applies
+ * the changed tiles of every frame to a local copy of the image and
+ * acknowledges each frame once applied.
+ *
+ * Latency is measured from the frame's submission to the streamer to
+ * the frame being applied, using the steady clock, so it is only
+ * meaningful with both ends on the same host (e.g. over loopback).*/
+class ChiFrameStreamReceiver
+{
+public:
+  struct Stats
+  {
+    size_t frames = 0;
+    size_t tiles = 0;
+    size_t bytes = 0;
+    double latency_ms = 0.0;     //mean
+    double max_latency_ms = 0.0;
+    double seconds = 0.0;        //first to last frame
+
+    double GetFramesPerSecond() const
+      { return seconds > 0.0 ? double(frames) / seconds : 0.0; }
+    double GetBytesPerSecond() const
+      { return seconds > 0.0 ? double(bytes) / seconds : 0.0; }
+  };
+
+private:
+  int                  m_fd = -1;
+  uint32_t             m_width = 0;
+  uint32_t             m_height = 0;
+  uint64_t             m_frame_number = 0;
+  std::vector<uint8_t> m_pixels;
+  std::vector<uint8_t> m_payload;
+
+  Stats                m_stats;
+  std::chrono::steady_clock::time_point m_first_frame;
+
+public:
+  ChiFrameStreamReceiver() = default;
+  ChiFrameStreamReceiver(const ChiFrameStreamReceiver&) = delete;
+  ChiFrameStreamReceiver& operator=(const ChiFrameStreamReceiver&) = delete;
+  ~ChiFrameStreamReceiver() { Disconnect(); }
+
+  bool Connect(const std::string& address, double timeout_seconds);
+  void Disconnect();
+  bool ReceiveFrame();
+
+  uint32_t       GetWidth() const {return m_width;}
+  uint32_t       GetHeight() const {return m_height;}
+  uint64_t       GetFrameNumber() const {return m_frame_number;}
+  const uint8_t* GetPixels() const {return m_pixels.data();}
+  const Stats&   GetStats() const {return m_stats;}
+
+private:
+  bool ReceiveAll(void* data, size_t size);
+};
+
+#endif
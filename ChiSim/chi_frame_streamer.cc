@@ -0,0 +1,464 @@
+#include "chi_frame_streamer.h"
+#include "chi_frame_encoder.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+//###################################################################
+/** Opens a socket on `unix:<path>` or `<host>:<port>`, listening on it
+ * if `listen` is set, else connected to it. Returns -1 on failure.*/
+int ChiFrameStreamer::OpenSocket(const std::string& address, bool listen)
+{
+  //============================ Unix domain socket
+  if (address.rfind("unix:", 0) == 0)
+  {
+    const std::string path = address.substr(5);
+
+    sockaddr_un unixAddress = {};
+    unixAddress.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(unixAddress.sun_path))
+      return -1;
+    std::memcpy(unixAddress.sun_path, path.c_str(), path.size() + 1);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    const sockaddr* socketAddress =
+      reinterpret_cast<const sockaddr*>(&unixAddress);
+    if (listen) unlink(path.c_str());
+    const int result = listen ?
+      bind(fd, socketAddress, sizeof(unixAddress)) :
+      connect(fd, socketAddress, sizeof(unixAddress));
+    if (result != 0 || (listen && ::listen(fd, 1) != 0))
+    {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  //============================ TCP
+  const size_t colon = address.rfind(':');
+  if (colon == std::string::npos) return -1;
+  const std::string host = address.substr(0, colon);
+  const std::string port = address.substr(colon + 1);
+
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = listen ? AI_PASSIVE : 0;
+
+  addrinfo* addresses = nullptr;
+  if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(),
+                  &hints, &addresses) != 0)
+    return -1;
+
+  int fd = -1;
+  for (addrinfo* a = addresses; a && fd < 0; a = a->ai_next)
+  {
+    fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+    if (fd < 0) continue;
+
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (listen)
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    const int result = listen ? bind(fd, a->ai_addr, a->ai_addrlen) :
+                                connect(fd, a->ai_addr, a->ai_addrlen);
+    if (result != 0 || (listen && ::listen(fd, 1) != 0))
+    {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+
+  return fd;
+}
+
+//###################################################################
+/** Listens on `address` and starts the sender thread, which serves
+ * viewers as they connect. Statistics of a previous run are cleared.*/
+void ChiFrameStreamer::Start(const std::string& address)
+{
+  Finish();
+
+  m_listen_fd = OpenSocket(address, true);
+  if (m_listen_fd < 0)
+    throw std::runtime_error("failed to listen for viewers on " +
+                             address + "!");
+
+  m_stopping = false;
+  m_mailbox_full = false;
+  m_viewer_connected = false;
+  m_stats = Stats();
+  m_started_timing = false;
+
+  m_sender = std::thread(&ChiFrameStreamer::SenderLoop, this);
+}
+
+//###################################################################
+/** Sends the frame still in the mailbox, unless the viewer is too far
+ * behind, waits briefly for the frames in flight to be acknowledged
+ * and stops the sender thread. Neither takes longer than about
+ * STOP_TIMEOUT_MS, also with a viewer that stopped reading.
+ * Statistics remain available until the next Start.*/
+void ChiFrameStreamer::Finish()
+{
+  if (!m_sender.joinable()) return;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_frame_cv.notify_all();
+  m_viewer_cv.notify_all();
+
+  // Wakes the sender if it is waiting for a viewer.
+  shutdown(m_listen_fd, SHUT_RDWR);
+
+  m_sender.join();
+
+  close(m_listen_fd);
+  m_listen_fd = -1;
+}
+
+//###################################################################
+/** Waits up to `timeout_seconds` for a viewer to connect. Returns
+ * whether one is connected.*/
+bool ChiFrameStreamer::WaitForViewer(double timeout_seconds)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  return m_viewer_cv.wait_for(
+    lock, std::chrono::duration<double>(timeout_seconds),
+    [this]{ return m_viewer_connected || m_stopping; }) && m_viewer_connected;
+}
+
+//###################################################################
+/** Copies a frame of tightly packed 4 byte pixels into the mailbox,
+ * replacing a frame not yet taken by the sender. Frames submitted
+ * while no viewer is connected are skipped. Never blocks on the
+ * socket.*/
+void ChiFrameStreamer::Submit(size_t frame_number,
+                              uint32_t width,
+                              uint32_t height,
+                              const void* pixels,
+                              bool bgra)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  ++m_stats.frames_submitted;
+
+  if (!m_viewer_connected)
+  {
+    ++m_stats.frames_skipped;
+    return;
+  }
+  if (m_mailbox_full) ++m_stats.frames_skipped;
+
+  const uint8_t* bytes = static_cast<const uint8_t*>(pixels);
+  m_mailbox.frame_number = frame_number;
+  m_mailbox.width = width;
+  m_mailbox.height = height;
+  m_mailbox.bgra = bgra;
+  m_mailbox.pixels.assign(bytes, bytes + size_t(width) * height * 4);
+  m_mailbox.submitted = std::chrono::steady_clock::now();
+  m_mailbox_full = true;
+  lock.unlock();
+
+  m_frame_cv.notify_one();
+}
+
+//###################################################################
+/** Statistics of the current or last run.*/
+ChiFrameStreamer::Stats ChiFrameStreamer::GetStats()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  Stats stats = m_stats;
+  if (m_started_timing)
+    stats.seconds = std::chrono::duration<double>(
+      m_last_send - m_first_send).count();
+
+  return stats;
+}
+
+//###################################################################
+/** Accepts viewers one at a time and sends each the newest frame
+ * whenever fewer than MAX_FRAMES_IN_FLIGHT frames are unacknowledged,
+ * until Finish is called.*/
+void ChiFrameStreamer::SenderLoop()
+{
+  while (true)
+  {
+    //============================ Wait for a viewer
+    if (m_viewer_fd < 0)
+    {
+      const int fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_stopping)
+      {
+        if (fd >= 0) close(fd);
+        break;
+      }
+      if (fd < 0) continue;
+
+      const int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+      m_viewer_fd = fd;
+      m_viewer_connected = true;
+      m_previous.clear();
+      m_in_flight.clear();
+      m_ack_bytes = 0;
+      m_viewer_cv.notify_all();
+    }
+
+    //============================ Back-pressure
+    // Before taking a frame, so the one sent is the newest once the
+    // viewer catches up. A viewer that stopped acknowledging but keeps
+    // the connection open must not hold up Finish.
+    bool connected = true, stopping = false;
+    while (connected && !stopping &&
+           m_in_flight.size() >= MAX_FRAMES_IN_FLIGHT)
+    {
+      connected = ReadAcknowledgements(100);
+
+      std::lock_guard<std::mutex> lock(m_mutex);
+      stopping = m_stopping;
+    }
+    if (stopping) break;
+    if (!connected)
+    {
+      CloseViewer();
+      continue;
+    }
+
+    //============================ Wait for a frame
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_frame_cv.wait(lock, [this]{ return m_stopping || m_mailbox_full; });
+      if (!m_mailbox_full) break;
+
+      std::swap(m_sending, m_mailbox);
+      m_mailbox_full = false;
+    }
+
+    connected = SendFrame(m_sending);
+    if (connected) connected = ReadAcknowledgements(0);
+    if (!connected) CloseViewer();
+  }
+
+  //============================ Drain
+  // Gives the viewer a moment to acknowledge the last frames so the
+  // latency covers them too.
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(STOP_TIMEOUT_MS);
+  while (m_viewer_fd >= 0 && !m_in_flight.empty() &&
+         std::chrono::steady_clock::now() < deadline)
+    if (!ReadAcknowledgements(100)) break;
+
+  CloseViewer();
+}
+
+//###################################################################
+/** Sends the tiles of a frame that changed since the last frame sent.
+ * Returns false once the viewer is gone.*/
+bool ChiFrameStreamer::SendFrame(Frame& frame)
+{
+  if (frame.bgra)
+    for (size_t p = 0; p < frame.pixels.size(); p += 4)
+      std::swap(frame.pixels[p + 0], frame.pixels[p + 2]);
+
+  const bool keyFrame = m_previous.empty() ||
+                        m_previous_width != frame.width ||
+                        m_previous_height != frame.height;
+
+  const uint32_t tilesX = (frame.width + TILE_SIZE - 1) / TILE_SIZE;
+  const uint32_t tilesY = (frame.height + TILE_SIZE - 1) / TILE_SIZE;
+  const size_t rowPitch = size_t(frame.width) * 4;
+
+  //============================ Encode changed tiles
+  std::vector<uint8_t> payload;
+  std::vector<uint8_t> tile;
+  uint32_t numTiles = 0;
+
+  for (uint32_t ty = 0; ty < tilesY; ++ty)
+    for (uint32_t tx = 0; tx < tilesX; ++tx)
+    {
+      const uint32_t x = tx * TILE_SIZE;
+      const uint32_t y = ty * TILE_SIZE;
+      const uint32_t w = std::min(TILE_SIZE, frame.width - x);
+      const uint32_t h = std::min(TILE_SIZE, frame.height - y);
+      const size_t offset = size_t(y) * rowPitch + size_t(x) * 4;
+
+      bool changed = keyFrame;
+      for (uint32_t r = 0; r < h && !changed; ++r)
+        changed = std::memcmp(frame.pixels.data() + offset + r * rowPitch,
+                              m_previous.data() + offset + r * rowPitch,
+                              size_t(w) * 4) != 0;
+      if (!changed) continue;
+
+      tile.resize(size_t(w) * h * 4);
+      for (uint32_t r = 0; r < h; ++r)
+        std::memcpy(tile.data() + size_t(r) * w * 4,
+                    frame.pixels.data() + offset + r * rowPitch,
+                    size_t(w) * 4);
+
+      const std::vector<uint8_t> encoded =
+        ChiFrameEncoder::EncodeQOI(w, h, tile.data());
+
+      TileHeader tileHeader;
+      tileHeader.index = ty * tilesX + tx;
+      tileHeader.size = uint32_t(encoded.size());
+      const uint8_t* headerBytes = reinterpret_cast<const uint8_t*>(&tileHeader);
+      payload.insert(payload.end(), headerBytes,
+                     headerBytes + sizeof(tileHeader));
+      payload.insert(payload.end(), encoded.begin(), encoded.end());
+      ++numTiles;
+    }
+
+  //============================ Send
+  FrameHeader header;
+  header.width = frame.width;
+  header.height = frame.height;
+  header.frame_number = frame.frame_number;
+  header.submitted_ns = uint64_t(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(
+      frame.submitted.time_since_epoch()).count());
+  header.num_tiles = numTiles;
+  header.payload_size = uint32_t(payload.size());
+
+  if (!SendAll(&header, sizeof(header)) ||
+      !SendAll(payload.data(), payload.size()))
+    return false;
+
+  m_in_flight.emplace_back(frame.frame_number, frame.submitted);
+  std::swap(m_previous, frame.pixels);
+  m_previous_width = frame.width;
+  m_previous_height = frame.height;
+
+  //============================ Statistics
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const auto now = std::chrono::steady_clock::now();
+  if (!m_started_timing)
+  {
+    m_started_timing = true;
+    m_first_send = now;
+  }
+  m_last_send = now;
+
+  ++m_stats.frames_sent;
+  m_stats.tiles_sent += numTiles;
+  m_stats.tiles_total += size_t(tilesX) * tilesY;
+  m_stats.bytes_raw += m_previous.size();
+  m_stats.bytes_sent += sizeof(header) + payload.size();
+
+  return true;
+}
+
+//###################################################################
+/** Writes all of `size` bytes to the viewer without blocking in send:
+ * while the socket is full, waits for it in steps of 100 ms. A viewer
+ * that stopped reading without disconnecting would otherwise hold up
+ * Finish for good, so once Finish was called the send is given up
+ * after STOP_TIMEOUT_MS. Returns false once the viewer is gone or the
+ * send was given up.*/
+bool ChiFrameStreamer::SendAll(const void* data, size_t size)
+{
+  const char* bytes = static_cast<const char*>(data);
+  std::chrono::steady_clock::time_point deadline;
+  bool stopping = false;
+
+  while (size > 0)
+  {
+    const ssize_t numSent =
+      send(m_viewer_fd, bytes, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (numSent > 0)
+    {
+      bytes += numSent;
+      size -= size_t(numSent);
+      continue;
+    }
+    if (numSent == 0 ||
+        (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+      return false;
+
+    //============================ Socket full
+    pollfd writable = {m_viewer_fd, POLLOUT, 0};
+    if (poll(&writable, 1, 100) < 0 && errno != EINTR) return false;
+
+    if (!stopping)
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      stopping = m_stopping;
+      deadline = std::chrono::steady_clock::now() +
+                 std::chrono::milliseconds(STOP_TIMEOUT_MS);
+    }
+    else if (std::chrono::steady_clock::now() > deadline)
+      return false;
+  }
+  return true;
+}
+
+//###################################################################
+/** Reads the viewer's acknowledgements, waiting up to `timeout_ms` for
+ * the first. Returns false once the viewer is gone.*/
+bool ChiFrameStreamer::ReadAcknowledgements(int timeout_ms)
+{
+  pollfd readable = {m_viewer_fd, POLLIN, 0};
+  if (poll(&readable, 1, timeout_ms) <= 0) return true;
+
+  uint64_t frameNumbers[16];
+  const ssize_t numRead = recv(m_viewer_fd, frameNumbers,
+                               sizeof(frameNumbers), MSG_DONTWAIT);
+  if (numRead == 0) return false;
+  if (numRead < 0) return errno == EAGAIN || errno == EINTR;
+
+  // Acknowledgements are 8 bytes each and in frame order, so counting
+  // whole ones is enough; a partial one is completed by the next read.
+  const size_t numBytes = m_ack_bytes + size_t(numRead);
+  const size_t numAcks = numBytes / sizeof(uint64_t);
+  m_ack_bytes = numBytes % sizeof(uint64_t);
+
+  const auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (size_t a = 0; a < numAcks && !m_in_flight.empty(); ++a)
+  {
+    const double latencyMs = std::chrono::duration<double, std::milli>(
+      now - m_in_flight.front().second).count();
+    m_in_flight.pop_front();
+
+    auto& stats = m_stats;
+    ++stats.frames_acknowledged;
+    stats.latency_ms +=
+      (latencyMs - stats.latency_ms) / double(stats.frames_acknowledged);
+  }
+
+  return true;
+}
+
+//###################################################################
+/** Drops the current viewer; the next one gets a key frame.*/
+void ChiFrameStreamer::CloseViewer()
+{
+  if (m_viewer_fd < 0) return;
+
+  close(m_viewer_fd);
+  m_viewer_fd = -1;
+  m_in_flight.clear();
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_viewer_connected = false;
+}
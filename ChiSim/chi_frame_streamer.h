@@ -0,0 +1,150 @@
+#ifndef _ChiFrameStreamer_h
+#define _ChiFrameStreamer_h
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+//###################################################################
+/** Streams rendered frames to a viewer over a socket.
+ *
+ * The streamer listens on `unix:<path>` or `<host>:<port>` (TCP) and
+ * serves one viewer at a time, e.g. a ChiFrameStreamReceiver. Each
+ * frame is split into TILE_SIZE x TILE_SIZE tiles. Only the tiles that
+ * differ from the last frame sent are sent, each QOI compressed. The
+ * first frame to a new viewer sends every tile.
+ *
+ * Submit copies a frame into a single slot mailbox and returns; a
+ * sender thread encodes and sends the newest frame whenever the
+ * socket can take it. The viewer acknowledges every frame once shown
+ * and at most MAX_FRAMES_IN_FLIGHT frames are unacknowledged, so when
+ * the link or viewer falls behind the frame rate drops (frames are
+ * skipped) instead of the latency growing. The renderer never blocks.
+ *
+ * Messages, in host byte order (the viewer is expected on a like
+ * machine):
+ *
+ *   streamer: FrameHeader, then num_tiles x (TileHeader, QOI data)
+ *   viewer:   uint64_t frame_number once the frame is shown
+ *
+ * POSIX only.*/
+class ChiFrameStreamer
+{
+public:
+  static constexpr uint32_t MAGIC = 0x46534843; //"CHSF"
+  static constexpr uint32_t TILE_SIZE = 64;
+  static constexpr size_t   MAX_FRAMES_IN_FLIGHT = 2;
+  static constexpr int      STOP_TIMEOUT_MS = 1000;
+
+  struct FrameHeader
+  {
+    uint32_t magic = MAGIC;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t tile_size = TILE_SIZE;
+    uint64_t frame_number = 0;
+    uint64_t submitted_ns = 0;  //steady clock, for same-host latency
+    uint32_t num_tiles = 0;
+    uint32_t payload_size = 0;  //bytes of tiles following the header
+  };
+
+  struct TileHeader
+  {
+    uint32_t index = 0;         //row-major tile index
+    uint32_t size = 0;          //bytes of QOI data
+  };
+
+  struct Stats
+  {
+    size_t frames_submitted = 0;
+    size_t frames_sent = 0;
+    size_t frames_skipped = 0;
+    size_t tiles_sent = 0;
+    size_t tiles_total = 0;
+    size_t bytes_raw = 0;
+    size_t bytes_sent = 0;
+    size_t frames_acknowledged = 0;
+    double latency_ms = 0.0;    //submission to acknowledgement read,
+                                //mean; an upper bound since
+                                //acknowledgements are read on sends
+    double seconds = 0.0;       //first to last frame sent
+
+    double GetFramesPerSecond() const
+      { return seconds > 0.0 ? double(frames_sent) / seconds : 0.0; }
+    double GetBytesPerSecond() const
+      { return seconds > 0.0 ? double(bytes_sent) / seconds : 0.0; }
+  };
+
+private:
+  struct Frame
+  {
+    size_t               frame_number = 0;
+    uint32_t             width = 0;
+    uint32_t             height = 0;
+    bool                 bgra = false;
+    std::vector<uint8_t> pixels;
+    std::chrono::steady_clock::time_point submitted;
+  };
+
+  int                     m_listen_fd = -1;
+  int                     m_viewer_fd = -1;
+
+  std::mutex              m_mutex;
+  std::condition_variable m_frame_cv;
+  std::condition_variable m_viewer_cv;
+  Frame                   m_mailbox;
+  bool                    m_mailbox_full = false;
+  bool                    m_viewer_connected = false;
+  bool                    m_stopping = false;
+  std::thread             m_sender;
+
+  // Sender thread only.
+  Frame                   m_sending;
+  std::vector<uint8_t>    m_previous;
+  uint32_t                m_previous_width = 0;
+  uint32_t                m_previous_height = 0;
+  std::deque<std::pair<uint64_t, std::chrono::steady_clock::time_point>>
+                          m_in_flight;
+  size_t                  m_ack_bytes = 0;
+
+  Stats                   m_stats;
+  bool                    m_started_timing = false;
+  std::chrono::steady_clock::time_point m_first_send;
+  std::chrono::steady_clock::time_point m_last_send;
+
+public:
+  ChiFrameStreamer() = default;
+  ChiFrameStreamer(const ChiFrameStreamer&) = delete;
+  ChiFrameStreamer& operator=(const ChiFrameStreamer&) = delete;
+  ~ChiFrameStreamer() { Finish(); }
+
+  void Start(const std::string& address);
+  void Finish();
+  bool WaitForViewer(double timeout_seconds);
+
+  void Submit(size_t frame_number,
+              uint32_t width,
+              uint32_t height,
+              const void* pixels,
+              bool bgra);
+
+  bool  IsRunning() const {return m_sender.joinable();}
+  Stats GetStats();
+
+  static int OpenSocket(const std::string& address, bool listen);
+
+private:
+  void SenderLoop();
+  bool SendFrame(Frame& frame);
+  bool SendAll(const void* data, size_t size);
+  bool ReadAcknowledgements(int timeout_ms);
+  void CloseViewer();
+};
+
+#endif
@@ -0,0 +1,110 @@
+#include "chi_offset_allocator.h"
+
+#include <stdexcept>
+
+//###################################################################
+/** Releases all allocations and makes the whole capacity available as
+ * a single free range.*/
+void ChiOffsetAllocator::Reset(uint32_t capacity)
+{
+  m_capacity = capacity;
+  m_used = 0;
+
+  m_free_by_offset.clear();
+  m_free_by_size.clear();
+  m_allocations.clear();
+
+  if (capacity > 0)
+    InsertFreeRange(0, capacity);
+}
+
+//###################################################################
+/** Allocates `size` units and returns the offset of the range, or
+ * INVALID_OFFSET if no free range is large enough.*/
+uint32_t ChiOffsetAllocator::Allocate(uint32_t size)
+{
+  if (size == 0) return INVALID_OFFSET;
+
+  auto bySize = m_free_by_size.lower_bound(size);
+  if (bySize == m_free_by_size.end()) return INVALID_OFFSET;
+
+  const uint32_t rangeOffset = bySize->second;
+  const uint32_t rangeSize   = bySize->first;
+
+  EraseFreeRange(m_free_by_offset.find(rangeOffset));
+
+  if (rangeSize > size)
+    InsertFreeRange(rangeOffset + size, rangeSize - size);
+
+  m_allocations[rangeOffset] = size;
+  m_used += size;
+
+  return rangeOffset;
+}
+
+//###################################################################
+/** Returns a range obtained from Allocate and merges it with adjacent
+ * free ranges.*/
+void ChiOffsetAllocator::Free(uint32_t offset)
+{
+  auto allocation = m_allocations.find(offset);
+  if (allocation == m_allocations.end())
+    throw std::logic_error("freeing an offset that was not allocated!");
+
+  uint32_t size = allocation->second;
+  m_allocations.erase(allocation);
+  m_used -= size;
+
+  //============================ Merge with the following range
+  auto next = m_free_by_offset.find(offset + size);
+  if (next != m_free_by_offset.end())
+  {
+    size += next->second;
+    EraseFreeRange(next);
+  }
+
+  //============================ Merge with the preceding range
+  auto prev = m_free_by_offset.lower_bound(offset);
+  if (prev != m_free_by_offset.begin())
+  {
+    --prev;
+    if (prev->first + prev->second == offset)
+    {
+      offset = prev->first;
+      size += prev->second;
+      EraseFreeRange(prev);
+    }
+  }
+
+  InsertFreeRange(offset, size);
+}
+
+//###################################################################
+/** Size of the largest range that can currently be allocated.*/
+uint32_t ChiOffsetAllocator::GetLargestFreeRange() const
+{
+  if (m_free_by_size.empty()) return 0;
+  return m_free_by_size.rbegin()->first;
+}
+
+//###################################################################
+void ChiOffsetAllocator::InsertFreeRange(uint32_t offset, uint32_t size)
+{
+  m_free_by_offset[offset] = size;
+  m_free_by_size.emplace(size, offset);
+}
+
+//###################################################################
+void ChiOffsetAllocator::EraseFreeRange(
+  std::map<uint32_t, uint32_t>::iterator it)
+{
+  auto range = m_free_by_size.equal_range(it->second);
+  for (auto s = range.first; s != range.second; ++s)
+    if (s->second == it->first)
+    {
+      m_free_by_size.erase(s);
+      break;
+    }
+
+  m_free_by_offset.erase(it);
+}
@@ -0,0 +1,49 @@
+#ifndef _ChiOffsetAllocator_h
+#define _ChiOffsetAllocator_h
+
+#include <map>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+//###################################################################
+/** Sub-allocates ranges of a fixed capacity, e.g. elements of a large
+ * GPU buffer.
+ *
+ * Free ranges are kept sorted both by offset, so that a freed range can
+ * be merged with its neighbours, and by size, so that allocation picks
+ * the smallest range that fits (best fit). Offsets and sizes are in
+ * arbitrary units (vertices, indices, bytes); the allocator never
+ * touches the memory itself.*/
+class ChiOffsetAllocator
+{
+public:
+  static constexpr uint32_t INVALID_OFFSET = ~0u;
+
+private:
+  uint32_t                               m_capacity = 0;
+  uint32_t                               m_used = 0;
+
+  std::map<uint32_t, uint32_t>           m_free_by_offset; //offset->size
+  std::multimap<uint32_t, uint32_t>      m_free_by_size;   //size->offset
+  std::unordered_map<uint32_t, uint32_t> m_allocations;    //offset->size
+
+public:
+  explicit ChiOffsetAllocator(uint32_t capacity = 0) { Reset(capacity); }
+
+  void     Reset(uint32_t capacity);
+
+  uint32_t Allocate(uint32_t size);
+  void     Free(uint32_t offset);
+
+  uint32_t GetCapacity() const {return m_capacity;}
+  uint32_t GetUsed() const {return m_used;}
+  uint32_t GetLargestFreeRange() const;
+  size_t   GetNumFreeRanges() const {return m_free_by_offset.size();}
+
+private:
+  void InsertFreeRange(uint32_t offset, uint32_t size);
+  void EraseFreeRange(std::map<uint32_t, uint32_t>::iterator it);
+};
+
+#endif
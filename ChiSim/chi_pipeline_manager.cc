@@ -0,0 +1,774 @@
+#include "chi_pipeline_manager.h"
+
+#include <stdexcept>
+#include <string_view>
+#include <array>
+#include <algorithm>
+
+namespace
+{
+  /** The four parts of a graphics pipeline library.*/
+  enum LibraryPart
+  {
+    VERTEX_INPUT       = 0,
+    PRE_RASTERIZATION  = 1,
+    FRAGMENT_SHADER    = 2,
+    FRAGMENT_OUTPUT    = 3
+  };
+
+  //=================================================================
+  /** Fixed-function and shader state of a pipeline, built from a
+   * description. Owns the shader modules it creates.*/
+  struct PipelineState
+  {
+    VkDevice                                 device;
+    VkShaderModule                           vertex_module   = VK_NULL_HANDLE;
+    VkShaderModule                           fragment_module = VK_NULL_HANDLE;
+    std::vector<VkPipelineShaderStageCreateInfo> stages;
+    std::vector<VkSpecializationMapEntry>    specialization_entries;
+    VkSpecializationInfo                     specialization = {};
+
+    VkPipelineVertexInputStateCreateInfo     vertex_input = {};
+    VkPipelineInputAssemblyStateCreateInfo   input_assembly = {};
+    VkPipelineViewportStateCreateInfo        viewport = {};
+    VkPipelineRasterizationStateCreateInfo   rasterizer = {};
+    VkPipelineMultisampleStateCreateInfo     multisampling = {};
+    VkPipelineDepthStencilStateCreateInfo    depth_stencil = {};
+    VkPipelineColorBlendAttachmentState      blend_attachment = {};
+    VkPipelineColorBlendStateCreateInfo      color_blending = {};
+    std::array<VkDynamicState, 2>            dynamic_states =
+      {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+    VkPipelineDynamicStateCreateInfo         dynamic_state = {};
+
+    PipelineState(VkDevice in_device,
+                  const ChiPipelineManager::GraphicsPipelineDesc& desc,
+                  bool vertex_stage, bool fragment_stage) :
+      device(in_device)
+    {
+      for (uint32_t c = 0; c < desc.specialization_constants.size(); ++c)
+      {
+        VkSpecializationMapEntry entry = {};
+        entry.constantID = c;
+        entry.offset = c * sizeof(uint32_t);
+        entry.size = sizeof(uint32_t);
+        specialization_entries.push_back(entry);
+      }
+      specialization.mapEntryCount = specialization_entries.size();
+      specialization.pMapEntries = specialization_entries.data();
+      specialization.dataSize =
+        desc.specialization_constants.size() * sizeof(uint32_t);
+      specialization.pData = desc.specialization_constants.data();
+
+      if (vertex_stage)
+        AddStage(desc.vertex_spirv, VK_SHADER_STAGE_VERTEX_BIT,
+                 vertex_module);
+      if (fragment_stage)
+        AddStage(desc.fragment_spirv, VK_SHADER_STAGE_FRAGMENT_BIT,
+                 fragment_module);
+
+      vertex_input.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+      vertex_input.vertexBindingDescriptionCount =
+        desc.vertex_bindings.size();
+      vertex_input.pVertexBindingDescriptions = desc.vertex_bindings.data();
+      vertex_input.vertexAttributeDescriptionCount =
+        desc.vertex_attributes.size();
+      vertex_input.pVertexAttributeDescriptions =
+        desc.vertex_attributes.data();
+
+      input_assembly.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+      input_assembly.topology = desc.topology;
+      input_assembly.primitiveRestartEnable = VK_FALSE;
+
+      // Viewport and scissor are dynamic.
+      viewport.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+      viewport.viewportCount = 1;
+      viewport.scissorCount = 1;
+
+      rasterizer.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+      rasterizer.depthClampEnable = VK_FALSE;
+      rasterizer.rasterizerDiscardEnable = VK_FALSE;
+      rasterizer.polygonMode = desc.polygon_mode;
+      rasterizer.lineWidth = 1.0f;
+      rasterizer.cullMode = desc.cull_mode;
+      rasterizer.frontFace = desc.front_face;
+      rasterizer.depthBiasEnable = VK_FALSE;
+
+      multisampling.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+      multisampling.sampleShadingEnable = VK_FALSE;
+      multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+      depth_stencil.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+      depth_stencil.depthTestEnable = desc.depth_test ? VK_TRUE : VK_FALSE;
+      depth_stencil.depthWriteEnable = desc.depth_write ? VK_TRUE : VK_FALSE;
+      depth_stencil.depthCompareOp = desc.depth_compare;
+      depth_stencil.depthBoundsTestEnable = VK_FALSE;
+      depth_stencil.minDepthBounds = 0.0f;
+      depth_stencil.maxDepthBounds = 1.0f;
+      depth_stencil.stencilTestEnable = VK_FALSE;
+
+      blend_attachment.colorWriteMask =
+        VK_COLOR_COMPONENT_R_BIT |
+        VK_COLOR_COMPONENT_G_BIT |
+        VK_COLOR_COMPONENT_B_BIT |
+        VK_COLOR_COMPONENT_A_BIT;
+      blend_attachment.blendEnable = VK_FALSE;
+
+      color_blending.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+      color_blending.logicOpEnable = VK_FALSE;
+      color_blending.logicOp = VK_LOGIC_OP_COPY;
+      color_blending.attachmentCount = 1;
+      color_blending.pAttachments = &blend_attachment;
+
+      dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+      dynamic_state.dynamicStateCount = dynamic_states.size();
+      dynamic_state.pDynamicStates = dynamic_states.data();
+    }
+
+    ~PipelineState()
+    {
+      if (vertex_module != VK_NULL_HANDLE)
+        vkDestroyShaderModule(device, vertex_module, nullptr);
+      if (fragment_module != VK_NULL_HANDLE)
+        vkDestroyShaderModule(device, fragment_module, nullptr);
+    }
+
+    PipelineState(const PipelineState&) = delete;
+    PipelineState& operator=(const PipelineState&) = delete;
+
+    void AddStage(const std::vector<char>& code,
+                  VkShaderStageFlagBits stage,
+                  VkShaderModule& module)
+    {
+      VkShaderModuleCreateInfo createInfo = {};
+      createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+      createInfo.codeSize = code.size();
+      createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+
+      if (vkCreateShaderModule(device,
+                               &createInfo,
+                               nullptr,
+                               &module) != VK_SUCCESS)
+        throw std::runtime_error("failed to create shader module!");
+
+      VkPipelineShaderStageCreateInfo stageInfo = {};
+      stageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+      stageInfo.stage = stage;
+      stageInfo.module = module;
+      stageInfo.pName = "main";
+      if (specialization.mapEntryCount > 0)
+        stageInfo.pSpecializationInfo = &specialization;
+      stages.push_back(stageInfo);
+    }
+  };
+
+  //=================================================================
+  template<class T>
+  void AppendBytes(std::string& key, const T& value)
+  {
+    key.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  size_t HashCode(const std::vector<char>& code)
+  {
+    return std::hash<std::string_view>()(
+      std::string_view(code.data(), code.size()));
+  }
+}
+
+//###################################################################
+/** Starts the worker threads. Pipeline libraries are only used when
+ * requested and when the Vulkan headers know the extension.*/
+void ChiPipelineManager::Initialize(VkDevice device,
+                                    VkPipelineCache pipeline_cache,
+                                    bool use_pipeline_libraries,
+                                    size_t num_threads)
+{
+  m_device = device;
+  m_pipeline_cache = pipeline_cache;
+#ifdef VK_EXT_graphics_pipeline_library
+  m_use_libraries = use_pipeline_libraries;
+#else
+  m_use_libraries = false;
+#endif
+  m_stopping = false;
+
+  for (size_t t = 0; t < std::max<size_t>(num_threads, 1); ++t)
+    m_workers.emplace_back(&ChiPipelineManager::WorkerLoop, this);
+}
+
+//###################################################################
+/** Stops the workers, dropping queued work, and destroys every
+ * pipeline and cached library. Must be called before the device is
+ * destroyed.*/
+void ChiPipelineManager::Shutdown()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+    m_tasks.clear();
+  }
+  m_task_cv.notify_all();
+
+  for (auto& worker : m_workers)
+    worker.join();
+  m_workers.clear();
+
+  if (m_device == VK_NULL_HANDLE) return;
+
+  for (auto& entry : m_entries)
+    DestroyEntryPipelines(entry);
+  m_entries.clear();
+  m_free_handles.clear();
+
+  for (auto& library : m_library_cache)
+    vkDestroyPipeline(m_device, library.second, nullptr);
+  m_library_cache.clear();
+
+  m_device = VK_NULL_HANDLE;
+}
+
+//###################################################################
+/** Queues a pipeline for compilation and returns its handle, reusing a
+ * released one if there is any. Until the pipeline is usable
+ * GetPipeline resolves to `fallback`.*/
+ChiPipelineManager::PipelineHandle ChiPipelineManager::
+  RequestGraphicsPipeline(const GraphicsPipelineDesc& desc,
+                          PipelineHandle fallback)
+{
+  PipelineHandle handle;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_free_handles.empty())
+    {
+      handle = m_free_handles.back();
+      m_free_handles.pop_back();
+    }
+    else
+    {
+      handle = m_entries.size();
+      m_entries.emplace_back();
+    }
+
+    Entry& entry = m_entries[handle];
+    entry.desc = desc;
+    entry.fallback = fallback;
+    entry.pending_tasks = 1;
+    entry.request_time = std::chrono::steady_clock::now();
+  }
+
+  Enqueue([this, handle]() { CompileTask(handle); });
+
+  return handle;
+}
+
+//###################################################################
+/** Best pipeline currently available for a handle, following the
+ * fallback chain. Returns VK_NULL_HANDLE if nothing is ready yet.*/
+VkPipeline ChiPipelineManager::GetPipeline(PipelineHandle handle) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  while (handle < m_entries.size())
+  {
+    const Entry& entry = m_entries[handle];
+    if (entry.optimized_pipeline != VK_NULL_HANDLE)
+      return entry.optimized_pipeline;
+    if (entry.fast_pipeline != VK_NULL_HANDLE)
+      return entry.fast_pipeline;
+
+    handle = entry.fallback;
+  }
+
+  return VK_NULL_HANDLE;
+}
+
+//###################################################################
+/** Whether the handle's own pipeline (fast-linked or optimized) is
+ * ready, ignoring the fallback.*/
+bool ChiPipelineManager::IsUsable(PipelineHandle handle) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  const Entry& entry = m_entries.at(handle);
+  return entry.fast_pipeline != VK_NULL_HANDLE ||
+         entry.optimized_pipeline != VK_NULL_HANDLE;
+}
+
+//###################################################################
+/** Whether the final, optimized pipeline of a handle is ready.*/
+bool ChiPipelineManager::IsOptimized(PipelineHandle handle) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_entries.at(handle).optimized_pipeline != VK_NULL_HANDLE;
+}
+
+//###################################################################
+/** Whether compiling the handle's pipeline failed.*/
+bool ChiPipelineManager::HasFailed(PipelineHandle handle) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_entries.at(handle).failed;
+}
+
+//###################################################################
+/** Blocks until the handle's own pipeline (fast-linked or optimized)
+ * is usable. Throws if its compilation failed.*/
+void ChiPipelineManager::WaitUntilUsable(PipelineHandle handle)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  const Entry& entry = m_entries.at(handle);
+
+  m_ready_cv.wait(lock, [&entry]()
+  {
+    return entry.failed ||
+           entry.fast_pipeline != VK_NULL_HANDLE ||
+           entry.optimized_pipeline != VK_NULL_HANDLE;
+  });
+
+  if (entry.failed)
+    throw std::runtime_error("failed to create graphics pipeline \"" +
+                             entry.desc.name + "\"!");
+}
+
+//###################################################################
+/** Time in milliseconds from the request until the handle's pipeline
+ * first became usable.*/
+double ChiPipelineManager::GetUsableTime(PipelineHandle handle) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_entries.at(handle).usable_ms;
+}
+
+//###################################################################
+/** Time in milliseconds from the request until the handle's optimized
+ * pipeline became ready, zero while it is pending.*/
+double ChiPipelineManager::GetOptimizedTime(PipelineHandle handle) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_entries.at(handle).optimized_ms;
+}
+
+//###################################################################
+/** Destroys a handle's pipelines and frees the handle for reuse. The
+ * caller must guarantee the GPU no longer uses them and must not use
+ * the handle again. If compilation is still in flight, both happen
+ * when it finishes.*/
+void ChiPipelineManager::Release(PipelineHandle handle)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Entry& entry = m_entries.at(handle);
+
+  entry.released = true;
+  if (entry.pending_tasks == 0)
+    RecycleEntryLocked(handle);
+}
+
+//###################################################################
+void ChiPipelineManager::WorkerLoop()
+{
+  while (true)
+  {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_task_cv.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+
+      if (m_stopping) return;
+
+      task = std::move(m_tasks.front());
+      m_tasks.pop_front();
+    }
+
+    task();
+  }
+}
+
+//###################################################################
+void ChiPipelineManager::Enqueue(std::function<void()> task)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tasks.push_back(std::move(task));
+  }
+  m_task_cv.notify_one();
+}
+
+//###################################################################
+/** First compilation of a pipeline. With pipeline libraries this
+ * gathers (or builds) the four parts, links them without optimization
+ * and queues the optimized link. Otherwise the pipeline is compiled
+ * monolithically.*/
+void ChiPipelineManager::CompileTask(PipelineHandle handle)
+{
+  GraphicsPipelineDesc desc;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_entries[handle].released) { FinishTaskLocked(handle); return; }
+    desc = m_entries[handle].desc;
+  }
+
+  VkPipeline libraries[4] = {};
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  try
+  {
+    if (m_use_libraries)
+    {
+      for (int part = 0; part < 4; ++part)
+        libraries[part] = GetLibrary(desc, part);
+      pipeline = LinkLibraries(desc, libraries, false);
+    }
+    else
+      pipeline = CreateMonolithic(desc);
+  }
+  catch (const std::runtime_error&)
+  {
+    pipeline = VK_NULL_HANDLE;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Entry& entry = m_entries[handle];
+
+    entry.usable_ms = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - entry.request_time).count();
+
+    if (pipeline == VK_NULL_HANDLE)
+      entry.failed = true;
+    else if (m_use_libraries)
+    {
+      std::copy(libraries, libraries + 4, entry.libraries);
+      entry.fast_pipeline = pipeline;
+      ++entry.pending_tasks;
+    }
+    else
+    {
+      entry.optimized_pipeline = pipeline;
+      entry.optimized_ms = entry.usable_ms;
+    }
+
+    ++m_ready_generation;
+  }
+  m_ready_cv.notify_all();
+
+  if (pipeline != VK_NULL_HANDLE && m_use_libraries)
+    Enqueue([this, handle]() { OptimizeTask(handle); });
+
+  FinishTask(handle);
+}
+
+//###################################################################
+/** Links a pipeline's libraries with link-time optimization. The fast
+ * pipeline stays in use until this completes.*/
+void ChiPipelineManager::OptimizeTask(PipelineHandle handle)
+{
+  GraphicsPipelineDesc desc;
+  VkPipeline libraries[4];
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_entries[handle].released) { FinishTaskLocked(handle); return; }
+    desc = m_entries[handle].desc;
+    std::copy(m_entries[handle].libraries,
+              m_entries[handle].libraries + 4, libraries);
+  }
+
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  try
+  {
+    pipeline = LinkLibraries(desc, libraries, true);
+  }
+  catch (const std::runtime_error&) {}
+
+  if (pipeline != VK_NULL_HANDLE)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Entry& entry = m_entries[handle];
+
+    entry.optimized_pipeline = pipeline;
+    entry.optimized_ms = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - entry.request_time).count();
+
+    ++m_ready_generation;
+  }
+  m_ready_cv.notify_all();
+
+  FinishTask(handle);
+}
+
+//###################################################################
+void ChiPipelineManager::FinishTask(PipelineHandle handle)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  FinishTaskLocked(handle);
+}
+
+//###################################################################
+/** Completes a task of an entry, recycling the entry if it was
+ * released meanwhile. m_mutex must be held.*/
+void ChiPipelineManager::FinishTaskLocked(PipelineHandle handle)
+{
+  Entry& entry = m_entries[handle];
+
+  --entry.pending_tasks;
+  if (entry.released && entry.pending_tasks == 0)
+    RecycleEntryLocked(handle);
+}
+
+//###################################################################
+/** Destroys the linked pipelines of an entry. Libraries are shared
+ * through the cache and live until Shutdown.*/
+void ChiPipelineManager::DestroyEntryPipelines(Entry& entry)
+{
+  if (entry.fast_pipeline != VK_NULL_HANDLE)
+    vkDestroyPipeline(m_device, entry.fast_pipeline, nullptr);
+  if (entry.optimized_pipeline != VK_NULL_HANDLE)
+    vkDestroyPipeline(m_device, entry.optimized_pipeline, nullptr);
+
+  entry.fast_pipeline = VK_NULL_HANDLE;
+  entry.optimized_pipeline = VK_NULL_HANDLE;
+}
+
+//###################################################################
+/** Destroys a released entry's pipelines, drops its description and
+ * SPIR-V and puts its handle on the free list. Entries falling back to
+ * it fall back to its own fallback instead, which is what GetPipeline
+ * resolved them to since the release. m_mutex must be held.*/
+void ChiPipelineManager::RecycleEntryLocked(PipelineHandle handle)
+{
+  Entry& entry = m_entries[handle];
+  DestroyEntryPipelines(entry);
+
+  for (auto& other : m_entries)
+    if (other.fallback == handle)
+      other.fallback = entry.fallback;
+
+  entry = Entry();
+  m_free_handles.push_back(handle);
+}
+
+//###################################################################
+/** Compiles a complete pipeline in one call.*/
+VkPipeline ChiPipelineManager::
+  CreateMonolithic(const GraphicsPipelineDesc& desc)
+{
+  PipelineState state(m_device, desc, true, true);
+
+  VkGraphicsPipelineCreateInfo pipelineInfo = {};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipelineInfo.stageCount = state.stages.size();
+  pipelineInfo.pStages = state.stages.data();
+  pipelineInfo.pVertexInputState = &state.vertex_input;
+  pipelineInfo.pInputAssemblyState = &state.input_assembly;
+  pipelineInfo.pViewportState = &state.viewport;
+  pipelineInfo.pRasterizationState = &state.rasterizer;
+  pipelineInfo.pMultisampleState = &state.multisampling;
+  pipelineInfo.pDepthStencilState = &state.depth_stencil;
+  pipelineInfo.pColorBlendState = &state.color_blending;
+  pipelineInfo.pDynamicState = &state.dynamic_state;
+  pipelineInfo.layout = desc.layout;
+  pipelineInfo.renderPass = desc.render_pass;
+  pipelineInfo.subpass = desc.subpass;
+  pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+  VkPipeline pipeline;
+  if (vkCreateGraphicsPipelines(m_device,
+                                m_pipeline_cache,
+                                1,
+                                &pipelineInfo,
+                                nullptr,
+                                &pipeline) != VK_SUCCESS)
+    throw std::runtime_error("failed to create graphics pipeline!");
+
+  return pipeline;
+}
+
+//###################################################################
+/** Returns the cached library for one part of a pipeline, building it
+ * on first use. Two workers may build the same part concurrently, in
+ * which case the later result is discarded.*/
+VkPipeline ChiPipelineManager::GetLibrary(const GraphicsPipelineDesc& desc,
+                                          int part)
+{
+  const std::string key = LibraryKey(desc, part);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto cached = m_library_cache.find(key);
+    if (cached != m_library_cache.end()) return cached->second;
+  }
+
+  VkPipeline library = CreateLibrary(desc, part);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto inserted = m_library_cache.emplace(key, library);
+  if (!inserted.second)
+    vkDestroyPipeline(m_device, library, nullptr);
+
+  return inserted.first->second;
+}
+
+//###################################################################
+/** Builds one part of a pipeline as a graphics pipeline library.*/
+VkPipeline ChiPipelineManager::CreateLibrary(const GraphicsPipelineDesc& desc,
+                                             int part)
+{
+#ifdef VK_EXT_graphics_pipeline_library
+  PipelineState state(m_device, desc,
+                      part == PRE_RASTERIZATION,
+                      part == FRAGMENT_SHADER);
+
+  VkGraphicsPipelineLibraryCreateInfoEXT libraryInfo = {};
+  libraryInfo.sType =
+    VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+
+  VkGraphicsPipelineCreateInfo pipelineInfo = {};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipelineInfo.pNext = &libraryInfo;
+  pipelineInfo.flags =
+    VK_PIPELINE_CREATE_LIBRARY_BIT_KHR |
+    VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT;
+
+  switch (part)
+  {
+    case VERTEX_INPUT:
+      libraryInfo.flags =
+        VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT;
+      pipelineInfo.pVertexInputState = &state.vertex_input;
+      pipelineInfo.pInputAssemblyState = &state.input_assembly;
+      break;
+    case PRE_RASTERIZATION:
+      libraryInfo.flags =
+        VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT;
+      pipelineInfo.stageCount = state.stages.size();
+      pipelineInfo.pStages = state.stages.data();
+      pipelineInfo.pViewportState = &state.viewport;
+      pipelineInfo.pRasterizationState = &state.rasterizer;
+      pipelineInfo.pDynamicState = &state.dynamic_state;
+      pipelineInfo.layout = desc.layout;
+      pipelineInfo.renderPass = desc.render_pass;
+      pipelineInfo.subpass = desc.subpass;
+      break;
+    case FRAGMENT_SHADER:
+      libraryInfo.flags = VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT;
+      pipelineInfo.stageCount = state.stages.size();
+      pipelineInfo.pStages = state.stages.data();
+      pipelineInfo.pMultisampleState = &state.multisampling;
+      pipelineInfo.pDepthStencilState = &state.depth_stencil;
+      pipelineInfo.layout = desc.layout;
+      pipelineInfo.renderPass = desc.render_pass;
+      pipelineInfo.subpass = desc.subpass;
+      break;
+    case FRAGMENT_OUTPUT:
+      libraryInfo.flags =
+        VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT;
+      pipelineInfo.pMultisampleState = &state.multisampling;
+      pipelineInfo.pColorBlendState = &state.color_blending;
+      pipelineInfo.renderPass = desc.render_pass;
+      pipelineInfo.subpass = desc.subpass;
+      break;
+    default:
+      throw std::logic_error("invalid pipeline library part!");
+  }
+
+  VkPipeline library;
+  if (vkCreateGraphicsPipelines(m_device,
+                                m_pipeline_cache,
+                                1,
+                                &pipelineInfo,
+                                nullptr,
+                                &library) != VK_SUCCESS)
+    throw std::runtime_error("failed to create pipeline library!");
+
+  return library;
+#else
+  throw std::logic_error("pipeline libraries are not supported!");
+#endif
+}
+
+//###################################################################
+/** Links the four parts of a pipeline into an executable pipeline.*/
+VkPipeline ChiPipelineManager::LinkLibraries(const GraphicsPipelineDesc& desc,
+                                             const VkPipeline* libraries,
+                                             bool optimize)
+{
+#ifdef VK_EXT_graphics_pipeline_library
+  VkPipelineLibraryCreateInfoKHR linkInfo = {};
+  linkInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+  linkInfo.libraryCount = 4;
+  linkInfo.pLibraries = libraries;
+
+  VkGraphicsPipelineCreateInfo pipelineInfo = {};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipelineInfo.pNext = &linkInfo;
+  pipelineInfo.layout = desc.layout;
+  if (optimize)
+    pipelineInfo.flags = VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT;
+
+  VkPipeline pipeline;
+  if (vkCreateGraphicsPipelines(m_device,
+                                m_pipeline_cache,
+                                1,
+                                &pipelineInfo,
+                                nullptr,
+                                &pipeline) != VK_SUCCESS)
+    throw std::runtime_error("failed to link graphics pipeline!");
+
+  return pipeline;
+#else
+  throw std::logic_error("pipeline libraries are not supported!");
+#endif
+}
+
+//###################################################################
+/** Key under which a pipeline part is cached. It contains exactly the
+ * state that part is built from.*/
+std::string ChiPipelineManager::LibraryKey(const GraphicsPipelineDesc& desc,
+                                           int part)
+{
+  std::string key;
+  AppendBytes(key, part);
+  AppendBytes(key, desc.specialization_constants.size());
+
+  switch (part)
+  {
+    case VERTEX_INPUT:
+      for (const auto& binding : desc.vertex_bindings)
+        AppendBytes(key, binding);
+      for (const auto& attribute : desc.vertex_attributes)
+        AppendBytes(key, attribute);
+      AppendBytes(key, desc.topology);
+      break;
+    case PRE_RASTERIZATION:
+      for (uint32_t value : desc.specialization_constants)
+        AppendBytes(key, value);
+      AppendBytes(key, HashCode(desc.vertex_spirv));
+      AppendBytes(key, desc.vertex_spirv.size());
+      AppendBytes(key, desc.polygon_mode);
+      AppendBytes(key, desc.cull_mode);
+      AppendBytes(key, desc.front_face);
+      AppendBytes(key, desc.layout);
+      break;
+    case FRAGMENT_SHADER:
+      for (uint32_t value : desc.specialization_constants)
+        AppendBytes(key, value);
+      AppendBytes(key, HashCode(desc.fragment_spirv));
+      AppendBytes(key, desc.fragment_spirv.size());
+      AppendBytes(key, desc.depth_test);
+      AppendBytes(key, desc.depth_write);
+      AppendBytes(key, desc.depth_compare);
+      AppendBytes(key, desc.layout);
+      break;
+    default:
+      break;
+  }
+
+  // Render passes with the same attachment formats are compatible.
+  AppendBytes(key, desc.color_format);
+  AppendBytes(key, desc.depth_format);
+  AppendBytes(key, desc.subpass);
+
+  return key;
+}
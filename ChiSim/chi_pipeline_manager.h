@@ -0,0 +1,165 @@
+#ifndef _ChiPipelineManager_h
+#define _ChiPipelineManager_h
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <string>
+#include <deque>
+#include <map>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+//###################################################################
+/** Compiles graphics pipelines on a pool of worker threads.
+ *
+ * A request returns a handle immediately. GetPipeline resolves the
+ * handle to the best pipeline available at that moment:
+ *  1. the link-time optimized pipeline once it is ready,
+ *  2. otherwise a fast-linked pipeline (pipeline libraries only),
+ *  3. otherwise the pipeline of the fallback handle given with the
+ *     request, which is typically a simpler variant that is already
+ *     compiled.
+ *
+ * When VK_EXT_graphics_pipeline_library is available each pipeline is
+ * split into its vertex input, pre-rasterization, fragment shader and
+ * fragment output parts. Parts are cached and shared between requests,
+ * so a new variant usually only compiles the stage that changed and is
+ * then linked without optimization, which is fast. The optimized link
+ * follows as a second task. Without the extension pipelines are
+ * compiled monolithically.
+ *
+ * GetReadyGeneration changes whenever any pipeline improves, which
+ * tells the owner that recorded command buffers are stale. Released
+ * handles are reused by later requests.*/
+class ChiPipelineManager
+{
+public:
+  typedef size_t PipelineHandle;
+  static constexpr PipelineHandle INVALID_HANDLE = ~size_t(0);
+
+  /** Everything needed to build a graphics pipeline. Shader code is
+   * copied so the request does not depend on caller owned modules.
+   * Color and depth formats identify compatible render passes and key
+   * the cached pipeline libraries.*/
+  struct GraphicsPipelineDesc
+  {
+    std::string name;
+
+    std::vector<char> vertex_spirv;
+    std::vector<char> fragment_spirv;
+
+    /** Values of specialization constants 0..N-1, 32 bits each, applied
+     * to both stages. Constant IDs a stage does not declare are
+     * ignored.*/
+    std::vector<uint32_t> specialization_constants;
+
+    std::vector<VkVertexInputBindingDescription>   vertex_bindings;
+    std::vector<VkVertexInputAttributeDescription> vertex_attributes;
+    VkPrimitiveTopology topology      = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    VkPolygonMode       polygon_mode  = VK_POLYGON_MODE_FILL;
+    VkCullModeFlags     cull_mode     = VK_CULL_MODE_BACK_BIT;
+    VkFrontFace         front_face    = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+    bool                depth_test    = true;
+    bool                depth_write   = true;
+    VkCompareOp         depth_compare = VK_COMPARE_OP_LESS;
+
+    VkPipelineLayout    layout        = VK_NULL_HANDLE;
+    VkRenderPass        render_pass   = VK_NULL_HANDLE;
+    uint32_t            subpass       = 0;
+    VkFormat            color_format  = VK_FORMAT_UNDEFINED;
+    VkFormat            depth_format  = VK_FORMAT_UNDEFINED;
+  };
+
+private:
+  struct Entry
+  {
+    GraphicsPipelineDesc desc;
+    PipelineHandle       fallback = INVALID_HANDLE;
+
+    VkPipeline           libraries[4] = {};
+    VkPipeline           fast_pipeline = VK_NULL_HANDLE;
+    VkPipeline           optimized_pipeline = VK_NULL_HANDLE;
+
+    int                  pending_tasks = 0;
+    bool                 failed = false;
+    bool                 released = false;
+    double               usable_ms = 0.0;
+    double               optimized_ms = 0.0;
+    std::chrono::steady_clock::time_point request_time;
+  };
+
+  VkDevice                        m_device = VK_NULL_HANDLE;
+  VkPipelineCache                 m_pipeline_cache = VK_NULL_HANDLE;
+  bool                            m_use_libraries = false;
+
+  mutable std::mutex              m_mutex;
+  std::condition_variable         m_task_cv;
+  std::condition_variable         m_ready_cv;
+  std::deque<std::function<void()>> m_tasks;
+  std::vector<std::thread>        m_workers;
+  bool                            m_stopping = false;
+
+  std::deque<Entry>               m_entries;
+  std::vector<PipelineHandle>     m_free_handles;
+  std::map<std::string, VkPipeline> m_library_cache;
+  std::atomic<uint64_t>           m_ready_generation{0};
+
+public:
+  ChiPipelineManager() = default;
+  ChiPipelineManager(const ChiPipelineManager&) = delete;
+  ChiPipelineManager& operator=(const ChiPipelineManager&) = delete;
+  ~ChiPipelineManager() { Shutdown(); }
+
+  void Initialize(VkDevice device,
+                  VkPipelineCache pipeline_cache,
+                  bool use_pipeline_libraries,
+                  size_t num_threads);
+  void Shutdown();
+
+  PipelineHandle RequestGraphicsPipeline(
+    const GraphicsPipelineDesc& desc,
+    PipelineHandle fallback = INVALID_HANDLE);
+
+  VkPipeline GetPipeline(PipelineHandle handle) const;
+  bool       IsUsable(PipelineHandle handle) const;
+  bool       IsOptimized(PipelineHandle handle) const;
+  bool       HasFailed(PipelineHandle handle) const;
+  void       WaitUntilUsable(PipelineHandle handle);
+  double     GetUsableTime(PipelineHandle handle) const;
+  double     GetOptimizedTime(PipelineHandle handle) const;
+  void       Release(PipelineHandle handle);
+
+  bool       UsesPipelineLibraries() const {return m_use_libraries;}
+  uint64_t   GetReadyGeneration() const {return m_ready_generation.load();}
+
+private:
+  void WorkerLoop();
+  void Enqueue(std::function<void()> task);
+
+  void CompileTask(PipelineHandle handle);
+  void OptimizeTask(PipelineHandle handle);
+  void FinishTask(PipelineHandle handle);
+  void FinishTaskLocked(PipelineHandle handle);
+  void DestroyEntryPipelines(Entry& entry);
+  void RecycleEntryLocked(PipelineHandle handle);
+
+  VkPipeline CreateMonolithic(const GraphicsPipelineDesc& desc);
+  VkPipeline GetLibrary(const GraphicsPipelineDesc& desc, int part);
+  VkPipeline CreateLibrary(const GraphicsPipelineDesc& desc, int part);
+  VkPipeline LinkLibraries(const GraphicsPipelineDesc& desc,
+                           const VkPipeline* libraries,
+                           bool optimize);
+
+  static std::string LibraryKey(const GraphicsPipelineDesc& desc, int part);
+};
+
+#endif
@@ -0,0 +1,762 @@
+#include "chi_render_graph.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+//###################################################################
+/** Converts a usage into the layout, stages and access flags
+ * it requires. */
+ChiRenderGraph::AccessState
+  ChiRenderGraph::GetUsageAccessState(Usage usage, QueueType queue_type)
+{
+  const bool compute = (queue_type == QueueType::Compute);
+  const VkPipelineStageFlags shader_stages = compute?
+    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT :
+    VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+  AccessState state;
+  switch (usage)
+  {
+    case Usage::ColorAttachment:
+      state.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+      state.stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+      state.access = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                     VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+      break;
+    case Usage::DepthAttachment:
+      state.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+      state.stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                     VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+      state.access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                     VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+      break;
+    case Usage::DepthRead:
+      state.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+      state.stages = compute? shader_stages :
+                     VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                     VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT |
+                     VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+      state.access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                     VK_ACCESS_SHADER_READ_BIT;
+      break;
+    case Usage::SampledRead:
+      state.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      state.stages = shader_stages;
+      state.access = VK_ACCESS_SHADER_READ_BIT;
+      break;
+    case Usage::StorageRead:
+      state.layout = VK_IMAGE_LAYOUT_GENERAL;
+      state.stages = shader_stages;
+      state.access = VK_ACCESS_SHADER_READ_BIT;
+      break;
+    case Usage::StorageWrite:
+      state.layout = VK_IMAGE_LAYOUT_GENERAL;
+      state.stages = shader_stages;
+      state.access = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+      break;
+    case Usage::TransferSrc:
+      state.layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+      state.stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+      state.access = VK_ACCESS_TRANSFER_READ_BIT;
+      break;
+    case Usage::TransferDst:
+      state.layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      state.stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+      state.access = VK_ACCESS_TRANSFER_WRITE_BIT;
+      break;
+    case Usage::UniformRead:
+      state.stages = shader_stages;
+      state.access = VK_ACCESS_UNIFORM_READ_BIT;
+      break;
+    case Usage::VertexRead:
+      state.stages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+      state.access = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+      break;
+    case Usage::IndexRead:
+      state.stages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+      state.access = VK_ACCESS_INDEX_READ_BIT;
+      break;
+    case Usage::Present:
+      state.layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+      state.stages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+      state.access = 0;
+      break;
+  }
+
+  return state;
+}
+
+//###################################################################
+/** Stages and access flags normally associated with a layout. */
+ChiRenderGraph::AccessState
+  ChiRenderGraph::GetLayoutAccessState(VkImageLayout layout)
+{
+  switch (layout)
+  {
+    case VK_IMAGE_LAYOUT_UNDEFINED:
+    case VK_IMAGE_LAYOUT_PREINITIALIZED:
+    {
+      AccessState state;
+      state.layout = layout;
+      state.stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+      state.access = (layout == VK_IMAGE_LAYOUT_PREINITIALIZED)?
+                     VK_ACCESS_HOST_WRITE_BIT : 0;
+      return state;
+    }
+    case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+      return GetUsageAccessState(Usage::ColorAttachment, QueueType::Graphics);
+    case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
+      return GetUsageAccessState(Usage::DepthAttachment, QueueType::Graphics);
+    case VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL:
+      return GetUsageAccessState(Usage::DepthRead, QueueType::Graphics);
+    case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+    {
+      auto state = GetUsageAccessState(Usage::SampledRead, QueueType::Graphics);
+      state.stages |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+      return state;
+    }
+    case VK_IMAGE_LAYOUT_GENERAL:
+    {
+      auto state = GetUsageAccessState(Usage::StorageWrite, QueueType::Graphics);
+      state.stages |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                      VK_PIPELINE_STAGE_TRANSFER_BIT;
+      state.access |= VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+      return state;
+    }
+    case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+      return GetUsageAccessState(Usage::TransferSrc, QueueType::Graphics);
+    case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+      return GetUsageAccessState(Usage::TransferDst, QueueType::Graphics);
+    case VK_IMAGE_LAYOUT_PRESENT_SRC_KHR:
+      return GetUsageAccessState(Usage::Present, QueueType::Graphics);
+    default:
+      throw std::invalid_argument("unsupported image layout!");
+  }
+}
+
+//###################################################################
+/** Imports an externally owned image. */
+ChiRenderGraph::ResourceID
+  ChiRenderGraph::ImportImage(const std::string& name,
+                              VkImage image,
+                              const ImageDesc& desc,
+                              const AccessState& initial_state)
+{
+  Resource resource;
+  resource.name          = name;
+  resource.kind          = ResourceKind::Image;
+  resource.imported      = true;
+  resource.is_output     = true;
+  resource.desc          = desc;
+  resource.image         = image;
+  resource.initial_state = initial_state;
+
+  m_resources.push_back(resource);
+  m_compiled = false;
+
+  return m_resources.size() - 1;
+}
+
+//###################################################################
+/** Imports an externally owned buffer. */
+ChiRenderGraph::ResourceID
+  ChiRenderGraph::ImportBuffer(const std::string& name,
+                               VkBuffer buffer,
+                               const AccessState& initial_state)
+{
+  Resource resource;
+  resource.name          = name;
+  resource.kind          = ResourceKind::Buffer;
+  resource.imported      = true;
+  resource.is_output     = true;
+  resource.buffer        = buffer;
+  resource.initial_state = initial_state;
+  resource.initial_state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+  m_resources.push_back(resource);
+  m_compiled = false;
+
+  return m_resources.size() - 1;
+}
+
+//###################################################################
+/** Declares a transient image owned by the graph. Its memory may be
+ * shared with other transients whose lifetimes do not overlap.*/
+ChiRenderGraph::ResourceID
+  ChiRenderGraph::CreateImage(const std::string& name, const ImageDesc& desc)
+{
+  Resource resource;
+  resource.name = name;
+  resource.kind = ResourceKind::Image;
+  resource.desc = desc;
+
+  m_resources.push_back(resource);
+  m_compiled = false;
+
+  return m_resources.size() - 1;
+}
+
+//###################################################################
+/** Sets the state a resource must be in once the graph has executed. */
+void ChiRenderGraph::SetFinalUsage(ResourceID id, Usage usage)
+{
+  auto& resource = m_resources.at(id);
+  resource.final_state = GetUsageAccessState(usage, QueueType::Graphics);
+  if (resource.kind == ResourceKind::Buffer)
+    resource.final_state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  resource.has_final_state = true;
+  resource.is_output = true;
+  m_compiled = false;
+}
+
+//###################################################################
+/** Marks a resource as consumed outside of the graph so that the
+ * passes producing it are never culled. */
+void ChiRenderGraph::MarkOutput(ResourceID id)
+{
+  m_resources.at(id).is_output = true;
+  m_compiled = false;
+}
+
+//###################################################################
+/** Adds a pass. Passes execute in the order they are added. */
+void ChiRenderGraph::AddPass(
+  const std::string& name,
+  QueueType queue_type,
+  const std::vector<std::pair<ResourceID, Usage>>& accesses,
+  ExecuteFunction execute,
+  bool has_side_effects)
+{
+  Pass pass;
+  pass.name             = name;
+  pass.queue_type       = queue_type;
+  pass.execute          = std::move(execute);
+  pass.has_side_effects = has_side_effects;
+
+  for (const auto& access : accesses)
+  {
+    if (access.first >= m_resources.size())
+      throw std::invalid_argument("render graph pass \"" + name +
+                                  "\" references an unknown resource!");
+    pass.accesses.push_back({access.first, access.second});
+  }
+
+  m_passes.push_back(std::move(pass));
+  m_compiled = false;
+}
+
+//###################################################################
+/** Compiles the graph: culls passes, allocates transient resources
+ * and computes barriers. Recompiling, after the graph changed, first
+ * releases the transients of the previous compile, which must no
+ * longer be in use. */
+void ChiRenderGraph::Compile(VkDevice device, VkPhysicalDevice physical_device)
+{
+  if (m_compiled) return;
+
+  DestroyTransients();
+
+  m_device          = device;
+  m_physical_device = physical_device;
+  m_stats           = Stats();
+  m_stats.num_passes = m_passes.size();
+
+  CullPasses();
+  ComputeLifetimes();
+  AllocateTransients();
+  ComputeBarriers();
+
+  m_compiled = true;
+}
+
+//###################################################################
+/** Walks the passes backwards from the outputs. A pass survives if it
+ * has side effects or writes something a surviving pass reads. */
+void ChiRenderGraph::CullPasses()
+{
+  std::vector<bool> needed(m_resources.size(), false);
+  for (size_t r = 0; r < m_resources.size(); ++r)
+    needed[r] = m_resources[r].is_output;
+
+  for (auto pass = m_passes.rbegin(); pass != m_passes.rend(); ++pass)
+  {
+    bool live = pass->has_side_effects;
+    for (const auto& access : pass->accesses)
+    {
+      auto state = GetUsageAccessState(access.usage, pass->queue_type);
+      bool is_write = (state.access & (VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                                       VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+                                       VK_ACCESS_SHADER_WRITE_BIT |
+                                       VK_ACCESS_TRANSFER_WRITE_BIT)) != 0;
+      if (is_write && needed[access.id]) live = true;
+    }
+
+    pass->culled = !live;
+    if (!live) { ++m_stats.num_culled_passes; continue; }
+
+    for (const auto& access : pass->accesses)
+      needed[access.id] = true;
+  }
+}
+
+//###################################################################
+/** Determines the first and last surviving pass using each resource. */
+void ChiRenderGraph::ComputeLifetimes()
+{
+  for (auto& resource : m_resources)
+  {
+    resource.first_pass  = -1;
+    resource.last_pass   = -1;
+    resource.image_usage = 0;
+  }
+
+  for (int p = 0; p < static_cast<int>(m_passes.size()); ++p)
+  {
+    const auto& pass = m_passes[p];
+    if (pass.culled) continue;
+
+    for (const auto& access : pass.accesses)
+    {
+      auto& resource = m_resources[access.id];
+      if (resource.first_pass < 0) resource.first_pass = p;
+      resource.last_pass = p;
+
+      switch (access.usage)
+      {
+        case Usage::ColorAttachment:
+          resource.image_usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT; break;
+        case Usage::DepthAttachment:
+        case Usage::DepthRead:
+          resource.image_usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+          if (access.usage == Usage::DepthRead)
+            resource.image_usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+          break;
+        case Usage::SampledRead:
+          resource.image_usage |= VK_IMAGE_USAGE_SAMPLED_BIT; break;
+        case Usage::StorageRead:
+        case Usage::StorageWrite:
+          resource.image_usage |= VK_IMAGE_USAGE_STORAGE_BIT; break;
+        case Usage::TransferSrc:
+          resource.image_usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT; break;
+        case Usage::TransferDst:
+          resource.image_usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT; break;
+        default: break;
+      }
+    }
+  }
+}
+
+//###################################################################
+/** Creates the transient images and assigns them to memory blocks.
+ * Largest images are placed first; an image joins an existing block
+ * when none of the block's occupants are alive at the same time. */
+void ChiRenderGraph::AllocateTransients()
+{
+  std::vector<ResourceID>           transients;
+  std::vector<VkMemoryRequirements> requirements(m_resources.size());
+
+  for (ResourceID r = 0; r < m_resources.size(); ++r)
+  {
+    auto& resource = m_resources[r];
+    if (resource.imported || resource.first_pass < 0) continue;
+
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType         = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType     = VK_IMAGE_TYPE_2D;
+    imageInfo.extent.width  = resource.desc.extent.width;
+    imageInfo.extent.height = resource.desc.extent.height;
+    imageInfo.extent.depth  = 1;
+    imageInfo.mipLevels     = 1;
+    imageInfo.arrayLayers   = 1;
+    imageInfo.format        = resource.desc.format;
+    imageInfo.tiling        = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage         = resource.image_usage;
+    imageInfo.samples       = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode   = VK_SHARING_MODE_EXCLUSIVE;
+
+    if (vkCreateImage(m_device, &imageInfo, nullptr, &resource.image) !=
+        VK_SUCCESS)
+      throw std::runtime_error("failed to create transient image \"" +
+                               resource.name + "\"!");
+
+    vkGetImageMemoryRequirements(m_device, resource.image, &requirements[r]);
+    m_stats.transient_bytes_requested += requirements[r].size;
+    transients.push_back(r);
+  }
+
+  std::stable_sort(transients.begin(), transients.end(),
+    [&requirements](ResourceID a, ResourceID b)
+    { return requirements[a].size > requirements[b].size; });
+
+  //======================================== Assign to blocks
+  for (ResourceID r : transients)
+  {
+    auto& resource = m_resources[r];
+    const auto& req = requirements[r];
+
+    int chosen = -1;
+    for (size_t b = 0; b < m_memory_blocks.size() && chosen < 0; ++b)
+    {
+      auto& block = m_memory_blocks[b];
+      if ((block.type_bits & req.memoryTypeBits) == 0) continue;
+
+      bool overlaps = false;
+      for (ResourceID other : block.occupants)
+      {
+        const auto& o = m_resources[other];
+        if (resource.first_pass <= o.last_pass &&
+            o.first_pass <= resource.last_pass)
+        { overlaps = true; break; }
+      }
+      if (!overlaps) chosen = static_cast<int>(b);
+    }
+
+    if (chosen < 0)
+    {
+      m_memory_blocks.emplace_back();
+      chosen = static_cast<int>(m_memory_blocks.size() - 1);
+    }
+
+    auto& block = m_memory_blocks[chosen];
+    block.size       = std::max(block.size, req.size);
+    block.type_bits &= req.memoryTypeBits;
+    block.occupants.push_back(r);
+    resource.memory_block = chosen;
+  }
+
+  //======================================== Allocate and bind
+  VkPhysicalDeviceMemoryProperties memProperties;
+  vkGetPhysicalDeviceMemoryProperties(m_physical_device, &memProperties);
+
+  for (auto& block : m_memory_blocks)
+  {
+    uint32_t type_index = memProperties.memoryTypeCount;
+    for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i)
+      if ((block.type_bits & (1u << i)) &&
+          (memProperties.memoryTypes[i].propertyFlags &
+           VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+      { type_index = i; break; }
+
+    if (type_index == memProperties.memoryTypeCount)
+      throw std::runtime_error("failed to find memory type for "
+                               "transient images!");
+
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize  = block.size;
+    allocInfo.memoryTypeIndex = type_index;
+
+    if (vkAllocateMemory(m_device, &allocInfo, nullptr, &block.memory) !=
+        VK_SUCCESS)
+      throw std::runtime_error("failed to allocate transient image memory!");
+
+    m_stats.transient_bytes_allocated += block.size;
+
+    for (ResourceID r : block.occupants)
+    {
+      auto& resource = m_resources[r];
+      vkBindImageMemory(m_device, resource.image, block.memory, 0);
+
+      VkImageViewCreateInfo viewInfo = {};
+      viewInfo.sType    = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+      viewInfo.image    = resource.image;
+      viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+      viewInfo.format   = resource.desc.format;
+      viewInfo.subresourceRange.aspectMask     = resource.desc.aspect;
+      viewInfo.subresourceRange.baseMipLevel   = 0;
+      viewInfo.subresourceRange.levelCount     = 1;
+      viewInfo.subresourceRange.baseArrayLayer = 0;
+      viewInfo.subresourceRange.layerCount     = 1;
+
+      if (vkCreateImageView(m_device, &viewInfo, nullptr, &resource.view) !=
+          VK_SUCCESS)
+        throw std::runtime_error("failed to create transient image view!");
+    }
+  }
+}
+
+//###################################################################
+/** Simulates the frame, tracking for every resource its layout, its
+ * last write and the stages that already see that write. Every hazard
+ * found before a pass is folded into that pass's single barrier batch.*/
+void ChiRenderGraph::ComputeBarriers()
+{
+  struct TrackState
+  {
+    VkImageLayout        layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkPipelineStageFlags write_stages = 0;
+    VkAccessFlags        write_access = 0;
+    VkPipelineStageFlags read_stages = 0;
+    VkPipelineStageFlags visible_stages = 0;
+  };
+
+  const VkAccessFlags write_mask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                                   VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+                                   VK_ACCESS_SHADER_WRITE_BIT |
+                                   VK_ACCESS_TRANSFER_WRITE_BIT |
+                                   VK_ACCESS_HOST_WRITE_BIT |
+                                   VK_ACCESS_MEMORY_WRITE_BIT;
+
+  std::vector<TrackState> track(m_resources.size());
+  std::vector<TrackState> block_track(m_memory_blocks.size());
+
+  for (size_t r = 0; r < m_resources.size(); ++r)
+  {
+    const auto& resource = m_resources[r];
+    if (!resource.imported) continue;
+    track[r].layout       = resource.initial_state.layout;
+    track[r].write_stages = resource.initial_state.stages;
+    track[r].write_access = resource.initial_state.access & write_mask;
+  }
+
+  auto transition = [&](ResourceID r, const AccessState& req,
+                        BarrierBatch& batch)
+  {
+    auto& state = track[r];
+    const bool is_image   = m_resources[r].kind == ResourceKind::Image;
+    const bool is_write   = (req.access & write_mask) != 0;
+    const bool new_layout = is_image && state.layout != req.layout;
+
+    bool needed = new_layout;
+    if (is_write)
+      needed = needed || state.write_stages || state.read_stages;
+    else if (state.write_access != 0)
+      needed = needed || (req.stages & ~state.visible_stages) != 0;
+
+    if (needed)
+    {
+      batch.src_stages |= state.write_stages | state.read_stages;
+      batch.dst_stages |= req.stages;
+      batch.barriers.push_back({r,
+                                state.layout,
+                                is_image? req.layout : state.layout,
+                                state.write_access,
+                                req.access});
+    }
+
+    if (is_write || new_layout)
+    {
+      state.write_stages   = req.stages;
+      state.write_access   = req.access & write_mask;
+      state.read_stages    = is_write? 0 : req.stages;
+      state.visible_stages = req.stages;
+    }
+    else
+    {
+      state.read_stages    |= req.stages;
+      state.visible_stages |= req.stages;
+    }
+    if (is_image) state.layout = req.layout;
+  };
+
+  m_pass_barriers.assign(m_passes.size(), BarrierBatch());
+
+  for (int p = 0; p < static_cast<int>(m_passes.size()); ++p)
+  {
+    auto& pass = m_passes[p];
+    if (pass.culled) continue;
+
+    //==================================== Merge accesses per resource
+    std::vector<std::pair<ResourceID, AccessState>> merged;
+    for (const auto& access : pass.accesses)
+    {
+      auto req = GetUsageAccessState(access.usage, pass.queue_type);
+      if (m_resources[access.id].kind == ResourceKind::Buffer)
+        req.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+      auto existing = std::find_if(merged.begin(), merged.end(),
+        [&access](const std::pair<ResourceID, AccessState>& m)
+        { return m.first == access.id; });
+
+      if (existing == merged.end())
+        merged.emplace_back(access.id, req);
+      else
+      {
+        if (existing->second.layout != req.layout)
+          throw std::invalid_argument("render graph pass \"" + pass.name +
+                                      "\" uses \"" +
+                                      m_resources[access.id].name +
+                                      "\" in two different layouts!");
+        existing->second.stages |= req.stages;
+        existing->second.access |= req.access;
+      }
+    }
+
+    //==================================== Transients begin/alias
+    for (const auto& m : merged)
+    {
+      const auto& resource = m_resources[m.first];
+      if (resource.imported || resource.first_pass != p) continue;
+
+      track[m.first] = block_track[resource.memory_block];
+      track[m.first].layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    }
+
+    auto& batch = m_pass_barriers[p];
+    for (const auto& m : merged)
+      transition(m.first, m.second, batch);
+
+    //==================================== Transients end
+    for (const auto& m : merged)
+    {
+      const auto& resource = m_resources[m.first];
+      if (resource.imported || resource.last_pass != p) continue;
+      block_track[resource.memory_block] = track[m.first];
+    }
+
+    m_stats.num_barriers += batch.barriers.size();
+    if (!batch.barriers.empty()) ++m_stats.num_barrier_calls;
+  }
+
+  //======================================== Final states
+  m_final_barriers = BarrierBatch();
+  for (size_t r = 0; r < m_resources.size(); ++r)
+    if (m_resources[r].has_final_state)
+      transition(r, m_resources[r].final_state, m_final_barriers);
+
+  m_stats.num_barriers += m_final_barriers.barriers.size();
+  if (!m_final_barriers.barriers.empty()) ++m_stats.num_barrier_calls;
+}
+
+//###################################################################
+/** Records a batch of barriers as a single vkCmdPipelineBarrier. */
+void ChiRenderGraph::RecordBarrierBatch(VkCommandBuffer cmd_buffer,
+                                        const BarrierBatch& batch) const
+{
+  if (batch.barriers.empty()) return;
+
+  std::vector<VkImageMemoryBarrier>  image_barriers;
+  std::vector<VkBufferMemoryBarrier> buffer_barriers;
+
+  for (const auto& b : batch.barriers)
+  {
+    const auto& resource = m_resources[b.id];
+    if (resource.kind == ResourceKind::Image)
+    {
+      VkImageMemoryBarrier barrier = {};
+      barrier.sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      barrier.oldLayout           = b.old_layout;
+      barrier.newLayout           = b.new_layout;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.srcAccessMask       = b.src_access;
+      barrier.dstAccessMask       = b.dst_access;
+      barrier.image               = resource.image;
+      barrier.subresourceRange.aspectMask     = resource.desc.aspect;
+      barrier.subresourceRange.baseMipLevel   = 0;
+      barrier.subresourceRange.levelCount     = VK_REMAINING_MIP_LEVELS;
+      barrier.subresourceRange.baseArrayLayer = 0;
+      barrier.subresourceRange.layerCount     = VK_REMAINING_ARRAY_LAYERS;
+      image_barriers.push_back(barrier);
+    }
+    else
+    {
+      VkBufferMemoryBarrier barrier = {};
+      barrier.sType               = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.srcAccessMask       = b.src_access;
+      barrier.dstAccessMask       = b.dst_access;
+      barrier.buffer              = resource.buffer;
+      barrier.offset              = 0;
+      barrier.size                = VK_WHOLE_SIZE;
+      buffer_barriers.push_back(barrier);
+    }
+  }
+
+  VkPipelineStageFlags src_stages = batch.src_stages?
+    batch.src_stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+  VkPipelineStageFlags dst_stages = batch.dst_stages?
+    batch.dst_stages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+
+  vkCmdPipelineBarrier(cmd_buffer,
+                       src_stages, dst_stages,
+                       0,
+                       0, nullptr,
+                       static_cast<uint32_t>(buffer_barriers.size()),
+                       buffer_barriers.data(),
+                       static_cast<uint32_t>(image_barriers.size()),
+                       image_barriers.data());
+}
+
+//###################################################################
+/** Records all surviving passes and their barriers. */
+void ChiRenderGraph::Execute(VkCommandBuffer cmd_buffer) const
+{
+  if (!m_compiled)
+    throw std::logic_error("render graph executed before being compiled!");
+
+  for (size_t p = 0; p < m_passes.size(); ++p)
+  {
+    const auto& pass = m_passes[p];
+    if (pass.culled) continue;
+
+    RecordBarrierBatch(cmd_buffer, m_pass_barriers[p]);
+    if (pass.execute) pass.execute(cmd_buffer);
+  }
+
+  RecordBarrierBatch(cmd_buffer, m_final_barriers);
+}
+
+//###################################################################
+/** Rebinds an imported image, e.g. to the next swap chain image. */
+void ChiRenderGraph::SetImportedImage(ResourceID id, VkImage image)
+{
+  auto& resource = m_resources.at(id);
+  if (!resource.imported || resource.kind != ResourceKind::Image)
+    throw std::invalid_argument("render graph resource \"" + resource.name +
+                                "\" is not an imported image!");
+  resource.image = image;
+}
+
+//###################################################################
+/** Rebinds an imported buffer. */
+void ChiRenderGraph::SetImportedBuffer(ResourceID id, VkBuffer buffer)
+{
+  auto& resource = m_resources.at(id);
+  if (!resource.imported || resource.kind != ResourceKind::Buffer)
+    throw std::invalid_argument("render graph resource \"" + resource.name +
+                                "\" is not an imported buffer!");
+  resource.buffer = buffer;
+}
+
+//###################################################################
+/** Destroys all transient resources and clears the graph. */
+void ChiRenderGraph::Reset()
+{
+  DestroyTransients();
+
+  m_resources.clear();
+  m_passes.clear();
+  m_pass_barriers.clear();
+  m_final_barriers = BarrierBatch();
+  m_compiled = false;
+  m_stats = Stats();
+}
+
+//###################################################################
+/** Destroys the transient images and views and frees their memory
+ * blocks, keeping the resource declarations.*/
+void ChiRenderGraph::DestroyTransients()
+{
+  if (m_device != VK_NULL_HANDLE)
+  {
+    for (auto& resource : m_resources)
+    {
+      if (resource.imported) continue;
+      if (resource.view != VK_NULL_HANDLE)
+        vkDestroyImageView(m_device, resource.view, nullptr);
+      if (resource.image != VK_NULL_HANDLE)
+        vkDestroyImage(m_device, resource.image, nullptr);
+      resource.view = VK_NULL_HANDLE;
+      resource.image = VK_NULL_HANDLE;
+      resource.memory_block = -1;
+    }
+
+    for (auto& block : m_memory_blocks)
+      vkFreeMemory(m_device, block.memory, nullptr);
+  }
+
+  m_memory_blocks.clear();
+}
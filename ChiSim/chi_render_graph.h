@@ -0,0 +1,213 @@
+#ifndef _ChiRenderGraph_h
+#define _ChiRenderGraph_h
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <string>
+#include <functional>
+#include <cstdint>
+
+//###################################################################
+/** Frame render graph.
+ *
+ * Passes declare the images and buffers they read and write. When the
+ * graph is compiled it
+ *  - culls passes whose outputs are never consumed,
+ *  - creates transient images and aliases their memory when their
+ *    lifetimes do not overlap, and
+ *  - computes the layout transitions and memory dependencies between
+ *    passes, merged into a single vkCmdPipelineBarrier per pass.
+ *
+ * Imported resources (swap chain images, long-lived buffers) are not
+ * owned by the graph. Their handles may be rebound with
+ * SetImportedImage/SetImportedBuffer after compilation, which allows a
+ * single compiled graph to be recorded against every swap chain image.*/
+class ChiRenderGraph
+{
+public:
+  typedef size_t ResourceID;
+  typedef std::function<void(VkCommandBuffer)> ExecuteFunction;
+
+  /** The ways in which a pass can touch a resource. */
+  enum class Usage
+  {
+    ColorAttachment,
+    DepthAttachment,
+    DepthRead,
+    SampledRead,
+    StorageRead,
+    StorageWrite,
+    TransferSrc,
+    TransferDst,
+    UniformRead,
+    VertexRead,
+    IndexRead,
+    Present
+  };
+
+  enum class QueueType
+  {
+    Graphics,
+    Compute
+  };
+
+  /** Pipeline state of a resource at a point in the frame. */
+  struct AccessState
+  {
+    VkImageLayout        layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkPipelineStageFlags stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    VkAccessFlags        access = 0;
+  };
+
+  /** Description of a transient image owned by the graph. */
+  struct ImageDesc
+  {
+    VkFormat           format = VK_FORMAT_UNDEFINED;
+    VkExtent2D         extent = {0, 0};
+    VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+  };
+
+  /** Compilation statistics. */
+  struct Stats
+  {
+    size_t       num_passes        = 0;
+    size_t       num_culled_passes = 0;
+    size_t       num_barriers      = 0;
+    size_t       num_barrier_calls = 0;
+    VkDeviceSize transient_bytes_requested = 0;
+    VkDeviceSize transient_bytes_allocated = 0;
+  };
+
+private:
+  enum class ResourceKind { Image, Buffer };
+
+  struct Resource
+  {
+    std::string        name;
+    ResourceKind       kind = ResourceKind::Image;
+    bool               imported = false;
+    bool               is_output = false;
+
+    ImageDesc          desc;
+    VkImageUsageFlags  image_usage = 0;
+    VkImage            image = VK_NULL_HANDLE;
+    VkImageView        view  = VK_NULL_HANDLE;
+    VkBuffer           buffer = VK_NULL_HANDLE;
+
+    AccessState        initial_state;
+    AccessState        final_state;
+    bool               has_final_state = false;
+
+    int                first_pass = -1;
+    int                last_pass  = -1;
+    int                memory_block = -1;
+  };
+
+  struct ResourceAccess
+  {
+    ResourceID id;
+    Usage      usage;
+  };
+
+  struct Pass
+  {
+    std::string                 name;
+    QueueType                   queue_type = QueueType::Graphics;
+    std::vector<ResourceAccess> accesses;
+    ExecuteFunction             execute;
+    bool                        has_side_effects = false;
+    bool                        culled = false;
+  };
+
+  struct Barrier
+  {
+    ResourceID    id;
+    VkImageLayout old_layout;
+    VkImageLayout new_layout;
+    VkAccessFlags src_access;
+    VkAccessFlags dst_access;
+  };
+
+  struct BarrierBatch
+  {
+    VkPipelineStageFlags src_stages = 0;
+    VkPipelineStageFlags dst_stages = 0;
+    std::vector<Barrier> barriers;
+  };
+
+  struct MemoryBlock
+  {
+    VkDeviceMemory     memory = VK_NULL_HANDLE;
+    VkDeviceSize       size = 0;
+    uint32_t           type_bits = ~0u;
+    std::vector<ResourceID> occupants;
+  };
+
+  VkDevice                  m_device = VK_NULL_HANDLE;
+  VkPhysicalDevice          m_physical_device = VK_NULL_HANDLE;
+
+  std::vector<Resource>     m_resources;
+  std::vector<Pass>         m_passes;
+  std::vector<BarrierBatch> m_pass_barriers;
+  BarrierBatch              m_final_barriers;
+  std::vector<MemoryBlock>  m_memory_blocks;
+
+  bool                      m_compiled = false;
+  Stats                     m_stats;
+
+public:
+  /** Converts a usage into the layout, stages and access flags
+   * it requires. */
+  static AccessState GetUsageAccessState(Usage usage, QueueType queue_type);
+
+  /** Stages and access flags normally associated with a layout. Used for
+   * one-off transitions outside the graph.*/
+  static AccessState GetLayoutAccessState(VkImageLayout layout);
+
+  //============================== Building
+  ResourceID ImportImage(const std::string& name,
+                         VkImage image,
+                         const ImageDesc& desc,
+                         const AccessState& initial_state);
+  ResourceID ImportBuffer(const std::string& name,
+                          VkBuffer buffer,
+                          const AccessState& initial_state);
+  ResourceID CreateImage(const std::string& name, const ImageDesc& desc);
+
+  void SetFinalUsage(ResourceID id, Usage usage);
+  void MarkOutput(ResourceID id);
+
+  void AddPass(const std::string& name,
+               QueueType queue_type,
+               const std::vector<std::pair<ResourceID, Usage>>& accesses,
+               ExecuteFunction execute,
+               bool has_side_effects = false);
+
+  //============================== Compilation and execution
+  void Compile(VkDevice device, VkPhysicalDevice physical_device);
+  void Execute(VkCommandBuffer cmd_buffer) const;
+  void Reset();
+
+  void SetImportedImage(ResourceID id, VkImage image);
+  void SetImportedBuffer(ResourceID id, VkBuffer buffer);
+
+  VkImage     GetImage(ResourceID id) const {return m_resources.at(id).image;}
+  VkImageView GetImageView(ResourceID id) const {return m_resources.at(id).view;}
+  VkBuffer    GetBuffer(ResourceID id) const {return m_resources.at(id).buffer;}
+
+  bool         IsCompiled() const {return m_compiled;}
+  const Stats& GetStats() const {return m_stats;}
+
+private:
+  void CullPasses();
+  void ComputeLifetimes();
+  void AllocateTransients();
+  void DestroyTransients();
+  void ComputeBarriers();
+  void RecordBarrierBatch(VkCommandBuffer cmd_buffer,
+                          const BarrierBatch& batch) const;
+};
+
+#endif
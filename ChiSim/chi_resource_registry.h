@@ -0,0 +1,195 @@
+#ifndef _ChiResourceRegistry_h
+#define _ChiResourceRegistry_h
+
+#include <unordered_map>
+#include <vector>
+#include <utility>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+//###################################################################
+/** Shares GPU objects between identical requests.
+ *
+ * Resources are identified by their content (file bytes, arrays,
+ * create-infos), so a texture loaded twice from different paths or a
+ * mesh uploaded twice from the same arrays maps to one object. Entries
+ * are found by a hash of the content and keep only its size and a
+ * second, independent hash, which a hit must match as well; the
+ * content is not kept. A colliding entry is stored under the next free
+ * key. Insert returns the key; each key is reference counted and the
+ * owner destroys the object when Release reports that the last
+ * reference is gone.
+ *
+ * Every hit is credited with the memory and creation time the original
+ * request cost, which is what deduplication saved. The registry never
+ * creates or destroys objects itself.*/
+template<typename Resource>
+class ChiResourceRegistry
+{
+public:
+  typedef uint64_t Key;
+  typedef std::vector<unsigned char> Content;
+  static constexpr Key HASH_SEED = 0xcbf29ce484222325ull;
+
+  struct Statistics
+  {
+    size_t   requests    = 0;
+    size_t   hits        = 0;
+    uint64_t bytes_saved = 0;
+    double   ms_saved    = 0.0;
+  };
+
+private:
+  struct Entry
+  {
+    Resource resource;
+    Key      check      = 0;
+    uint64_t size       = 0;
+    size_t   references = 0;
+    uint64_t bytes      = 0;
+    double   create_ms  = 0.0;
+  };
+
+  std::unordered_map<Key, Entry> m_entries;
+  Statistics                     m_statistics;
+
+public:
+  /** 64-bit FNV-1a hash of `size` bytes. Chain calls through `seed` to
+   * hash several arrays into one key.*/
+  static Key Hash(const void* data, size_t size, Key seed = HASH_SEED)
+  {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    Key hash = seed;
+    for (size_t i = 0; i < size; ++i)
+    {
+      hash ^= bytes[i];
+      hash *= 0x100000001b3ull;
+    }
+    return hash;
+  }
+
+  /** 64-bit MurmurHash64A of `size` bytes, independent of Hash. Entries
+   * whose content hashes collide are told apart by it.*/
+  static Key Check(const void* data, size_t size)
+  {
+    const Key m = 0xc6a4a7935bd1e995ull;
+    const int r = 47;
+
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    Key hash = 0x8445d61a4e774912ull ^ (uint64_t(size) * m);
+
+    const size_t numBlocks = size / 8;
+    for (size_t b = 0; b < numBlocks; ++b)
+    {
+      Key block;
+      std::memcpy(&block, bytes + 8 * b, 8);
+
+      block *= m;
+      block ^= block >> r;
+      block *= m;
+
+      hash ^= block;
+      hash *= m;
+    }
+
+    const unsigned char* tail = bytes + 8 * numBlocks;
+    const size_t tailSize = size % 8;
+    if (tailSize > 0)
+    {
+      for (size_t i = 0; i < tailSize; ++i)
+        hash ^= Key(tail[i]) << (8 * i);
+      hash *= m;
+    }
+
+    hash ^= hash >> r;
+    hash *= m;
+    hash ^= hash >> r;
+    return hash;
+  }
+
+  /** Appends `size` bytes to `content`. Call repeatedly to identify a
+   * resource by several arrays.*/
+  static void Append(Content& content, const void* data, size_t size)
+  {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    content.insert(content.end(), bytes, bytes + size);
+  }
+
+  /** Looks up a resource by content. On a hit `resource` is set and a
+   * reference is added. Entries sharing the content's hash are probed
+   * at consecutive keys.*/
+  bool Acquire(const Content& content, Resource& resource)
+  {
+    ++m_statistics.requests;
+
+    const Key check = Check(content.data(), content.size());
+
+    auto entry = m_entries.end();
+    for (Key key = Hash(content.data(), content.size()); ; ++key)
+    {
+      entry = m_entries.find(key);
+      if (entry == m_entries.end()) return false;
+      if (entry->second.size == content.size() &&
+          entry->second.check == check)
+        break;
+    }
+
+    ++entry->second.references;
+    ++m_statistics.hits;
+    m_statistics.bytes_saved += entry->second.bytes;
+    m_statistics.ms_saved    += entry->second.create_ms;
+
+    resource = entry->second.resource;
+    return true;
+  }
+
+  /** Adds a resource created after a missed Acquire, with one
+   * reference, and returns the key to Release it with. `bytes` and
+   * `create_ms` are what later hits save. The content is only hashed,
+   * the caller may drop it afterwards.*/
+  Key Insert(const Content& content, const Resource& resource,
+             uint64_t bytes, double create_ms)
+  {
+    Key key = Hash(content.data(), content.size());
+    while (m_entries.count(key) > 0) ++key;
+
+    Entry& entry = m_entries[key];
+    entry.resource   = resource;
+    entry.check      = Check(content.data(), content.size());
+    entry.size       = content.size();
+    entry.references = 1;
+    entry.bytes      = bytes;
+    entry.create_ms  = create_ms;
+    return key;
+  }
+
+  /** Drops a reference. Returns true, with `resource` set, when it was
+   * the last one; the caller then destroys the resource.*/
+  bool Release(Key key, Resource& resource)
+  {
+    auto entry = m_entries.find(key);
+    if (entry == m_entries.end()) return false;
+    if (--entry->second.references > 0) return false;
+
+    resource = entry->second.resource;
+    m_entries.erase(entry);
+    return true;
+  }
+
+  /** Calls `visitor` on every registered resource, e.g. to destroy
+   * them at shutdown before Clear.*/
+  template<typename Visitor>
+  void ForEach(Visitor visitor) const
+  {
+    for (const auto& entry : m_entries)
+      visitor(entry.second.resource);
+  }
+
+  void Clear() {m_entries.clear();}
+
+  size_t GetNumResources() const {return m_entries.size();}
+  const Statistics& GetStatistics() const {return m_statistics;}
+};
+
+#endif
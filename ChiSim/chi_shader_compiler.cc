@@ -0,0 +1,279 @@
+#include "chi_shader_compiler.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <filesystem>
+#include <functional>
+#include <thread>
+#include <cstring>
+
+#include <unistd.h>
+
+#ifdef CHI_HAVE_SHADERC
+#include <shaderc/shaderc.h>
+#endif
+
+/** Bumped whenever the cache key, file layout or compile options
+ * change.*/
+static const uint32_t CACHE_FORMAT_VERSION = 2;
+
+/** First word of every SPIR-V module.*/
+static const uint32_t SPIRV_MAGIC = 0x07230203;
+
+/** Identifies the build of the compiler library, set by CMake from a
+ * hash of the shaderc library linked. The SPIR-V version alone stays
+ * the same across compiler releases with different code generation.*/
+#ifndef CHI_SHADERC_BUILD
+#define CHI_SHADERC_BUILD ""
+#endif
+
+//###################################################################
+ChiShaderCompiler::ChiShaderCompiler()
+{
+#ifdef CHI_HAVE_SHADERC
+  m_compiler = shaderc_compiler_initialize();
+#endif
+}
+
+//###################################################################
+ChiShaderCompiler::~ChiShaderCompiler()
+{
+#ifdef CHI_HAVE_SHADERC
+  if (m_compiler != nullptr)
+    shaderc_compiler_release(static_cast<shaderc_compiler_t>(m_compiler));
+#endif
+}
+
+//###################################################################
+/** Whether GLSL can be compiled at runtime.*/
+bool ChiShaderCompiler::IsAvailable()
+{
+#ifdef CHI_HAVE_SHADERC
+  return true;
+#else
+  return false;
+#endif
+}
+
+//###################################################################
+/** Determines the shader stage from the file extension
+ * (.vert, .frag, .comp).*/
+ChiShaderCompiler::Stage ChiShaderCompiler::
+  GetStageFromFilename(const std::string& filename)
+{
+  const std::string extension =
+    std::filesystem::path(filename).extension().string();
+
+  if (extension == ".vert") return Stage::Vertex;
+  if (extension == ".frag") return Stage::Fragment;
+  if (extension == ".comp") return Stage::Compute;
+
+  throw std::runtime_error("unknown shader stage for \"" + filename + "\"!");
+}
+
+//###################################################################
+/** Sets the directory compiled shaders are cached in. An empty string
+ * disables the cache.*/
+void ChiShaderCompiler::SetCacheDirectory(const std::string& directory)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_cache_directory = directory;
+
+  if (!directory.empty())
+  {
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+  }
+}
+
+//###################################################################
+/** Reads a GLSL file and compiles it, see Compile.*/
+std::vector<char> ChiShaderCompiler::CompileFile(const std::string& path,
+                                                 Stage stage,
+                                                 const DefineList& defines)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open())
+    throw std::runtime_error("failed to open shader \"" + path + "\"!");
+
+  std::stringstream source;
+  source << file.rdbuf();
+
+  return Compile(source.str(), path, stage, defines);
+}
+
+//###################################################################
+/** Returns the SPIR-V of a GLSL source, from the cache if it was
+ * compiled before with the same stage, defines and compiler.*/
+std::vector<char> ChiShaderCompiler::Compile(const std::string& source,
+                                             const std::string& name,
+                                             Stage stage,
+                                             const DefineList& defines)
+{
+  std::string cacheDirectory;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    cacheDirectory = m_cache_directory;
+  }
+
+  //============================ Try the cache
+  std::string cachePath;
+  if (!cacheDirectory.empty())
+  {
+    std::stringstream filename;
+    filename << std::hex << ComputeKey(source, stage, defines) << ".spv";
+    cachePath = (std::filesystem::path(cacheDirectory) /
+                 filename.str()).string();
+
+    std::ifstream file(cachePath, std::ios::binary | std::ios::ate);
+    if (file.is_open() && file.tellg() > 0)
+    {
+      std::vector<char> spirv((size_t) file.tellg());
+      file.seekg(0);
+      file.read(spirv.data(), spirv.size());
+
+      uint32_t magic = 0;
+      if (spirv.size() >= sizeof(magic))
+        memcpy(&magic, spirv.data(), sizeof(magic));
+
+      if (file && spirv.size() % 4 == 0 && magic == SPIRV_MAGIC)
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_cache_hits;
+        return spirv;
+      }
+    }
+  }
+
+  //============================ Compile
+  std::vector<char> spirv = CompileUncached(source, name, stage, defines);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_cache_misses;
+  }
+
+  //============================ Store, replacing atomically
+  // Processes and threads compiling the same shader each write their
+  // own temporary file.
+  if (!cachePath.empty())
+  {
+    std::stringstream tempName;
+    tempName << cachePath << "." << getpid() << "."
+             << std::hash<std::thread::id>()(std::this_thread::get_id())
+             << ".tmp";
+    const std::string tempPath = tempName.str();
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    file.write(spirv.data(), spirv.size());
+    file.close();
+
+    std::error_code error;
+    if (file)
+      std::filesystem::rename(tempPath, cachePath, error);
+    if (!file || error)
+      std::filesystem::remove(tempPath, error);
+  }
+
+  return spirv;
+}
+
+//###################################################################
+/** Runs the compiler. Throws with the compiler log on failure.*/
+std::vector<char> ChiShaderCompiler::
+  CompileUncached(const std::string& source,
+                  const std::string& name,
+                  Stage stage,
+                  const DefineList& defines)
+{
+#ifdef CHI_HAVE_SHADERC
+  shaderc_shader_kind kind = shaderc_vertex_shader;
+  switch (stage)
+  {
+    case Stage::Vertex:   kind = shaderc_vertex_shader; break;
+    case Stage::Fragment: kind = shaderc_fragment_shader; break;
+    case Stage::Compute:  kind = shaderc_compute_shader; break;
+  }
+
+  shaderc_compile_options_t options = shaderc_compile_options_initialize();
+  shaderc_compile_options_set_target_env(options,
+                                         shaderc_target_env_vulkan,
+                                         shaderc_env_version_vulkan_1_2);
+  shaderc_compile_options_set_optimization_level(
+    options, shaderc_optimization_level_performance);
+  for (const auto& define : defines)
+    shaderc_compile_options_add_macro_definition(options,
+                                                 define.first.c_str(),
+                                                 define.first.size(),
+                                                 define.second.c_str(),
+                                                 define.second.size());
+
+  shaderc_compilation_result_t result =
+    shaderc_compile_into_spv(static_cast<shaderc_compiler_t>(m_compiler),
+                             source.c_str(), source.size(),
+                             kind, name.c_str(), "main", options);
+  shaderc_compile_options_release(options);
+
+  if (shaderc_result_get_compilation_status(result) !=
+      shaderc_compilation_status_success)
+  {
+    std::string log = shaderc_result_get_error_message(result);
+    shaderc_result_release(result);
+    throw std::runtime_error("failed to compile shader \"" + name +
+                             "\":\n" + log);
+  }
+
+  const char* bytes = shaderc_result_get_bytes(result);
+  std::vector<char> spirv(bytes, bytes + shaderc_result_get_length(result));
+  shaderc_result_release(result);
+
+  return spirv;
+#else
+  throw std::runtime_error("failed to compile shader \"" + name +
+                           "\", built without a runtime shader compiler!");
+#endif
+}
+
+//###################################################################
+/** 64-bit FNV-1a hash of everything that affects the compiled code,
+ * including the compiler build (CHI_SHADERC_BUILD).*/
+uint64_t ChiShaderCompiler::ComputeKey(const std::string& source,
+                                       Stage stage,
+                                       const DefineList& defines)
+{
+  uint64_t hash = 0xcbf29ce484222325ull;
+  auto mix = [&hash](const void* data, size_t size)
+  {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+      hash ^= bytes[i];
+      hash *= 0x100000001b3ull;
+    }
+  };
+  auto mixString = [&mix](const std::string& value)
+  {
+    uint64_t size = value.size();
+    mix(&size, sizeof(size));
+    mix(value.data(), value.size());
+  };
+
+  mix(&CACHE_FORMAT_VERSION, sizeof(CACHE_FORMAT_VERSION));
+
+  unsigned int spvVersion = 0, spvRevision = 0;
+#ifdef CHI_HAVE_SHADERC
+  shaderc_get_spv_version(&spvVersion, &spvRevision);
+#endif
+  mix(&spvVersion, sizeof(spvVersion));
+  mix(&spvRevision, sizeof(spvRevision));
+  mixString(CHI_SHADERC_BUILD);
+
+  mix(&stage, sizeof(stage));
+  mixString(source);
+  for (const auto& define : defines)
+  {
+    mixString(define.first);
+    mixString(define.second);
+  }
+
+  return hash;
+}
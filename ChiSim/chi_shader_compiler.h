@@ -0,0 +1,77 @@
+#ifndef _ChiShaderCompiler_h
+#define _ChiShaderCompiler_h
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+//###################################################################
+/** Compiles GLSL to SPIR-V at runtime.
+ *
+ * Compiled SPIR-V is stored in a cache directory under a key made of
+ * the shader source, its stage, the preprocessor defines, the SPIR-V
+ * version and the build of the compiler library, so unchanged shaders
+ * are loaded from disk instead of being recompiled. Cache files are
+ * written to a temporary name unique to the writing process and thread
+ * and renamed into place; files that do not start with the SPIR-V
+ * magic number are recompiled.
+ *
+ * The compiler is only available when built with shaderc
+ * (CHI_HAVE_SHADERC, see the CHI_RUNTIME_SHADERS CMake option).
+ * Without it IsAvailable() returns false and callers must fall back to
+ * precompiled SPIR-V. Compile calls may come from any thread.*/
+class ChiShaderCompiler
+{
+public:
+  enum class Stage
+  {
+    Vertex,
+    Fragment,
+    Compute
+  };
+
+  typedef std::vector<std::pair<std::string, std::string>> DefineList;
+
+private:
+  std::mutex  m_mutex;
+  void*       m_compiler = nullptr;
+  std::string m_cache_directory;
+  size_t      m_cache_hits = 0;
+  size_t      m_cache_misses = 0;
+
+public:
+  ChiShaderCompiler();
+  ~ChiShaderCompiler();
+  ChiShaderCompiler(const ChiShaderCompiler&) = delete;
+  ChiShaderCompiler& operator=(const ChiShaderCompiler&) = delete;
+
+  static bool IsAvailable();
+  static Stage GetStageFromFilename(const std::string& filename);
+
+  void SetCacheDirectory(const std::string& directory);
+
+  std::vector<char> CompileFile(const std::string& path,
+                                Stage stage,
+                                const DefineList& defines = {});
+  std::vector<char> Compile(const std::string& source,
+                            const std::string& name,
+                            Stage stage,
+                            const DefineList& defines = {});
+
+  size_t GetCacheHits() const {return m_cache_hits;}
+  size_t GetCacheMisses() const {return m_cache_misses;}
+
+private:
+  std::vector<char> CompileUncached(const std::string& source,
+                                    const std::string& name,
+                                    Stage stage,
+                                    const DefineList& defines);
+  static uint64_t ComputeKey(const std::string& source,
+                             Stage stage,
+                             const DefineList& defines);
+};
+
+#endif
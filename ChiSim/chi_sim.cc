@@ -1,95 +1,70 @@
 #include "chi_sim.h"
 
-//###################################################################
-/** Creates vertex buffers. */
-void ChiSim::CreateVertexBuffer()
-{
-  VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
-
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
-  CreateBuffer(bufferSize,
-               VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-               VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-               stagingBuffer,
-               stagingBufferMemory);
-
-  void* data;
-  vkMapMemory(m_device, stagingBufferMemory, 0, bufferSize, 0, &data);
-  memcpy(data, vertices.data(), (size_t) bufferSize);
-  vkUnmapMemory(m_device, stagingBufferMemory);
-
-  CreateBuffer(bufferSize,
-               VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-               VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-               m_vertex_buffer,
-               m_vertex_buffer_memory);
-
-  CopyBuffer(stagingBuffer, m_vertex_buffer, bufferSize);
-
-  vkDestroyBuffer(m_device, stagingBuffer, nullptr);
-  vkFreeMemory(m_device, stagingBufferMemory, nullptr);
-}
-
-//###################################################################
-/** Create index buffers. */
-void ChiSim::CreateIndexBuffer()
-{
-  VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
-
-  VkBuffer stagingBuffer;
-  VkDeviceMemory stagingBufferMemory;
-  CreateBuffer(bufferSize,
-               VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-               VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-               stagingBuffer,
-               stagingBufferMemory);
-
-  void* data;
-  vkMapMemory(m_device, stagingBufferMemory, 0, bufferSize, 0, &data);
-  memcpy(data, indices.data(), (size_t) bufferSize);
-  vkUnmapMemory(m_device, stagingBufferMemory);
-
-  CreateBuffer(bufferSize,
-               VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-               VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-               VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-               m_index_buffer,
-               m_index_buffer_memory);
-
-  CopyBuffer(stagingBuffer, m_index_buffer, bufferSize);
-
-  vkDestroyBuffer(m_device, stagingBuffer, nullptr);
-  vkFreeMemory(m_device, stagingBufferMemory, nullptr);
-}
-
-
+#include <cmath>
 
 //###################################################################
 /** Update uniform buffer. */
 void ChiSim::UpdateUniformBuffer(uint32_t currentImage)
 {
-  static auto startTime = std::chrono::high_resolution_clock::now();
-
   auto currentTime = std::chrono::high_resolution_clock::now();
   float time =
     std::chrono::duration<float, std::chrono::seconds::period>(
-      currentTime - startTime).count();
+      currentTime - m_start_time).count();
+
+  // Every poster tile shows the same instant, batch jobs and in-situ
+  // renders the instant of their timestep. Compositing processes step
+  // time by frame so their partitions of a frame show the same
+  // instant.
+  if (m_poster) time = 0.0f;
+  if (m_batch_job)
+    time = float(m_batch_job->timestep) * k_batch_timestep_seconds;
+  if (m_compositing)
+    time = float(m_num_readback_frames) * k_batch_timestep_seconds;
+  if (m_insitu_step)
+    time = float(*m_insitu_step) * k_batch_timestep_seconds;
+
+  glm::vec3 eye(2.0f, 2.0f, 2.0f);
+  if (m_batch_job)
+  {
+    const float angle = glm::radians(45.0f) + glm::radians(360.0f) *
+                        float(m_batch_job->camera % k_batch_cameras) /
+                        float(k_batch_cameras);
+    eye = glm::vec3(2.0f * std::sqrt(2.0f) * std::cos(angle),
+                    2.0f * std::sqrt(2.0f) * std::sin(angle),
+                    2.0f);
+  }
 
   UniformBufferObject ubo = {};
   ubo.model = glm::rotate(glm::mat4(1.0f),
                           time * glm::radians(90.0f),
                           glm::vec3(0.0f, 0.0f, 1.0f));
-  ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f),
+  ubo.view = glm::lookAt(eye,
                          glm::vec3(0.0f, 0.0f, 0.0f),
                          glm::vec3(0.0f, 0.0f, 1.0f));
-  ubo.proj = glm::perspective(glm::radians(45.0f),
-                              m_swap_chain_extent.width /
-                              (float) m_swap_chain_extent.height, 0.1f, 10.0f);
-  ubo.proj[1][1] *= -1;
+  if (m_poster)
+    ubo.proj = GetPosterTileProjection(m_num_readback_frames);
+  else
+  {
+    ubo.proj = glm::perspective(glm::radians(45.0f),
+                                m_swap_chain_extent.width /
+                                (float) m_swap_chain_extent.height, 0.1f, 10.0f);
+    ubo.proj[1][1] *= -1;
+  }
+  ubo.model_view = ubo.view * ubo.model;
+  ubo.mvp = ubo.proj * ubo.model_view;
+
+  // Scene space clip planes (a, b, c, d) keeping a*x + b*y + c*z + d >= 0.
+  ubo.clip_planes[0] = glm::vec4( 1.0f,  0.0f, 0.0f, 0.25f);
+  ubo.clip_planes[1] = glm::vec4( 0.0f,  1.0f, 0.0f, 0.25f);
+  ubo.clip_planes[2] = glm::vec4(-1.0f,  0.0f, 0.0f, 0.25f);
+  ubo.clip_planes[3] = glm::vec4( 0.0f, -1.0f, 0.0f, 0.25f);
+
+  ubo.features = glm::ivec4(m_shader_variant.use_texture ? 1 : 0,
+                            m_shader_variant.colormap_id,
+                            m_shader_variant.num_clip_planes,
+                            m_shader_variant.lighting_mode);
+  ubo.field_range = m_field_range;
+  ubo.field_base = uint32_t(m_current_frame) * k_geometry_vertex_capacity;
 
   void* data;
   vkMapMemory(m_device,
@@ -97,6 +72,8 @@ void ChiSim::UpdateUniformBuffer(uint32_t currentImage)
               0, sizeof(ubo), 0, &data);
   memcpy(data, &ubo, sizeof(ubo));
   vkUnmapMemory(m_device, m_uniform_buffers_memory[currentImage]);
+
+  WriteDrawParameters(currentImage);
 }
 
 //###################################################################
@@ -22,8 +22,29 @@
 #include <cstdint>
 #include <optional>
 #include <set>
+#include <map>
 #include <array>
 #include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "chi_render_graph.h"
+#include "chi_offset_allocator.h"
+#include "chi_descriptor_allocator.h"
+#include "chi_resource_registry.h"
+#include "chi_skyline_packer.h"
+#include "chi_frame_encoder.h"
+#include "chi_striped_image_writer.h"
+#include "chi_compositor.h"
+#include "chi_frame_streamer.h"
+#include "chi_solver_ring.h"
+#include "chi_pipeline_manager.h"
+#include "chi_shader_compiler.h"
+#include "chi_file_watcher.h"
 
 //###################################################################
 /** Main simulation system class. */
@@ -33,7 +54,19 @@ public:
   const int WIDTH = 800;
   const int HEIGHT = 600;
 
-  const int MAX_FRAMES_IN_FLIGHT = 2;
+  /** Upper bound on frames in flight. Synchronization objects are
+   * created for this many; the active count depends on the
+   * presentation mode. */
+  const int MAX_FRAMES_IN_FLIGHT = 3;
+
+  /** Quiet period after the last resize event before a suboptimal
+   * swap chain is recreated. Out-of-date swap chains are recreated
+   * immediately. */
+  const double k_resize_debounce_ms = 50.0;
+
+  /** The recreation benchmark recreates the swap chain every this many
+   * frames. */
+  const size_t k_recreate_benchmark_interval = 30;
 
   const std::vector<const char*> k_validation_layers =
     {"VK_LAYER_KHRONOS_validation"};
@@ -41,6 +74,16 @@ public:
   const std::vector<const char*> k_device_extensions =
     {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
 
+  /** Headless mode renders into k_offscreen_images images of WIDTH x
+   * HEIGHT in place of swap chain images. */
+  const uint32_t k_offscreen_images = 2;
+  const VkFormat k_offscreen_format = VK_FORMAT_R8G8B8A8_SRGB;
+
+  /** Batch jobs: animation time per timestep and the number of cameras
+   * spaced evenly around the scene. */
+  const float    k_batch_timestep_seconds = 1.0f / 30.0f;
+  const uint32_t k_batch_cameras = 4;
+
   struct Vertex
   {
     glm::vec3 pos;
@@ -93,15 +136,451 @@ public:
     {{-0.5f, 0.5f, -0.5f}, {1.0f, 1.0f, 1.0f}, {0.0f, 1.0f}}
   };
 
-  const std::vector<uint16_t> indices = {
+  const std::vector<uint32_t> indices = {
     0, 1, 2, 2, 3, 0,
     4, 5, 6, 6, 7, 4
   };
 
+  /** A timeline semaphore owned by a queue. Every submission to the
+   * queue signals the next counter value. */
+  struct QueueTimeline
+  {
+    VkSemaphore semaphore      = VK_NULL_HANDLE;
+    uint64_t    last_submitted = 0;
+  };
+
+  /** A semaphore a submission waits on. For timeline semaphores
+   * `value` is the counter value to wait for; binary semaphores
+   * ignore it. */
+  struct SemaphoreWait
+  {
+    VkSemaphore          semaphore;
+    uint64_t             value;
+    VkPipelineStageFlags stages;
+  };
+
+  /** Smoothed per-frame timings in milliseconds. CPU wait is the time
+   * the host spent blocked on the timeline; GPU time comes from
+   * timestamp queries around the recorded frame. */
+  struct FrameTimings
+  {
+    double cpu_wait_ms = 0.0;
+    double gpu_ms      = 0.0;
+    double frame_ms    = 0.0;
+    double latency_ms  = 0.0;
+    size_t num_frames  = 0;
+  };
+
+  /** A frame read back through the readback ring, see
+   * SetReadbackCallback. `pixels` holds tightly packed rows of 4 bytes
+   * per pixel in `format` and is only valid during the callback. With
+   * depth readback `depth` holds the depth aspect, 4 bytes per pixel in
+   * `depth_format`, see GetReadbackDepth. */
+  struct ReadbackFrame
+  {
+    size_t      frame_number = 0;
+    uint32_t    width        = 0;
+    uint32_t    height       = 0;
+    VkFormat    format       = VK_FORMAT_UNDEFINED;
+    const void* pixels       = nullptr;
+    VkFormat    depth_format = VK_FORMAT_UNDEFINED;
+    const void* depth        = nullptr;
+  };
+  typedef std::function<void(const ReadbackFrame&)> ReadbackCallback;
+
+  /** Host visible, persistently mapped buffer a frame is copied into. */
+  struct ReadbackSlot
+  {
+    VkBuffer       buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    void*          mapped = nullptr;
+    VkBuffer       depth_buffer = VK_NULL_HANDLE;
+    VkDeviceMemory depth_memory = VK_NULL_HANDLE;
+    void*          depth_mapped = nullptr;
+  };
+
+  /** A copy submitted with a frame, consumed once the graphics
+   * timeline reaches `timeline_value`. */
+  struct PendingReadback
+  {
+    ReadbackSlot slot;
+    VkExtent2D   extent;
+    VkFormat     format;
+    VkFormat     depth_format;
+    size_t       frame_number;
+    uint64_t     timeline_value;
+    std::chrono::high_resolution_clock::time_point submitted;
+  };
+
+  /** Readback latency from submission to consumption, in milliseconds
+   * and in frames submitted meanwhile, and the frame time of frames
+   * without (0) and with (1) capture. */
+  struct ReadbackTimings
+  {
+    size_t                frames         = 0;
+    double                latency_ms     = 0.0;
+    double                latency_frames = 0.0;
+    std::array<double, 2> frame_ms       = {0.0, 0.0};
+    std::array<size_t, 2> num_frames     = {0, 0};
+  };
+
+  /** Sustained rate of one frame encoder configuration. */
+  struct EncoderResult
+  {
+    ChiFrameEncoder::Format format;
+    size_t                  num_threads;
+    ChiFrameEncoder::Stats  stats;
+  };
+
+  /** Cost of the in-situ Render calls: wall time of the whole call
+   * and of the field update within it, the field bytes copied by the
+   * host into staging memory and those read by the device straight
+   * from imported solver memory, and the updates done each way. */
+  struct InSituTimings
+  {
+    size_t calls            = 0;
+    double render_ms        = 0.0;
+    double max_render_ms    = 0.0;
+    double update_ms        = 0.0;
+    size_t bytes_copied     = 0;
+    size_t bytes_imported   = 0;
+    size_t staged_updates   = 0;
+    size_t imported_updates = 0;
+  };
+
+  /** A solver field array imported as device memory through
+   * VK_EXT_external_memory_host, see b26_in_situ.cc. */
+  struct ImportedField
+  {
+    const float*   host_pointer = nullptr;
+    VkDeviceSize   size = 0;
+    VkBuffer       buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+  };
+
+  /** Persistently mapped staging buffer of a frame slot's field
+   * updates, see b26_in_situ.cc. Updates are sub-allocated from it
+   * until the slot comes around again. */
+  struct FieldStaging
+  {
+    VkBuffer       buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    void*          mapped = nullptr;
+    VkDeviceSize   size = 0;
+    VkDeviceSize   used = 0;
+  };
+
+  /** Solver steps drawn from a ChiSolverRing and skipped because the
+   * solver was faster, uploads discarded because the solver overwrote
+   * them meanwhile, and the mean wait for and upload of a step. */
+  struct RingTimings
+  {
+    size_t steps         = 0;
+    size_t steps_skipped = 0;
+    size_t torn_reads    = 0;
+    double wait_ms       = 0.0;
+    double upload_ms     = 0.0;
+  };
+
+  /** A frame rendered by a batch worker, see EnableBatchWorker. */
+  struct BatchJob
+  {
+    size_t      index = 0;
+    uint32_t    timestep = 0;
+    uint32_t    camera = 0;
+    std::string dataset;
+  };
+
+  /** Runtime trade-off between input-to-photon latency and throughput.
+   *  - LowLatency:    FIFO, minimum swap chain depth, one frame in
+   *                   flight and the camera/UBO sampled just before
+   *                   submission.
+   *  - Balanced:      MAILBOX when available, two frames in flight.
+   *  - MaxThroughput: IMMEDIATE (else MAILBOX), deeper swap chain and
+   *                   three frames in flight, e.g. for movie capture.*/
+  enum class PresentationMode
+  {
+    LowLatency    = 0,
+    Balanced      = 1,
+    MaxThroughput = 2
+  };
+
+  /** Cost of swap chain recreations done one way: the time the render
+   * loop is held up, and the part of it spent waiting for the device
+   * to idle. */
+  struct RecreateTimings
+  {
+    size_t count          = 0;
+    double ms_average     = 0.0;
+    double ms_max         = 0.0;
+    double idle_ms_average = 0.0;
+  };
+
+  /** A frame's camera/UBO sample time, resolved to a latency once the
+   * graphics timeline reaches `timeline_value`. */
+  struct LatencySample
+  {
+    uint64_t         timeline_value = 0;
+    std::chrono::high_resolution_clock::time_point sampled;
+    PresentationMode mode;
+  };
+
+  /** A mesh sub-allocated from the shared geometry buffers. Indices are
+   * relative to the mesh's first vertex, which is applied as the
+   * vertexOffset of the indexed draw. Pulled meshes live in the
+   * structure-of-arrays buffers instead and are drawn with vertex
+   * pulling (see UploadFieldMesh).*/
+  struct MeshRange
+  {
+    uint32_t first_index   = 0;
+    uint32_t index_count   = 0;
+    int32_t  vertex_offset = 0;
+    uint32_t vertex_count  = 0;
+    bool     active        = false;
+    bool     pulled        = false;
+    bool     shared        = true;  //registered, see UploadMesh
+    uint64_t key           = 0; //key in the mesh registry
+  };
+  typedef size_t MeshID;
+
+  /** A shader of the main pipeline: its GLSL source, the defines it
+   * is compiled with and the SPIR-V the build produces from it (see
+   * chi_add_spirv in CMakeLists.txt), used without a runtime
+   * compiler.*/
+  struct ShaderFile
+  {
+    std::string                   source;
+    std::string                   precompiled;
+    ChiShaderCompiler::DefineList defines;
+  };
+  const ShaderFile k_main_vertex_shader   = {"shader.vert", "vert.spv", {}};
+  const ShaderFile k_main_fragment_shader = {"shader.frag", "frag.spv", {}};
+  const ShaderFile k_bindless_fragment_shader =
+    {"shader.frag", "frag_bindless.spv", {{"BINDLESS", "1"}}};
+  const ShaderFile k_pulled_vertex_shader =
+    {"shader.vert", "vert_pulled.spv", {{"VERTEX_PULLING", "1"}}};
+  const ShaderFile k_field_range_shader =
+    {"field_range.comp", "field_range.spv", {}};
+
+  /** Capacities of the shared geometry buffers, in vertices and
+   * indices. The pulled coordinate, field and connectivity buffers have
+   * the same capacities; the field buffer once per frame slot. */
+  const uint32_t k_geometry_vertex_capacity = 1 << 20;
+  const uint32_t k_geometry_index_capacity  = 1 << 22;
+
   struct UniformBufferObject {
     glm::mat4 model;
     glm::mat4 view;
     glm::mat4 proj;
+    glm::mat4 model_view;
+    glm::mat4 mvp;
+    glm::vec4 clip_planes[4];
+    glm::ivec4 features; //texture, colormap, clip planes, lighting
+    glm::vec2  field_range; //automatic colormap range of the solver field
+    uint32_t   field_base; //frame slot's range of the pulled field buffer
+  };
+
+  /** Feature selection of the main shaders. Specialized pipelines bake
+   * these in as specialization constants so the driver removes unused
+   * branches; the uber-shader reads them from the uniform buffer. The
+   * constant IDs match shaders/shader.vert and shader.frag.*/
+  struct ShaderVariant
+  {
+    bool     use_texture     = true;
+    uint32_t colormap_id     = 0; //0 none, 1 grayscale, 2 jet, 3 viridis
+    uint32_t num_clip_planes = 0; //0..4
+    uint32_t lighting_mode   = 0; //0 unlit, 1 headlight
+
+    static constexpr uint32_t NUM_COLORMAPS      = 4;
+    static constexpr uint32_t MAX_CLIP_PLANES    = 4;
+    static constexpr uint32_t NUM_LIGHTING_MODES = 2;
+
+    /** Unique key used to deduplicate variant pipelines. */
+    uint32_t GetKey() const
+    {
+      return uint32_t(use_texture) |
+             (colormap_id     << 1) |
+             (num_clip_planes << 4) |
+             (lighting_mode   << 8);
+    }
+
+    std::vector<uint32_t> GetSpecializationConstants(bool uber) const
+    {
+      return {uint32_t(uber), uint32_t(use_texture),
+              colormap_id, num_clip_planes, lighting_mode};
+    }
+  };
+
+  /** Small per-draw parameters. The layout matches DrawParameters in
+   * shaders/shader.vert and shader.frag (std430/std140 agree here). */
+  struct DrawParameters
+  {
+    uint32_t  model_index    = 0;
+    uint32_t  field_id       = 0; //0 color luminance, 1-3 object x, y, z
+    glm::vec2 colormap_range = glm::vec2(0.0f, 1.0f);
+    uint32_t  clip_flags     = 0xFu; //bit p enables clip plane p
+    uint32_t  texture_index  = 0; //bindless texture slot
+    uint32_t  vertex_offset  = 0; //first vertex of a pulled mesh
+    uint32_t  atlas_layer    = 0; //0 no atlas, else atlas layer + 1
+    glm::vec4 texture_rect   = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f); //atlas
+                                  //uv offset (xy) and scale (zw)
+  };
+
+  /** A draw of a mesh. `parameters.model_index` refers to the model
+   * matrix of the draw list the command belongs to. */
+  struct DrawCommand
+  {
+    MeshID         mesh = 0;
+    DrawParameters parameters;
+  };
+
+  /** How per-draw parameters reach the shaders.
+   *  - PushConstants:   vkCmdPushConstants in the recorded stream.
+   *  - DynamicUniforms: a dynamic uniform buffer bound per draw at the
+   *                     draw's offset; the bind-heavy path, kept for
+   *                     comparison.
+   *  - Indirect:        a storage buffer indexed by the instance index,
+   *                     with all draws batched into indirect calls.
+   *                     Together with bindless textures no state
+   *                     changes between draws. */
+  enum class DrawParameterPath
+  {
+    PushConstants   = 0,
+    DynamicUniforms = 1,
+    Indirect        = 2
+  };
+
+  /** Cost of a draw parameter path with the draw benchmark: CPU time
+   * to record a command buffer and GPU time per frame. */
+  struct DrawPathTimings
+  {
+    double record_ms  = 0.0;
+    size_t recordings = 0;
+    double gpu_ms     = 0.0;
+    size_t frames     = 0;
+  };
+
+  /** Where the vertex shader gets vertices from.
+   *  - Interleaved: fixed-function vertex input of ChiSim::Vertex.
+   *  - Pulled:      storage buffers of coordinates, connectivity and
+   *                 field values, fetched by gl_VertexIndex. */
+  enum class VertexInput
+  {
+    Interleaved = 0,
+    Pulled      = 1
+  };
+
+  /** Cost of a vertex input with the vertex pulling benchmark: time to
+   * get the solver arrays onto the GPU and GPU time per frame. */
+  struct VertexInputTimings
+  {
+    double upload_ms = 0.0;
+    double gpu_ms    = 0.0;
+    size_t frames    = 0;
+  };
+
+  /** Vertices per side of the vertex pulling benchmark's grid. */
+  const uint32_t k_pulling_benchmark_grid = 512;
+
+  /** Capacity of the per-image model matrix and draw uniform buffers,
+   * and the number of draws of the draw benchmark. */
+  const uint32_t k_max_draws       = 16384;
+  const uint32_t k_benchmark_draws = 10000;
+
+  /** Upper bound on bindless texture slots; the device limit may be
+   * lower. The draw benchmark spreads k_benchmark_textures textures
+   * over its draws. */
+  const uint32_t k_max_bindless_textures = 4096;
+  const uint32_t k_benchmark_textures    = 8;
+
+  /** Texture atlas: k_atlas_layers layers of k_atlas_size^2 texels,
+   * allocated by the first AddAtlasImage. Every atlas image is
+   * surrounded by k_atlas_padding texels of its own edge, so bilinear
+   * filtering never reaches a neighbour. */
+  const uint32_t k_atlas_size    = 1024;
+  const uint32_t k_atlas_layers  = 4;
+  const uint32_t k_atlas_padding = 2;
+
+  /** Where an image was packed in the texture atlas; see
+   * UseAtlasRegion. */
+  struct AtlasRegion
+  {
+    uint32_t  layer = 0;
+    glm::vec4 rect  = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f); //uv offset, scale
+  };
+
+  /** A sampled texture, shared through the texture registry by all
+   * loads of the same content. */
+  struct Texture
+  {
+    VkImage        image  = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkImageView    view   = VK_NULL_HANDLE;
+    uint32_t       slot   = 0;
+    uint64_t       key    = 0; //key in the texture registry
+  };
+
+  const std::string k_texture_path = "../textures/texture.jpg";
+
+  /** Copies of the main mesh and texture loaded by the repeated asset
+   * scene, each as if it were a separate asset. */
+  const uint32_t k_repeated_assets = 16;
+
+  /** Contents of a set 0 descriptor set in the layout of
+   * m_main_descriptor_template. Zero-initialize before filling in, the
+   * descriptor cache compares it bytewise. */
+  struct MainDescriptorData
+  {
+    VkDescriptorBufferInfo uniforms;
+    VkDescriptorImageInfo  texture;
+    VkDescriptorBufferInfo model_matrices;
+    VkDescriptorBufferInfo draw_parameters;
+    VkDescriptorBufferInfo pulled_coordinates;
+    VkDescriptorBufferInfo pulled_connectivity;
+    VkDescriptorBufferInfo pulled_field_values;
+    VkDescriptorImageInfo  atlas;
+  };
+
+  /** Contents of a set 1 descriptor set in the layout of
+   * m_draw_descriptor_template. */
+  struct DrawDescriptorData
+  {
+    VkDescriptorBufferInfo draw_uniforms;
+  };
+
+  /** Contents of a field range reduction's set, in the layout of
+   * m_field_range_template. */
+  struct FieldRangeDescriptorData
+  {
+    VkDescriptorBufferInfo field_values;
+    VkDescriptorBufferInfo range;
+  };
+
+  /** Push constants of shaders/field_range.comp. */
+  struct FieldRangeParameters
+  {
+    uint32_t first = 0;
+    uint32_t count = 0;
+  };
+
+  /** Pools of the long-lived descriptor allocator start at this many
+   * sets and double when exhausted; per-frame allocators start
+   * smaller. */
+  const uint32_t k_descriptor_pool_sets       = 16;
+  const uint32_t k_frame_descriptor_pool_sets = 4;
+
+  /** Workgroups of a field range reduction at most; each strides over
+   * the field. */
+  const uint32_t k_field_range_max_groups = 64;
+
+  /** GPU time of a variant, drawn with the uber-shader and with its
+   * specialized pipeline. */
+  struct VariantTimings
+  {
+    double uber_gpu_ms               = 0.0;
+    size_t uber_frames               = 0;
+    double specialized_gpu_ms        = 0.0;
+    size_t specialized_frames        = 0;
   };
 
 #ifdef NDEBUG
@@ -110,11 +589,125 @@ public:
   const bool k_enable_validation_layers = true;
 #endif
 
-  GLFWwindow*                    m_main_window;
+  GLFWwindow*                    m_main_window = nullptr;
+  bool                           m_glfw_user = false; //counted in a01
 
   VkInstance                     m_vk_instance;
   VkDebugUtilsMessengerEXT       m_debug_messenger;
-  VkSurfaceKHR                   m_main_surface;
+  VkSurfaceKHR                   m_main_surface = VK_NULL_HANDLE;
+
+  /** Headless mode: no window, surface or swap chain. Frames are
+   * rendered into offscreen images and captured, see b19_headless.cc. */
+  bool                           m_headless = false;
+  size_t                         m_headless_frames = 60;
+  std::string                    m_headless_output_prefix = "frame";
+  std::vector<VkDeviceMemory>    m_offscreen_image_memory;
+  uint32_t                       m_next_offscreen_image = 0;
+
+  /** Frame readback ring, one slot per swap chain image, see
+   * b20_frame_readback.cc. */
+  bool                           m_readback_supported = false;
+  bool                           m_capture_enabled = false;
+  bool                           m_readback_depth = false;
+  ReadbackCallback               m_readback_callback;
+  std::vector<ReadbackSlot>      m_readback_slots;
+  std::deque<PendingReadback>    m_pending_readbacks;
+  std::vector<bool>              m_command_buffer_captures;
+  size_t                         m_num_readback_frames = 0;
+  ReadbackTimings                m_readback_timings;
+
+  /** Encoder captured frames go to unless a readback callback is set,
+   * see b21_frame_encoding.cc. 0 threads means one per core. */
+  ChiFrameEncoder                m_frame_encoder;
+  ChiFrameEncoder::Format        m_encoder_format =
+                                   ChiFrameEncoder::Format::PNG;
+  size_t                         m_encoder_threads = 0;
+  std::vector<EncoderResult>     m_encoder_results;
+
+  /** Tiled poster rendering, see b22_poster.cc. */
+  bool                           m_poster = false;
+  uint32_t                       m_poster_width = 0;
+  uint32_t                       m_poster_height = 0;
+  std::string                    m_poster_path;
+  ChiStripedImageWriter          m_poster_writer;
+  std::chrono::high_resolution_clock::time_point m_poster_start;
+
+  /** Batch worker process, see b23_batch_worker.cc. Jobs are keyed by
+   * the capture number of their frame while in flight. */
+  bool                           m_batch_worker = false;
+  int                            m_batch_read_fd = -1;
+  int                            m_batch_write_fd = -1;
+  std::optional<BatchJob>        m_batch_job;
+  std::map<size_t, BatchJob>     m_batch_jobs_in_flight;
+
+  /** Sort-last compositing process, see b24_compositing.cc. Renders
+   * draw partition m_composite_rank of m_composite_size. */
+  bool                           m_compositing = false;
+  uint32_t                       m_composite_rank = 0;
+  uint32_t                       m_composite_size = 1;
+  bool                           m_composite_write_frames = true;
+  ChiCompositor                  m_compositor;
+  std::vector<DrawCommand>       m_partition_draws;
+
+  /** Streaming to a viewer, see b25_frame_streaming.cc. */
+  bool                           m_streaming = false;
+  double                         m_stream_viewer_timeout = 10.0;
+  ChiFrameStreamer               m_frame_streamer;
+  ChiFrameStreamer::Stats        m_stream_stats;
+
+  /** Context driven by a solver through Render, see b26_in_situ.cc.
+   * The solver's field is read from m_solver_field at every Render,
+   * through the frame slot's staging buffer or, with
+   * m_import_solver_fields, by the device from the imported array
+   * itself. Field updates are copied into the current frame slot's
+   * range of the pulled field buffer by that slot's field command
+   * buffer; m_stale_field_ranges lists per slot the meshes whose newest
+   * field is in another slot's range. Staging buffers outgrown while
+   * copies from them were recorded wait in m_retiring_field_staging
+   * for those copies' submission.
+   *
+   * A solver mesh set up with a reversed field range is colored over
+   * m_field_range, which follows the field: each update is reduced on
+   * the device by the field range pipeline into the slot's host
+   * visible m_field_range_buffers, and read back once the submission
+   * has retired (m_field_range_values). */
+  bool                           m_initialized = false;
+  std::chrono::high_resolution_clock::time_point m_start_time;
+  std::optional<size_t>          m_insitu_step;
+  std::optional<MeshID>          m_solver_mesh;
+  const float*                   m_solver_field = nullptr;
+  std::vector<Vertex>            m_solver_vertices; //without vertex pulling
+  std::vector<uint32_t>          m_solver_indices;
+  std::vector<VkCommandBuffer>   m_field_command_buffers;
+  std::vector<uint64_t>          m_field_copy_values;
+  bool                           m_field_copies_recording = false;
+  std::vector<FieldStaging>      m_field_staging;
+  std::vector<FieldStaging>      m_retiring_field_staging;
+  std::vector<std::map<MeshID, size_t>> m_stale_field_ranges;
+  bool                           m_import_solver_fields = false;
+  std::vector<ImportedField>     m_imported_fields;
+  InSituTimings                  m_insitu_timings;
+  bool                           m_solver_auto_range = false;
+  glm::vec2                      m_field_range = glm::vec2(0.0f, 1.0f);
+  uint64_t                       m_field_range_value = 0;
+  VkDescriptorSetLayout          m_field_range_set_layout = VK_NULL_HANDLE;
+  VkDescriptorUpdateTemplate     m_field_range_template = VK_NULL_HANDLE;
+  VkPipelineLayout               m_field_range_pipeline_layout = VK_NULL_HANDLE;
+  VkPipeline                     m_field_range_pipeline = VK_NULL_HANDLE;
+  std::vector<VkBuffer>          m_field_range_buffers;
+  std::vector<VkDeviceMemory>    m_field_range_buffers_memory;
+  std::vector<uint32_t*>         m_field_range_mapped;
+  std::vector<uint64_t>          m_field_range_values;
+  bool                           m_field_range_recorded = false;
+  VkDeviceSize                   m_storage_buffer_alignment = 1;
+
+  /** Solver data read from another process, see b27_solver_ring.cc. */
+  std::string                    m_solver_ring_name;
+  double                         m_solver_ring_timeout = 10.0;
+  ChiSolverRing                  m_solver_ring;
+  uint64_t                       m_ring_field_sequence = 0;
+  uint64_t                       m_ring_mesh_version = 0;
+  RingTimings                    m_ring_timings;
 
   VkPhysicalDevice               m_physical_device = VK_NULL_HANDLE;
   VkDevice                       m_device;
@@ -122,7 +715,7 @@ public:
   VkQueue                        m_graphics_queue;
   VkQueue                        m_present_queue;
 
-  VkSwapchainKHR                 m_swap_chain;
+  VkSwapchainKHR                 m_swap_chain = VK_NULL_HANDLE;
   std::vector<VkImage>           m_swap_chain_images;
   VkFormat                       m_swap_chain_image_format;
   VkExtent2D                     m_swap_chain_extent;
@@ -131,57 +724,498 @@ public:
 
   VkRenderPass                   m_render_pass;
   VkDescriptorSetLayout          m_descriptor_set_layout;
+  VkDescriptorSetLayout          m_draw_descriptor_set_layout;
   VkPipelineLayout               m_pipeline_layout;
-  VkPipeline                     m_graphics_pipeline;
+  VkPipelineCache                m_pipeline_cache = VK_NULL_HANDLE;
+  bool                           m_pipeline_cache_warm = false;
+  const std::string              k_pipeline_cache_filename =
+                                   "pipeline_cache.bin";
+  ChiPipelineManager             m_pipeline_manager;
+  ChiPipelineManager::PipelineHandle
+                                 m_main_pipeline =
+                                   ChiPipelineManager::INVALID_HANDLE;
+  uint64_t                       m_pipelines_ready_generation = 0;
+
+  ChiShaderCompiler              m_shader_compiler;
+  ChiFileWatcher                 m_shader_watcher;
+  std::string                    m_shader_directory;
+  bool                           m_shader_hot_reload = false;
+  const std::string              k_shader_cache_directory = "shader_cache";
+
+  std::vector<char>              m_main_vertex_spirv;
+  std::vector<char>              m_main_fragment_spirv;
+  std::vector<char>              m_pulled_vertex_spirv;
+
+  std::mutex                     m_shader_reload_mutex;
+  std::vector<char>              m_reloaded_vertex_spirv;
+  std::vector<char>              m_reloaded_fragment_spirv;
+  std::vector<char>              m_reloaded_pulled_vertex_spirv;
+  ChiPipelineManager::PipelineHandle
+                                 m_reloading_pipeline =
+                                   ChiPipelineManager::INVALID_HANDLE;
+
+  ShaderVariant                  m_shader_variant;
+  bool                           m_use_specialized_variants = true;
+  std::map<uint32_t, ChiPipelineManager::PipelineHandle>
+                                 m_variant_pipelines;
+  std::vector<uint32_t>          m_command_buffer_variant_keys;
+  std::map<uint32_t, VariantTimings>
+                                 m_variant_timings;
+  bool                           m_graphics_pipeline_library_supported = false;
+  bool                           m_external_memory_host_supported = false;
+  VkDeviceSize                   m_host_import_alignment = 0;
+  bool                           m_bindless_supported = false;
+  bool                           m_indirect_draws_supported = false;
+  bool                           m_multi_draw_indirect_supported = false;
 
   VkCommandPool                  m_command_pool;
   std::vector<VkCommandBuffer>   m_command_buffers;
 
   std::vector<VkSemaphore>       m_image_available_semaphores;
   std::vector<VkSemaphore>       m_render_finished_semaphores;
-  std::vector<VkFence>           m_in_flight_fences;
-  std::vector<VkFence>           m_images_in_flight;
   size_t                         m_current_frame = 0;
 
-  bool                           m_framebuffer_resized = false;
+  QueueTimeline                  m_graphics_timeline;
+  std::vector<uint64_t>          m_frame_timeline_values;
+  std::vector<uint64_t>          m_image_timeline_values;
+  std::vector<bool>              m_image_timestamps_written;
+  std::deque<std::pair<uint64_t, std::function<void()>>>
+                                 m_retired_resources;
+
+  VkQueryPool                    m_timestamp_query_pool = VK_NULL_HANDLE;
+  double                         m_timestamp_period_ns = 1.0;
+
+  PresentationMode               m_presentation_mode =
+                                   PresentationMode::Balanced;
+  PresentationMode               m_requested_presentation_mode =
+                                   PresentationMode::Balanced;
+  size_t                         m_frames_in_flight = 2;
+  std::array<FrameTimings, 3>    m_mode_timings;
+
+  /** Latency samples of submitted frames. The latency watcher thread
+   * waits for each sample's timeline value and resolves it the moment
+   * the value is reached, see b12_presentation_modes.cc. */
+  std::mutex                     m_latency_mutex;
+  std::condition_variable        m_latency_cv;
+  std::thread                    m_latency_watcher;
+  bool                           m_latency_stopping = false;
+  std::deque<LatencySample>      m_latency_samples;
+  std::vector<std::pair<PresentationMode, double>>
+                                 m_resolved_latencies;
 
+  bool                           m_framebuffer_resized = false;
+  std::chrono::high_resolution_clock::time_point
+                                 m_last_resize_event;
+  /** Swap chain recreation cost by method, see b13: [0] retiring on
+   * the timeline with oldSwapchain, [1] idling the device without it. */
+  std::array<RecreateTimings, 2> m_recreate_timings;
+  bool                           m_recreate_by_idling = false;
+  size_t                         m_recreate_benchmark_remaining = 0;
+  size_t                         m_recreate_benchmark_frame = 0;
+
+  /** Shared geometry buffers. All meshes are sub-allocated from these
+   * so a frame binds geometry once.*/
   VkBuffer                       m_vertex_buffer;
   VkDeviceMemory                 m_vertex_buffer_memory;
+  ChiOffsetAllocator             m_vertex_allocator;
 
   VkBuffer                       m_index_buffer;
   VkDeviceMemory                 m_index_buffer_memory;
+  ChiOffsetAllocator             m_index_allocator;
+
+  /** Structure-of-arrays geometry of pulled meshes: xyz coordinates,
+   * connectivity and one field value per vertex, in storage buffers.
+   * Each frame slot reads its own copy of the field values, so fields
+   * can be updated while other frames are in flight. */
+  VkBuffer                       m_pulled_coordinate_buffer;
+  VkDeviceMemory                 m_pulled_coordinate_buffer_memory;
+  VkBuffer                       m_pulled_field_buffer;
+  VkDeviceMemory                 m_pulled_field_buffer_memory;
+  ChiOffsetAllocator             m_pulled_vertex_allocator;
+  VkBuffer                       m_pulled_connectivity_buffer;
+  VkDeviceMemory                 m_pulled_connectivity_buffer_memory;
+  ChiOffsetAllocator             m_pulled_index_allocator;
+
+  std::vector<MeshRange>         m_meshes;
+  std::vector<MeshID>            m_free_mesh_ids;
+  /** Incremented whenever recorded command buffers become stale, i.e.
+   * the geometry or a pipeline changed. */
+  uint64_t                       m_scene_generation = 0;
+  std::vector<uint64_t>          m_command_buffer_generations;
 
   std::vector<VkBuffer>          m_uniform_buffers;
   std::vector<VkDeviceMemory>    m_uniform_buffers_memory;
 
-  VkDescriptorPool               m_descriptor_pool;
+  /** Draw list of the main pass and the model matrices it indexes.
+   * The draw benchmark replaces both with a grid of k_benchmark_draws
+   * small copies of the first mesh. */
+  std::vector<DrawCommand>       m_draws;
+  std::vector<glm::mat4>         m_model_matrices;
+  std::vector<DrawCommand>       m_benchmark_draws;
+  std::vector<glm::mat4>         m_benchmark_model_matrices;
+  bool                           m_draw_benchmark = false;
+
+  DrawParameterPath              m_draw_parameter_path =
+                                   DrawParameterPath::PushConstants;
+  std::vector<std::optional<DrawParameterPath>>
+                                 m_command_buffer_draw_paths;
+  std::array<DrawPathTimings, 3> m_draw_path_timings;
+
+  /** Vertex pulling benchmark: the same solver grid uploaded both as
+   * interleaved vertices and as pulled arrays, one of which is drawn. */
+  bool                           m_pulling_benchmark = false;
+  VertexInput                    m_pulling_benchmark_input =
+                                   VertexInput::Pulled;
+  std::array<std::vector<DrawCommand>, 2>
+                                 m_pulling_benchmark_draws;
+  std::vector<glm::mat4>         m_pulling_benchmark_model_matrices;
+  std::vector<std::optional<VertexInput>>
+                                 m_command_buffer_vertex_inputs;
+  std::array<VertexInputTimings, 2>
+                                 m_vertex_input_timings;
+
+  std::vector<VkBuffer>          m_model_matrix_buffers;
+  std::vector<VkDeviceMemory>    m_model_matrix_buffers_memory;
+  std::vector<VkBuffer>          m_draw_uniform_buffers;
+  std::vector<VkDeviceMemory>    m_draw_uniform_buffers_memory;
+  VkDeviceSize                   m_draw_uniform_stride = 0;
+  std::vector<VkBuffer>          m_draw_parameter_buffers;
+  std::vector<VkDeviceMemory>    m_draw_parameter_buffers_memory;
+  std::vector<VkBuffer>          m_indirect_buffers;
+  std::vector<VkDeviceMemory>    m_indirect_buffers_memory;
+  uint32_t                       m_max_draw_indirect_count = 1;
+
+  /** Bindless textures: one update-after-bind sampler array shared by
+   * all frames. Released slots return to the free list only once the
+   * frames that may still sample them have retired. */
+  VkDescriptorSetLayout          m_bindless_descriptor_set_layout =
+                                   VK_NULL_HANDLE;
+  VkDescriptorPool               m_bindless_descriptor_pool = VK_NULL_HANDLE;
+  VkDescriptorSet                m_bindless_descriptor_set = VK_NULL_HANDLE;
+  uint32_t                       m_bindless_capacity = 0;
+  uint32_t                       m_bindless_next_slot = 0;
+  std::vector<uint32_t>          m_bindless_free_slots;
+  std::vector<Texture>           m_benchmark_textures;
+
+  /** Long-lived descriptor sets are cached by contents in
+   * m_descriptor_allocator; the frame command buffers are recorded once
+   * per image, so their sets live as long as the image. Transient sets,
+   * written for a single submission of a frame slot's field command
+   * buffer, come from that slot's allocator, which is reset once the
+   * slot has retired. */
+  ChiDescriptorAllocator         m_descriptor_allocator;
+  std::vector<ChiDescriptorAllocator>
+                                 m_frame_descriptor_allocators;
+  VkDescriptorUpdateTemplate     m_main_descriptor_template = VK_NULL_HANDLE;
+  VkDescriptorUpdateTemplate     m_draw_descriptor_template = VK_NULL_HANDLE;
 
   std::vector<VkDescriptorSet>   m_descriptor_sets;
+  std::vector<VkDescriptorSet>   m_draw_descriptor_sets;
 
-  VkImage                        m_texture_image;
-  VkDeviceMemory                 m_texture_image_memory;
-
-  VkImageView                    m_texture_image_view;
+  Texture                        m_texture;
   VkSampler                      m_texture_sampler;
 
+  /** Small images packed into the layers of one array image, see
+   * AddAtlasImage. One skyline packer per layer; none until the first
+   * image allocates the atlas, which is a single texel before. */
+  VkImage                        m_atlas_image = VK_NULL_HANDLE;
+  VkDeviceMemory                 m_atlas_image_memory = VK_NULL_HANDLE;
+  VkImageView                    m_atlas_image_view = VK_NULL_HANDLE;
+  std::vector<ChiSkylinePacker>  m_atlas_packers;
+  size_t                         m_num_atlas_images = 0;
+
+  /** Content-addressed registries: identical textures, meshes and
+   * samplers share one reference-counted GPU object. */
+  ChiResourceRegistry<Texture>   m_texture_registry;
+  ChiResourceRegistry<MeshID>    m_mesh_registry;
+  ChiResourceRegistry<VkSampler> m_sampler_registry;
+  std::map<VkSampler, uint64_t>  m_sampler_keys;
+  bool                           m_repeated_asset_scene = false;
+
   VkImage                        m_depth_image;
   VkDeviceMemory                 m_depth_image_memory;
   VkImageView                    m_depth_image_view;
 
-  /** Obtains a reference to the singleton instance. */
-  static ChiSim& GetSystemScope()
-    { return m_instance; }
+  ChiRenderGraph                 m_render_graph;
+  ChiRenderGraph::ResourceID     m_rg_swap_chain_image;
+  ChiRenderGraph::ResourceID     m_rg_depth_image;
+  size_t                         m_rg_recording_image = 0;
+
+  /** Creates an independent renderer context. Contexts share no
+   * state, so a solver may create as many as it needs, headless or
+   * windowed. GLFW is initialized by the first windowed context and
+   * terminated by the last; like GLFW itself, windowed contexts must
+   * be driven from the main thread. */
+  ChiSim() {}
+
+  /** Releases everything, see Shutdown. A failing teardown is
+   * reported, not thrown; the latency watcher is joined regardless. */
+  ~ChiSim()
+  {
+    try { Shutdown(); }
+    catch (const std::exception& e)
+    {
+      std::cerr << "failed to shut down: " << e.what() << std::endl;
+      try { StopLatencyWatcher(); } catch (...) {}
+    }
+  }
 
   /** Deleted copy constructor. */
   ChiSim(const ChiSim&) = delete;
 
+  /** Requests a presentation mode. It is applied between frames.
+   * Windowed only: headless contexts have no swap chain. */
+  void SetPresentationMode(PresentationMode mode)
+    { if (m_headless)
+        throw std::runtime_error("failed to set presentation mode, "
+                                 "context is headless!");
+      m_requested_presentation_mode = mode; }
+
+  /** Smoothed timings of the given presentation mode. */
+  const FrameTimings& GetFrameTimings(PresentationMode mode) const
+    { return m_mode_timings[static_cast<size_t>(mode)]; }
+
+  /** Allocator for transient descriptor sets of the frame slot being
+   * recorded. Its sets are freed when the slot comes around again, so
+   * only this slot's next submission may use them. */
+  ChiDescriptorAllocator& GetFrameDescriptorAllocator()
+    { return m_frame_descriptor_allocators[m_current_frame]; }
+
+  MeshID UploadMesh(const std::vector<Vertex>& mesh_vertices,
+                    const std::vector<uint32_t>& mesh_indices,
+                    bool shared = true);
+  MeshID UploadFieldMesh(const std::vector<float>& coordinates,
+                         const std::vector<uint32_t>& connectivity,
+                         const std::vector<float>& field_values);
+  MeshID UploadFieldMesh(const float* coordinates,
+                         size_t num_vertices,
+                         const uint32_t* connectivity,
+                         size_t num_indices,
+                         const float* field_values,
+                         bool shared = true);
+  void   UpdateFieldValues(MeshID mesh_id, const float* field_values);
+  void   FreeMesh(MeshID mesh_id);
+
+  /** Whether field meshes are drawn by vertex pulling. Without the
+   * pulled vertex shader UploadFieldMesh interleaves them into
+   * vertices instead. Known after Initialize. */
+  bool IsVertexPullingAvailable() const
+    { return !m_pulled_vertex_spirv.empty(); }
+
+  /** Selects the shader features used by the main pass. The
+   * specialized pipeline is compiled in the background; until it is
+   * ready the uber-shader draws the variant. */
+  void SetShaderVariant(const ShaderVariant& variant)
+    { m_shader_variant = variant; ++m_scene_generation; }
+  const ShaderVariant& GetShaderVariant() const
+    { return m_shader_variant; }
+
+  /** Draws with specialized pipelines (default) or always with the
+   * uber-shader, e.g. to compare their cost. */
+  void SetUseSpecializedVariants(bool use_specialized)
+    { m_use_specialized_variants = use_specialized; ++m_scene_generation; }
+
+  size_t AddDraw(MeshID mesh_id, const glm::mat4& model);
+  size_t AddDraw(MeshID mesh_id,
+                 const glm::mat4& model,
+                 DrawParameters parameters);
+  void   ClearDraws();
+
+  /** Selects how per-draw parameters are passed to the shaders. */
+  void SetDrawParameterPath(DrawParameterPath path)
+    { m_draw_parameter_path = path; ++m_scene_generation; }
+  DrawParameterPath GetDrawParameterPath() const
+    { return m_draw_parameter_path; }
+
+  uint32_t RegisterTexture(VkImageView image_view, VkSampler sampler);
+  void     ReleaseTexture(uint32_t slot);
+
+  Texture   LoadTexture(const std::string& path);
+  Texture   LoadTexture(uint32_t width, uint32_t height, const void* pixels);
+  void      UnloadTexture(const Texture& texture);
+  VkSampler AcquireSampler(const VkSamplerCreateInfo& sampler_info);
+  void      ReleaseSampler(VkSampler sampler);
+
+  AtlasRegion AddAtlasImage(uint32_t width, uint32_t height,
+                            const void* pixels);
+
+  /** Makes a draw sample its texture from an atlas region. */
+  static void UseAtlasRegion(DrawParameters& parameters,
+                             const AtlasRegion& region)
+    { parameters.atlas_layer = region.layer + 1;
+      parameters.texture_rect = region.rect; }
+
+  /** Adds k_repeated_assets copies of the main mesh and texture to the
+   * scene, loaded separately, to measure what sharing them saves. Must
+   * be set before Execute. */
+  void EnableRepeatedAssetScene(bool enable)
+    { m_repeated_asset_scene = enable; }
+
+  /** Replaces the scene with k_benchmark_draws draws, to compare the
+   * draw parameter paths. */
+  void EnableDrawBenchmark(bool enable)
+    { m_draw_benchmark = enable; ++m_scene_generation; }
+
+  /** Replaces the scene with a solver grid of
+   * k_pulling_benchmark_grid^2 vertices, drawn from interleaved
+   * vertices or pulled arrays, to compare the two vertex inputs. */
+  void EnableVertexPullingBenchmark(bool enable)
+    { m_pulling_benchmark = enable; ++m_scene_generation; }
+  void SetVertexPullingBenchmarkInput(VertexInput input)
+    { m_pulling_benchmark_input = input; ++m_scene_generation; }
+  VertexInput GetVertexPullingBenchmarkInput() const
+    { return m_pulling_benchmark_input; }
+
+  /** Watches the shader sources and swaps in recompiled pipelines
+   * while running. Must be set before Execute. */
+  void EnableShaderHotReload(bool enable)
+    { m_shader_hot_reload = enable; }
+
+  /** Renders `num_frames` frames without a window into offscreen
+   * images and captures them to `<output_prefix>_<frame>.<ext>`, see
+   * SetFrameEncoder. Needs no display or present support, so it runs
+   * on compute nodes and under software ICDs such as lavapipe. Must be
+   * set before Execute. */
+  void EnableHeadless(bool enable,
+                      size_t num_frames = 60,
+                      const std::string& output_prefix = "frame")
+    { m_headless = enable;
+      m_headless_frames = num_frames;
+      m_headless_output_prefix = output_prefix;
+      if (enable)
+      {
+        m_capture_enabled = true;
+        m_requested_presentation_mode = m_presentation_mode;
+      } }
+
+  /** Copies every frame into the readback ring; captured frames are
+   * handed to the readback callback a few frames later, without
+   * stalling the render loop. */
+  void EnableFrameCapture(bool enable)
+    { m_capture_enabled = enable; ++m_scene_generation; }
+
+  /** Receives captured frames, in order, on the render thread, in
+   * place of the frame encoder. */
+  void SetReadbackCallback(ReadbackCallback callback)
+    { m_readback_callback = std::move(callback); }
+
+  /** Format and number of worker threads (0 for one per core) the
+   * frame encoder compresses captured frames with. Changing it while
+   * running finishes the frames queued with the previous setting. */
+  void SetFrameEncoder(ChiFrameEncoder::Format format,
+                       size_t num_threads = 0)
+    { FinishFrameEncoder();
+      m_encoder_format = format;
+      m_encoder_threads = num_threads; }
+
+  /** Renders a `width` x `height` poster, beyond the size of any image
+   * the device can create, as headless tiles of WIDTH x HEIGHT. Each
+   * tile is drawn through its own sub-frustum and streamed into the
+   * striped TIFF `path`, so memory use does not grow with the poster.
+   * Must be set before Execute, after EnableHeadless. */
+  void EnablePoster(uint32_t width, uint32_t height, const std::string& path);
+
+  /** Runs as a worker process of a ChiBatchCoordinator: renders the
+   * jobs received over the pipe `read_fd` headless, one frame each,
+   * and reports the written frames over `write_fd`. Must be set before
+   * Execute, after EnableHeadless. */
+  void EnableBatchWorker(int read_fd, int write_fd);
+
+  /** Runs as process `rank` of `size` attached to the ChiCompositor
+   * region `region`: renders its share of the draws headless with
+   * depth, and rank 0 writes the composited frames unless
+   * `write_frames` is false. Must be set before Execute, after
+   * EnableHeadless. */
+  void EnableCompositing(const std::string& region,
+                         uint32_t rank, uint32_t size,
+                         bool write_frames = true);
+
+  /** Recreates the swap chain `num_recreations` times while drawing,
+   * alternating between retiring the old objects on the timeline with
+   * oldSwapchain and the device idle teardown without it, and prints
+   * the cost of each. Windowed only. Must be set before Execute. */
+  void EnableRecreateBenchmark(size_t num_recreations)
+    { m_recreate_benchmark_remaining = num_recreations; }
+
+  /** Streams captured frames, in place of the frame encoder, to a
+   * viewer connecting to `address` (`unix:<path>` or `<host>:<port>`),
+   * see ChiFrameStreamer. Headless runs wait up to
+   * `viewer_timeout_seconds` for the viewer before the first frame.
+   * Must be set before Execute. */
+  void EnableStreaming(const std::string& address,
+                       double viewer_timeout_seconds = 10.0);
+
+  /** Draws the fields a solver process publishes to the ChiSolverRing
+   * `name`, newest first, in place of the scene, waiting up to
+   * `timeout_seconds` for the ring. Must be set before Execute. */
+  void EnableSolverRing(const std::string& name,
+                        double timeout_seconds = 10.0);
+
+  /** Runs the renderer's own main loop: creates everything, draws
+   * until the window is closed or the headless, batch or compositing
+   * run is done, and releases everything. */
   void Execute() {
-    CreateMainWindow();
-    InitializeVulkan();
+    Initialize();
     mainLoop();
+    Shutdown();
+  }
+
+  /** Creates the window, unless headless, and all Vulkan resources, for
+   * a caller that drives frames with Render instead of Execute. */
+  void Initialize() {
+    if (m_initialized) return;
+    if (!m_headless) CreateMainWindow();
+    InitializeVulkan();
+    m_start_time = std::chrono::high_resolution_clock::now();
+    m_initialized = true;
+  }
+
+  bool Render(size_t step);
+
+  /** Finishes the frames in flight, captures and encodes them, prints
+   * the timings and releases everything. Does nothing if not
+   * initialized. */
+  void Shutdown() {
+    if (!m_initialized) return;
+    FinishRendering();
     cleanup();
+    m_initialized = false;
   }
 
+  MeshID SetSolverMesh(const float* coordinates,
+                       size_t num_nodes,
+                       const uint32_t* connectivity,
+                       size_t num_indices,
+                       const float* field_values,
+                       float field_min,
+                       float field_max);
+
+  /** Points the solver mesh at another field array of the same size,
+   * e.g. after the solver swaps its buffers. Read at the next Render. */
+  void SetSolverField(const float* field_values)
+    { m_solver_field = field_values; }
+
+  /** Lets the device read solver fields in place: each field array is
+   * imported as device memory through VK_EXT_external_memory_host and
+   * copied on the device, with no host copy, when the extension is
+   * available and the array starts on a GetHostImportAlignment
+   * boundary. Other fields go through the staging buffer. An imported
+   * array must stay allocated until ReleaseImportedFields, the next
+   * SetSolverMesh or Shutdown. Must be set before Initialize. */
+  void EnableFieldImport(bool enable = true)
+    { m_import_solver_fields = enable; }
+
+  /** Alignment solver arrays need to be imported, 0 without
+   * VK_EXT_external_memory_host. Known after Initialize. */
+  VkDeviceSize GetHostImportAlignment() const
+    { return m_external_memory_host_supported ? m_host_import_alignment : 0; }
+
+  /** Colormap range of a solver mesh set up with a reversed range: the
+   * minimum and maximum of its newest field read back. */
+  glm::vec2 GetFieldRange() const {return m_field_range;}
+
+  void ReleaseImportedFields();
+
 
 
 private:
@@ -213,43 +1247,47 @@ private:
     std::vector<VkPresentModeKHR> presentModes;
   };
 
-  /** Default constructor privatized. */
-  ChiSim() {}
-
-  /** Declared singleton m_vk_instance of chi_sim. */
-  static ChiSim m_instance;
-
   void CreateMainWindow();
+  void DestroyMainWindow();
 
   static void FramebufferResizeCallback(GLFWwindow* window, int width,
                                                             int height);
+  static void KeyCallback(GLFWwindow* window, int key, int scancode,
+                          int action, int mods);
 
   void InitializeVulkan() {
     CreateVulkanInstance();
     SetupDebugMessenger();
-    CreateMainWindowSurface();
+    if (!m_headless) CreateMainWindowSurface();
     PickPhysicalDevice();
     CreateLogicalDevice();
+    CreateQueueTimelines(); //once-off
+    CreatePipelineCache(); //once-off
+    CreatePipelineManager(); //once-off
+    InitializeShaders(); //once-off
 
     CreateSwapChain();
     CreateRenderPass();
 
     CreateDescriptorSetLayout(); //once-off
+    CreateDescriptorAllocators(); //once-off
+    CreatePipelineLayout(); //once-off
     CreateGraphicsPipeline();
     CreateCommandPool(); //once-off
 
-    CreateTextureImage();
-    CreateTextureImageView();
-//    CreateTextureSampler();
-    CreateVertexBuffer();
-    CreateIndexBuffer();
-
     CreateTextureSampler();
+    CreateBindlessDescriptors(); //once-off
+    CreateTextureImage();
+    CreateTextureAtlas(); //once-off
+    CreateGeometryBuffers(); //once-off
+    CreateFieldRangePipeline(); //once-off
+    AddDraw(UploadMesh(vertices, indices), glm::mat4(1.0f));
+    if (m_repeated_asset_scene) LoadRepeatedAssetScene();
 
     CreateDepthResources();
     CreateFramebuffers();
+    CreateReadbackRing();
     CreateUniformBuffers();
-    CreateDescriptorPool();
     CreateDescriptorSets();
 
 
@@ -259,13 +1297,41 @@ private:
 
   void mainLoop()
   {
-    while (!glfwWindowShouldClose(m_main_window))
+    if (m_batch_worker)
+      while (AcquireBatchJob())
+        DrawFrame();
+    else if (!m_solver_ring_name.empty())
+    {
+      WaitForStreamViewer();
+      OpenSolverRing();
+      while (AcquireRingStep())
+        DrawFrame();
+    }
+    else if (m_headless)
     {
-      glfwPollEvents();
-      DrawFrame();
+      WaitForStreamViewer();
+      while (m_num_readback_frames < m_headless_frames)
+        DrawFrame();
     }
+    else
+      while (!glfwWindowShouldClose(m_main_window))
+      {
+        glfwPollEvents();
+        DrawFrame();
+      }
+  }
 
+  void FinishRendering()
+  {
     vkDeviceWaitIdle(m_device);
+    StopLatencyWatcher();
+    UpdateLatencySamples();
+    ConsumeCompletedReadbacks();
+    FinishFrameEncoder();
+    FinishFrameStreamer();
+    CollectRetiredResources();
+
+    PrintFrameTimings();
   }
 
   void cleanupSwapChain()
@@ -282,34 +1348,62 @@ private:
                          m_command_buffers.size(),
                          m_command_buffers.data());
 
-    vkDestroyPipeline(m_device, m_graphics_pipeline, nullptr);
-    vkDestroyPipelineLayout(m_device, m_pipeline_layout, nullptr);
+    vkDestroyQueryPool(m_device, m_timestamp_query_pool, nullptr);
+    m_timestamp_query_pool = VK_NULL_HANDLE;
+
+    m_render_graph.Reset();
+
+    m_pipeline_manager.Release(m_main_pipeline);
     vkDestroyRenderPass(m_device, m_render_pass, nullptr);
 
     for (auto imageView : m_swap_chain_image_views)
       vkDestroyImageView(m_device, imageView, nullptr);
 
+    DestroyReadbackRing();
+    DestroyOffscreenTargets();
     vkDestroySwapchainKHR(m_device, m_swap_chain, nullptr);
 
     for (size_t i = 0; i < m_swap_chain_images.size(); i++)
     {
       vkDestroyBuffer(m_device, m_uniform_buffers[i], nullptr);
       vkFreeMemory(m_device, m_uniform_buffers_memory[i], nullptr);
+      vkDestroyBuffer(m_device, m_model_matrix_buffers[i], nullptr);
+      vkFreeMemory(m_device, m_model_matrix_buffers_memory[i], nullptr);
+      vkDestroyBuffer(m_device, m_draw_uniform_buffers[i], nullptr);
+      vkFreeMemory(m_device, m_draw_uniform_buffers_memory[i], nullptr);
+      vkDestroyBuffer(m_device, m_draw_parameter_buffers[i], nullptr);
+      vkFreeMemory(m_device, m_draw_parameter_buffers_memory[i], nullptr);
+      vkDestroyBuffer(m_device, m_indirect_buffers[i], nullptr);
+      vkFreeMemory(m_device, m_indirect_buffers_memory[i], nullptr);
+
+      m_descriptor_allocator.Free(m_descriptor_sets[i]);
+      m_descriptor_allocator.Free(m_draw_descriptor_sets[i]);
     }
-
-    vkDestroyDescriptorPool(m_device, m_descriptor_pool, nullptr);
   }
 
   void cleanup() {
     cleanupSwapChain();
 
-    vkDestroySampler(m_device, m_texture_sampler, nullptr);
-    vkDestroyImageView(m_device, m_texture_image_view, nullptr);
+    DestroyInSituResources();
+
+    DestroyResourceRegistries();
+    DestroyTextureAtlas();
+    vkDestroyDescriptorPool(m_device, m_bindless_descriptor_pool, nullptr);
 
-    vkDestroyImage(m_device, m_texture_image, nullptr);
-    vkFreeMemory(m_device, m_texture_image_memory, nullptr);
+    m_descriptor_allocator.Shutdown();
+    for (auto& allocator : m_frame_descriptor_allocators)
+      allocator.Shutdown();
+    vkDestroyDescriptorUpdateTemplate(m_device, m_main_descriptor_template,
+                                      nullptr);
+    vkDestroyDescriptorUpdateTemplate(m_device, m_draw_descriptor_template,
+                                      nullptr);
 
+    vkDestroyPipelineLayout(m_device, m_pipeline_layout, nullptr);
     vkDestroyDescriptorSetLayout(m_device, m_descriptor_set_layout, nullptr);
+    vkDestroyDescriptorSetLayout(m_device, m_draw_descriptor_set_layout,
+                                 nullptr);
+    vkDestroyDescriptorSetLayout(m_device, m_bindless_descriptor_set_layout,
+                                 nullptr);
 
     vkDestroyBuffer(m_device, m_vertex_buffer, nullptr);
     vkFreeMemory(m_device, m_vertex_buffer_memory, nullptr);
@@ -317,14 +1411,26 @@ private:
     vkDestroyBuffer(m_device, m_index_buffer, nullptr);
     vkFreeMemory(m_device, m_index_buffer_memory, nullptr);
 
+    vkDestroyBuffer(m_device, m_pulled_coordinate_buffer, nullptr);
+    vkFreeMemory(m_device, m_pulled_coordinate_buffer_memory, nullptr);
+    vkDestroyBuffer(m_device, m_pulled_field_buffer, nullptr);
+    vkFreeMemory(m_device, m_pulled_field_buffer_memory, nullptr);
+    vkDestroyBuffer(m_device, m_pulled_connectivity_buffer, nullptr);
+    vkFreeMemory(m_device, m_pulled_connectivity_buffer_memory, nullptr);
+
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
       vkDestroySemaphore(m_device, m_render_finished_semaphores[i], nullptr);
       vkDestroySemaphore(m_device, m_image_available_semaphores[i], nullptr);
-      vkDestroyFence(m_device, m_in_flight_fences[i], nullptr);
     }
+    vkDestroySemaphore(m_device, m_graphics_timeline.semaphore, nullptr);
 
     vkDestroyCommandPool(m_device, m_command_pool, nullptr);
 
+    m_shader_watcher.Stop();
+    m_pipeline_manager.Shutdown();
+    SavePipelineCache();
+    vkDestroyPipelineCache(m_device, m_pipeline_cache, nullptr);
+
     vkDestroyDevice(m_device, nullptr);
 
     if (k_enable_validation_layers) {
@@ -334,34 +1440,14 @@ private:
     vkDestroySurfaceKHR(m_vk_instance, m_main_surface, nullptr);
     vkDestroyInstance(m_vk_instance, nullptr);
 
-    glfwDestroyWindow(m_main_window);
-
-    glfwTerminate();
+    DestroyMainWindow();
   }
 
-  void recreateSwapChain() {
-    int width = 0, height = 0;
-    glfwGetFramebufferSize(m_main_window, &width, &height);
-    while (width == 0 || height == 0) {
-      glfwGetFramebufferSize(m_main_window, &width, &height);
-      glfwWaitEvents();
-    }
-
-    vkDeviceWaitIdle(m_device);
-
-    cleanupSwapChain();
-
-    CreateSwapChain();
-    CreateRenderPass();
-    CreateGraphicsPipeline();
-
-    CreateDepthResources();
-    CreateFramebuffers();
-    CreateUniformBuffers();
-    CreateDescriptorPool();
-    CreateDescriptorSets();
-    CreateCommandBuffers();
-  }
+  void recreateSwapChain();
+  void StepRecreateBenchmark();
+  void RetireSizeDependentResources();
+  void RetireFormatDependentResources();
+  void RetireImageCountDependentResources();
 
   void CreateVulkanInstance();
 
@@ -373,8 +1459,78 @@ private:
   void PickPhysicalDevice();
   void CreateLogicalDevice();
   void CreateSwapChain();
+  void CreateOffscreenTargets();
+  VkResult AcquireOffscreenImage(uint32_t& image_index);
+  void CreateReadbackRing();
+  void RecordReadbackCopy(VkCommandBuffer cmd_buffer);
+  void SubmitReadback(uint32_t image_index, uint64_t timeline_value);
+  void ConsumeCompletedReadbacks();
+  void UpdateReadbackFrameTime(bool captured, double frame_ms);
+  void PrintReadbackTimings();
+  void RetireReadbackRing();
+  void DestroyReadbackRing();
+  void EncodeFrame(const ReadbackFrame& frame);
+  void FinishFrameEncoder();
+  void PrintEncoderTimings();
+  uint32_t GetNumPosterTilesX() const;
+  glm::mat4 GetPosterTileProjection(size_t tile) const;
+  void WritePosterTile(const ReadbackFrame& frame);
+  bool AcquireBatchJob();
+  void WriteBatchFrame(const ReadbackFrame& frame);
+  void SendBatchMessage(const std::string& message);
+  void CompositeFrame(const ReadbackFrame& frame);
+  void StreamFrame(const ReadbackFrame& frame);
+  void UpdateSolverField();
+  const ImportedField* ImportSolverField(const float* field_values,
+                                         VkDeviceSize size);
+  VkDeviceSize GetPulledFieldOffset(size_t frame, int32_t vertex_offset) const;
+  VkCommandBuffer BeginFieldCopies();
+  VkDeviceSize StageFieldValues(const float* field_values, VkDeviceSize size);
+  void RecordFieldCopy(MeshID mesh_id, VkBuffer source,
+                       VkDeviceSize source_offset);
+  void DestroyFieldStaging(const FieldStaging& staging);
+  void CreateFieldRangePipeline();
+  void RecordFieldRange(MeshID mesh_id);
+  void ResolveFieldRanges();
+  static glm::vec2 ComputeFieldRange(const float* field_values,
+                                     size_t count);
+  void DestroyFieldRangePipeline();
+  uint64_t SubmitFieldCopies();
+  void PrintInSituTimings();
+  void OpenSolverRing();
+  bool AcquireRingStep();
+  void PrintSolverRingTimings();
+  void DestroyInSituResources();
+  void WaitForStreamViewer();
+  void FinishFrameStreamer();
+  void PrintStreamTimings();
+  static void GetReadbackDepth(const ReadbackFrame& frame, float* depth);
+  void DestroyOffscreenTargets();
   void CreateRenderPass();
+  void CreatePipelineLayout();
+  void CreatePipelineManager();
+  ChiPipelineManager::GraphicsPipelineDesc GetMainPipelineDesc();
   void CreateGraphicsPipeline();
+  void InitializeShaders();
+  std::string GetShaderPath(const ShaderFile& shader) const;
+  bool IsShaderAvailable(const ShaderFile& shader) const;
+  std::vector<char> LoadShader(const ShaderFile& shader);
+  const ShaderFile& GetMainFragmentShader() const;
+  void StartShaderHotReload();
+  void ApplyShaderReloads();
+  ChiPipelineManager::PipelineHandle
+    GetVariantPipeline(const ShaderVariant& variant,
+                       DrawParameterPath path =
+                         DrawParameterPath::PushConstants,
+                       VertexInput input = VertexInput::Interleaved);
+  void RetireVariantPipelines();
+  VkPipeline SelectMainPassPipeline(uint32_t& variant_key);
+  VkPipeline SelectPulledPipeline(uint32_t& variant_key);
+  void UpdateVariantTimings(uint32_t image_index, double gpu_ms);
+  void PrintVariantTimings();
+  bool IsPipelineCacheDataValid(const std::vector<char>& data);
+  void CreatePipelineCache();
+  void SavePipelineCache();
   void CreateFramebuffers();
   void CreateCommandPool();
   void CreateBuffer(VkDeviceSize size,
@@ -383,13 +1539,60 @@ private:
                     VkBuffer& buffer,
                     VkDeviceMemory& bufferMemory);
   void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
-  void CreateVertexBuffer();
-  void CreateIndexBuffer();
+  void CreateGeometryBuffers();
   void CreateUniformBuffers();
   void CreateCommandBuffers();
+  void RecordCommandBuffer(size_t image_index);
+  void BuildRenderGraph();
+  void RecordMainPass(VkCommandBuffer cmd_buffer);
+  void BuildBenchmarkDraws();
+  void CreateBenchmarkTextures();
+  void BuildIndirectCommands(
+    std::vector<VkDrawIndexedIndirectCommand>& commands,
+    std::vector<VkDrawIndirectCommand>& pulled_commands);
+  const std::vector<DrawCommand>& GetActiveDraws();
+  const std::vector<DrawCommand>& GetSceneDraws();
+  const std::vector<glm::mat4>& GetActiveModelMatrices();
+  void WriteDrawParameters(uint32_t image_index);
+  void UpdateDrawPathTimings(uint32_t image_index, double gpu_ms);
+  void PrintDrawPathTimings();
+  static const char* GetDrawParameterPathName(DrawParameterPath path);
+  void BuildPullingBenchmark();
+  static std::vector<Vertex> InterleaveFieldMesh(const float* coordinates,
+                                                 size_t num_vertices,
+                                                 const float* field_values);
+  void ReplaceInterleavedSolverMesh();
+  void UpdateVertexInputTimings(uint32_t image_index, double gpu_ms);
+  void PrintVertexInputTimings();
+  static const char* GetVertexInputName(VertexInput input);
   void CreateSyncObjects();
   void DrawFrame();
 
+  void CreateQueueTimelines();
+  uint64_t SubmitToTimeline(VkQueue queue,
+                            QueueTimeline& timeline,
+                            VkCommandBuffer cmd_buffer,
+                            const std::vector<SemaphoreWait>& waits,
+                            const std::vector<VkSemaphore>& signal_binary);
+  double WaitForTimelineValue(const QueueTimeline& timeline, uint64_t value);
+  uint64_t GetCompletedTimelineValue(const QueueTimeline& timeline);
+  void RetireAfter(uint64_t timeline_value, std::function<void()> deleter);
+  void CollectRetiredResources();
+  void ReadGPUFrameTime(uint32_t image_index);
+
+  static size_t GetFramesInFlight(PresentationMode mode);
+  static const char* GetPresentationModeName(PresentationMode mode);
+  FrameTimings& CurrentTimings()
+    { return m_mode_timings[static_cast<size_t>(m_presentation_mode)]; }
+  void ApplyPresentationMode();
+  void QueueLatencySample(uint64_t timeline_value,
+                          std::chrono::high_resolution_clock::time_point
+                            sampled);
+  void LatencyWatcherLoop();
+  void StopLatencyWatcher();
+  void UpdateLatencySamples();
+  void PrintFrameTimings();
+
   VkShaderModule CreateShaderModule(const std::vector<char>& code);
   VkSurfaceFormatKHR ChooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);
 
@@ -402,6 +1605,9 @@ private:
   bool IsDeviceSuitable(VkPhysicalDevice device);
 
   bool CheckDeviceExtensionSupport(VkPhysicalDevice device);
+  std::vector<const char*> GetRequiredDeviceExtensions();
+  bool IsDeviceExtensionAvailable(VkPhysicalDevice device,
+                                  const char* extension_name);
 
   QueueFamilyIndices FindDeviceQueueFamilies(VkPhysicalDevice device);
 
@@ -420,13 +1626,30 @@ private:
   uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
 
   void CreateDescriptorSetLayout();
+  void CreateDescriptorUpdateTemplates();
 
   void UpdateUniformBuffer(uint32_t currentImage);
 
-  void CreateDescriptorPool();
+  void CreateDescriptorAllocators();
   void CreateDescriptorSets();
 
   void CreateTextureImage();
+  void CreateTextureFromPixels(uint32_t width,
+                               uint32_t height,
+                               const void* pixels,
+                               VkImage& image,
+                               VkDeviceMemory& image_memory);
+  void CreateBindlessDescriptorSetLayout();
+  void CreateBindlessDescriptors();
+  Texture CreateTexture(uint32_t width, uint32_t height, const void* pixels);
+  void LoadRepeatedAssetScene();
+  void PrintResourceStatistics();
+  void DestroyResourceRegistries();
+  void CreateTextureAtlas();
+  void AllocateTextureAtlas();
+  void CreateAtlasImage(uint32_t size, uint32_t layers);
+  void PrintAtlasStatistics();
+  void DestroyTextureAtlas();
 
   void CreateImage(uint32_t width,
                    uint32_t height,
@@ -439,6 +1662,7 @@ private:
 
   VkCommandBuffer BeginSingleTimeCommands();
   void EndSingleTimeCommands(VkCommandBuffer commandBuffer);
+  uint64_t SubmitSingleTimeCommands(VkCommandBuffer commandBuffer);
 
   void TransitionImageLayout(VkImage image,
                              VkFormat format,
@@ -450,7 +1674,6 @@ private:
                          uint32_t width,
                          uint32_t height);
 
-  void CreateTextureImageView();
   VkImageView CreateImageView(VkImage image,
                               VkFormat format,
                               VkImageAspectFlags aspect_flags=
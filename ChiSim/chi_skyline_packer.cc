@@ -0,0 +1,115 @@
+#include "chi_skyline_packer.h"
+
+#include <algorithm>
+
+//###################################################################
+/** Empties the area and sets its size. The skyline is a single segment
+ * along the bottom edge.*/
+void ChiSkylinePacker::Reset(uint32_t width, uint32_t height)
+{
+  m_width = width;
+  m_height = height;
+  m_used_area = 0;
+
+  m_skyline.clear();
+  if (width > 0 && height > 0)
+    m_skyline.push_back({0, 0, width});
+}
+
+//###################################################################
+/** Places a `width` x `height` rectangle and returns its bottom-left
+ * corner in `x`, `y`. Returns false, leaving the area unchanged, if it
+ * does not fit anywhere.*/
+bool ChiSkylinePacker::Insert(uint32_t width, uint32_t height,
+                              uint32_t& x, uint32_t& y)
+{
+  if (width == 0 || height == 0) return false;
+
+  //============================ Find the lowest position
+  size_t   bestSegment = m_skyline.size();
+  uint32_t bestTop     = INVALID_POSITION;
+  uint32_t bestWidth   = INVALID_POSITION;
+  uint32_t bestY       = 0;
+
+  for (size_t s = 0; s < m_skyline.size(); ++s)
+  {
+    const uint32_t fitY = FitHeight(s, width, height);
+    if (fitY == INVALID_POSITION) continue;
+
+    const uint32_t top = fitY + height;
+    if (top < bestTop ||
+        (top == bestTop && m_skyline[s].width < bestWidth))
+    {
+      bestSegment = s;
+      bestTop     = top;
+      bestWidth   = m_skyline[s].width;
+      bestY       = fitY;
+    }
+  }
+
+  if (bestSegment == m_skyline.size()) return false;
+
+  x = m_skyline[bestSegment].x;
+  y = bestY;
+
+  //============================ Raise the skyline under the rectangle
+  m_skyline.insert(m_skyline.begin() + bestSegment, {x, bestTop, width});
+
+  const uint32_t right = x + width;
+  for (size_t s = bestSegment + 1; s < m_skyline.size();)
+  {
+    Segment& segment = m_skyline[s];
+    if (segment.x >= right) break;
+
+    const uint32_t segmentRight = segment.x + segment.width;
+    if (segmentRight <= right)
+    {
+      m_skyline.erase(m_skyline.begin() + s);
+      continue;
+    }
+
+    segment.width = segmentRight - right;
+    segment.x = right;
+    break;
+  }
+
+  //============================ Merge segments of equal height
+  for (size_t s = 0; s + 1 < m_skyline.size();)
+  {
+    if (m_skyline[s].y == m_skyline[s + 1].y)
+    {
+      m_skyline[s].width += m_skyline[s + 1].width;
+      m_skyline.erase(m_skyline.begin() + s + 1);
+    }
+    else
+      ++s;
+  }
+
+  m_used_area += uint64_t(width) * height;
+
+  return true;
+}
+
+//###################################################################
+/** Returns the y at which a rectangle starting at the left edge of
+ * `segment` rests on the skyline, or INVALID_POSITION if it would stick
+ * out of the area.*/
+uint32_t ChiSkylinePacker::FitHeight(size_t segment,
+                                     uint32_t width,
+                                     uint32_t height) const
+{
+  const uint32_t x = m_skyline[segment].x;
+  if (x + width > m_width) return INVALID_POSITION;
+
+  uint32_t y = 0;
+  uint32_t remaining = width;
+  for (size_t s = segment; remaining > 0; ++s)
+  {
+    y = std::max(y, m_skyline[s].y);
+    if (y + height > m_height) return INVALID_POSITION;
+
+    remaining -= std::min(remaining, m_skyline[s].width);
+  }
+
+  return y;
+}
@@ -0,0 +1,56 @@
+#ifndef _ChiSkylinePacker_h
+#define _ChiSkylinePacker_h
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+//###################################################################
+/** Packs rectangles into a fixed-size 2D area, e.g. a layer of a
+ * texture atlas.
+ *
+ * The packed area is described by its skyline: the top edge of the
+ * rectangles placed so far, stored as horizontal segments sorted by x.
+ * A new rectangle goes where its top edge ends up lowest (bottom-left
+ * rule), with ties broken by the narrower segment. Rectangles can be
+ * inserted at any time but not removed; Reset clears the whole area.
+ * Coordinates are in arbitrary units (texels); the packer never
+ * touches the image itself.*/
+class ChiSkylinePacker
+{
+public:
+  static constexpr uint32_t INVALID_POSITION = ~0u;
+
+private:
+  struct Segment
+  {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+  };
+
+  uint32_t             m_width = 0;
+  uint32_t             m_height = 0;
+  uint64_t             m_used_area = 0;
+  std::vector<Segment> m_skyline;
+
+public:
+  explicit ChiSkylinePacker(uint32_t width = 0, uint32_t height = 0)
+    { Reset(width, height); }
+
+  void Reset(uint32_t width, uint32_t height);
+
+  bool Insert(uint32_t width, uint32_t height, uint32_t& x, uint32_t& y);
+
+  uint32_t GetWidth() const {return m_width;}
+  uint32_t GetHeight() const {return m_height;}
+  uint64_t GetUsedArea() const {return m_used_area;}
+  float    GetOccupancy() const
+    { return m_width * m_height == 0 ? 0.0f :
+             float(m_used_area) / (float(m_width) * float(m_height)); }
+
+private:
+  uint32_t FitHeight(size_t segment, uint32_t width, uint32_t height) const;
+};
+
+#endif
@@ -0,0 +1,315 @@
+#include "chi_solver_ring.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <cerrno>
+#include <new>
+
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+              std::atomic<uint32_t>::is_always_lock_free,
+              "the solver ring needs lock-free atomics in shared memory");
+
+//###################################################################
+/** Rounds `size` up to whole pages.*/
+static uint64_t RoundUpToPages(uint64_t size)
+{
+  const uint64_t pageSize = uint64_t(sysconf(_SC_PAGESIZE));
+  return (size + pageSize - 1) / pageSize * pageSize;
+}
+
+//###################################################################
+/** Creates the region `name` (e.g. "/chisim_ring") for meshes of up to
+ * `max_nodes` nodes and `max_indices` triangle corners, replacing a
+ * stale region of the same name. The region is removed again by
+ * Close, so renderers have to Open it before.*/
+void ChiSolverRing::Create(const std::string& name,
+                           size_t max_nodes,
+                           size_t max_indices)
+{
+  Close();
+
+  //============================ Layout
+  Header layout;
+  layout.max_nodes = max_nodes;
+  layout.max_indices = max_indices;
+  layout.mesh_offset = RoundUpToPages(sizeof(Header));
+  layout.slot_offset = layout.mesh_offset +
+    RoundUpToPages(sizeof(float) * 3 * max_nodes +
+                   sizeof(uint32_t) * max_indices);
+  layout.slot_stride = RoundUpToPages(sizeof(float) * max_nodes);
+  layout.region_size = layout.slot_offset + NUM_SLOTS * layout.slot_stride;
+
+  //============================ Create the region
+  shm_unlink(name.c_str());
+  const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0)
+    throw std::runtime_error("failed to create solver ring " + name + "!");
+
+  if (ftruncate(fd, off_t(layout.region_size)) != 0)
+  {
+    close(fd);
+    shm_unlink(name.c_str());
+    throw std::runtime_error("failed to size solver ring!");
+  }
+
+  void* mapped = mmap(nullptr, layout.region_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED)
+  {
+    shm_unlink(name.c_str());
+    throw std::runtime_error("failed to map solver ring!");
+  }
+
+  m_header = new (mapped) Header();
+  m_header->max_nodes = layout.max_nodes;
+  m_header->max_indices = layout.max_indices;
+  m_header->region_size = layout.region_size;
+  m_header->mesh_offset = layout.mesh_offset;
+  m_header->slot_offset = layout.slot_offset;
+  m_header->slot_stride = layout.slot_stride;
+  m_header->producer_pid = int64_t(getpid());
+
+  m_data = static_cast<uint8_t*>(mapped);
+  m_name = name;
+  m_owner = true;
+  m_num_written = 0;
+}
+
+//###################################################################
+/** Publishes the mesh and the range its fields are colored over.
+ * Fields written afterwards belong to this mesh. Readers still using
+ * the previous mesh see their reads fail IsValid.*/
+void ChiSolverRing::WriteMesh(const float* coordinates,
+                              size_t num_nodes,
+                              const uint32_t* connectivity,
+                              size_t num_indices,
+                              float field_min,
+                              float field_max)
+{
+  if (!m_owner)
+    throw std::runtime_error("failed to write solver mesh, "
+                             "ring not created by this process!");
+  if (num_nodes > m_header->max_nodes || num_indices > m_header->max_indices)
+    throw std::runtime_error("failed to write solver mesh, "
+                             "mesh exceeds the ring's capacity!");
+
+  const uint64_t version =
+    m_header->mesh_sequence.load(std::memory_order_relaxed) / 2 + 1;
+
+  m_header->mesh_sequence.store(2 * version - 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  memcpy(GetCoordinates(), coordinates, sizeof(float) * 3 * num_nodes);
+  memcpy(GetConnectivity(), connectivity, sizeof(uint32_t) * num_indices);
+  m_header->num_nodes = num_nodes;
+  m_header->num_indices = num_indices;
+  m_header->field_min = field_min;
+  m_header->field_max = field_max;
+
+  m_header->mesh_sequence.store(2 * version, std::memory_order_release);
+}
+
+//###################################################################
+/** Publishes the field of timestep `step`, one value per node of the
+ * current mesh, into the oldest slot. Never waits for readers.*/
+void ChiSolverRing::WriteField(uint64_t step, const float* values)
+{
+  if (!m_owner)
+    throw std::runtime_error("failed to write solver field, "
+                             "ring not created by this process!");
+
+  const uint64_t meshSequence =
+    m_header->mesh_sequence.load(std::memory_order_relaxed);
+  if (meshSequence == 0)
+    throw std::runtime_error("failed to write solver field, "
+                             "no mesh written!");
+
+  const uint64_t payload = ++m_num_written;
+  const uint64_t index = payload % NUM_SLOTS;
+  Slot& slot = m_header->slots[index];
+
+  slot.sequence.store(2 * payload - 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  const size_t numValues = size_t(m_header->num_nodes);
+  memcpy(GetSlotValues(index), values, sizeof(float) * numValues);
+  slot.step = step;
+  slot.mesh_version = meshSequence / 2;
+  slot.num_values = numValues;
+
+  slot.sequence.store(2 * payload, std::memory_order_release);
+  m_header->latest.store(payload, std::memory_order_release);
+}
+
+//###################################################################
+/** Tells readers no more fields follow.*/
+void ChiSolverRing::Finish()
+{
+  if (m_owner) m_header->finished.store(1, std::memory_order_release);
+}
+
+//###################################################################
+/** Maps the region `name`, waiting up to `timeout_seconds` for the
+ * solver to create it. Returns false if it did not.*/
+bool ChiSolverRing::Open(const std::string& name, double timeout_seconds)
+{
+  Close();
+
+  //============================ Wait for the region
+  auto start = std::chrono::steady_clock::now();
+  int fd = -1;
+  while ((fd = shm_open(name.c_str(), O_RDONLY, 0600)) < 0)
+  {
+    if (std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - start).count() > timeout_seconds)
+      return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  // The header tells the size of the rest. Read only: a renderer
+  // cannot disturb the solver.
+  void* mapped = mmap(nullptr, sizeof(Header), PROT_READ, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED)
+  {
+    close(fd);
+    throw std::runtime_error("failed to map solver ring!");
+  }
+  const Header* header = static_cast<const Header*>(mapped);
+  const bool valid = header->magic == MAGIC && header->num_slots == NUM_SLOTS;
+  const uint64_t regionSize = header->region_size;
+  munmap(mapped, sizeof(Header));
+
+  if (!valid)
+  {
+    close(fd);
+    throw std::runtime_error("failed to open solver ring " + name +
+                             ", not a solver ring!");
+  }
+
+  mapped = mmap(nullptr, regionSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED)
+    throw std::runtime_error("failed to map solver ring!");
+
+  m_header = static_cast<Header*>(mapped);
+  m_data = static_cast<uint8_t*>(mapped);
+  m_name = name;
+  m_owner = false;
+  return true;
+}
+
+//###################################################################
+/** Points `mesh` at the published mesh. Returns false if there is none
+ * or it is being written.*/
+bool ChiSolverRing::AcquireMesh(Mesh& mesh) const
+{
+  const uint64_t sequence =
+    m_header->mesh_sequence.load(std::memory_order_acquire);
+  if (sequence == 0 || sequence % 2 != 0) return false;
+
+  mesh.version = sequence / 2;
+  mesh.coordinates = GetCoordinates();
+  mesh.num_nodes = size_t(m_header->num_nodes);
+  mesh.connectivity = GetConnectivity();
+  mesh.num_indices = size_t(m_header->num_indices);
+  mesh.field_min = m_header->field_min;
+  mesh.field_max = m_header->field_max;
+
+  // The sizes may be torn too.
+  mesh.num_nodes = std::min<size_t>(mesh.num_nodes, m_header->max_nodes);
+  mesh.num_indices = std::min<size_t>(mesh.num_indices,
+                                      m_header->max_indices);
+  return IsValid(mesh);
+}
+
+//###################################################################
+/** Points `field` at the newest complete field if its payload number
+ * is above `newer_than`. Returns false if there is none, or if the
+ * solver lapped the newest slot MAX_ACQUIRE_ATTEMPTS times in a row
+ * while it was looked at; callers poll again later either way.*/
+bool ChiSolverRing::AcquireField(Field& field, uint64_t newer_than) const
+{
+  for (uint32_t attempt = 0; attempt < MAX_ACQUIRE_ATTEMPTS; ++attempt)
+  {
+    // Lets the writer finish the slot when it shares the core.
+    if (attempt > 0) std::this_thread::yield();
+
+    const uint64_t payload = m_header->latest.load(std::memory_order_acquire);
+    if (payload <= newer_than) return false;
+
+    const uint64_t index = payload % NUM_SLOTS;
+    const Slot& slot = m_header->slots[index];
+    if (slot.sequence.load(std::memory_order_acquire) != 2 * payload)
+      continue; // Lapped since; try the newer one.
+
+    field.sequence = payload;
+    field.step = slot.step;
+    field.mesh_version = slot.mesh_version;
+    field.values = GetSlotValues(index);
+    field.num_values = std::min<size_t>(size_t(slot.num_values),
+                                        m_header->max_nodes);
+
+    if (IsValid(field)) return true;
+  }
+
+  return false;
+}
+
+//###################################################################
+/** Whether `mesh` is still the published mesh, i.e. reads of it since
+ * AcquireMesh were not torn.*/
+bool ChiSolverRing::IsValid(const Mesh& mesh) const
+{
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return m_header->mesh_sequence.load(std::memory_order_relaxed) ==
+         2 * mesh.version;
+}
+
+//###################################################################
+/** Whether the slot of `field` still holds it, i.e. reads of it since
+ * AcquireField were not torn.*/
+bool ChiSolverRing::IsValid(const Field& field) const
+{
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const Slot& slot = m_header->slots[field.sequence % NUM_SLOTS];
+  return slot.sequence.load(std::memory_order_relaxed) ==
+         2 * field.sequence;
+}
+
+//###################################################################
+/** Whether the solver has written its last field.*/
+bool ChiSolverRing::IsFinished() const
+{
+  return m_header->finished.load(std::memory_order_acquire) != 0;
+}
+
+//###################################################################
+/** Whether the solver process still runs.*/
+bool ChiSolverRing::IsProducerAlive() const
+{
+  const pid_t pid = pid_t(m_header->producer_pid);
+  return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+//###################################################################
+/** Unmaps the region; the solver also removes its name.*/
+void ChiSolverRing::Close()
+{
+  if (!m_header) return;
+
+  munmap(m_header, m_header->region_size);
+  if (m_owner) shm_unlink(m_name.c_str());
+
+  m_header = nullptr;
+  m_data = nullptr;
+  m_owner = false;
+}
@@ -0,0 +1,148 @@
+#ifndef _ChiSolverRing_h
+#define _ChiSolverRing_h
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+//###################################################################
+/** Shared memory ring through which a solver process hands live data
+ * to a renderer process.
+ *
+ * The solver Create-s a named POSIX shared memory region sized for its
+ * largest mesh, publishes the mesh once with WriteMesh and a field,
+ * one value per node, per timestep with WriteField. The renderer
+ * Open-s the region and reads the newest complete field with
+ * AcquireField straight from the shared pages, e.g. to upload it,
+ * without copying it out first.
+ *
+ * Fields go to NUM_SLOTS slots in turn. Each slot carries a sequence
+ * number that is odd while the slot is written and even once it is
+ * complete (a seqlock), and the header the payload number of the
+ * newest complete field. Neither side ever waits for the other: the
+ * solver overwrites the oldest slot whatever the renderer is doing,
+ * and a renderer that falls behind skips to the newest field. Since a
+ * slot may be overwritten while it is read, the reader checks
+ * IsValid after using the data and discards it if the slot was
+ * reused meanwhile (a torn read); with NUM_SLOTS slots that takes the
+ * solver lapping the ring during one read. The mesh is guarded the
+ * same way.
+ *
+ * Slot data starts on page boundaries and fills whole pages, so field
+ * slots can be imported as device memory in place.
+ *
+ * Single writer, any number of readers. POSIX only.*/
+class ChiSolverRing
+{
+public:
+  static constexpr uint32_t MAGIC = 0x52534843; //"CHSR"
+  static constexpr uint32_t NUM_SLOTS = 4;
+  static constexpr uint32_t MAX_ACQUIRE_ATTEMPTS = 64;
+
+  /** The mesh as published: `num_nodes` x, y, z coordinates and
+   * `num_indices` triangle corner indices, pointing into the ring. */
+  struct Mesh
+  {
+    uint64_t        version = 0;
+    const float*    coordinates = nullptr;
+    size_t          num_nodes = 0;
+    const uint32_t* connectivity = nullptr;
+    size_t          num_indices = 0;
+    float           field_min = 0.0f;
+    float           field_max = 1.0f;
+  };
+
+  /** A field as published: one value per node of the mesh with
+   * `mesh_version`, pointing into the ring. */
+  struct Field
+  {
+    uint64_t        sequence = 0;    //payload number, from 1
+    uint64_t        step = 0;
+    uint64_t        mesh_version = 0;
+    const float*    values = nullptr;
+    size_t          num_values = 0;
+  };
+
+private:
+  struct alignas(64) Slot
+  {
+    std::atomic<uint64_t> sequence{0};  //2p-1 writing, 2p complete
+    uint64_t              step = 0;
+    uint64_t              mesh_version = 0;
+    uint64_t              num_values = 0;
+  };
+
+  struct Header
+  {
+    uint32_t              magic = MAGIC;
+    uint32_t              num_slots = NUM_SLOTS;
+    uint64_t              max_nodes = 0;
+    uint64_t              max_indices = 0;
+    uint64_t              region_size = 0;
+    uint64_t              mesh_offset = 0;
+    uint64_t              slot_offset = 0;
+    uint64_t              slot_stride = 0;
+    int64_t               producer_pid = 0;
+
+    std::atomic<uint64_t> mesh_sequence{0};  //2v-1 writing, 2v complete
+    uint64_t              num_nodes = 0;
+    uint64_t              num_indices = 0;
+    float                 field_min = 0.0f;
+    float                 field_max = 1.0f;
+
+    std::atomic<uint64_t> latest{0};         //newest complete payload
+    std::atomic<uint32_t> finished{0};
+
+    Slot                  slots[NUM_SLOTS];
+  };
+
+  std::string m_name;
+  Header*     m_header = nullptr;
+  uint8_t*    m_data = nullptr;
+  bool        m_owner = false;
+  uint64_t    m_num_written = 0;
+
+public:
+  ChiSolverRing() = default;
+  ChiSolverRing(const ChiSolverRing&) = delete;
+  ChiSolverRing& operator=(const ChiSolverRing&) = delete;
+  ~ChiSolverRing() { Close(); }
+
+  // Solver side
+  void Create(const std::string& name, size_t max_nodes, size_t max_indices);
+  void WriteMesh(const float* coordinates,
+                 size_t num_nodes,
+                 const uint32_t* connectivity,
+                 size_t num_indices,
+                 float field_min,
+                 float field_max);
+  void WriteField(uint64_t step, const float* values);
+  void Finish();
+
+  // Renderer side
+  bool Open(const std::string& name, double timeout_seconds);
+  bool AcquireMesh(Mesh& mesh) const;
+  bool AcquireField(Field& field, uint64_t newer_than) const;
+  bool IsValid(const Mesh& mesh) const;
+  bool IsValid(const Field& field) const;
+  bool IsFinished() const;
+  bool IsProducerAlive() const;
+
+  void Close();
+
+  bool               IsOpen() const {return m_header != nullptr;}
+  const std::string& GetName() const {return m_name;}
+
+private:
+  float*    GetCoordinates() const
+    { return reinterpret_cast<float*>(m_data + m_header->mesh_offset); }
+  uint32_t* GetConnectivity() const
+    { return reinterpret_cast<uint32_t*>(GetCoordinates() +
+                                         3 * m_header->max_nodes); }
+  float*    GetSlotValues(uint64_t slot) const
+    { return reinterpret_cast<float*>(m_data + m_header->slot_offset +
+                                      slot * m_header->slot_stride); }
+};
+
+#endif
@@ -0,0 +1,208 @@
+#include "chi_striped_image_writer.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+namespace
+{
+  const uint64_t k_header_size = 8;
+  const uint16_t k_num_entries = 10;
+
+  /** File offsets of the directory and the arrays it points to, and
+   * the total file size. Directory entries must be word aligned, the
+   * arrays follow the directory.*/
+  struct Layout
+  {
+    uint64_t ifd_offset     = 0;
+    uint64_t bits_offset    = 0;
+    uint64_t offsets_offset = 0;
+    uint64_t counts_offset  = 0;
+    uint64_t file_size      = 0;
+  };
+
+  Layout ComputeLayout(uint64_t data_size, uint32_t num_strips)
+  {
+    Layout layout;
+    layout.ifd_offset     = (k_header_size + data_size + 1) & ~uint64_t(1);
+    layout.bits_offset    = layout.ifd_offset + 2 + 12 * k_num_entries + 4;
+    layout.offsets_offset = layout.bits_offset + 6;
+    layout.counts_offset  = layout.offsets_offset + 4 * uint64_t(num_strips);
+    layout.file_size      = layout.counts_offset + 4 * uint64_t(num_strips);
+    return layout;
+  }
+
+  void Write16(std::ofstream& file, uint16_t value)
+  {
+    const uint8_t bytes[2] = {uint8_t(value), uint8_t(value >> 8)};
+    file.write(reinterpret_cast<const char*>(bytes), 2);
+  }
+
+  void Write32(std::ofstream& file, uint32_t value)
+  {
+    const uint8_t bytes[4] = {uint8_t(value),       uint8_t(value >> 8),
+                              uint8_t(value >> 16), uint8_t(value >> 24)};
+    file.write(reinterpret_cast<const char*>(bytes), 4);
+  }
+
+  /** One 12 byte directory entry. SHORT values are stored in the low
+   * half of the value field.*/
+  void WriteEntry(std::ofstream& file, uint16_t tag, uint16_t type,
+                  uint32_t count, uint32_t value)
+  {
+    Write16(file, tag);
+    Write16(file, type);
+    Write32(file, count);
+    if (type == 3 && count == 1) { Write16(file, uint16_t(value));
+                                   Write16(file, 0); }
+    else Write32(file, value);
+  }
+}
+
+//###################################################################
+/** Creates the file and writes its header and directory. The pixel
+ * data in between is filled in by WriteRegion.*/
+void ChiStripedImageWriter::Open(const std::string& path,
+                                 uint32_t width,
+                                 uint32_t height,
+                                 uint32_t rows_per_strip)
+{
+  if (width == 0 || height == 0 || rows_per_strip == 0)
+    throw std::runtime_error("failed to open " + path +
+                             ", image is empty!");
+
+  const uint64_t rowSize  = uint64_t(width) * 3;
+  const uint64_t dataSize = rowSize * height;
+  const uint32_t numStrips = (height + rows_per_strip - 1) / rows_per_strip;
+
+  //============================ Layout
+  const Layout layout = ComputeLayout(dataSize, numStrips);
+  const uint64_t ifdOffset     = layout.ifd_offset;
+  const uint64_t bitsOffset    = layout.bits_offset;
+  const uint64_t offsetsOffset = layout.offsets_offset;
+  const uint64_t countsOffset  = layout.counts_offset;
+
+  if (layout.file_size > UINT32_MAX)
+    throw std::runtime_error("failed to open " + path +
+                             ", image exceeds the 4 GiB TIFF limit!");
+
+  m_file.open(path, std::ios::binary | std::ios::trunc);
+  if (!m_file)
+    throw std::runtime_error("failed to open " + path + "!");
+
+  m_path = path;
+  m_width = width;
+  m_height = height;
+  m_bytes_written = 0;
+  m_row.resize(rowSize);
+
+  //============================ Header
+  m_file.write("II*\0", 4);
+  Write32(m_file, uint32_t(ifdOffset));
+
+  //============================ Directory
+  m_file.seekp(std::streamoff(ifdOffset));
+  Write16(m_file, k_num_entries);
+  WriteEntry(m_file, 256, 4, 1, width);                 // ImageWidth
+  WriteEntry(m_file, 257, 4, 1, height);                // ImageLength
+  WriteEntry(m_file, 258, 3, 3, uint32_t(bitsOffset));  // BitsPerSample
+  WriteEntry(m_file, 259, 3, 1, 1);                     // No compression
+  WriteEntry(m_file, 262, 3, 1, 2);                     // RGB
+  WriteEntry(m_file, 273, 4, numStrips,                 // StripOffsets
+             numStrips == 1 ? uint32_t(k_header_size) :
+                              uint32_t(offsetsOffset));
+  WriteEntry(m_file, 277, 3, 1, 3);                     // SamplesPerPixel
+  WriteEntry(m_file, 278, 4, 1, rows_per_strip);        // RowsPerStrip
+  WriteEntry(m_file, 279, 4, numStrips,                 // StripByteCounts
+             numStrips == 1 ? uint32_t(dataSize) :
+                              uint32_t(countsOffset));
+  WriteEntry(m_file, 284, 3, 1, 1);                     // Chunky planes
+  Write32(m_file, 0);
+
+  Write16(m_file, 8); Write16(m_file, 8); Write16(m_file, 8);
+
+  for (uint32_t s = 0; s < numStrips; ++s)
+    Write32(m_file, uint32_t(k_header_size +
+                             uint64_t(s) * rows_per_strip * rowSize));
+  for (uint32_t s = 0; s < numStrips; ++s)
+  {
+    const uint32_t rows = std::min(rows_per_strip,
+                                   height - s * rows_per_strip);
+    Write32(m_file, uint32_t(uint64_t(rows) * rowSize));
+  }
+
+  if (!m_file)
+    throw std::runtime_error("failed to write " + path + "!");
+}
+
+//###################################################################
+/** Writes a region of 4 byte RGBA (or BGRA) pixels at (x, y). Parts of
+ * the region outside the image are skipped, so edge tiles can be
+ * passed whole.*/
+void ChiStripedImageWriter::WriteRegion(uint32_t x,
+                                        uint32_t y,
+                                        uint32_t width,
+                                        uint32_t height,
+                                        const void* pixels,
+                                        size_t row_pitch,
+                                        bool bgra)
+{
+  if (x >= m_width || y >= m_height) return;
+
+  const uint32_t columns = std::min(width, m_width - x);
+  const uint32_t rows    = std::min(height, m_height - y);
+  const uint64_t rowSize = uint64_t(m_width) * 3;
+
+  const size_t red  = bgra ? 2 : 0;
+  const size_t blue = bgra ? 0 : 2;
+
+  for (uint32_t r = 0; r < rows; ++r)
+  {
+    const uint8_t* source =
+      static_cast<const uint8_t*>(pixels) + r * row_pitch;
+
+    for (uint32_t c = 0; c < columns; ++c)
+    {
+      m_row[3 * c + 0] = source[4 * c + red];
+      m_row[3 * c + 1] = source[4 * c + 1];
+      m_row[3 * c + 2] = source[4 * c + blue];
+    }
+
+    m_file.seekp(std::streamoff(k_header_size +
+                                uint64_t(y + r) * rowSize +
+                                uint64_t(x) * 3));
+    m_file.write(reinterpret_cast<const char*>(m_row.data()),
+                 std::streamsize(3 * columns));
+  }
+
+  if (!m_file)
+    throw std::runtime_error("failed to write " + m_path + "!");
+
+  m_bytes_written += uint64_t(rows) * columns * 3;
+}
+
+//###################################################################
+/** Flushes and closes the file.*/
+void ChiStripedImageWriter::Close()
+{
+  if (!m_file.is_open()) return;
+
+  m_file.close();
+  if (!m_file)
+    throw std::runtime_error("failed to write " + m_path + "!");
+
+  m_row.clear();
+  m_row.shrink_to_fit();
+}
+
+//###################################################################
+/** Size in bytes of the file Open lays out for an image, which must not
+ * exceed UINT32_MAX. Lets callers reject an image before rendering it.*/
+uint64_t ChiStripedImageWriter::GetFileSize(uint32_t width,
+                                            uint32_t height,
+                                            uint32_t rows_per_strip)
+{
+  const uint64_t dataSize = uint64_t(width) * 3 * height;
+  const uint32_t numStrips = (height + rows_per_strip - 1) / rows_per_strip;
+
+  return ComputeLayout(dataSize, numStrips).file_size;
+}
@@ -0,0 +1,53 @@
+#ifndef _ChiStripedImageWriter_h
+#define _ChiStripedImageWriter_h
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+//###################################################################
+/** Writes an image far larger than fits in memory, region by region,
+ * to an uncompressed 8-bit RGB TIFF organized in horizontal strips.
+ *
+ * The file layout is fixed when it is opened: header, pixel data in
+ * row-major strips of `rows_per_strip` rows, then the directory. Each
+ * region's rows are written straight to their final offsets, so the
+ * writer only ever buffers a single row and regions may arrive in any
+ * order. Alpha is dropped. Classic TIFF addresses at most 4 GiB, which
+ * is about 37k x 37k pixels.*/
+class ChiStripedImageWriter
+{
+private:
+  std::ofstream        m_file;
+  std::string          m_path;
+  uint32_t             m_width = 0;
+  uint32_t             m_height = 0;
+  uint64_t             m_bytes_written = 0;
+  std::vector<uint8_t> m_row;
+
+public:
+  void Open(const std::string& path,
+            uint32_t width,
+            uint32_t height,
+            uint32_t rows_per_strip);
+  void WriteRegion(uint32_t x,
+                   uint32_t y,
+                   uint32_t width,
+                   uint32_t height,
+                   const void* pixels,
+                   size_t row_pitch,
+                   bool bgra);
+  void Close();
+
+  static uint64_t GetFileSize(uint32_t width,
+                              uint32_t height,
+                              uint32_t rows_per_strip);
+
+  bool     IsOpen() const {return m_file.is_open();}
+  uint64_t GetBytesWritten() const {return m_bytes_written;}
+  size_t   GetBufferSize() const {return m_row.capacity();}
+};
+
+#endif
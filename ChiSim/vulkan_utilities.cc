@@ -39,22 +39,42 @@ VkCommandBuffer ChiSim::BeginSingleTimeCommands()
 }
 
 //###################################################################
-/** End single time commands. */
+/** End single time commands. The work joins the graphics timeline and
+ * only its own counter value is waited on, not the whole queue. */
 void ChiSim::EndSingleTimeCommands(VkCommandBuffer commandBuffer)
 {
   vkEndCommandBuffer(commandBuffer);
 
-  VkSubmitInfo submitInfo = {};
-  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &commandBuffer;
-
-  vkQueueSubmit(m_graphics_queue, 1, &submitInfo, VK_NULL_HANDLE);
-  vkQueueWaitIdle(m_graphics_queue);
+  uint64_t value = SubmitToTimeline(m_graphics_queue,
+                                    m_graphics_timeline,
+                                    commandBuffer,
+                                    {}, {});
+  WaitForTimelineValue(m_graphics_timeline, value);
 
   vkFreeCommandBuffers(m_device, m_command_pool, 1, &commandBuffer);
 }
 
+//###################################################################
+/** Ends and submits single time commands without waiting for them.
+ * Returns their graphics timeline value; the command buffer is freed
+ * once it is reached, resources the commands use must be kept alive
+ * as long (e.g. with RetireAfter). */
+uint64_t ChiSim::SubmitSingleTimeCommands(VkCommandBuffer commandBuffer)
+{
+  vkEndCommandBuffer(commandBuffer);
+
+  uint64_t value = SubmitToTimeline(m_graphics_queue,
+                                    m_graphics_timeline,
+                                    commandBuffer,
+                                    {}, {});
+  RetireAfter(value, [this, commandBuffer]()
+    {
+      vkFreeCommandBuffers(m_device, m_command_pool, 1, &commandBuffer);
+    });
+
+  return value;
+}
+
 //###################################################################
 /** Create image view. */
 VkImageView ChiSim::CreateImageView(VkImage image,
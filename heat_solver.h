@@ -0,0 +1,94 @@
+#ifndef _HeatSolver_h
+#define _HeatSolver_h
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+
+/** Allocates in whole, aligned 64 KiB blocks, a multiple of the host
+ * import alignment of common drivers, so solver arrays can be
+ * imported by ChiSim::EnableFieldImport.*/
+template <typename T>
+struct ImportableAllocator
+{
+  typedef T value_type;
+  static constexpr size_t k_block = 64 * 1024;
+
+  ImportableAllocator() = default;
+  template <typename U>
+  ImportableAllocator(const ImportableAllocator<U>&) {}
+
+  T* allocate(size_t n)
+  {
+    const size_t bytes = (n * sizeof(T) + k_block - 1) / k_block * k_block;
+    void* memory = std::aligned_alloc(k_block, std::max(bytes, k_block));
+    if (!memory) throw std::bad_alloc();
+    return static_cast<T*>(memory);
+  }
+  void deallocate(T* p, size_t) { std::free(p); }
+
+  template <typename U>
+  bool operator==(const ImportableAllocator<U>&) const { return true; }
+  template <typename U>
+  bool operator!=(const ImportableAllocator<U>&) const { return false; }
+};
+
+/** Stand-in solver for the in-situ benchmark: explicit heat diffusion
+ * on an n x n node grid over [-1, 1]^2, heated by a source circling
+ * the centre.*/
+struct HeatSolver
+{
+  size_t                n;
+  std::vector<float>    coordinates;
+  std::vector<uint32_t> connectivity;
+  std::vector<float, ImportableAllocator<float>> temperature;
+  std::vector<float, ImportableAllocator<float>> next;
+
+  explicit HeatSolver(size_t grid_size) : n(std::max<size_t>(grid_size, 2))
+  {
+    for (size_t j = 0; j < n; ++j)
+      for (size_t i = 0; i < n; ++i)
+        coordinates.insert(coordinates.end(),
+                           {2.0f * float(i) / float(n - 1) - 1.0f,
+                            2.0f * float(j) / float(n - 1) - 1.0f,
+                            0.0f});
+
+    for (size_t j = 0; j + 1 < n; ++j)
+      for (size_t i = 0; i + 1 < n; ++i)
+      {
+        const uint32_t v = uint32_t(j * n + i);
+        const uint32_t w = uint32_t(n);
+        connectivity.insert(connectivity.end(),
+                            {v, v + 1, v + w + 1, v, v + w + 1, v + w});
+      }
+
+    temperature.assign(n * n, 0.0f);
+    next = temperature;
+  }
+
+  void Step(size_t step)
+  {
+    const double angle = 0.01 * double(step);
+    const size_t si = size_t((0.5 + 0.3 * std::cos(angle)) * double(n - 1));
+    const size_t sj = size_t((0.5 + 0.3 * std::sin(angle)) * double(n - 1));
+    temperature[sj * n + si] = 1.0f;
+
+    for (size_t j = 1; j + 1 < n; ++j)
+      for (size_t i = 1; i + 1 < n; ++i)
+      {
+        const size_t v = j * n + i;
+        next[v] = temperature[v] + 0.2f * (temperature[v - 1] +
+                                           temperature[v + 1] +
+                                           temperature[v - n] +
+                                           temperature[v + n] -
+                                           4.0f * temperature[v]);
+      }
+    std::swap(temperature, next);
+  }
+};
+
+#endif
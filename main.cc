@@ -1,12 +1,386 @@
 #include "ChiSim/chi_sim.h"
+#include "ChiSim/chi_batch_coordinator.h"
+#include "ChiSim/chi_compositor.h"
+#include "ChiSim/chi_frame_stream_receiver.h"
+#include "heat_solver.h"
 #include <stdexcept>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
 
-ChiSim ChiSim::m_instance;
+/** Runs the batch jobs on `numWorkers` worker processes, or with
+ * --batch-scaling on 1, 2, 4, ... up to `numWorkers` workers in turn,
+ * and prints the throughput of each run. Workers are this executable,
+ * started with `workerArgs`.*/
+static void RunBatch(const std::vector<ChiBatchCoordinator::Job>& jobs,
+                     size_t numWorkers,
+                     bool scaling,
+                     const char* argv0,
+                     const std::vector<std::string>& workerArgs)
+{
+  const std::string executable =
+    access("/proc/self/exe", X_OK) == 0 ? "/proc/self/exe" : argv0;
 
-int main() {
-  auto& app = ChiSim::GetSystemScope();
+  std::vector<size_t> workerCounts = {numWorkers};
+  if (scaling)
+  {
+    workerCounts.clear();
+    for (size_t n = 1; n < numWorkers; n *= 2) workerCounts.push_back(n);
+    workerCounts.push_back(numWorkers);
+  }
+
+  double baseRate = 0.0;
+  for (size_t n : workerCounts)
+  {
+    ChiBatchCoordinator coordinator;
+    auto stats = coordinator.Run(jobs, n, executable, workerArgs);
+    if (baseRate == 0.0) baseRate = stats.GetJobsPerSecond();
+
+    std::cout << "Batch (" << stats.num_workers << " workers): "
+              << stats.jobs << " frames in " << stats.seconds << " s, "
+              << stats.GetJobsPerSecond() << " frames/s, speedup "
+              << (baseRate > 0.0 ? stats.GetJobsPerSecond() / baseRate : 0.0)
+              << ", " << stats.steals << " steals";
+    if (stats.restarts > 0)
+      std::cout << ", " << stats.restarts << " workers restarted";
+    if (stats.failed_jobs > 0)
+      std::cout << ", " << stats.failed_jobs << " failed";
+    std::cout << std::endl;
+  }
+}
+
+/** Renders `width` x `height` frames split over `numProcesses`
+ * compositing processes, or with --composite-scaling over 1, 2, 4, ...
+ * up to `numProcesses` processes in turn without writing frames, and
+ * prints the rate of each run. Scaling runs also check that every
+ * run's frames are identical to those of the single process run.*/
+static void RunComposite(size_t numProcesses,
+                         uint32_t width,
+                         uint32_t height,
+                         bool scaling,
+                         const char* argv0,
+                         std::vector<std::string> workerArgs)
+{
+  const std::string executable =
+    access("/proc/self/exe", X_OK) == 0 ? "/proc/self/exe" : argv0;
+
+  std::vector<size_t> processCounts = {numProcesses};
+  if (scaling)
+  {
+    processCounts.clear();
+    for (size_t n = 1; n < numProcesses; n *= 2) processCounts.push_back(n);
+    processCounts.push_back(numProcesses);
+    workerArgs.push_back("--composite-discard");
+  }
+
+  double baseRate = 0.0;
+  uint64_t baseChecksum = 0;
+  for (size_t n : processCounts)
+  {
+    auto stats = ChiCompositor::Launch(n, width, height,
+                                       executable, workerArgs);
+    if (baseRate == 0.0)
+    {
+      baseRate = stats.GetFramesPerSecond();
+      baseChecksum = stats.checksum;
+    }
+
+    std::cout << "Composite (" << stats.num_processes << " processes): "
+              << stats.frames << " frames in " << stats.seconds << " s, "
+              << stats.GetFramesPerSecond() << " frames/s, speedup "
+              << (baseRate > 0.0 ? stats.GetFramesPerSecond() / baseRate : 0.0)
+              << ", composite " << stats.composite_ms << " ms, wait "
+              << stats.wait_ms << " ms";
+    if (scaling)
+      std::cout << ", identical to 1 process: "
+                << (stats.checksum == baseChecksum ? "yes" : "no");
+    std::cout << std::endl;
+  }
+}
+
+/** Watches the frames streamed by a renderer started with --stream,
+ * until it finishes, prints the received rate, bandwidth and latency
+ * and writes the last frame to `<outputPrefix>_view.png`.*/
+static void RunStreamViewer(const std::string& address,
+                            const std::string& outputPrefix)
+{
+  ChiFrameStreamReceiver receiver;
+  if (!receiver.Connect(address, 30.0))
+    throw std::runtime_error("failed to connect to stream " + address + "!");
+
+  while (receiver.ReceiveFrame()) {}
+
+  const auto& stats = receiver.GetStats();
+  std::cout << "Stream viewer (" << stats.frames << " frames): "
+            << stats.GetFramesPerSecond() << " fps, "
+            << stats.GetBytesPerSecond() / (1024.0 * 1024.0) << " MiB/s, "
+            << (stats.frames > 0 ? double(stats.tiles) / double(stats.frames) :
+                0.0)
+            << " tiles/frame, latency " << stats.latency_ms << " ms (max "
+            << stats.max_latency_ms << " ms)" << std::endl;
+
+  if (stats.frames == 0) return;
+
+  const std::vector<uint8_t> encoded =
+    ChiFrameEncoder::EncodePNG(receiver.GetWidth(), receiver.GetHeight(),
+                               receiver.GetPixels());
+  std::ofstream file(outputPrefix + "_view.png", std::ios::binary);
+  file.write(reinterpret_cast<const char*>(encoded.data()),
+             std::streamsize(encoded.size()));
+}
+
+/** Runs the stand-in solver for `numSteps` steps, first alone and then
+ * with an in-situ `context` rendering its field every `interval`
+ * steps, and prints the overhead each render adds to the solver. With
+ * `importField` the context reads the field from the solver's arrays
+ * in place, where the device supports it. With `autoRange` the field
+ * is colored over its own range, reduced on the device per update.*/
+static void RunInSitu(ChiSim& context,
+                      size_t numSteps,
+                      size_t interval,
+                      size_t gridSize,
+                      bool importField,
+                      bool autoRange)
+{
+  interval = std::max<size_t>(interval, 1);
+  context.EnableFieldImport(importField);
+
+  //============================ Solver alone
+  auto start = std::chrono::steady_clock::now();
+  {
+    HeatSolver solver(gridSize);
+    for (size_t step = 0; step < numSteps; ++step) solver.Step(step);
+  }
+  const double solverSeconds = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+
+  //============================ Solver with in-situ renders
+  HeatSolver solver(gridSize);
+  context.Initialize();
+  context.SetSolverMesh(solver.coordinates.data(), solver.n * solver.n,
+                        solver.connectivity.data(),
+                        solver.connectivity.size(),
+                        solver.temperature.data(),
+                        autoRange ? 1.0f : 0.0f, autoRange ? 0.0f : 0.05f);
+
+  size_t numRenders = 0;
+  start = std::chrono::steady_clock::now();
+  for (size_t step = 0; step < numSteps; ++step)
+  {
+    solver.Step(step);
+    if (step % interval != 0) continue;
+
+    // The solver swaps its buffers, so the field moves.
+    context.SetSolverField(solver.temperature.data());
+    if (!context.Render(step)) break;
+    ++numRenders;
+  }
+  const double inSituSeconds = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+  const glm::vec2 fieldRange = context.GetFieldRange();
+
+  context.Shutdown();
+
+  std::cout << "In-situ (" << solver.n << "^2 nodes, " << numSteps
+            << " steps, render every " << interval << "): solver "
+            << 1000.0 * solverSeconds / double(std::max<size_t>(numSteps, 1))
+            << " ms/step alone, "
+            << 1000.0 * inSituSeconds / double(std::max<size_t>(numSteps, 1))
+            << " ms/step with renders, overhead "
+            << (numRenders > 0 ?
+                1000.0 * (inSituSeconds - solverSeconds) / double(numRenders) :
+                0.0)
+            << " ms per render" << std::endl;
+  if (autoRange)
+    std::cout << "Automatic colormap range at the end: [" << fieldRange.x
+              << ", " << fieldRange.y << "]" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  ChiSim app;
+
+  bool headless = false;
+  size_t headlessFrames = 60;
+  std::string outputPrefix = "frame";
+  ChiFrameEncoder::Format encoderFormat = ChiFrameEncoder::Format::PNG;
+  size_t encoderThreads = 0;
+  unsigned posterWidth = 0, posterHeight = 0;
+  std::string batchFile;
+  unsigned batchTimesteps = 0;
+  size_t batchWorkers = std::max(std::thread::hardware_concurrency(), 1u);
+  bool batchScaling = false;
+  int batchReadFd = -1, batchWriteFd = -1;
+  size_t compositeProcesses = 0;
+  bool compositeScaling = false;
+  bool compositeDiscard = false;
+  std::string compositeRegion;
+  unsigned compositeRank = 0, compositeSize = 0;
+  std::string streamAddress, streamViewAddress;
+  size_t inSituSteps = 0, inSituInterval = 10, inSituGrid = 512;
+  bool inSituImport = false, inSituAutoRange = false;
+  std::string solverRing;
+  std::vector<std::string> workerArgs;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string argument = argv[i];
+
+    //============================ Batch and composite launcher options
+    // Everything else is passed on to the workers.
+    if (argument.rfind("--batch=", 0) == 0)
+      { batchFile = argument.substr(8); continue; }
+    else if (argument.rfind("--batch-timesteps=", 0) == 0)
+      { batchTimesteps = std::strtoul(argument.c_str() + 18, nullptr, 10);
+        continue; }
+    else if (argument.rfind("--workers=", 0) == 0)
+      { batchWorkers = std::strtoul(argument.c_str() + 10, nullptr, 10);
+        continue; }
+    else if (argument == "--batch-scaling")
+      { batchScaling = true; continue; }
+    else if (argument.rfind("--batch-worker=", 0) == 0)
+      { std::sscanf(argument.c_str() + 15, "%d,%d",
+                    &batchReadFd, &batchWriteFd);
+        continue; }
+    else if (argument.rfind("--composite=", 0) == 0)
+      { compositeProcesses = std::strtoul(argument.c_str() + 12, nullptr, 10);
+        continue; }
+    else if (argument == "--composite-scaling")
+      { compositeScaling = true; continue; }
+    else if (argument == "--composite-discard")
+      { compositeDiscard = true; continue; }
+    else if (argument.rfind("--composite-worker=", 0) == 0)
+      { const size_t comma = argument.find(',');
+        compositeRegion = argument.substr(19, comma - 19);
+        if (comma != std::string::npos)
+          std::sscanf(argument.c_str() + comma + 1, "%u,%u",
+                      &compositeRank, &compositeSize);
+        continue; }
+    workerArgs.push_back(argument);
+
+    if (argument == "--hot-reload")
+      app.EnableShaderHotReload(true);
+    else if (argument == "--draw-benchmark")
+      app.EnableDrawBenchmark(true);
+    else if (argument == "--draw-parameters=uniforms")
+      app.SetDrawParameterPath(ChiSim::DrawParameterPath::DynamicUniforms);
+    else if (argument == "--draw-parameters=indirect")
+      app.SetDrawParameterPath(ChiSim::DrawParameterPath::Indirect);
+    else if (argument == "--vertex-pulling-benchmark")
+      app.EnableVertexPullingBenchmark(true);
+    else if (argument == "--vertex-input=interleaved")
+      app.SetVertexPullingBenchmarkInput(ChiSim::VertexInput::Interleaved);
+    else if (argument == "--repeated-assets")
+      app.EnableRepeatedAssetScene(true);
+    else if (argument.rfind("--recreate-benchmark=", 0) == 0)
+      app.EnableRecreateBenchmark(
+        std::strtoul(argument.c_str() + 21, nullptr, 10));
+    else if (argument == "--capture")
+      app.EnableFrameCapture(true);
+    else if (argument == "--encoder=png")
+      encoderFormat = ChiFrameEncoder::Format::PNG;
+    else if (argument == "--encoder=qoi")
+      encoderFormat = ChiFrameEncoder::Format::QOI;
+    else if (argument == "--encoder=raw")
+      encoderFormat = ChiFrameEncoder::Format::Raw;
+    else if (argument.rfind("--encoder-threads=", 0) == 0)
+      encoderThreads = std::strtoul(argument.c_str() + 18, nullptr, 10);
+    else if (argument == "--headless")
+      headless = true;
+    else if (argument.rfind("--frames=", 0) == 0)
+      headlessFrames = std::strtoul(argument.c_str() + 9, nullptr, 10);
+    else if (argument.rfind("--poster=", 0) == 0)
+      std::sscanf(argument.c_str() + 9, "%ux%u", &posterWidth, &posterHeight);
+    else if (argument.rfind("--output=", 0) == 0)
+      outputPrefix = argument.substr(9);
+    else if (argument.rfind("--stream=", 0) == 0)
+      streamAddress = argument.substr(9);
+    else if (argument.rfind("--stream-view=", 0) == 0)
+      streamViewAddress = argument.substr(14);
+    else if (argument.rfind("--insitu=", 0) == 0)
+      inSituSteps = std::strtoul(argument.c_str() + 9, nullptr, 10);
+    else if (argument.rfind("--insitu-interval=", 0) == 0)
+      inSituInterval = std::strtoul(argument.c_str() + 18, nullptr, 10);
+    else if (argument.rfind("--insitu-grid=", 0) == 0)
+      inSituGrid = std::strtoul(argument.c_str() + 14, nullptr, 10);
+    else if (argument == "--insitu-import")
+      inSituImport = true;
+    else if (argument == "--insitu-auto-range")
+      inSituAutoRange = true;
+    else if (argument.rfind("--solver-ring=", 0) == 0)
+      solverRing = argument.substr(14);
+  }
+
+  // Headless runs need no display, e.g. on compute nodes or in CI with
+  // lavapipe (VK_DRIVER_FILES=.../lvp_icd.x86_64.json).
+  app.EnableHeadless(headless, headlessFrames, outputPrefix);
+  app.SetFrameEncoder(encoderFormat, encoderThreads);
+
+  // Posters, e.g. --poster=32768x16384, are written to <output>.tif.
+  if (posterWidth > 0 && posterHeight > 0)
+    app.EnablePoster(posterWidth, posterHeight, outputPrefix + ".tif");
+
+  if (batchReadFd >= 0 && batchWriteFd >= 0)
+    app.EnableBatchWorker(batchReadFd, batchWriteFd);
 
   try {
+    if (!compositeRegion.empty())
+      app.EnableCompositing(compositeRegion, compositeRank, compositeSize,
+                            !compositeDiscard);
+
+    // Streams, e.g. --headless --stream=127.0.0.1:9000 watched with
+    // --stream-view=127.0.0.1:9000, or unix:/tmp/chisim.sock.
+    if (!streamViewAddress.empty())
+    {
+      RunStreamViewer(streamViewAddress, outputPrefix);
+      return EXIT_SUCCESS;
+    }
+    if (!streamAddress.empty())
+      app.EnableStreaming(streamAddress);
+
+    // Batch runs, e.g. --batch=jobs.txt --workers=16, only coordinate;
+    // each worker process renders with its own device. With lavapipe,
+    // LP_NUM_THREADS=1 keeps workers from oversubscribing the cores.
+    if (!batchFile.empty() || batchTimesteps > 0)
+    {
+      RunBatch(batchFile.empty() ?
+               ChiBatchCoordinator::MakeTimestepJobs(batchTimesteps) :
+               ChiBatchCoordinator::ReadJobFile(batchFile),
+               batchWorkers, batchScaling, argv[0], workerArgs);
+      return EXIT_SUCCESS;
+    }
+
+    // Sort-last runs, e.g. --composite=4 --frames=120, split the draws
+    // over processes and merge their frames by depth. Use
+    // --repeated-assets or --draw-benchmark for enough draws to split.
+    if (compositeProcesses > 0)
+    {
+      RunComposite(compositeProcesses, app.WIDTH, app.HEIGHT,
+                   compositeScaling, argv[0], workerArgs);
+      return EXIT_SUCCESS;
+    }
+
+    // In-situ runs, e.g. --headless --insitu=1000 --insitu-interval=10,
+    // drive the renderer from a stand-in solver instead of Execute.
+    // --insitu-import reads the solver's field in place,
+    // --insitu-auto-range colors it over its own range.
+    if (inSituSteps > 0)
+    {
+      RunInSitu(app, inSituSteps, inSituInterval, inSituGrid, inSituImport,
+                inSituAutoRange);
+      return EXIT_SUCCESS;
+    }
+
+    // Solver ring runs, e.g. --headless --solver-ring=/chisim_ring next
+    // to chisim_producer --ring=/chisim_ring, draw another process's
+    // solver data; --insitu-import reads it from the ring in place.
+    if (!solverRing.empty())
+    {
+      app.EnableFieldImport(inSituImport);
+      app.EnableSolverRing(solverRing);
+    }
+
     app.Execute();
   } catch (const std::exception& e) {
     std::cerr << e.what() << std::endl;
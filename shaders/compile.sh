@@ -1,2 +1,15 @@
-~/Desktop/Projects/Vulkan/vulkan-1.2.131.2/macOS/bin/glslc shader.vert -o vert.spv
-~/Desktop/Projects/Vulkan/vulkan-1.2.131.2/macOS/bin/glslc shader.frag -o frag.spv
+#!/bin/sh
+# Precompiles the shaders into the directory given as argument, this
+# one by default. Only needed to run a build without runtime shader
+# compilation against SPIR-V of your own; point CHI_SHADER_DIR at the
+# directory then. CMake builds compile the same files into the build
+# tree themselves (see chi_add_spirv).
+GLSLC="${GLSLC:-${VULKAN_SDK:+$VULKAN_SDK/bin/}glslc} --target-env=vulkan1.2"
+cd "$(dirname "$0")"
+OUT="${1:-.}"
+mkdir -p "$OUT"
+$GLSLC shader.vert -o "$OUT/vert.spv"
+$GLSLC shader.frag -o "$OUT/frag.spv"
+$GLSLC -DBINDLESS shader.frag -o "$OUT/frag_bindless.spv"
+$GLSLC -DVERTEX_PULLING shader.vert -o "$OUT/vert_pulled.spv"
+$GLSLC field_range.comp -o "$OUT/field_range.spv"
@@ -1,14 +1,176 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
 
+// See shader.vert.
+layout(constant_id = 0) const bool UBER_SHADER     = true;
+layout(constant_id = 1) const bool USE_TEXTURE     = true;
+layout(constant_id = 2) const int  COLORMAP_ID     = 0;
+layout(constant_id = 3) const int  NUM_CLIP_PLANES = 0;
+layout(constant_id = 4) const int  LIGHTING_MODE   = 0;
+const int DRAW_PARAMETERS_PUSHED   = 0;
+const int DRAW_PARAMETERS_UNIFORM  = 1;
+const int DRAW_PARAMETERS_INDEXED  = 2;
+layout(constant_id = 5) const int DRAW_PARAMETERS_SOURCE =
+    DRAW_PARAMETERS_PUSHED;
+
+struct DrawParameters {
+    uint model_index;
+    uint field_id;
+    vec2 colormap_range;
+    uint clip_flags;
+    uint texture_index;
+    uint vertex_offset;
+    uint atlas_layer;
+    vec4 texture_rect;
+};
+
+layout(push_constant) uniform DrawPushConstants {
+    DrawParameters params;
+} pushed;
+
+layout(set = 1, binding = 0) uniform DrawUniforms {
+    DrawParameters params;
+} drawUniforms;
+
+layout(binding = 3) readonly buffer DrawParameterBuffer {
+    DrawParameters params[];
+} drawBuffer;
+
+layout(location = 5) flat in uint fragDrawIndex;
+
+DrawParameters GetDrawParameters()
+{
+    if (DRAW_PARAMETERS_SOURCE == DRAW_PARAMETERS_INDEXED)
+        return drawBuffer.params[fragDrawIndex];
+    if (DRAW_PARAMETERS_SOURCE == DRAW_PARAMETERS_UNIFORM)
+        return drawUniforms.params;
+    return pushed.params;
+}
+
+const int COLORMAP_NONE      = 0;
+const int COLORMAP_GRAYSCALE = 1;
+const int COLORMAP_JET       = 2;
+const int COLORMAP_VIRIDIS   = 3;
+
+const int LIGHTING_UNLIT     = 0;
+const int LIGHTING_HEADLIGHT = 1;
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+    mat4 model_view;
+    mat4 mvp;
+    vec4 clip_planes[4];
+    ivec4 features; // texture, colormap, clip planes, lighting
+    vec2 field_range; // automatic colormap range of the solver field
+    uint field_base; // frame slot's range of the pulled field values
+} ubo;
+
+#ifdef BINDLESS
+// Built with -DBINDLESS when the device supports descriptor indexing:
+// every texture lives in one array and draws select theirs by slot.
+// Batched draws differ in slot within one call, hence nonuniformEXT.
+layout(set = 2, binding = 0) uniform sampler2D textures[];
+
+vec4 SampleTexture(uint slot, vec2 coord)
+{
+    return texture(textures[nonuniformEXT(slot)], coord);
+}
+#else
 layout(binding = 1) uniform sampler2D texSampler;
 
+vec4 SampleTexture(uint slot, vec2 coord)
+{
+    return texture(texSampler, coord);
+}
+#endif
+
+// Small images packed by ChiSim::AddAtlasImage. A draw with an
+// atlas_layer maps its texture coordinates into its texture_rect; they
+// are clamped since the padding around the rect only covers filtering.
+layout(binding = 7) uniform sampler2DArray atlasSampler;
+
+vec4 SampleDrawTexture(DrawParameters draw, vec2 coord)
+{
+    if (draw.atlas_layer == 0u)
+        return SampleTexture(draw.texture_index, coord);
+
+    vec2 atlasCoord = draw.texture_rect.xy +
+                      clamp(coord, 0.0, 1.0) * draw.texture_rect.zw;
+    return texture(atlasSampler,
+                   vec3(atlasCoord, float(draw.atlas_layer - 1u)));
+}
+
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) in vec3 fragObjectPos;
+layout(location = 3) in vec3 fragViewPos;
+layout(location = 4) in float fragFieldValue;
 
 layout(location = 0) out vec4 outColor;
 
+vec3 Colormap(int id, float t)
+{
+    t = clamp(t, 0.0, 1.0);
+
+    if (id == COLORMAP_JET)
+        return clamp(vec3(1.5) - abs(4.0 * t - vec3(3.0, 2.0, 1.0)),
+                     0.0, 1.0);
+
+    if (id == COLORMAP_VIRIDIS)
+    {
+        // Polynomial fit of matplotlib's viridis.
+        const vec3 c0 = vec3( 0.27772733,  0.00540734,   0.33409981);
+        const vec3 c1 = vec3( 0.10509304,  1.40461353,   1.38459016);
+        const vec3 c2 = vec3(-0.33086183,  0.21484756,   0.09509516);
+        const vec3 c3 = vec3(-4.63423050, -5.79910097, -19.33244096);
+        const vec3 c4 = vec3( 6.22826994, 14.17993337,  56.69055260);
+        const vec3 c5 = vec3( 4.77638500,-13.74514538, -65.35303263);
+        const vec3 c6 = vec3(-5.43545586,  4.64585261,  26.31243525);
+        return c0 + t*(c1 + t*(c2 + t*(c3 + t*(c4 + t*(c5 + t*c6)))));
+    }
+
+    return vec3(t);
+}
+
 void main() {
-//    outColor = vec4(fragTexCoord, 0.0, 1.0);
-    outColor = texture(texSampler, fragTexCoord);
-}
\ No newline at end of file
+    bool useTexture   = UBER_SHADER ? (ubo.features.x != 0) : USE_TEXTURE;
+    int colormapID    = UBER_SHADER ? ubo.features.y : COLORMAP_ID;
+    int numClipPlanes = UBER_SHADER ? ubo.features.z : NUM_CLIP_PLANES;
+    int lightingMode  = UBER_SHADER ? ubo.features.w : LIGHTING_MODE;
+
+    DrawParameters draw = GetDrawParameters();
+
+    for (int p = 0; p < min(numClipPlanes, 4); ++p)
+        if ((draw.clip_flags & (1u << p)) != 0u &&
+            dot(vec4(fragObjectPos, 1.0), ubo.clip_planes[p]) < 0.0)
+            discard;
+
+    vec4 color = useTexture ? SampleDrawTexture(draw, fragTexCoord)
+                            : vec4(fragColor, 1.0);
+
+    if (colormapID != COLORMAP_NONE)
+    {
+        float value = (draw.field_id > 0)
+                      ? fragFieldValue
+                      : dot(color.rgb, vec3(0.299, 0.587, 0.114));
+        // A reversed range asks for the automatic one.
+        vec2 range = (draw.colormap_range.x > draw.colormap_range.y)
+                     ? ubo.field_range : draw.colormap_range;
+        color.rgb = Colormap(colormapID,
+                             (value - range.x) / max(range.y - range.x, 1e-6));
+    }
+
+    if (lightingMode == LIGHTING_HEADLIGHT)
+    {
+        // Flat shading from screen-space derivatives, lit from the eye.
+        vec3 normal = normalize(cross(dFdx(fragViewPos), dFdy(fragViewPos)));
+        color.rgb *= abs(normal.z);
+    }
+
+    outColor = color;
+}
@@ -1,22 +1,134 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+// Shader variant selection, see ChiSim::ShaderVariant. The uber-shader
+// (UBER_SHADER = true) reads the features from the uniform buffer at
+// runtime; specialized pipelines bake them in so dead branches are
+// removed when the pipeline is created.
+layout(constant_id = 0) const bool UBER_SHADER     = true;
+layout(constant_id = 1) const bool USE_TEXTURE     = true;
+layout(constant_id = 2) const int  COLORMAP_ID     = 0;
+layout(constant_id = 3) const int  NUM_CLIP_PLANES = 0;
+layout(constant_id = 4) const int  LIGHTING_MODE   = 0;
+
+// Where the per-draw parameters come from, see ChiSim::DrawParameters
+// and ChiSim::DrawParameterPath: push constants (0), a dynamic uniform
+// buffer (1) or a storage buffer indexed by the instance index, which
+// batched indirect draws set through firstInstance (2).
+const int DRAW_PARAMETERS_PUSHED   = 0;
+const int DRAW_PARAMETERS_UNIFORM  = 1;
+const int DRAW_PARAMETERS_INDEXED  = 2;
+layout(constant_id = 5) const int DRAW_PARAMETERS_SOURCE =
+    DRAW_PARAMETERS_PUSHED;
+
+struct DrawParameters {
+    uint model_index;
+    uint field_id;      // 0 color luminance, 1-3 object x, y, z
+    vec2 colormap_range;
+    uint clip_flags;
+    uint texture_index; // bindless texture slot
+    uint vertex_offset; // first vertex of a pulled mesh
+    uint atlas_layer;   // 0 no atlas, else atlas layer + 1
+    vec4 texture_rect;  // atlas uv offset (xy) and scale (zw)
+};
+
+layout(push_constant) uniform DrawPushConstants {
+    DrawParameters params;
+} pushed;
+
+layout(set = 1, binding = 0) uniform DrawUniforms {
+    DrawParameters params;
+} drawUniforms;
+
+layout(binding = 3) readonly buffer DrawParameterBuffer {
+    DrawParameters params[];
+} drawBuffer;
+
+DrawParameters GetDrawParameters()
+{
+    if (DRAW_PARAMETERS_SOURCE == DRAW_PARAMETERS_INDEXED)
+        return drawBuffer.params[gl_InstanceIndex];
+    if (DRAW_PARAMETERS_SOURCE == DRAW_PARAMETERS_UNIFORM)
+        return drawUniforms.params;
+    return pushed.params;
+}
+
 layout(binding = 0) uniform UniformBufferObject {
     mat4 model;
     mat4 view;
     mat4 proj;
+    mat4 model_view;
+    mat4 mvp;
+    vec4 clip_planes[4];
+    ivec4 features; // texture, colormap, clip planes, lighting
+    vec2 field_range; // automatic colormap range of the solver field
+    uint field_base; // frame slot's range of the pulled field values
 } ubo;
 
+layout(binding = 2) readonly buffer ModelMatrices {
+    mat4 models[];
+} modelMatrices;
+
+#ifdef VERTEX_PULLING
+// Solver arrays as uploaded by ChiSim::UploadFieldMesh: x, y, z per
+// vertex (a float array, since vec3 arrays would be padded), triangle
+// connectivity relative to the mesh's first vertex and one field value
+// per vertex. Draws are not indexed; firstVertex is the mesh's first
+// connectivity entry, so gl_VertexIndex walks the connectivity.
+layout(binding = 4) readonly buffer PulledCoordinates {
+    float coordinates[];
+} pulledCoordinates;
+
+layout(binding = 5) readonly buffer PulledConnectivity {
+    uint connectivity[];
+} pulledConnectivity;
+
+layout(binding = 6) readonly buffer PulledFieldValues {
+    float values[];
+} pulledFieldValues;
+#else
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
+#endif
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) out vec3 fragObjectPos;
+layout(location = 3) out vec3 fragViewPos;
+layout(location = 4) out float fragFieldValue;
+layout(location = 5) flat out uint fragDrawIndex;
 
 void main()
 {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+    int numClipPlanes = UBER_SHADER ? ubo.features.z : NUM_CLIP_PLANES;
+    int lightingMode  = UBER_SHADER ? ubo.features.w : LIGHTING_MODE;
+
+    DrawParameters draw = GetDrawParameters();
+    fragDrawIndex = gl_InstanceIndex;
+
+#ifdef VERTEX_PULLING
+    uint vertex = pulledConnectivity.connectivity[gl_VertexIndex] +
+                  draw.vertex_offset;
+    vec3 inPosition = vec3(pulledCoordinates.coordinates[3 * vertex + 0],
+                           pulledCoordinates.coordinates[3 * vertex + 1],
+                           pulledCoordinates.coordinates[3 * vertex + 2]);
+    // The field is shown as the color's luminance (field_id 0). Each
+    // frame slot reads its own copy of the field values.
+    vec3 inColor = vec3(pulledFieldValues.values[ubo.field_base + vertex]);
+    vec2 inTexCoord = inPosition.xy + 0.5;
+#endif
+
+    vec4 position = modelMatrices.models[draw.model_index] *
+                    vec4(inPosition, 1.0);
+    gl_Position = ubo.mvp * position;
     fragColor = inColor;
     fragTexCoord = inTexCoord;
-}
\ No newline at end of file
+    fragFieldValue = (draw.field_id > 0) ? inPosition[draw.field_id - 1]
+                                        : 0.0;
+
+    // Clip planes are given in scene space, before ubo.model.
+    fragObjectPos = (numClipPlanes > 0) ? position.xyz : vec3(0.0);
+    fragViewPos = (lightingMode != 0) ? (ubo.model_view * position).xyz
+                                      : vec3(0.0);
+}
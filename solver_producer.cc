@@ -0,0 +1,89 @@
+#include "ChiSim/chi_solver_ring.h"
+#include "heat_solver.h"
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+#include <cstdlib>
+
+/** Stand-in solver process for testing the solver ring: runs the heat
+ * solver and publishes its mesh once and its field every `interval`
+ * steps to a ChiSolverRing, for a renderer started with
+ * `app2 --solver-ring=<ring>`. `--step-ms` paces the solver to at
+ * least that many ms per step. Prints the solver's ms/step and the
+ * cost of publishing, which does not depend on the renderer.*/
+int main(int argc, char* argv[]) {
+  std::string ringName = "/chisim_ring";
+  size_t numSteps = 1000, interval = 1, gridSize = 512;
+  double stepMs = 0.0;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string argument = argv[i];
+    if (argument.rfind("--ring=", 0) == 0)
+      ringName = argument.substr(7);
+    else if (argument.rfind("--steps=", 0) == 0)
+      numSteps = std::strtoul(argument.c_str() + 8, nullptr, 10);
+    else if (argument.rfind("--interval=", 0) == 0)
+      interval = std::max<size_t>(
+        std::strtoul(argument.c_str() + 11, nullptr, 10), 1);
+    else if (argument.rfind("--grid=", 0) == 0)
+      gridSize = std::strtoul(argument.c_str() + 7, nullptr, 10);
+    else if (argument.rfind("--step-ms=", 0) == 0)
+      stepMs = std::strtod(argument.c_str() + 10, nullptr);
+  }
+
+  try {
+    HeatSolver solver(gridSize);
+
+    ChiSolverRing ring;
+    ring.Create(ringName, solver.n * solver.n, solver.connectivity.size());
+    ring.WriteMesh(solver.coordinates.data(), solver.n * solver.n,
+                   solver.connectivity.data(), solver.connectivity.size(),
+                   0.0f, 0.05f);
+
+    std::cout << "Publishing " << solver.n << "^2 nodes to solver ring "
+              << ringName << std::endl;
+
+    double publishMs = 0.0, maxPublishMs = 0.0;
+    size_t numPublished = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t step = 0; step < numSteps; ++step)
+    {
+      auto stepStart = std::chrono::steady_clock::now();
+      solver.Step(step);
+
+      if (step % interval == 0)
+      {
+        auto publishStart = std::chrono::steady_clock::now();
+        ring.WriteField(step, solver.temperature.data());
+        const double ms = std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - publishStart).count();
+        publishMs += ms;
+        maxPublishMs = std::max(maxPublishMs, ms);
+        ++numPublished;
+      }
+
+      if (stepMs > 0.0)
+        std::this_thread::sleep_until(
+          stepStart + std::chrono::duration<double, std::milli>(stepMs));
+    }
+    const double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+
+    ring.Finish();
+
+    std::cout << "Solver: " << numSteps << " steps, "
+              << 1000.0 * seconds / double(std::max<size_t>(numSteps, 1))
+              << " ms/step, " << numPublished << " fields published, "
+              << (numPublished > 0 ? publishMs / double(numPublished) : 0.0)
+              << " ms per field (max " << maxPublishMs << " ms)"
+              << std::endl;
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}